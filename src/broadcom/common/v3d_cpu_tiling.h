@@ -25,8 +25,18 @@
  *
  * Contains load/store functions common to both v3d and vc4.  The utile layout
  * stayed the same, though the way utiles get laid out has changed.
+ *
+ * On x86, the SSE2 paths are used whenever the compiler targets SSE2 (always
+ * on x86-64), and the AVX2 ones when the including file is built with
+ * -mavx2.
  */
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 static inline void
 v3d_load_utile(void *cpu, uint32_t cpu_stride,
                void *gpu, uint32_t gpu_stride)
@@ -129,6 +139,63 @@ v3d_load_utile(void *cpu, uint32_t cpu_stride,
                         : "v0", "v1", "v2", "v3");
                 return;
         }
+#elif defined(__SSE2__)
+        if (gpu_stride == 8 || gpu_stride == 16 || gpu_stride == 32) {
+                /* Load from the GPU in one shot, 16 bytes per register. */
+#if defined(__AVX2__)
+                __m256i v01 = _mm256_loadu_si256((__m256i *)gpu);
+                __m256i v23 = _mm256_loadu_si256((__m256i *)(gpu + 32));
+
+                if (gpu_stride == 32) {
+                        _mm256_storeu_si256((__m256i *)cpu, v01);
+                        _mm256_storeu_si256((__m256i *)(cpu + cpu_stride),
+                                            v23);
+                        return;
+                }
+
+                __m128i v[4] = {
+                        _mm256_castsi256_si128(v01),
+                        _mm256_extracti128_si256(v01, 1),
+                        _mm256_castsi256_si128(v23),
+                        _mm256_extracti128_si256(v23, 1),
+                };
+#else
+                __m128i v[4] = {
+                        _mm_loadu_si128((__m128i *)gpu + 0),
+                        _mm_loadu_si128((__m128i *)gpu + 1),
+                        _mm_loadu_si128((__m128i *)gpu + 2),
+                        _mm_loadu_si128((__m128i *)gpu + 3),
+                };
+#endif
+
+                /* Store each line to the cpu-side destination, incrementing
+                 * it by the stride each time.
+                 */
+                for (int i = 0; i < 4; i++) {
+                        switch (gpu_stride) {
+                        case 8:
+                                /* Two 8-byte lines per register. */
+                                _mm_storel_epi64((__m128i *)cpu, v[i]);
+                                cpu += cpu_stride;
+                                _mm_storeh_pd((double *)cpu,
+                                              _mm_castsi128_pd(v[i]));
+                                cpu += cpu_stride;
+                                break;
+                        case 16:
+                                _mm_storeu_si128((__m128i *)cpu, v[i]);
+                                cpu += cpu_stride;
+                                break;
+                        case 32:
+                                /* Two registers per 32-byte line. */
+                                _mm_storeu_si128((__m128i *)cpu + (i & 1),
+                                                 v[i]);
+                                if (i & 1)
+                                        cpu += cpu_stride;
+                                break;
+                        }
+                }
+                return;
+        }
 #endif
 
         for (uint32_t gpu_offset = 0; gpu_offset < 64; gpu_offset += gpu_stride) {
@@ -233,6 +300,61 @@ v3d_store_utile(void *gpu, uint32_t gpu_stride,
                         : "v0", "v1", "v2", "v3");
                 return;
         }
+#elif defined(__SSE2__)
+        if (gpu_stride == 8 || gpu_stride == 16 || gpu_stride == 32) {
+#if defined(__AVX2__)
+                if (gpu_stride == 32) {
+                        __m256i v0 = _mm256_loadu_si256((__m256i *)cpu);
+                        __m256i v1 =
+                                _mm256_loadu_si256((__m256i *)(cpu +
+                                                               cpu_stride));
+                        _mm256_storeu_si256((__m256i *)gpu, v0);
+                        _mm256_storeu_si256((__m256i *)(gpu + 32), v1);
+                        return;
+                }
+#endif
+
+                /* Load each line from the cpu-side source, incrementing it
+                 * by the stride each time, 16 bytes per register.
+                 */
+                __m128i v[4];
+                for (int i = 0; i < 4; i++) {
+                        switch (gpu_stride) {
+                        case 8: {
+                                /* Two 8-byte lines per register. */
+                                __m128i lo = _mm_loadl_epi64((__m128i *)cpu);
+                                cpu += cpu_stride;
+                                __m128i hi = _mm_loadl_epi64((__m128i *)cpu);
+                                cpu += cpu_stride;
+                                v[i] = _mm_unpacklo_epi64(lo, hi);
+                                break;
+                        }
+                        case 16:
+                                v[i] = _mm_loadu_si128((__m128i *)cpu);
+                                cpu += cpu_stride;
+                                break;
+                        case 32:
+                                /* Two registers per 32-byte line. */
+                                v[i] = _mm_loadu_si128((__m128i *)cpu +
+                                                       (i & 1));
+                                if (i & 1)
+                                        cpu += cpu_stride;
+                                break;
+                        }
+                }
+
+                /* Store to the GPU in one shot. */
+#if defined(__AVX2__)
+                _mm256_storeu_si256((__m256i *)gpu,
+                                    _mm256_set_m128i(v[1], v[0]));
+                _mm256_storeu_si256((__m256i *)(gpu + 32),
+                                    _mm256_set_m128i(v[3], v[2]));
+#else
+                for (int i = 0; i < 4; i++)
+                        _mm_storeu_si128((__m128i *)gpu + i, v[i]);
+#endif
+                return;
+        }
 #endif
 
         for (uint32_t gpu_offset = 0; gpu_offset < 64; gpu_offset += gpu_stride) {
@@ -77,6 +77,11 @@ extern uint32_t v3d_mesa_debug;
                                      V3D_DEBUG_VS | V3D_DEBUG_CS | \
                                      V3D_DEBUG_RA)
 
+/* Flags that don't change the code we generate, so they are left out of the
+ * on-disk cache keys.
+ */
+#define V3D_DEBUG_CACHE_NEUTRAL     (V3D_DEBUG_PRECOMPILE | V3D_DEBUG_CACHE)
+
 #ifdef HAVE_ANDROID_PLATFORM
 #define LOG_TAG "BROADCOM-MESA"
 #if ANDROID_API_LEVEL >= 26
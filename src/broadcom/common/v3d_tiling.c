@@ -25,9 +25,21 @@
  *
  * Handles information about the V3D tiling formats, and loading and storing
  * from them.
+ *
+ * On x86, this file is also built with -mavx2 and V3D_BUILD_AVX2 set (see
+ * v3d_tiling_avx2.c), producing _avx2-suffixed copies of its functions that
+ * the base load/store entrypoints dispatch to when the CPU has AVX2.
  */
 
+#ifdef V3D_BUILD_AVX2
+#define v3d_utile_width v3d_utile_width_avx2
+#define v3d_utile_height v3d_utile_height_avx2
+#define v3d_load_tiled_image v3d_load_tiled_image_avx2
+#define v3d_store_tiled_image v3d_store_tiled_image_avx2
+#endif
+
 #include <stdint.h>
+#include "util/u_cpu_detect.h"
 #include "v3d_tiling.h"
 #include "broadcom/common/v3d_cpu_tiling.h"
 
@@ -462,6 +474,14 @@ v3d_load_tiled_image(void *dst, uint32_t dst_stride,
                      uint32_t image_h,
                      const struct pipe_box *box)
 {
+#if defined(USE_X86_AVX2) && !defined(V3D_BUILD_AVX2)
+        if (util_get_cpu_caps()->has_avx2) {
+                v3d_load_tiled_image_avx2(dst, dst_stride, src, src_stride,
+                                          tiling_format, cpp, image_h, box);
+                return;
+        }
+#endif
+
         v3d_move_tiled_image(src, src_stride,
                              dst, dst_stride,
                              tiling_format,
@@ -482,6 +502,14 @@ v3d_store_tiled_image(void *dst, uint32_t dst_stride,
                       uint32_t image_h,
                       const struct pipe_box *box)
 {
+#if defined(USE_X86_AVX2) && !defined(V3D_BUILD_AVX2)
+        if (util_get_cpu_caps()->has_avx2) {
+                v3d_store_tiled_image_avx2(dst, dst_stride, src, src_stride,
+                                           tiling_format, cpp, image_h, box);
+                return;
+        }
+#endif
+
         v3d_move_tiled_image(dst, dst_stride,
                              src, src_stride,
                              tiling_format,
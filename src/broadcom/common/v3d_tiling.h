@@ -76,5 +76,15 @@ void v3d_store_tiled_image(void *dst, uint32_t dst_stride,
                            enum v3d_tiling_mode tiling_format, int cpp,
                            uint32_t image_h,
                            const struct pipe_box *box);
+void v3d_load_tiled_image_avx2(void *dst, uint32_t dst_stride,
+                               void *src, uint32_t src_stride,
+                               enum v3d_tiling_mode tiling_format, int cpp,
+                               uint32_t image_h,
+                               const struct pipe_box *box);
+void v3d_store_tiled_image_avx2(void *dst, uint32_t dst_stride,
+                                void *src, uint32_t src_stride,
+                                enum v3d_tiling_mode tiling_format, int cpp,
+                                uint32_t image_h,
+                                const struct pipe_box *box);
 
 #endif /* V3D_TILING_H */
@@ -0,0 +1,304 @@
+/*
+ * Copyright © 2024 Raspberry Pi Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/** @file strategy_bench.c
+ *
+ * Benchmark for V3D_SPECULATIVE_STRATEGIES.  It compiles a corpus of compute
+ * shaders, in the style of a shader-db run, once with a compiler that tries
+ * the fallback strategies one after another and once with one that compiles
+ * them speculatively.  For each mode it reports the wall time for the
+ * corpus, and it fails if any shader's QPU code or strategy differs between
+ * the two.
+ *
+ * The shaders load a number of values from an SSBO and store back sums
+ * that each need all of them, so the register pressure (and the strategy
+ * each shader ends up with) scales with the number of values.  Half of them
+ * do that inside a loop, so that the loop unrolling strategies come into
+ * play too.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler/glsl_types.h"
+#include "compiler/nir/nir_builder.h"
+#include "util/os_time.h"
+#include "util/ralloc.h"
+#include "broadcom/compiler/v3d_compiler.h"
+
+static const nir_shader_compiler_options options = {
+        .lower_all_io_to_temps = true,
+        .lower_fdiv = true,
+        .lower_ffma16 = true,
+        .lower_ffma32 = true,
+        .lower_ffma64 = true,
+        .lower_flrp32 = true,
+        .lower_fpow = true,
+        .lower_fsat = true,
+        .lower_fsqrt = true,
+        .lower_to_scalar = true,
+        .has_fsub = true,
+        .has_isub = true,
+        .max_unroll_iterations = 16,
+};
+
+static const unsigned corpus_sizes[] = { 8, 16, 24, 32, 48, 64 };
+
+struct corpus_shader {
+        char name[32];
+        nir_shader *nir;
+};
+
+static nir_shader *
+build_shader(unsigned num_values, bool loop, const char *name)
+{
+        nir_builder b = nir_builder_init_simple_shader(MESA_SHADER_COMPUTE,
+                                                       &options, "%s", name);
+        b.shader->info.workgroup_size[0] = 16;
+        b.shader->info.workgroup_size[1] = 1;
+        b.shader->info.workgroup_size[2] = 1;
+        b.shader->info.num_ssbos = 1;
+
+        nir_ssa_def *zero = nir_imm_int(&b, 0);
+        nir_ssa_def **values = ralloc_array(b.shader, nir_ssa_def *,
+                                            num_values);
+
+        for (unsigned i = 0; i < num_values; i++) {
+                values[i] = nir_load_ssbo(&b, 1, 32, zero,
+                                          nir_imm_int(&b, i * 4),
+                                          .align_mul = 4);
+        }
+
+        nir_variable *scale = NULL;
+        nir_variable *counter = NULL;
+        if (loop) {
+                scale = nir_local_variable_create(b.impl, glsl_float_type(),
+                                                  "scale");
+                counter = nir_local_variable_create(b.impl, glsl_int_type(),
+                                                    "i");
+                nir_store_var(&b, scale, nir_imm_float(&b, 1.0f), 0x1);
+                nir_store_var(&b, counter, zero, 0x1);
+                nir_push_loop(&b);
+                nir_ssa_def *i = nir_load_var(&b, counter);
+                nir_push_if(&b, nir_ige(&b, i, nir_imm_int(&b, 4)));
+                nir_jump(&b, nir_jump_break);
+                nir_pop_if(&b, NULL);
+        }
+
+        for (unsigned j = 0; j < num_values; j++) {
+                nir_ssa_def *sum = nir_imm_float(&b, 0.0f);
+                for (unsigned i = 0; i < num_values; i++) {
+                        float c = (float)((i * 7 + j * 13) % 17 + 1);
+                        sum = nir_fadd(&b, sum,
+                                       nir_fmul_imm(&b, values[i], c));
+                }
+                if (loop)
+                        sum = nir_fmul(&b, sum, nir_load_var(&b, scale));
+                nir_store_ssbo(&b, sum, zero,
+                               nir_imm_int(&b, (num_values + j) * 4),
+                               .write_mask = 0x1, .align_mul = 4);
+        }
+
+        if (loop) {
+                nir_ssa_def *i = nir_load_var(&b, counter);
+                nir_store_var(&b, scale,
+                              nir_fmul_imm(&b, nir_load_var(&b, scale), 0.5f),
+                              0x1);
+                nir_store_var(&b, counter, nir_iadd_imm(&b, i, 1), 0x1);
+                nir_pop_loop(&b, NULL);
+        }
+
+        /* What the drivers run on a new shader before compiling it. */
+        NIR_PASS(_, b.shader, nir_lower_vars_to_ssa);
+        NIR_PASS(_, b.shader, nir_lower_load_const_to_scalar);
+        v3d_optimize_nir(NULL, b.shader);
+        nir_sweep(b.shader);
+
+        return b.shader;
+}
+
+static void
+debug_output(const char *msg, void *data)
+{
+}
+
+struct compile_result {
+        uint64_t *qpu_insts;
+        uint32_t size;
+        uint8_t strategy;
+        uint8_t threads;
+        uint32_t spills;
+};
+
+static int64_t
+compile_corpus(const struct v3d_compiler *compiler,
+               struct corpus_shader *corpus, unsigned corpus_count,
+               struct compile_result *results)
+{
+        int64_t start = os_time_get_nano();
+
+        for (unsigned i = 0; i < corpus_count; i++) {
+                struct v3d_key key;
+                struct v3d_prog_data *prog_data;
+
+                memset(&key, 0, sizeof(key));
+                key.environment = V3D_ENVIRONMENT_VULKAN;
+
+                struct compile_result *r = &results[i];
+                r->qpu_insts = v3d_compile(compiler, &key, &prog_data,
+                                           corpus[i].nir, debug_output, NULL,
+                                           i, 0, &r->size);
+                r->strategy = prog_data->compile_strategy_idx;
+                r->threads = prog_data->threads;
+                r->spills = prog_data->tmu_spills;
+                ralloc_free(prog_data);
+        }
+
+        return os_time_get_nano() - start;
+}
+
+static const struct v3d_compiler *
+create_compiler(const struct v3d_device_info *devinfo, unsigned speculative)
+{
+        char value[16];
+        snprintf(value, sizeof(value), "%u", speculative);
+        setenv("V3D_SPECULATIVE_STRATEGIES", value, 1);
+
+        return v3d_compiler_init(devinfo, 0);
+}
+
+static void
+usage(const char *name)
+{
+        fprintf(stderr,
+                "Usage: %s [-n repeats] [-s speculative strategies]\n",
+                name);
+        exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+        unsigned repeats = 3;
+        unsigned speculative = 3;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+                switch (opt) {
+                case 'n':
+                        repeats = atoi(optarg);
+                        break;
+                case 's':
+                        speculative = atoi(optarg);
+                        break;
+                default:
+                        usage(argv[0]);
+                }
+        }
+        if (repeats < 1 || speculative < 1)
+                usage(argv[0]);
+
+        glsl_type_singleton_init_or_ref();
+
+        const struct v3d_device_info devinfo = {
+                .ver = 42,
+                .vpm_size = 16 * 1024,
+                .qpu_count = 8,
+        };
+
+        const unsigned corpus_count = 2 * ARRAY_SIZE(corpus_sizes);
+        struct corpus_shader corpus[2 * ARRAY_SIZE(corpus_sizes)];
+        for (unsigned i = 0; i < corpus_count; i++) {
+                unsigned num_values = corpus_sizes[i / 2];
+                bool loop = i & 1;
+
+                snprintf(corpus[i].name, sizeof(corpus[i].name), "%s%u",
+                         loop ? "loop-" : "straight-", num_values);
+                corpus[i].nir = build_shader(num_values, loop,
+                                             corpus[i].name);
+        }
+
+        const struct v3d_compiler *serial = create_compiler(&devinfo, 0);
+        const struct v3d_compiler *parallel =
+                create_compiler(&devinfo, speculative);
+        if (!serial || !parallel) {
+                fprintf(stderr, "Failed to create the compilers\n");
+                return 1;
+        }
+
+        struct compile_result serial_results[ARRAY_SIZE(corpus)];
+        struct compile_result parallel_results[ARRAY_SIZE(corpus)];
+        int64_t serial_ns = INT64_MAX, parallel_ns = INT64_MAX;
+        bool mismatch = false;
+
+        for (unsigned n = 0; n < repeats; n++) {
+                serial_ns = MIN2(serial_ns,
+                                 compile_corpus(serial, corpus, corpus_count,
+                                                serial_results));
+                parallel_ns = MIN2(parallel_ns,
+                                   compile_corpus(parallel, corpus,
+                                                  corpus_count,
+                                                  parallel_results));
+
+                for (unsigned i = 0; i < corpus_count; i++) {
+                        struct compile_result *a = &serial_results[i];
+                        struct compile_result *b = &parallel_results[i];
+
+                        if (a->size != b->size ||
+                            a->strategy != b->strategy ||
+                            memcmp(a->qpu_insts, b->qpu_insts, a->size) != 0) {
+                                fprintf(stderr, "%s: speculative compile "
+                                        "differs (strategy %d vs %d)\n",
+                                        corpus[i].name,
+                                        a->strategy, b->strategy);
+                                mismatch = true;
+                        }
+
+                        if (n == repeats - 1) {
+                                printf("%-12s strategy %2d, %d threads, "
+                                       "%3d spills, %5d bytes\n",
+                                       corpus[i].name, a->strategy,
+                                       a->threads, a->spills, a->size);
+                        }
+
+                        free(a->qpu_insts);
+                        free(b->qpu_insts);
+                }
+        }
+
+        printf("\n%u shaders, best of %u runs:\n", corpus_count, repeats);
+        printf("  serial:              %8.2f ms\n", serial_ns / 1e6);
+        printf("  %u speculative:       %8.2f ms (%.2fx)\n", speculative,
+               parallel_ns / 1e6, (double)serial_ns / parallel_ns);
+
+        v3d_compiler_free(serial);
+        v3d_compiler_free(parallel);
+        for (unsigned i = 0; i < corpus_count; i++)
+                ralloc_free(corpus[i].nir);
+        glsl_type_singleton_decref();
+
+        return mismatch ? 1 : 0;
+}
@@ -38,6 +38,7 @@
 #include "compiler/nir/nir.h"
 #include "util/list.h"
 #include "util/u_math.h"
+#include "util/u_queue.h"
 
 #include "qpu/qpu_instr.h"
 #include "pipe/p_state.h"
@@ -594,6 +595,14 @@ struct v3d_compiler {
         struct ra_class *reg_class_r5[3];
         struct ra_class *reg_class_phys[3];
         struct ra_class *reg_class_phys_or_acc[3];
+
+        /**
+         * Number of fallback strategies v3d_compile() may run ahead of time
+         * on strategy_queue once the default one fails (0 to disable), from
+         * V3D_SPECULATIVE_STRATEGIES.
+         */
+        uint32_t speculative_strategies;
+        struct util_queue strategy_queue;
 };
 
 /**
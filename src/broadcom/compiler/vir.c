@@ -23,6 +23,8 @@
 
 #include "broadcom/common/v3d_device_info.h"
 #include "v3d_compiler.h"
+#include "util/u_atomic.h"
+#include "util/u_debug.h"
 #include "util/u_prim.h"
 #include "compiler/nir/nir_schedule.h"
 #include "compiler/nir/nir_builder.h"
@@ -516,6 +518,9 @@ vir_link_blocks(struct qblock *predecessor, struct qblock *successor)
         }
 }
 
+/* Pi 4 has four cores, one of which is running v3d_compile() itself. */
+#define V3D_MAX_SPECULATIVE_STRATEGIES 3
+
 const struct v3d_compiler *
 v3d_compiler_init(const struct v3d_device_info *devinfo,
                   uint32_t max_inline_uniform_buffers)
@@ -532,13 +537,33 @@ v3d_compiler_init(const struct v3d_device_info *devinfo,
                 return NULL;
         }
 
+        /* The speculative compiles would interleave their shader dumps. */
+        uint32_t speculative_strategies =
+                debug_get_num_option("V3D_SPECULATIVE_STRATEGIES", 0);
+        if (speculative_strategies > 0 &&
+            !(v3d_mesa_debug & (V3D_DEBUG_SHADERS | V3D_DEBUG_PERF))) {
+                speculative_strategies = MIN2(speculative_strategies,
+                                              V3D_MAX_SPECULATIVE_STRATEGIES);
+                if (util_queue_init(&compiler->strategy_queue, "v3d_strat",
+                                    32, speculative_strategies,
+                                    UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL)) {
+                        compiler->speculative_strategies =
+                                speculative_strategies;
+                }
+        }
+
         return compiler;
 }
 
 void
 v3d_compiler_free(const struct v3d_compiler *compiler)
 {
-        ralloc_free((void *)compiler);
+        struct v3d_compiler *c = (struct v3d_compiler *)compiler;
+
+        if (c->speculative_strategies)
+                util_queue_destroy(&c->strategy_queue);
+
+        ralloc_free(c);
 }
 
 struct v3d_compiler_strategy {
@@ -1776,6 +1801,136 @@ skip_compile_strategy(struct v3d_compile *c, uint32_t idx)
            return false;
    };
 }
+
+/**
+ * State shared by the speculative compiles of a v3d_compile() call.
+ *
+ * Once the default strategy fails, the next few strategies that the failed
+ * compile doesn't rule out are compiled on compiler->strategy_queue while
+ * v3d_compile() works through them in order.  v3d_compile() still applies the
+ * skip and selection rules as if it had compiled each strategy itself, and a
+ * strategy's compile only depends on its inputs, so the result is the same as
+ * without speculation; we just drop the compiles that turn out not to be
+ * needed.
+ */
+struct v3d_strategy_state {
+        const struct v3d_compiler *compiler;
+        struct v3d_key *key;
+        nir_shader *s;
+        void (*debug_output)(const char *msg, void *debug_output_data);
+        void *debug_output_data;
+        int program_id;
+        int variant_id;
+
+        /* Set once v3d_compile() has picked its result. */
+        int cancelled;
+
+        struct v3d_strategy_job {
+                struct v3d_strategy_state *state;
+                uint32_t strat;
+                bool queued;
+                struct util_queue_fence fence;
+                struct v3d_compile *c;
+        } jobs[ARRAY_SIZE(strategies)];
+};
+
+static struct v3d_compile *
+v3d_compile_strategy(const struct v3d_strategy_state *state, uint32_t strat)
+{
+        struct v3d_compile *c =
+                vir_compile_init(state->compiler, state->key, state->s,
+                                 state->debug_output, state->debug_output_data,
+                                 state->program_id, state->variant_id,
+                                 strat, &strategies[strat],
+                                 strat == ARRAY_SIZE(strategies) - 1);
+
+        v3d_attempt_compile(c);
+
+        return c;
+}
+
+static void
+v3d_strategy_job_execute(void *data, void *gdata, int thread_index)
+{
+        struct v3d_strategy_job *job = data;
+
+        if (p_atomic_read(&job->state->cancelled))
+                return;
+
+        job->c = v3d_compile_strategy(job->state, job->strat);
+}
+
+/**
+ * Keeps up to compiler->speculative_strategies strategies from \p first on
+ * queued, leaving out the ones that \p prev says would be skipped.
+ */
+static void
+v3d_queue_strategies(struct v3d_strategy_state *state,
+                     struct v3d_compile *prev, uint32_t first)
+{
+        const struct v3d_compiler *compiler = state->compiler;
+        uint32_t queued = 0;
+
+        for (uint32_t strat = first;
+             strat < ARRAY_SIZE(strategies) &&
+             queued < compiler->speculative_strategies;
+             strat++) {
+                struct v3d_strategy_job *job = &state->jobs[strat];
+
+                if (!job->queued) {
+                        if (skip_compile_strategy(prev, strat))
+                                continue;
+
+                        job->state = state;
+                        job->strat = strat;
+                        job->queued = true;
+                        util_queue_fence_init(&job->fence);
+                        util_queue_add_job((struct util_queue *)
+                                           &compiler->strategy_queue,
+                                           job, &job->fence,
+                                           v3d_strategy_job_execute, NULL, 0);
+                }
+                queued++;
+        }
+}
+
+/**
+ * Returns the compile of strategy \p strat, from the queue if it was
+ * speculatively compiled.
+ */
+static struct v3d_compile *
+v3d_get_strategy_compile(struct v3d_strategy_state *state, uint32_t strat)
+{
+        struct v3d_strategy_job *job = &state->jobs[strat];
+
+        if (!job->queued)
+                return v3d_compile_strategy(state, strat);
+
+        util_queue_fence_wait(&job->fence);
+        struct v3d_compile *c = job->c;
+        job->c = NULL;
+
+        return c;
+}
+
+static void
+v3d_finish_strategy_compiles(struct v3d_strategy_state *state)
+{
+        p_atomic_set(&state->cancelled, true);
+
+        for (uint32_t strat = 0; strat < ARRAY_SIZE(strategies); strat++) {
+                struct v3d_strategy_job *job = &state->jobs[strat];
+
+                if (!job->queued)
+                        continue;
+
+                util_queue_fence_wait(&job->fence);
+                util_queue_fence_destroy(&job->fence);
+                if (job->c)
+                        vir_compile_destroy(job->c);
+        }
+}
+
 uint64_t *v3d_compile(const struct v3d_compiler *compiler,
                       struct v3d_key *key,
                       struct v3d_prog_data **out_prog_data,
@@ -1788,6 +1943,16 @@ uint64_t *v3d_compile(const struct v3d_compiler *compiler,
 {
         struct v3d_compile *c = NULL;
 
+        struct v3d_strategy_state strategy_state = {
+                .compiler = compiler,
+                .key = key,
+                .s = s,
+                .debug_output = debug_output,
+                .debug_output_data = debug_output_data,
+                .program_id = program_id,
+                .variant_id = variant_id,
+        };
+
         uint32_t best_spill_fill_count = UINT32_MAX;
         struct v3d_compile *best_c = NULL;
         for (int32_t strat = 0; strat < ARRAY_SIZE(strategies); strat++) {
@@ -1813,17 +1978,18 @@ uint64_t *v3d_compile(const struct v3d_compiler *compiler,
                                 free(debug_msg);
                         }
 
+                        /* Start on the strategies we may fall back to
+                         * after this one while we compile it.  Nothing is
+                         * speculated until the default strategy has failed,
+                         * which it usually doesn't.
+                         */
+                        v3d_queue_strategies(&strategy_state, c, strat + 1);
+
                         if (c != best_c)
                                 vir_compile_destroy(c);
                 }
 
-                c = vir_compile_init(compiler, key, s,
-                                     debug_output, debug_output_data,
-                                     program_id, variant_id,
-                                     strat, &strategies[strat],
-                                     strat == ARRAY_SIZE(strategies) - 1);
-
-                v3d_attempt_compile(c);
+                c = v3d_get_strategy_compile(&strategy_state, strat);
 
                 /* Broken shader or driver bug */
                 if (c->compilation_result == V3D_COMPILATION_FAILED)
@@ -1879,6 +2045,8 @@ uint64_t *v3d_compile(const struct v3d_compiler *compiler,
                 c = best_c;
         }
 
+        v3d_finish_strategy_compiles(&strategy_state);
+
         if (V3D_DBG(PERF) &&
             c->compilation_result !=
             V3D_COMPILATION_FAILED_REGISTER_ALLOCATION &&
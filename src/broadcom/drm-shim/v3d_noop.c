@@ -120,8 +120,17 @@ v3d_ioctl_get_param(int fd, unsigned long request, void *arg)
 
         switch (gp->param) {
         case DRM_V3D_PARAM_SUPPORTS_TFU:
+        case DRM_V3D_PARAM_SUPPORTS_CSD:
+        case DRM_V3D_PARAM_SUPPORTS_CACHE_FLUSH:
+        /* Without it v3dv signals through sync files, which drm-shim
+         * can't export.
+         */
+        case DRM_V3D_PARAM_SUPPORTS_MULTISYNC_EXT:
                 gp->value = 1;
                 return 0;
+        case DRM_V3D_PARAM_SUPPORTS_PERFMON:
+                gp->value = 0;
+                return 0;
         default:
                 break;
         }
@@ -138,6 +147,7 @@ v3d_ioctl_get_param(int fd, unsigned long request, void *arg)
 static ioctl_fn_t driver_ioctls[] = {
         [DRM_V3D_SUBMIT_CL] = v3d_ioctl_noop,
         [DRM_V3D_SUBMIT_TFU] = v3d_ioctl_noop,
+        [DRM_V3D_SUBMIT_CSD] = v3d_ioctl_noop,
         [DRM_V3D_WAIT_BO] = v3d_ioctl_noop,
         [DRM_V3D_CREATE_BO] = v3d_ioctl_create_bo,
         [DRM_V3D_GET_PARAM] = v3d_ioctl_get_param,
@@ -154,8 +164,9 @@ drm_shim_driver_init(void)
         shim_device.driver_ioctl_count = ARRAY_SIZE(driver_ioctls);
 
         drm_shim_override_file("OF_FULLNAME=/rdb/v3d\n"
-                               "OF_COMPATIBLE_N=1\n"
-                               "OF_COMPATIBLE_0=brcm,7278-v3d\n",
+                               "OF_COMPATIBLE_N=2\n"
+                               "OF_COMPATIBLE_0=brcm,2711-v3d\n"
+                               "OF_COMPATIBLE_1=brcm,7278-v3d\n",
                                "/sys/dev/char/%d:%d/device/uevent",
                                DRM_MAJOR, render_node_minor);
 }
@@ -0,0 +1,1530 @@
+/*
+ * Copyright © 2024 Raspberry Pi Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/** @file v3d-compile.c
+ *
+ * Offline shader compiler for V3D 4.2 (Raspberry Pi 4).  It runs the real
+ * drivers on top of the v3d_noop drm-shim device, so that images can ship
+ * caches filled in at build time instead of compiling on first launch.
+ *
+ * Each input is a pipeline description: a file in the TOML subset vc4-glsl
+ * uses for its sidecars, naming the shader of each stage and the state the
+ * driver keys its compiles on.  SPIR-V stages are built into a pipeline by
+ * v3dv, which ends up in a VkPipelineCache blob and/or the on-disk cache.
+ * GLSL stages are linked into a program by the gallium driver, which
+ * precompiles its default variants, and can only go to the on-disk cache.
+ */
+
+#include <ctype.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define VK_NO_PROTOTYPES
+#include <vulkan/vulkan_core.h>
+#include <vulkan/vk_icd.h>
+
+#define EGL_EGL_PROTOTYPES 0
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GL_GLES_PROTOTYPES 0
+#include <GLES3/gl32.h>
+
+#include "util/macros.h"
+#include "util/os_file.h"
+#include "util/ralloc.h"
+#include "util/u_dynarray.h"
+#include "vk_enum_to_str.h"
+
+/* Exported by libvulkan_broadcom for the loader, which we don't go through,
+ * as we want the driver from this build whatever else is installed.
+ */
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+vk_icdGetInstanceProcAddr(VkInstance instance, const char *pName);
+
+/* Set once we have re-executed ourselves with the drm-shim preloaded. */
+#define V3D_COMPILE_SHIMMED_ENV "V3D_COMPILE_SHIMMED"
+
+static const struct {
+   const char *name;
+   VkShaderStageFlagBits vk_stage;
+   GLenum gl_type;
+} stages[] = {
+   { "vertex", VK_SHADER_STAGE_VERTEX_BIT, GL_VERTEX_SHADER },
+   { "geometry", VK_SHADER_STAGE_GEOMETRY_BIT, GL_GEOMETRY_SHADER },
+   { "fragment", VK_SHADER_STAGE_FRAGMENT_BIT, GL_FRAGMENT_SHADER },
+   { "compute", VK_SHADER_STAGE_COMPUTE_BIT, GL_COMPUTE_SHADER },
+};
+
+#define COMPUTE_STAGE 3
+
+struct v3d_compile_options {
+   const char *input;
+   const char *output;
+   const char *disk_cache;
+   bool robust_buffer_access;
+   bool robust_image_access;
+   bool verbose;
+};
+
+/**
+ * One "name = value" or "name = [value, ...]" entry of a description, under
+ * the [section] it appears in, if any.
+ */
+struct v3d_compile_entry {
+   const char *section;
+   const char *name;
+   const char **values;
+   unsigned num_values;
+   bool list;
+   unsigned line;
+   /* Set once something has consumed the entry. */
+   bool used;
+};
+
+struct v3d_compile_desc {
+   const char *path;
+   /* Directory the shader paths are relative to. */
+   const char *dir;
+   struct util_dynarray entries;
+   /* Set by the lookups on a malformed entry, once it has been reported. */
+   bool failed;
+
+   const char *shaders[ARRAY_SIZE(stages)];
+   bool spirv;
+   /* Set when v3dv found the pipeline in the cache instead of compiling. */
+   bool cache_hit;
+};
+
+static void
+skip_space(const char **c, unsigned *line, bool newlines)
+{
+   while (**c) {
+      if (**c == '#') {
+         while (**c && **c != '\n')
+            ++*c;
+      } else if (**c == '\n' && newlines) {
+         ++*line;
+         ++*c;
+      } else if (**c == ' ' || **c == '\t' || **c == '\r') {
+         ++*c;
+      } else {
+         break;
+      }
+   }
+}
+
+static const char *
+parse_name(void *mem_ctx, const char **c)
+{
+   const char *name = *c;
+   while (isalnum(**c) || **c == '_')
+      ++*c;
+   if (*c == name || isdigit(*name))
+      return NULL;
+   return ralloc_strndup(mem_ctx, name, *c - name);
+}
+
+static bool
+parse_value(void *mem_ctx, const char *path, const char **c, unsigned line,
+            const char *name, struct util_dynarray *values)
+{
+   const char *value = *c, *value_end;
+   if (**c == '"') {
+      value = ++*c;
+      while (**c && **c != '"' && **c != '\n')
+         ++*c;
+      if (**c != '"') {
+         fprintf(stderr, "%s:%u: unterminated string in %s\n", path, line,
+                 name);
+         return false;
+      }
+      value_end = (*c)++;
+   } else {
+      while (**c && !isspace(**c) && **c != ',' && **c != ']' && **c != '#')
+         ++*c;
+      value_end = *c;
+      if (value_end == value) {
+         fprintf(stderr, "%s:%u: expected a value for %s\n", path, line,
+                 name);
+         return false;
+      }
+   }
+   util_dynarray_append(values, const char *,
+                        ralloc_strndup(mem_ctx, value, value_end - value));
+   return true;
+}
+
+static bool
+parse_desc(struct v3d_compile_desc *desc, const char *text)
+{
+   const char *path = desc->path;
+   const char *c = text;
+   const char *section = NULL;
+   unsigned line = 1;
+   for (;;) {
+      skip_space(&c, &line, true);
+      if (!*c)
+         return true;
+
+      if (*c == '[') {
+         ++c;
+         skip_space(&c, &line, false);
+         section = parse_name(desc, &c);
+         skip_space(&c, &line, false);
+         if (!section || *c != ']') {
+            fprintf(stderr, "%s:%u: expected a [section] name\n", path, line);
+            return false;
+         }
+         ++c;
+         continue;
+      }
+
+      struct v3d_compile_entry entry = {
+         .section = section,
+         .name = parse_name(desc, &c),
+         .line = line,
+      };
+      if (!entry.name) {
+         fprintf(stderr, "%s:%u: expected a name\n", path, line);
+         return false;
+      }
+
+      skip_space(&c, &line, false);
+      if (*c != '=') {
+         fprintf(stderr, "%s:%u: expected '=' after %s\n", path, line,
+                 entry.name);
+         return false;
+      }
+      ++c;
+      skip_space(&c, &line, false);
+
+      struct util_dynarray values;
+      util_dynarray_init(&values, desc);
+      entry.list = *c == '[';
+      if (entry.list) {
+         ++c;
+         for (;;) {
+            skip_space(&c, &line, true);
+            if (*c == ']') {
+               ++c;
+               break;
+            }
+            if (!parse_value(desc, path, &c, line, entry.name, &values))
+               return false;
+            skip_space(&c, &line, true);
+            if (*c == ',') {
+               ++c;
+            } else if (*c != ']') {
+               fprintf(stderr, "%s:%u: expected ',' or ']' in %s\n", path,
+                       line, entry.name);
+               return false;
+            }
+         }
+      } else if (!parse_value(desc, path, &c, line, entry.name, &values)) {
+         return false;
+      }
+      entry.values = values.data;
+      entry.num_values = util_dynarray_num_elements(&values, const char *);
+
+      skip_space(&c, &line, false);
+      if (*c && *c != '\n') {
+         fprintf(stderr, "%s:%u: trailing characters after %s\n", path, line,
+                 entry.name);
+         return false;
+      }
+
+      util_dynarray_foreach(&desc->entries, struct v3d_compile_entry, other) {
+         if (((!other->section && !section) ||
+              (other->section && section &&
+               strcmp(other->section, section) == 0)) &&
+             strcmp(other->name, entry.name) == 0) {
+            fprintf(stderr, "%s:%u: %s is set twice\n", path, line,
+                    entry.name);
+            return false;
+         }
+      }
+      util_dynarray_append(&desc->entries, struct v3d_compile_entry, entry);
+   }
+}
+
+static struct v3d_compile_entry *
+desc_find(struct v3d_compile_desc *desc, const char *section,
+          const char *name)
+{
+   util_dynarray_foreach(&desc->entries, struct v3d_compile_entry, entry) {
+      if ((section ? entry->section && strcmp(entry->section, section) == 0
+                   : !entry->section) &&
+          strcmp(entry->name, name) == 0) {
+         entry->used = true;
+         return entry;
+      }
+   }
+   return NULL;
+}
+
+static const char *
+desc_string(struct v3d_compile_desc *desc, const char *section,
+            const char *name)
+{
+   struct v3d_compile_entry *entry = desc_find(desc, section, name);
+   if (!entry)
+      return NULL;
+   if (entry->list) {
+      fprintf(stderr, "%s:%u: %s can't be a list\n", desc->path, entry->line,
+              name);
+      desc->failed = true;
+      return NULL;
+   }
+   return entry->values[0];
+}
+
+static bool
+parse_uint(struct v3d_compile_desc *desc, const struct v3d_compile_entry *entry,
+           const char *text, uint32_t *value)
+{
+   char *end;
+   errno = 0;
+   unsigned long v = strtoul(text, &end, 0);
+   if (errno || end == text || *end || v > UINT32_MAX) {
+      fprintf(stderr, "%s:%u: %s isn't a valid number for %s\n", desc->path,
+              entry->line, text, entry->name);
+      desc->failed = true;
+      return false;
+   }
+   *value = v;
+   return true;
+}
+
+static uint32_t
+desc_uint(struct v3d_compile_desc *desc, const char *section,
+          const char *name, uint32_t default_value)
+{
+   const char *text = desc_string(desc, section, name);
+   uint32_t value = default_value;
+   if (text)
+      parse_uint(desc, desc_find(desc, section, name), text, &value);
+   return value;
+}
+
+static bool
+desc_bool(struct v3d_compile_desc *desc, const char *section,
+          const char *name)
+{
+   const char *text = desc_string(desc, section, name);
+   if (!text || strcmp(text, "false") == 0)
+      return false;
+   if (strcmp(text, "true") == 0)
+      return true;
+
+   fprintf(stderr, "%s:%u: %s must be true or false\n", desc->path,
+           desc_find(desc, section, name)->line, name);
+   desc->failed = true;
+   return false;
+}
+
+static void
+desc_error(struct v3d_compile_desc *desc, const struct v3d_compile_entry *entry,
+           const char *value, const char *what)
+{
+   fprintf(stderr, "%s:%u: unknown %s \"%s\" in %s\n", desc->path,
+           entry->line, what, value, entry->name);
+   desc->failed = true;
+}
+
+/* Matches "triangle_list" or "VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST" against
+ * the second one.
+ */
+static bool
+enum_name_matches(const char *enum_name, const char *prefix,
+                  const char *text)
+{
+   if (strcasecmp(enum_name, text) == 0)
+      return true;
+   return strncmp(enum_name, prefix, strlen(prefix)) == 0 &&
+          strcasecmp(enum_name + strlen(prefix), text) == 0;
+}
+
+#define LOOKUP_VK_ENUM(type, prefix, last, text, value) ({               \
+   bool found = false;                                                   \
+   for (int v = 0; v <= (int)(last) && !found; v++) {                    \
+      if (enum_name_matches(vk_##type##_to_str((Vk##type)v), prefix,     \
+                            text)) {                                     \
+         *(value) = (Vk##type)v;                                         \
+         found = true;                                                   \
+      }                                                                  \
+   }                                                                     \
+   found;                                                                \
+})
+
+static VkFormat
+desc_format(struct v3d_compile_desc *desc,
+            const struct v3d_compile_entry *entry, const char *text)
+{
+   VkFormat format = VK_FORMAT_UNDEFINED;
+   if (!LOOKUP_VK_ENUM(Format, "VK_FORMAT_", VK_FORMAT_ASTC_12x12_SRGB_BLOCK,
+                       text, &format) ||
+       format == VK_FORMAT_UNDEFINED) {
+      desc_error(desc, entry, text, "format");
+   }
+   return format;
+}
+
+static VkShaderStageFlags
+desc_stage_flags(struct v3d_compile_desc *desc, const char *section,
+                 VkShaderStageFlags default_flags)
+{
+   struct v3d_compile_entry *entry = desc_find(desc, section, "stages");
+   if (!entry)
+      return default_flags;
+
+   VkShaderStageFlags flags = 0;
+   for (unsigned i = 0; i < entry->num_values; i++) {
+      const char *name = entry->values[i];
+      unsigned s;
+      for (s = 0; s < ARRAY_SIZE(stages); s++) {
+         if (strcmp(name, stages[s].name) == 0)
+            break;
+      }
+      if (s < ARRAY_SIZE(stages))
+         flags |= stages[s].vk_stage;
+      else if (strcmp(name, "all_graphics") == 0)
+         flags |= VK_SHADER_STAGE_ALL_GRAPHICS;
+      else if (strcmp(name, "all") == 0)
+         flags |= VK_SHADER_STAGE_ALL;
+      else
+         desc_error(desc, entry, name, "stage");
+   }
+   return flags;
+}
+
+/* Reports whatever the description sets that nothing looked at, as a typo
+ * there would otherwise silently compile a pipeline that never gets hit.
+ */
+static bool
+desc_check_unused(struct v3d_compile_desc *desc)
+{
+   util_dynarray_foreach(&desc->entries, struct v3d_compile_entry, entry) {
+      if (!entry->used) {
+         fprintf(stderr, "%s:%u: unknown setting %s%s%s\n", desc->path,
+                 entry->line, entry->section ? entry->section : "",
+                 entry->section ? "." : "", entry->name);
+         desc->failed = true;
+      }
+   }
+   return !desc->failed;
+}
+
+static bool
+has_suffix(const char *str, const char *suffix)
+{
+   size_t len = strlen(str), suffix_len = strlen(suffix);
+   return len >= suffix_len && strcmp(str + len - suffix_len, suffix) == 0;
+}
+
+static struct v3d_compile_desc *
+load_desc(void *mem_ctx, const char *path)
+{
+   size_t size;
+   char *text = os_read_file(path, &size);
+   if (!text) {
+      fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+      return NULL;
+   }
+
+   struct v3d_compile_desc *desc = rzalloc(mem_ctx, struct v3d_compile_desc);
+   desc->path = ralloc_strdup(desc, path);
+   char *dir = ralloc_strdup(desc, path);
+   desc->dir = ralloc_strdup(desc, dirname(dir));
+   util_dynarray_init(&desc->entries, desc);
+
+   bool parsed = parse_desc(desc, text);
+   free(text);
+   if (!parsed)
+      return NULL;
+
+   unsigned num_spirv = 0, num_shaders = 0;
+   for (unsigned s = 0; s < ARRAY_SIZE(stages); s++) {
+      desc->shaders[s] = desc_string(desc, NULL, stages[s].name);
+      if (!desc->shaders[s])
+         continue;
+      num_shaders++;
+      if (has_suffix(desc->shaders[s], ".spv"))
+         num_spirv++;
+   }
+   if (desc->failed)
+      return NULL;
+
+   if (num_shaders == 0) {
+      fprintf(stderr, "%s: no shaders\n", path);
+      return NULL;
+   }
+   if (num_spirv != 0 && num_spirv != num_shaders) {
+      fprintf(stderr, "%s: can't mix SPIR-V and GLSL stages\n", path);
+      return NULL;
+   }
+   if (desc->shaders[COMPUTE_STAGE] && num_shaders != 1) {
+      fprintf(stderr, "%s: compute can't be combined with other stages\n",
+              path);
+      return NULL;
+   }
+   desc->spirv = num_spirv != 0;
+
+   return desc;
+}
+
+static char *
+read_shader(struct v3d_compile_desc *desc, unsigned stage, size_t *size)
+{
+   const char *name = desc->shaders[stage];
+   char *path = name[0] == '/' ? ralloc_strdup(desc, name) :
+                ralloc_asprintf(desc, "%s/%s", desc->dir, name);
+
+   char *data = os_read_file(path, size);
+   if (!data)
+      fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+   return data;
+}
+
+#define V3D_COMPILE_VK_FUNCS(F)                                         \
+   F(DestroyInstance)                                                   \
+   F(EnumeratePhysicalDevices)                                          \
+   F(GetPhysicalDeviceFeatures2)                                        \
+   F(CreateDevice)                                                      \
+   F(DestroyDevice)                                                     \
+   F(CreateShaderModule)                                                \
+   F(DestroyShaderModule)                                               \
+   F(CreateDescriptorSetLayout)                                         \
+   F(DestroyDescriptorSetLayout)                                        \
+   F(CreatePipelineLayout)                                              \
+   F(DestroyPipelineLayout)                                             \
+   F(CreateRenderPass)                                                  \
+   F(DestroyRenderPass)                                                 \
+   F(CreatePipelineCache)                                               \
+   F(GetPipelineCacheData)                                              \
+   F(DestroyPipelineCache)                                              \
+   F(CreateGraphicsPipelines)                                           \
+   F(CreateComputePipelines)                                            \
+   F(DestroyPipeline)
+
+struct v3d_compile_vk {
+   VkInstance instance;
+   VkDevice device;
+   VkPipelineCache cache;
+
+#define DECLARE_VK_FUNC(name) PFN_vk##name name;
+   V3D_COMPILE_VK_FUNCS(DECLARE_VK_FUNC)
+#undef DECLARE_VK_FUNC
+};
+
+static bool
+vk_init(struct v3d_compile_vk *vk, const struct v3d_compile_options *options)
+{
+   PFN_vkCreateInstance CreateInstance = (PFN_vkCreateInstance)
+      vk_icdGetInstanceProcAddr(NULL, "vkCreateInstance");
+
+   const VkApplicationInfo app_info = {
+      .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+      .pApplicationName = "v3d-compile",
+      .apiVersion = VK_API_VERSION_1_2,
+   };
+   const VkInstanceCreateInfo instance_info = {
+      .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+      .pApplicationInfo = &app_info,
+   };
+   if (!CreateInstance ||
+       CreateInstance(&instance_info, NULL, &vk->instance) != VK_SUCCESS) {
+      fprintf(stderr, "Failed to create a Vulkan instance\n");
+      return false;
+   }
+
+#define LOAD_VK_FUNC(name)                                              \
+   vk->name = (PFN_vk##name)                                            \
+      vk_icdGetInstanceProcAddr(vk->instance, "vk" #name);
+   V3D_COMPILE_VK_FUNCS(LOAD_VK_FUNC)
+#undef LOAD_VK_FUNC
+
+   VkPhysicalDevice physical_device;
+   uint32_t count = 1;
+   VkResult result =
+      vk->EnumeratePhysicalDevices(vk->instance, &count, &physical_device);
+   if (result < 0 || count == 0) {
+      fprintf(stderr, "No V3D device found, is libv3d_noop_drm_shim.so "
+              "loadable?\n");
+      return false;
+   }
+
+   /* Everything the device supports is enabled, apart from robustness,
+    * which changes the code generated for a pipeline and so has to match
+    * what the application enables.
+    */
+   VkPhysicalDeviceImageRobustnessFeatures image_robustness = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_ROBUSTNESS_FEATURES,
+   };
+   VkPhysicalDeviceVulkan11Features features11 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES,
+      .pNext = options->robust_image_access ? &image_robustness : NULL,
+   };
+   VkPhysicalDeviceFeatures2 features = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &features11,
+   };
+   vk->GetPhysicalDeviceFeatures2(physical_device, &features);
+   features.features.robustBufferAccess = options->robust_buffer_access;
+
+   const char *image_robustness_ext = VK_EXT_IMAGE_ROBUSTNESS_EXTENSION_NAME;
+   const float priority = 1.0f;
+   const VkDeviceQueueCreateInfo queue_info = {
+      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+      .queueFamilyIndex = 0,
+      .queueCount = 1,
+      .pQueuePriorities = &priority,
+   };
+   const VkDeviceCreateInfo device_info = {
+      .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+      .pNext = &features,
+      .queueCreateInfoCount = 1,
+      .pQueueCreateInfos = &queue_info,
+      .enabledExtensionCount = options->robust_image_access ? 1 : 0,
+      .ppEnabledExtensionNames = &image_robustness_ext,
+   };
+   if (vk->CreateDevice(physical_device, &device_info, NULL,
+                        &vk->device) != VK_SUCCESS) {
+      fprintf(stderr, "Failed to create a Vulkan device\n");
+      return false;
+   }
+
+   size_t input_size = 0;
+   char *input = NULL;
+   if (options->input) {
+      input = os_read_file(options->input, &input_size);
+      if (!input) {
+         fprintf(stderr, "Failed to read %s: %s\n", options->input,
+                 strerror(errno));
+         return false;
+      }
+   }
+
+   const VkPipelineCacheCreateInfo cache_info = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+      .initialDataSize = input_size,
+      .pInitialData = input,
+   };
+   result = vk->CreatePipelineCache(vk->device, &cache_info, NULL,
+                                    &vk->cache);
+   free(input);
+   if (result != VK_SUCCESS) {
+      fprintf(stderr, "Failed to create a pipeline cache\n");
+      return false;
+   }
+
+   return true;
+}
+
+static bool
+vk_write_cache(struct v3d_compile_vk *vk, const char *path)
+{
+   size_t size = 0;
+   if (vk->GetPipelineCacheData(vk->device, vk->cache, &size,
+                                NULL) != VK_SUCCESS)
+      return false;
+
+   void *data = malloc(size);
+   if (!data ||
+       vk->GetPipelineCacheData(vk->device, vk->cache, &size,
+                                data) != VK_SUCCESS) {
+      free(data);
+      return false;
+   }
+
+   FILE *f = fopen(path, "wb");
+   bool ok = f && fwrite(data, 1, size, f) == size;
+   if (f && fclose(f) != 0)
+      ok = false;
+   if (!ok)
+      fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+   free(data);
+
+   return ok;
+}
+
+static void
+vk_finish(struct v3d_compile_vk *vk)
+{
+   if (vk->device) {
+      vk->DestroyPipelineCache(vk->device, vk->cache, NULL);
+      vk->DestroyDevice(vk->device, NULL);
+   }
+   /* This is what flushes the entries queued for the disk cache. */
+   if (vk->instance)
+      vk->DestroyInstance(vk->instance, NULL);
+}
+
+/**
+ * Creates the set layouts from the [setN] sections, each with a "bindings"
+ * list of descriptor types, and optional "counts" and "stages" lists.
+ */
+static unsigned
+vk_create_set_layouts(struct v3d_compile_vk *vk, struct v3d_compile_desc *desc,
+                      VkShaderStageFlags pipeline_stages,
+                      VkDescriptorSetLayout *layouts, unsigned max_sets)
+{
+   unsigned num_sets = 0;
+   util_dynarray_foreach(&desc->entries, struct v3d_compile_entry, entry) {
+      if (!entry->section)
+         continue;
+
+      uint32_t set;
+      char *end;
+      if (strncmp(entry->section, "set", 3) != 0 ||
+          !isdigit(entry->section[3]) ||
+          (set = strtoul(entry->section + 3, &end, 10)) >= max_sets ||
+          *end) {
+         fprintf(stderr, "%s:%u: unknown section [%s]\n", desc->path,
+                 entry->line, entry->section);
+         desc->failed = true;
+         return 0;
+      }
+      num_sets = MAX2(num_sets, set + 1);
+   }
+
+   for (unsigned set = 0; set < num_sets; set++) {
+      char *section = ralloc_asprintf(desc, "set%u", set);
+      struct v3d_compile_entry *types = desc_find(desc, section, "bindings");
+      struct v3d_compile_entry *counts = desc_find(desc, section, "counts");
+      unsigned num_bindings = types ? types->num_values : 0;
+
+      if (counts && counts->num_values != num_bindings) {
+         fprintf(stderr, "%s:%u: [%s] has %u counts for %u bindings\n",
+                 desc->path, counts->line, section, counts->num_values,
+                 num_bindings);
+         desc->failed = true;
+         break;
+      }
+
+      VkDescriptorSetLayoutBinding *bindings =
+         rzalloc_array(desc, VkDescriptorSetLayoutBinding, num_bindings);
+      VkShaderStageFlags stage_flags =
+         desc_stage_flags(desc, section, pipeline_stages);
+      for (unsigned b = 0; b < num_bindings; b++) {
+         bindings[b].binding = b;
+         bindings[b].stageFlags = stage_flags;
+         bindings[b].descriptorCount = 1;
+         if (!LOOKUP_VK_ENUM(DescriptorType, "VK_DESCRIPTOR_TYPE_",
+                             VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+                             types->values[b],
+                             &bindings[b].descriptorType)) {
+            desc_error(desc, types, types->values[b], "descriptor type");
+         }
+         if (counts) {
+            parse_uint(desc, counts, counts->values[b],
+                       &bindings[b].descriptorCount);
+         }
+      }
+      if (desc->failed)
+         break;
+
+      const VkDescriptorSetLayoutCreateInfo info = {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+         .bindingCount = num_bindings,
+         .pBindings = bindings,
+      };
+      if (vk->CreateDescriptorSetLayout(vk->device, &info, NULL,
+                                        &layouts[set]) != VK_SUCCESS) {
+         fprintf(stderr, "%s: failed to create set layout %u\n", desc->path,
+                 set);
+         desc->failed = true;
+         break;
+      }
+   }
+
+   return num_sets;
+}
+
+static VkRenderPass
+vk_create_render_pass(struct v3d_compile_vk *vk, struct v3d_compile_desc *desc,
+                      VkSampleCountFlagBits samples)
+{
+   struct v3d_compile_entry *colors = desc_find(desc, NULL, "color_formats");
+   const char *depth = desc_string(desc, NULL, "depth_format");
+   uint32_t view_mask = desc_uint(desc, NULL, "view_mask", 0);
+   unsigned num_colors = colors ? colors->num_values : 0;
+
+   VkAttachmentDescription *attachments =
+      rzalloc_array(desc, VkAttachmentDescription, num_colors + 1);
+   VkAttachmentReference *color_refs =
+      rzalloc_array(desc, VkAttachmentReference, num_colors);
+   unsigned num_attachments = 0;
+
+   for (unsigned i = 0; i < num_colors; i++) {
+      color_refs[i].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+      if (strcmp(colors->values[i], "unused") == 0) {
+         color_refs[i].attachment = VK_ATTACHMENT_UNUSED;
+         continue;
+      }
+      color_refs[i].attachment = num_attachments;
+      attachments[num_attachments++] = (VkAttachmentDescription) {
+         .format = desc_format(desc, colors, colors->values[i]),
+         .samples = samples,
+         .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+         .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+         .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+         .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+         .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+         .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      };
+   }
+
+   VkAttachmentReference depth_ref = {
+      .attachment = num_attachments,
+      .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+   };
+   if (depth) {
+      attachments[num_attachments++] = (VkAttachmentDescription) {
+         .format = desc_format(desc, desc_find(desc, NULL, "depth_format"),
+                               depth),
+         .samples = samples,
+         .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+         .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+         .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+         .stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE,
+         .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+         .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      };
+   }
+   if (desc->failed)
+      return VK_NULL_HANDLE;
+
+   const VkSubpassDescription subpass = {
+      .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+      .colorAttachmentCount = num_colors,
+      .pColorAttachments = color_refs,
+      .pDepthStencilAttachment = depth ? &depth_ref : NULL,
+   };
+   const VkRenderPassMultiviewCreateInfo multiview = {
+      .sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO,
+      .subpassCount = 1,
+      .pViewMasks = &view_mask,
+   };
+   const VkRenderPassCreateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+      .pNext = view_mask ? &multiview : NULL,
+      .attachmentCount = num_attachments,
+      .pAttachments = attachments,
+      .subpassCount = 1,
+      .pSubpasses = &subpass,
+   };
+
+   VkRenderPass pass;
+   if (vk->CreateRenderPass(vk->device, &info, NULL, &pass) != VK_SUCCESS) {
+      fprintf(stderr, "%s: failed to create the render pass\n", desc->path);
+      desc->failed = true;
+      return VK_NULL_HANDLE;
+   }
+   return pass;
+}
+
+static bool
+vk_create_graphics_pipeline(struct v3d_compile_vk *vk,
+                            struct v3d_compile_desc *desc,
+                            const VkPipelineShaderStageCreateInfo *stage_info,
+                            unsigned num_stages, VkPipelineLayout layout,
+                            const void *feedback_info)
+{
+   const char *topology_name = desc_string(desc, NULL, "topology");
+   const char *logic_op_name = desc_string(desc, NULL, "logic_op");
+   struct v3d_compile_entry *vertex_formats =
+      desc_find(desc, NULL, "vertex_formats");
+   uint32_t samples = desc_uint(desc, NULL, "samples", 1);
+   bool alpha_to_coverage = desc_bool(desc, NULL, "alpha_to_coverage");
+   bool alpha_to_one = desc_bool(desc, NULL, "alpha_to_one");
+   bool rasterizer_discard = desc_bool(desc, NULL, "rasterizer_discard");
+
+   VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+   if (topology_name &&
+       !LOOKUP_VK_ENUM(PrimitiveTopology, "VK_PRIMITIVE_TOPOLOGY_",
+                       VK_PRIMITIVE_TOPOLOGY_PATCH_LIST, topology_name,
+                       &topology)) {
+      desc_error(desc, desc_find(desc, NULL, "topology"), topology_name,
+                 "topology");
+   }
+
+   VkLogicOp logic_op = VK_LOGIC_OP_COPY;
+   if (logic_op_name &&
+       !LOOKUP_VK_ENUM(LogicOp, "VK_LOGIC_OP_", VK_LOGIC_OP_SET,
+                       logic_op_name, &logic_op)) {
+      desc_error(desc, desc_find(desc, NULL, "logic_op"), logic_op_name,
+                 "logic op");
+   }
+
+   if (samples != 1 && samples != 4) {
+      fprintf(stderr, "%s: samples must be 1 or 4\n", desc->path);
+      desc->failed = true;
+   }
+
+   /* One binding per attribute, as only the formats matter to the
+    * compile.
+    */
+   unsigned num_attributes = vertex_formats ? vertex_formats->num_values : 0;
+   VkVertexInputBindingDescription *vb_bindings =
+      rzalloc_array(desc, VkVertexInputBindingDescription, num_attributes);
+   VkVertexInputAttributeDescription *attributes =
+      rzalloc_array(desc, VkVertexInputAttributeDescription, num_attributes);
+   for (unsigned i = 0; i < num_attributes; i++) {
+      vb_bindings[i].binding = i;
+      vb_bindings[i].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+      attributes[i].location = i;
+      attributes[i].binding = i;
+      attributes[i].format =
+         desc_format(desc, vertex_formats, vertex_formats->values[i]);
+   }
+
+   VkRenderPass pass = vk_create_render_pass(vk, desc, samples);
+   if (desc->failed || !desc_check_unused(desc)) {
+      if (pass)
+         vk->DestroyRenderPass(vk->device, pass, NULL);
+      return false;
+   }
+
+   struct v3d_compile_entry *colors = desc_find(desc, NULL, "color_formats");
+   unsigned num_colors = colors ? colors->num_values : 0;
+   VkPipelineColorBlendAttachmentState *blend_attachments =
+      rzalloc_array(desc, VkPipelineColorBlendAttachmentState, num_colors);
+   for (unsigned i = 0; i < num_colors; i++)
+      blend_attachments[i].colorWriteMask = 0xf;
+
+   const VkPipelineVertexInputStateCreateInfo vi_state = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+      .vertexBindingDescriptionCount = num_attributes,
+      .pVertexBindingDescriptions = vb_bindings,
+      .vertexAttributeDescriptionCount = num_attributes,
+      .pVertexAttributeDescriptions = attributes,
+   };
+   const VkPipelineInputAssemblyStateCreateInfo ia_state = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+      .topology = topology,
+   };
+   const VkPipelineViewportStateCreateInfo vp_state = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+      .viewportCount = 1,
+      .scissorCount = 1,
+   };
+   const VkPipelineRasterizationStateCreateInfo rs_state = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+      .rasterizerDiscardEnable = rasterizer_discard,
+      .polygonMode = VK_POLYGON_MODE_FILL,
+      .cullMode = VK_CULL_MODE_NONE,
+      .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+      .lineWidth = 1.0f,
+   };
+   const VkPipelineMultisampleStateCreateInfo ms_state = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+      .rasterizationSamples = samples,
+      .alphaToCoverageEnable = alpha_to_coverage,
+      .alphaToOneEnable = alpha_to_one,
+   };
+   const VkPipelineDepthStencilStateCreateInfo ds_state = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+   };
+   const VkPipelineColorBlendStateCreateInfo cb_state = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+      .logicOpEnable = logic_op_name != NULL,
+      .logicOp = logic_op,
+      .attachmentCount = num_colors,
+      .pAttachments = blend_attachments,
+   };
+   const VkDynamicState dynamic_states[] = {
+      VK_DYNAMIC_STATE_VIEWPORT,
+      VK_DYNAMIC_STATE_SCISSOR,
+   };
+   const VkPipelineDynamicStateCreateInfo dyn_state = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+      .dynamicStateCount = ARRAY_SIZE(dynamic_states),
+      .pDynamicStates = dynamic_states,
+   };
+
+   const VkGraphicsPipelineCreateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+      .pNext = feedback_info,
+      .stageCount = num_stages,
+      .pStages = stage_info,
+      .pVertexInputState = &vi_state,
+      .pInputAssemblyState = &ia_state,
+      .pViewportState = &vp_state,
+      .pRasterizationState = &rs_state,
+      .pMultisampleState = &ms_state,
+      .pDepthStencilState = &ds_state,
+      .pColorBlendState = &cb_state,
+      .pDynamicState = &dyn_state,
+      .layout = layout,
+      .renderPass = pass,
+   };
+
+   VkPipeline pipeline;
+   VkResult result = vk->CreateGraphicsPipelines(vk->device, vk->cache, 1,
+                                                 &info, NULL, &pipeline);
+   if (result == VK_SUCCESS)
+      vk->DestroyPipeline(vk->device, pipeline, NULL);
+   vk->DestroyRenderPass(vk->device, pass, NULL);
+
+   return result == VK_SUCCESS;
+}
+
+static bool
+vk_compile(struct v3d_compile_vk *vk, struct v3d_compile_desc *desc)
+{
+   VkPipelineShaderStageCreateInfo stage_info[ARRAY_SIZE(stages)];
+   VkShaderModule modules[ARRAY_SIZE(stages)];
+   VkShaderStageFlags pipeline_stages = 0;
+   unsigned num_stages = 0;
+   bool ok = false;
+
+   const char *entry_point = desc_string(desc, NULL, "entry");
+   if (!entry_point)
+      entry_point = "main";
+
+   for (unsigned s = 0; s < ARRAY_SIZE(stages); s++) {
+      if (!desc->shaders[s])
+         continue;
+
+      size_t size;
+      char *spirv = read_shader(desc, s, &size);
+      if (!spirv)
+         goto fail;
+
+      const VkShaderModuleCreateInfo module_info = {
+         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+         .codeSize = size,
+         .pCode = (const uint32_t *)spirv,
+      };
+      bool valid = size % 4 == 0 &&
+         vk->CreateShaderModule(vk->device, &module_info, NULL,
+                                &modules[num_stages]) == VK_SUCCESS;
+      free(spirv);
+      if (!valid) {
+         fprintf(stderr, "%s: %s isn't valid SPIR-V\n", desc->path,
+                 desc->shaders[s]);
+         goto fail;
+      }
+
+      stage_info[num_stages] = (VkPipelineShaderStageCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+         .stage = stages[s].vk_stage,
+         .module = modules[num_stages],
+         .pName = entry_point,
+      };
+      num_stages++;
+      pipeline_stages |= stages[s].vk_stage;
+   }
+
+   VkDescriptorSetLayout set_layouts[16] = { 0 };
+   unsigned num_sets = vk_create_set_layouts(vk, desc, pipeline_stages,
+                                             set_layouts,
+                                             ARRAY_SIZE(set_layouts));
+
+   const VkPushConstantRange push_constants = {
+      .stageFlags = pipeline_stages,
+      .size = desc_uint(desc, NULL, "push_constants", 0),
+   };
+   VkPipelineLayout layout = VK_NULL_HANDLE;
+   if (!desc->failed) {
+      const VkPipelineLayoutCreateInfo layout_info = {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+         .setLayoutCount = num_sets,
+         .pSetLayouts = set_layouts,
+         .pushConstantRangeCount = push_constants.size ? 1 : 0,
+         .pPushConstantRanges = &push_constants,
+      };
+      if (vk->CreatePipelineLayout(vk->device, &layout_info, NULL,
+                                   &layout) != VK_SUCCESS) {
+         fprintf(stderr, "%s: failed to create the pipeline layout\n",
+                 desc->path);
+         desc->failed = true;
+      }
+   }
+
+   /* Tells us whether the pipeline came from the input cache. */
+   VkPipelineCreationFeedback feedback = { 0 };
+   const VkPipelineCreationFeedbackCreateInfo feedback_info = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO,
+      .pPipelineCreationFeedback = &feedback,
+   };
+
+   if (desc->failed) {
+      /* Already reported. */
+   } else if (pipeline_stages == VK_SHADER_STAGE_COMPUTE_BIT) {
+      if (desc_check_unused(desc)) {
+         const VkComputePipelineCreateInfo info = {
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .pNext = &feedback_info,
+            .stage = stage_info[0],
+            .layout = layout,
+         };
+         VkPipeline pipeline;
+         ok = vk->CreateComputePipelines(vk->device, vk->cache, 1, &info,
+                                         NULL, &pipeline) == VK_SUCCESS;
+         if (ok)
+            vk->DestroyPipeline(vk->device, pipeline, NULL);
+      }
+   } else {
+      ok = vk_create_graphics_pipeline(vk, desc, stage_info, num_stages,
+                                       layout, &feedback_info);
+   }
+   if (!ok && !desc->failed)
+      fprintf(stderr, "%s: failed to compile the pipeline\n", desc->path);
+   desc->cache_hit = ok && (feedback.flags &
+      VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT);
+
+   if (layout)
+      vk->DestroyPipelineLayout(vk->device, layout, NULL);
+   for (unsigned i = 0; i < num_sets; i++) {
+      if (set_layouts[i])
+         vk->DestroyDescriptorSetLayout(vk->device, set_layouts[i], NULL);
+   }
+fail:
+   for (unsigned i = 0; i < num_stages; i++)
+      vk->DestroyShaderModule(vk->device, modules[i], NULL);
+
+   return ok;
+}
+
+#define V3D_COMPILE_GL_FUNCS(F)                                         \
+   F(PFNGLCREATESHADERPROC, CreateShader)                               \
+   F(PFNGLSHADERSOURCEPROC, ShaderSource)                               \
+   F(PFNGLCOMPILESHADERPROC, CompileShader)                             \
+   F(PFNGLGETSHADERIVPROC, GetShaderiv)                                 \
+   F(PFNGLGETSHADERINFOLOGPROC, GetShaderInfoLog)                       \
+   F(PFNGLDELETESHADERPROC, DeleteShader)                               \
+   F(PFNGLCREATEPROGRAMPROC, CreateProgram)                             \
+   F(PFNGLATTACHSHADERPROC, AttachShader)                               \
+   F(PFNGLLINKPROGRAMPROC, LinkProgram)                                 \
+   F(PFNGLGETPROGRAMIVPROC, GetProgramiv)                               \
+   F(PFNGLGETPROGRAMINFOLOGPROC, GetProgramInfoLog)                     \
+   F(PFNGLDELETEPROGRAMPROC, DeleteProgram)
+
+struct v3d_compile_gl {
+   void *libegl;
+   EGLDisplay display;
+   /* GLES and desktop GL, created when a program first needs them. */
+   EGLContext contexts[2];
+
+   PFNEGLGETPROCADDRESSPROC GetProcAddress;
+   PFNEGLTERMINATEPROC Terminate;
+   PFNEGLBINDAPIPROC BindAPI;
+   PFNEGLCREATECONTEXTPROC CreateContext;
+   PFNEGLDESTROYCONTEXTPROC DestroyContext;
+   PFNEGLMAKECURRENTPROC MakeCurrent;
+   PFNEGLRELEASETHREADPROC ReleaseThread;
+
+#define DECLARE_GL_FUNC(type, name) type name;
+   V3D_COMPILE_GL_FUNCS(DECLARE_GL_FUNC)
+#undef DECLARE_GL_FUNC
+};
+
+static bool
+gl_init(struct v3d_compile_gl *gl)
+{
+   gl->libegl = dlopen("libEGL.so.1", RTLD_NOW | RTLD_LOCAL);
+   if (!gl->libegl) {
+      fprintf(stderr, "Failed to load libEGL.so.1: %s\n", dlerror());
+      return false;
+   }
+
+   gl->GetProcAddress = (PFNEGLGETPROCADDRESSPROC)
+      dlsym(gl->libegl, "eglGetProcAddress");
+   if (!gl->GetProcAddress)
+      return false;
+
+#define LOAD_EGL_FUNC(type, name) type name = (type) gl->GetProcAddress(#name)
+   LOAD_EGL_FUNC(PFNEGLGETPLATFORMDISPLAYEXTPROC, eglGetPlatformDisplayEXT);
+   LOAD_EGL_FUNC(PFNEGLINITIALIZEPROC, eglInitialize);
+   gl->Terminate = (PFNEGLTERMINATEPROC)
+      gl->GetProcAddress("eglTerminate");
+   gl->BindAPI = (PFNEGLBINDAPIPROC) gl->GetProcAddress("eglBindAPI");
+   gl->CreateContext = (PFNEGLCREATECONTEXTPROC)
+      gl->GetProcAddress("eglCreateContext");
+   gl->DestroyContext = (PFNEGLDESTROYCONTEXTPROC)
+      gl->GetProcAddress("eglDestroyContext");
+   gl->MakeCurrent = (PFNEGLMAKECURRENTPROC)
+      gl->GetProcAddress("eglMakeCurrent");
+   gl->ReleaseThread = (PFNEGLRELEASETHREADPROC)
+      gl->GetProcAddress("eglReleaseThread");
+#undef LOAD_EGL_FUNC
+
+   if (!eglGetPlatformDisplayEXT || !eglInitialize) {
+      fprintf(stderr, "libEGL.so.1 lacks EGL_EXT_platform_base\n");
+      return false;
+   }
+
+   gl->display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA,
+                                          EGL_DEFAULT_DISPLAY, NULL);
+   if (gl->display == EGL_NO_DISPLAY ||
+       !eglInitialize(gl->display, NULL, NULL)) {
+      fprintf(stderr, "Failed to initialize a surfaceless EGL display\n");
+      return false;
+   }
+
+#define LOAD_GL_FUNC(type, name)                                        \
+   gl->name = (type) gl->GetProcAddress("gl" #name);
+   V3D_COMPILE_GL_FUNCS(LOAD_GL_FUNC)
+#undef LOAD_GL_FUNC
+
+   return true;
+}
+
+static void
+gl_finish(struct v3d_compile_gl *gl)
+{
+   if (gl->display) {
+      gl->MakeCurrent(gl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                      EGL_NO_CONTEXT);
+      for (unsigned i = 0; i < ARRAY_SIZE(gl->contexts); i++) {
+         if (gl->contexts[i])
+            gl->DestroyContext(gl->display, gl->contexts[i]);
+      }
+      /* This is what flushes the entries queued for the disk cache. */
+      gl->Terminate(gl->display);
+      gl->ReleaseThread();
+   }
+   if (gl->libegl)
+      dlclose(gl->libegl);
+}
+
+/* GLSL ES is "#version 100" or "#version 3x0 es", no #version is 1.10. */
+static bool
+glsl_is_es(const char *source)
+{
+   const char *version = strstr(source, "#version");
+   if (!version)
+      return false;
+
+   const char *end = strchr(version, '\n');
+   unsigned number = strtoul(version + strlen("#version"), NULL, 10);
+   const char *es = strstr(version, " es");
+   return number == 100 || (es && (!end || es < end));
+}
+
+static bool
+gl_make_current(struct v3d_compile_gl *gl, bool es)
+{
+   EGLContext *context = &gl->contexts[es ? 0 : 1];
+   if (!*context) {
+      const EGLint attribs[] = {
+         EGL_CONTEXT_MAJOR_VERSION, 3,
+         EGL_CONTEXT_MINOR_VERSION, 1,
+         EGL_NONE,
+      };
+      gl->BindAPI(es ? EGL_OPENGL_ES_API : EGL_OPENGL_API);
+      *context = gl->CreateContext(gl->display, EGL_NO_CONFIG_KHR,
+                                   EGL_NO_CONTEXT, attribs);
+      if (!*context) {
+         fprintf(stderr, "Failed to create an %s 3.1 context\n",
+                 es ? "OpenGL ES" : "OpenGL");
+         return false;
+      }
+   }
+
+   return gl->MakeCurrent(gl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                          *context);
+}
+
+static bool
+gl_compile(struct v3d_compile_gl *gl, struct v3d_compile_desc *desc)
+{
+   char *sources[ARRAY_SIZE(stages)] = { NULL };
+   GLuint shaders[ARRAY_SIZE(stages)] = { 0 };
+   GLuint program = 0;
+   bool ok = false;
+   char log[4096];
+
+   if (!desc_check_unused(desc))
+      return false;
+
+   for (unsigned s = 0; s < ARRAY_SIZE(stages); s++) {
+      if (!desc->shaders[s])
+         continue;
+      size_t size;
+      sources[s] = read_shader(desc, s, &size);
+      if (!sources[s])
+         goto done;
+   }
+
+   bool es = true;
+   for (unsigned s = 0; s < ARRAY_SIZE(stages); s++) {
+      if (sources[s]) {
+         es = glsl_is_es(sources[s]);
+         break;
+      }
+   }
+   if (!gl_make_current(gl, es))
+      goto done;
+
+   program = gl->CreateProgram();
+   for (unsigned s = 0; s < ARRAY_SIZE(stages); s++) {
+      if (!sources[s])
+         continue;
+
+      GLint status;
+      shaders[s] = gl->CreateShader(stages[s].gl_type);
+      gl->ShaderSource(shaders[s], 1, (const GLchar **)&sources[s], NULL);
+      gl->CompileShader(shaders[s]);
+      gl->GetShaderiv(shaders[s], GL_COMPILE_STATUS, &status);
+      if (!status) {
+         gl->GetShaderInfoLog(shaders[s], sizeof(log), NULL, log);
+         fprintf(stderr, "%s: failed to compile %s:\n%s\n", desc->path,
+                 desc->shaders[s], log);
+         goto done;
+      }
+      gl->AttachShader(program, shaders[s]);
+   }
+
+   GLint status;
+   gl->LinkProgram(program);
+   gl->GetProgramiv(program, GL_LINK_STATUS, &status);
+   if (!status) {
+      gl->GetProgramInfoLog(program, sizeof(log), NULL, log);
+      fprintf(stderr, "%s: failed to link:\n%s\n", desc->path, log);
+      goto done;
+   }
+   ok = true;
+
+done:
+   for (unsigned s = 0; s < ARRAY_SIZE(stages); s++) {
+      if (shaders[s])
+         gl->DeleteShader(shaders[s]);
+      free(sources[s]);
+   }
+   if (program)
+      gl->DeleteProgram(program);
+
+   return ok;
+}
+
+/**
+ * Re-executes the tool with the v3d drm-shim preloaded, so that both drivers
+ * find a V3D 4.2 device whatever the host has.
+ */
+static void
+exec_with_shim(char **argv)
+{
+   const char *shim = getenv("V3D_COMPILE_DRM_SHIM");
+   if (!shim)
+      shim = V3D_NOOP_DRM_SHIM;
+   if (access(shim, R_OK) != 0) {
+      fprintf(stderr, "Can't find the v3d drm-shim at %s, set "
+              "V3D_COMPILE_DRM_SHIM to its path\n", shim);
+      exit(1);
+   }
+
+   const char *preload = getenv("LD_PRELOAD");
+   if (preload && *preload) {
+      char *shim_preload = ralloc_asprintf(NULL, "%s:%s", shim, preload);
+      setenv("LD_PRELOAD", shim_preload, 1);
+      ralloc_free(shim_preload);
+   } else {
+      setenv("LD_PRELOAD", shim, 1);
+   }
+   setenv("MESA_LOADER_DRIVER_OVERRIDE", "v3d", 1);
+   setenv(V3D_COMPILE_SHIMMED_ENV, "1", 1);
+   execv("/proc/self/exe", argv);
+
+   fprintf(stderr, "Failed to re-execute with %s preloaded: %s\n", shim,
+           strerror(errno));
+   exit(1);
+}
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr,
+           "Usage: %s [options] <pipeline description>...\n"
+           "\n"
+           "Compiles pipelines for V3D 4.2 (Raspberry Pi 4) on any host.\n"
+           "\n"
+           "  -i, --input <file>         start from a VkPipelineCache blob\n"
+           "                             written by an earlier run, only\n"
+           "                             compiling what it doesn't have\n"
+           "  -o, --output <file>        write a VkPipelineCache blob of the\n"
+           "                             SPIR-V pipelines\n"
+           "  -d, --disk-cache <dir>     add the compiled shaders to the Mesa\n"
+           "                             shader cache at <dir>, as\n"
+           "                             MESA_SHADER_CACHE_DIR would\n"
+           "      --robust-buffer-access compile as for a device with\n"
+           "                             robustBufferAccess enabled\n"
+           "      --robust-image-access  compile as for a device with\n"
+           "                             robustImageAccess enabled\n"
+           "  -v, --verbose              print each pipeline compiled, or\n"
+           "                             found in the input cache\n"
+           "  -h, --help                 show this message\n",
+           argv0);
+}
+
+enum {
+   OPT_ROBUST_BUFFER_ACCESS = 256,
+   OPT_ROBUST_IMAGE_ACCESS,
+};
+
+int
+main(int argc, char **argv)
+{
+   static const struct option long_options[] = {
+      { "input", required_argument, NULL, 'i' },
+      { "output", required_argument, NULL, 'o' },
+      { "disk-cache", required_argument, NULL, 'd' },
+      { "robust-buffer-access", no_argument, NULL,
+        OPT_ROBUST_BUFFER_ACCESS },
+      { "robust-image-access", no_argument, NULL, OPT_ROBUST_IMAGE_ACCESS },
+      { "verbose", no_argument, NULL, 'v' },
+      { "help", no_argument, NULL, 'h' },
+      { NULL, 0, NULL, 0 },
+   };
+   struct v3d_compile_options options = { 0 };
+   int c;
+
+   if (!getenv(V3D_COMPILE_SHIMMED_ENV))
+      exec_with_shim(argv);
+
+   while ((c = getopt_long(argc, argv, "i:o:d:vh", long_options,
+                           NULL)) != -1) {
+      switch (c) {
+      case 'i':
+         options.input = optarg;
+         break;
+      case 'o':
+         options.output = optarg;
+         break;
+      case 'd':
+         options.disk_cache = optarg;
+         break;
+      case OPT_ROBUST_BUFFER_ACCESS:
+         options.robust_buffer_access = true;
+         break;
+      case OPT_ROBUST_IMAGE_ACCESS:
+         options.robust_image_access = true;
+         break;
+      case 'v':
+         options.verbose = true;
+         break;
+      case 'h':
+         usage(argv[0]);
+         return 0;
+      default:
+         usage(argv[0]);
+         return 1;
+      }
+   }
+   if (optind == argc || (!options.output && !options.disk_cache)) {
+      usage(argv[0]);
+      return 1;
+   }
+
+   /* The disk cache is only written when asked for, so that we neither
+    * fill the user's cache nor pick stale entries from it.
+    */
+   if (options.disk_cache) {
+      setenv("MESA_SHADER_CACHE_DIR", options.disk_cache, 1);
+      unsetenv("MESA_SHADER_CACHE_DISABLE");
+   } else {
+      setenv("MESA_SHADER_CACHE_DISABLE", "true", 1);
+   }
+   /* Have the gallium driver compile its default variants when the program
+    * is linked, not at the first draw.
+    */
+   const char *debug = getenv("V3D_DEBUG");
+   if (debug && *debug) {
+      char *precompile_debug = ralloc_asprintf(NULL, "%s,precompile", debug);
+      setenv("V3D_DEBUG", precompile_debug, 1);
+      ralloc_free(precompile_debug);
+   } else {
+      setenv("V3D_DEBUG", "precompile", 1);
+   }
+
+   void *mem_ctx = ralloc_context(NULL);
+   struct v3d_compile_vk vk = { 0 };
+   struct v3d_compile_gl gl = { 0 };
+   bool vk_ready = false, gl_ready = false;
+   unsigned num_spirv = 0, num_failed = 0;
+   int ret = 0;
+
+   for (int i = optind; i < argc; i++) {
+      struct v3d_compile_desc *desc = load_desc(mem_ctx, argv[i]);
+      if (!desc) {
+         num_failed++;
+         continue;
+      }
+
+      bool ok;
+      if (desc->spirv) {
+         if (!vk_ready && !(vk_ready = vk_init(&vk, &options))) {
+            ret = 1;
+            goto out;
+         }
+         ok = vk_compile(&vk, desc);
+         num_spirv += ok;
+      } else {
+         if (!options.disk_cache) {
+            fprintf(stderr, "%s: GLSL programs can only go to the disk "
+                    "cache (-d)\n", desc->path);
+            num_failed++;
+            continue;
+         }
+         if (!gl_ready && !(gl_ready = gl_init(&gl))) {
+            ret = 1;
+            goto out;
+         }
+         ok = gl_compile(&gl, desc);
+      }
+
+      if (!ok)
+         num_failed++;
+      else if (options.verbose)
+         printf("%s: %s\n", desc->path,
+                desc->cache_hit ? "already in the cache" : "compiled");
+      ralloc_free(desc);
+   }
+
+   if (options.output && vk_ready && !vk_write_cache(&vk, options.output))
+      ret = 1;
+   if (options.output && !num_spirv)
+      fprintf(stderr, "Warning: no SPIR-V pipelines for %s\n",
+              options.output);
+   if (num_failed) {
+      fprintf(stderr, "%u of %d pipelines failed\n", num_failed,
+              argc - optind);
+      ret = 1;
+   }
+
+out:
+   if (vk_ready || vk.instance)
+      vk_finish(&vk);
+   if (gl_ready || gl.libegl)
+      gl_finish(&gl);
+   ralloc_free(mem_ctx);
+
+   return ret;
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright © 2024 Raspberry Pi Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/** @file pipeline_cache_bench.c
+ *
+ * Stress benchmark for the lookups of the pipeline cache.  A number of
+ * threads search a cache of SHA-1 keyed entries, as the workers of an engine
+ * creating its pipelines at load time would, while one more thread keeps
+ * adding new entries.  For each thread count it reports the lookup
+ * throughput of the lock-free v3dv_sha1_table and, for comparison, of a
+ * _mesa_hash_table behind a mutex, which is what the cache used before.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c11/threads.h"
+#include "util/hash_table.h"
+#include "util/os_time.h"
+#include "util/ralloc.h"
+#include "util/u_atomic.h"
+#include "util/u_math.h"
+#include "broadcom/vulkan/v3dv_sha1_table.h"
+
+#define MAX_THREADS 64
+
+struct entry {
+   unsigned char sha1_key[20];
+   uint32_t value;
+};
+
+struct bench {
+   bool locked;
+   struct v3dv_sha1_table *table;
+   struct hash_table *ht;
+   mtx_t mutex;
+
+   struct entry *entries;
+   uint32_t preloaded;
+   uint32_t total;
+   uint32_t lookups;
+
+   /* Tells the writer to stop once the readers are done */
+   bool done;
+};
+
+struct reader {
+   struct bench *bench;
+   uint32_t seed;
+};
+
+static uint32_t
+sha1_hash_func(const void *sha1)
+{
+   return _mesa_hash_data(sha1, 20);
+}
+
+static bool
+sha1_compare_func(const void *sha1_a, const void *sha1_b)
+{
+   return memcmp(sha1_a, sha1_b, 20) == 0;
+}
+
+static void
+fill_key(unsigned char sha1_key[20], uint32_t seed)
+{
+   /* xorshift is enough to spread the keys as a SHA-1 would */
+   for (unsigned i = 0; i < 20; i += 4) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      memcpy(&sha1_key[i], &seed, 4);
+   }
+}
+
+static const struct entry *
+bench_search(struct bench *bench, const unsigned char sha1_key[20])
+{
+   if (!bench->locked)
+      return v3dv_sha1_table_search(bench->table, sha1_key);
+
+   mtx_lock(&bench->mutex);
+   struct hash_entry *entry = _mesa_hash_table_search(bench->ht, sha1_key);
+   mtx_unlock(&bench->mutex);
+
+   return entry ? entry->data : NULL;
+}
+
+static void
+bench_insert(struct bench *bench, struct entry *entry)
+{
+   mtx_lock(&bench->mutex);
+   if (bench->locked)
+      _mesa_hash_table_insert(bench->ht, entry->sha1_key, entry);
+   else
+      v3dv_sha1_table_insert(bench->table, entry);
+   mtx_unlock(&bench->mutex);
+}
+
+static int
+reader_thread(void *data)
+{
+   struct reader *reader = data;
+   struct bench *bench = reader->bench;
+   uint32_t seed = reader->seed;
+
+   /* Three out of four lookups are for entries that were there from the
+    * start, the rest look for the entries being added, some of which are
+    * not there yet.
+    */
+   for (uint32_t i = 0; i < bench->lookups; i++) {
+      seed = seed * 1103515245 + 12345;
+      uint32_t r = seed >> 8;
+      uint32_t idx = (r & 3) ? r % bench->preloaded :
+                               bench->preloaded +
+                               r % (bench->total - bench->preloaded);
+
+      const struct entry *entry =
+         bench_search(bench, bench->entries[idx].sha1_key);
+      if (entry && entry->value != idx)
+         abort();
+   }
+
+   return 0;
+}
+
+static int
+writer_thread(void *data)
+{
+   struct bench *bench = data;
+
+   for (uint32_t i = bench->preloaded; i < bench->total; i++) {
+      if (p_atomic_read(&bench->done))
+         break;
+      bench_insert(bench, &bench->entries[i]);
+      thrd_yield();
+   }
+
+   return 0;
+}
+
+static double
+run(struct bench *bench, bool locked, unsigned num_threads)
+{
+   bench->locked = locked;
+   bench->done = false;
+   if (locked) {
+      bench->ht = _mesa_hash_table_create(NULL, sha1_hash_func,
+                                          sha1_compare_func);
+   } else {
+      bench->table = v3dv_sha1_table_create(NULL,
+                                            offsetof(struct entry, sha1_key));
+   }
+
+   for (uint32_t i = 0; i < bench->preloaded; i++)
+      bench_insert(bench, &bench->entries[i]);
+
+   struct reader readers[MAX_THREADS];
+   thrd_t threads[MAX_THREADS];
+   thrd_t writer;
+
+   int64_t start = os_time_get_nano();
+
+   thrd_create(&writer, writer_thread, bench);
+   for (unsigned i = 0; i < num_threads; i++) {
+      readers[i] = (struct reader) { .bench = bench, .seed = i + 1 };
+      thrd_create(&threads[i], reader_thread, &readers[i]);
+   }
+
+   for (unsigned i = 0; i < num_threads; i++)
+      thrd_join(threads[i], NULL);
+   int64_t ns = os_time_get_nano() - start;
+
+   p_atomic_set(&bench->done, true);
+   thrd_join(writer, NULL);
+
+   if (locked)
+      _mesa_hash_table_destroy(bench->ht, NULL);
+   else
+      ralloc_free(bench->table);
+
+   /* Millions of lookups per second over all the threads */
+   return (double)bench->lookups * num_threads / ns * 1e3;
+}
+
+static void
+usage(const char *name)
+{
+   fprintf(stderr,
+           "Usage: %s [-t max threads] [-n lookups per thread] "
+           "[-e entries]\n",
+           name);
+   exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned max_threads = 8;
+   struct bench bench = {
+      .lookups = 1000000,
+      .preloaded = 2048,
+   };
+   int opt;
+
+   while ((opt = getopt(argc, argv, "t:n:e:")) != -1) {
+      switch (opt) {
+      case 't':
+         max_threads = atoi(optarg);
+         break;
+      case 'n':
+         bench.lookups = atoi(optarg);
+         break;
+      case 'e':
+         bench.preloaded = atoi(optarg);
+         break;
+      default:
+         usage(argv[0]);
+      }
+   }
+   if (max_threads < 1 || max_threads > MAX_THREADS ||
+       bench.lookups < 1 || bench.preloaded < 1)
+      usage(argv[0]);
+
+   bench.total = bench.preloaded * 2;
+   bench.entries = calloc(bench.total, sizeof(*bench.entries));
+   if (!bench.entries)
+      return 1;
+   for (uint32_t i = 0; i < bench.total; i++) {
+      fill_key(bench.entries[i].sha1_key, i + 1);
+      bench.entries[i].value = i;
+   }
+   mtx_init(&bench.mutex, mtx_plain);
+
+   printf("%u entries, %u more added while searching, "
+          "%u lookups per thread\n\n",
+          bench.preloaded, bench.total - bench.preloaded, bench.lookups);
+   printf("threads   mutex (Mlookups/s)   lock-free (Mlookups/s)\n");
+
+   for (unsigned t = 1; t <= max_threads; t *= 2) {
+      double locked = run(&bench, true, t);
+      double lock_free = run(&bench, false, t);
+      printf("%7u   %18.2f   %22.2f (%.2fx)\n",
+             t, locked, lock_free, lock_free / locked);
+   }
+
+   mtx_destroy(&bench.mutex);
+   free(bench.entries);
+
+   return 0;
+}
@@ -755,7 +755,9 @@ v3dv_physical_device_init_disk_cache(struct v3dv_physical_device *device)
    _mesa_sha1_format(timestamp, device->driver_build_sha1);
 
    assert(device->name);
-   device->disk_cache = disk_cache_create(device->name, timestamp, v3d_mesa_debug);
+   const uint64_t driver_flags = v3d_mesa_debug & ~V3D_DEBUG_CACHE_NEUTRAL;
+   device->disk_cache = disk_cache_create(device->name, timestamp,
+                                          driver_flags);
 #else
    device->disk_cache = NULL;
 #endif
@@ -843,9 +845,9 @@ create_physical_device(struct v3dv_instance *instance,
    if (instance->vk.enabled_extensions.KHR_display ||
        instance->vk.enabled_extensions.EXT_acquire_drm_display) {
 #if !using_v3d_simulator
-      /* Open the primary node on the vc4 display device */
-      assert(drm_primary_device);
-      master_fd = open(primary_path, O_RDWR | O_CLOEXEC);
+      /* Open the primary node on the vc4 display device, if there is one */
+      if (drm_primary_device)
+         master_fd = open(primary_path, O_RDWR | O_CLOEXEC);
 #else
       /* There is only one device with primary and render nodes.
        * Open its primary node.
@@ -1071,9 +1073,14 @@ enumerate_devices(struct vk_instance *vk_instance)
    }
 
 #if !using_v3d_simulator
-   if (v3d_idx != -1 && vc4_idx != -1) {
+   /* Without a display device (a headless board, or the v3d drm-shim used by
+    * the offline compiler) we can still expose the device, we just won't be
+    * able to present from it.
+    */
+   if (v3d_idx != -1) {
       result =
-         create_physical_device(instance, devices[v3d_idx], devices[vc4_idx]);
+         create_physical_device(instance, devices[v3d_idx],
+                                vc4_idx != -1 ? devices[vc4_idx] : NULL);
    }
 #endif
 
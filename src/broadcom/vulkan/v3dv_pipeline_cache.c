@@ -22,6 +22,7 @@
  */
 
 #include "v3dv_private.h"
+#include "v3dv_sha1_table.h"
 #include "vulkan/util/vk_util.h"
 #include "util/blob.h"
 #include "nir/nir_serialize.h"
@@ -33,18 +34,6 @@ static const bool dump_stats_on_destroy = false;
 /* Shared for nir/variants */
 #define V3DV_MAX_PIPELINE_CACHE_ENTRIES 4096
 
-static uint32_t
-sha1_hash_func(const void *sha1)
-{
-   return _mesa_hash_data(sha1, 20);
-}
-
-static bool
-sha1_compare_func(const void *sha1_a, const void *sha1_b)
-{
-   return memcmp(sha1_a, sha1_b, 20) == 0;
-}
-
 struct serialized_nir {
    unsigned char sha1_key[20];
    size_t size;
@@ -91,11 +80,7 @@ v3dv_pipeline_cache_upload_nir(struct v3dv_pipeline *pipeline,
    if (cache->nir_stats.count > V3DV_MAX_PIPELINE_CACHE_ENTRIES)
       return;
 
-   pipeline_cache_lock(cache);
-   struct hash_entry *entry =
-      _mesa_hash_table_search(cache->nir_cache, sha1_key);
-   pipeline_cache_unlock(cache);
-   if (entry)
+   if (v3dv_sha1_table_search(cache->nir_cache, sha1_key))
       return;
 
    struct blob blob;
@@ -112,8 +97,7 @@ v3dv_pipeline_cache_upload_nir(struct v3dv_pipeline *pipeline,
     * lock.  We could unlock for the big memcpy but it's probably not worth
     * the hassle.
     */
-   entry = _mesa_hash_table_search(cache->nir_cache, sha1_key);
-   if (entry) {
+   if (v3dv_sha1_table_search(cache->nir_cache, sha1_key)) {
       blob_finish(&blob);
       pipeline_cache_unlock(cache);
       return;
@@ -127,6 +111,12 @@ v3dv_pipeline_cache_upload_nir(struct v3dv_pipeline *pipeline,
 
    blob_finish(&blob);
 
+   if (!v3dv_sha1_table_insert(cache->nir_cache, snir)) {
+      ralloc_free(snir);
+      pipeline_cache_unlock(cache);
+      return;
+   }
+
    cache->nir_stats.count++;
    if (debug_cache) {
       char sha1buf[41];
@@ -136,8 +126,6 @@ v3dv_pipeline_cache_upload_nir(struct v3dv_pipeline *pipeline,
          cache_dump_stats(cache);
    }
 
-   _mesa_hash_table_insert(cache->nir_cache, snir->sha1_key, snir);
-
    pipeline_cache_unlock(cache);
 }
 
@@ -157,14 +145,8 @@ v3dv_pipeline_cache_search_for_nir(struct v3dv_pipeline *pipeline,
       fprintf(stderr, "pipeline cache %p, search for nir %s\n", cache, sha1buf);
    }
 
-   const struct serialized_nir *snir = NULL;
-
-   pipeline_cache_lock(cache);
-   struct hash_entry *entry =
-      _mesa_hash_table_search(cache->nir_cache, sha1_key);
-   if (entry)
-      snir = entry->data;
-   pipeline_cache_unlock(cache);
+   const struct serialized_nir *snir =
+      v3dv_sha1_table_search(cache->nir_cache, sha1_key);
 
    if (snir) {
       struct blob_reader blob;
@@ -178,7 +160,7 @@ v3dv_pipeline_cache_search_for_nir(struct v3dv_pipeline *pipeline,
       if (blob.overrun) {
          ralloc_free(nir);
       } else {
-         cache->nir_stats.hit++;
+         p_atomic_inc(&cache->nir_stats.hit);
          if (debug_cache) {
             fprintf(stderr, "[v3dv nir cache] hit: %p\n", nir);
             if (dump_stats)
@@ -188,7 +170,7 @@ v3dv_pipeline_cache_search_for_nir(struct v3dv_pipeline *pipeline,
       }
    }
 
-   cache->nir_stats.miss++;
+   p_atomic_inc(&cache->nir_stats.miss);
    if (debug_cache) {
       fprintf(stderr, "[v3dv nir cache] miss\n");
       if (dump_stats)
@@ -208,14 +190,17 @@ v3dv_pipeline_cache_init(struct v3dv_pipeline_cache *cache,
    mtx_init(&cache->mutex, mtx_plain);
 
    if (cache_enabled) {
-      cache->nir_cache = _mesa_hash_table_create(NULL, sha1_hash_func,
-                                                 sha1_compare_func);
+      cache->nir_cache =
+         v3dv_sha1_table_create(NULL, offsetof(struct serialized_nir,
+                                               sha1_key));
       cache->nir_stats.miss = 0;
       cache->nir_stats.hit = 0;
       cache->nir_stats.count = 0;
 
-      cache->cache = _mesa_hash_table_create(NULL, sha1_hash_func,
-                                             sha1_compare_func);
+      cache->cache =
+         v3dv_sha1_table_create(NULL,
+                                offsetof(struct v3dv_pipeline_shared_data,
+                                         sha1_key));
       cache->stats.miss = 0;
       cache->stats.hit = 0;
       cache->stats.count = 0;
@@ -262,17 +247,14 @@ v3dv_pipeline_cache_search_for_pipeline(struct v3dv_pipeline_cache *cache,
       fprintf(stderr, "pipeline cache %p, search pipeline with key %s\n", cache, sha1buf);
    }
 
-   pipeline_cache_lock(cache);
-
-   struct hash_entry *entry =
-      _mesa_hash_table_search(cache->cache, sha1_key);
-
-   if (entry) {
-      struct v3dv_pipeline_shared_data *cache_entry =
-         (struct v3dv_pipeline_shared_data *) entry->data;
-      assert(cache_entry);
+   /* Entries are never removed before the cache is destroyed, so it is safe
+    * to take a reference on them without the lock.
+    */
+   struct v3dv_pipeline_shared_data *cache_entry =
+      v3dv_sha1_table_search(cache->cache, sha1_key);
 
-      cache->stats.hit++;
+   if (cache_entry) {
+      p_atomic_inc(&cache->stats.hit);
       *cache_hit = true;
       if (debug_cache) {
          fprintf(stderr, "[v3dv cache] hit: %p\n", cache_entry);
@@ -283,20 +265,16 @@ v3dv_pipeline_cache_search_for_pipeline(struct v3dv_pipeline_cache *cache,
 
       v3dv_pipeline_shared_data_ref(cache_entry);
 
-      pipeline_cache_unlock(cache);
-
       return cache_entry;
    }
 
-   cache->stats.miss++;
+   p_atomic_inc(&cache->stats.miss);
    if (debug_cache) {
       fprintf(stderr, "[v3dv cache] miss\n");
       if (dump_stats)
          cache_dump_stats(cache);
    }
 
-   pipeline_cache_unlock(cache);
-
 #ifdef ENABLE_SHADER_CACHE
    struct v3dv_device *device = cache->device;
    struct disk_cache *disk_cache = device->pdevice->disk_cache;
@@ -436,21 +414,17 @@ pipeline_cache_upload_shared_data(struct v3dv_pipeline_cache *cache,
       return;
 
    pipeline_cache_lock(cache);
-   struct hash_entry *entry = NULL;
 
-   /* If this is being called from the disk cache, we already know that the
-    * entry is not on the hash table
+   /* Another thread may have added the same entry since the search that
+    * missed, even if that search was on the disk cache.
     */
-   if (!from_disk_cache)
-      entry = _mesa_hash_table_search(cache->cache, shared_data->sha1_key);
-
-   if (entry) {
+   if (v3dv_sha1_table_search(cache->cache, shared_data->sha1_key) ||
+       !v3dv_sha1_table_insert(cache->cache, shared_data)) {
       pipeline_cache_unlock(cache);
       return;
    }
 
    v3dv_pipeline_shared_data_ref(shared_data);
-   _mesa_hash_table_insert(cache->cache, shared_data->sha1_key, shared_data);
    cache->stats.count++;
    if (debug_cache) {
       char sha1buf[41];
@@ -681,7 +655,11 @@ pipeline_cache_load(struct v3dv_pipeline_cache *cache,
       if (!snir)
          break;
 
-      _mesa_hash_table_insert(cache->nir_cache, snir->sha1_key, snir);
+      if (v3dv_sha1_table_search(cache->nir_cache, snir->sha1_key) ||
+          !v3dv_sha1_table_insert(cache->nir_cache, snir)) {
+         ralloc_free(snir);
+         continue;
+      }
       cache->nir_stats.count++;
    }
 
@@ -695,7 +673,11 @@ pipeline_cache_load(struct v3dv_pipeline_cache *cache,
       if (!cache_entry)
          break;
 
-      _mesa_hash_table_insert(cache->cache, cache_entry->sha1_key, cache_entry);
+      if (v3dv_sha1_table_search(cache->cache, cache_entry->sha1_key) ||
+          !v3dv_sha1_table_insert(cache->cache, cache_entry)) {
+         v3dv_pipeline_shared_data_unref(device, cache_entry);
+         continue;
+      }
       cache->stats.count++;
    }
 
@@ -747,21 +729,14 @@ v3dv_pipeline_cache_finish(struct v3dv_pipeline_cache *cache)
    if (dump_stats_on_destroy)
       cache_dump_stats(cache);
 
-   if (cache->nir_cache) {
-      hash_table_foreach(cache->nir_cache, entry)
-         ralloc_free(entry->data);
-
-      _mesa_hash_table_destroy(cache->nir_cache, NULL);
-   }
+   /* The serialized NIR shaders are allocated out of the table */
+   ralloc_free(cache->nir_cache);
 
    if (cache->cache) {
-      hash_table_foreach(cache->cache, entry) {
-         struct v3dv_pipeline_shared_data *cache_entry = entry->data;
-         if (cache_entry)
-            v3dv_pipeline_shared_data_unref(cache->device, cache_entry);
-      }
+      v3dv_sha1_table_foreach(cache->cache, entry)
+         v3dv_pipeline_shared_data_unref(cache->device, entry);
 
-      _mesa_hash_table_destroy(cache->cache, NULL);
+      ralloc_free(cache->cache);
    }
 }
 
@@ -797,11 +772,15 @@ v3dv_MergePipelineCaches(VkDevice device,
       if (!src->cache || !src->nir_cache)
          continue;
 
-      hash_table_foreach(src->nir_cache, entry) {
-         struct serialized_nir *src_snir = entry->data;
-         assert(src_snir);
+      /* Unlike dst, the source caches can be used to create pipelines from
+       * other threads while we merge them.
+       */
+      pipeline_cache_lock(src);
+
+      v3dv_sha1_table_foreach(src->nir_cache, entry) {
+         struct serialized_nir *src_snir = entry;
 
-         if (_mesa_hash_table_search(dst->nir_cache, src_snir->sha1_key))
+         if (v3dv_sha1_table_search(dst->nir_cache, src_snir->sha1_key))
             continue;
 
          /* FIXME: we are using serialized nir shaders because they are
@@ -816,7 +795,10 @@ v3dv_MergePipelineCaches(VkDevice device,
          snir_dst->size = src_snir->size;
          memcpy(snir_dst->data, src_snir->data, src_snir->size);
 
-         _mesa_hash_table_insert(dst->nir_cache, snir_dst->sha1_key, snir_dst);
+         if (!v3dv_sha1_table_insert(dst->nir_cache, snir_dst)) {
+            ralloc_free(snir_dst);
+            continue;
+         }
          dst->nir_stats.count++;
          if (debug_cache) {
             char sha1buf[41];
@@ -830,15 +812,14 @@ v3dv_MergePipelineCaches(VkDevice device,
          }
       }
 
-      hash_table_foreach(src->cache, entry) {
-         struct v3dv_pipeline_shared_data *cache_entry = entry->data;
-         assert(cache_entry);
+      v3dv_sha1_table_foreach(src->cache, entry) {
+         struct v3dv_pipeline_shared_data *cache_entry = entry;
 
-         if (_mesa_hash_table_search(dst->cache, cache_entry->sha1_key))
+         if (v3dv_sha1_table_search(dst->cache, cache_entry->sha1_key) ||
+             !v3dv_sha1_table_insert(dst->cache, cache_entry))
             continue;
 
          v3dv_pipeline_shared_data_ref(cache_entry);
-         _mesa_hash_table_insert(dst->cache, cache_entry->sha1_key, cache_entry);
 
          dst->stats.count++;
          if (debug_cache) {
@@ -852,6 +833,8 @@ v3dv_MergePipelineCaches(VkDevice device,
                cache_dump_stats(dst);
          }
       }
+
+      pipeline_cache_unlock(src);
    }
 
    return VK_SUCCESS;
@@ -864,8 +847,22 @@ shader_variant_write_to_blob(const struct v3dv_shader_variant *variant,
    blob_write_uint32(blob, variant->stage);
 
    blob_write_uint32(blob, variant->prog_data_size);
+   size_t ulist_offset =
+      blob->size + offsetof(struct v3d_prog_data, uniforms);
    blob_write_bytes(blob, variant->prog_data.base, variant->prog_data_size);
 
+   /* The uniform arrays are written below and reallocated on load, so clear
+    * their addresses: the same pipelines then always give the same blob.
+    */
+   const void *null_ptr = NULL;
+   blob_overwrite_bytes(blob,
+                        ulist_offset +
+                        offsetof(struct v3d_uniform_list, contents),
+                        &null_ptr, sizeof(null_ptr));
+   blob_overwrite_bytes(blob,
+                        ulist_offset + offsetof(struct v3d_uniform_list, data),
+                        &null_ptr, sizeof(null_ptr));
+
    struct v3d_uniform_list *ulist = &variant->prog_data.base->uniforms;
    blob_write_uint32(blob, ulist->count);
    blob_write_bytes(blob, ulist->contents, sizeof(enum quniform_contents) * ulist->count);
@@ -984,8 +981,8 @@ v3dv_GetPipelineCacheData(VkDevice _device,
    }
 
    if (cache->nir_cache) {
-      hash_table_foreach(cache->nir_cache, entry) {
-         const struct serialized_nir *snir = entry->data;
+      v3dv_sha1_table_foreach(cache->nir_cache, entry) {
+         const struct serialized_nir *snir = entry;
 
          size_t save_size = blob.size;
 
@@ -1011,8 +1008,8 @@ v3dv_GetPipelineCacheData(VkDevice _device,
    }
 
    if (cache->cache) {
-      hash_table_foreach(cache->cache, entry) {
-         struct v3dv_pipeline_shared_data *cache_entry = entry->data;
+      v3dv_sha1_table_foreach(cache->cache, entry) {
+         struct v3dv_pipeline_shared_data *cache_entry = entry;
 
          size_t save_size = blob.size;
          if (!v3dv_pipeline_shared_data_write_to_blob(cache_entry, &blob)) {
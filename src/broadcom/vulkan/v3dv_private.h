@@ -445,10 +445,13 @@ struct v3dv_pipeline_cache {
    struct v3dv_device *device;
    mtx_t mutex;
 
-   struct hash_table *nir_cache;
+   /* Searches of both tables are lock-free, mutex only serializes the
+    * writers.
+    */
+   struct v3dv_sha1_table *nir_cache;
    struct v3dv_pipeline_cache_stats nir_stats;
 
-   struct hash_table *cache;
+   struct v3dv_sha1_table *cache;
    struct v3dv_pipeline_cache_stats stats;
 
    /* For VK_EXT_pipeline_creation_cache_control. */
@@ -0,0 +1,140 @@
+/*
+ * Copyright © 2024 Raspberry Pi Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "v3dv_sha1_table.h"
+#include "util/ralloc.h"
+#include "util/u_atomic.h"
+
+#define V3DV_SHA1_TABLE_MIN_SIZE 16
+
+static const unsigned char *
+entry_key(const struct v3dv_sha1_table *table, const void *entry)
+{
+   return (const unsigned char *) entry + table->key_offset;
+}
+
+/* The keys are SHA-1s already, so any of their bits is as good a hash as we
+ * could compute.
+ */
+static uint32_t
+key_hash(const unsigned char sha1_key[20])
+{
+   uint32_t hash;
+   memcpy(&hash, sha1_key, sizeof(hash));
+   return hash;
+}
+
+static struct v3dv_sha1_table_slots *
+slots_create(struct v3dv_sha1_table *table, uint32_t size)
+{
+   struct v3dv_sha1_table_slots *slots =
+      rzalloc_size(table, sizeof(*slots) + size * sizeof(slots->entries[0]));
+   if (slots)
+      slots->size = size;
+   return slots;
+}
+
+static void
+slots_add(const struct v3dv_sha1_table *table,
+          struct v3dv_sha1_table_slots *slots,
+          void *entry)
+{
+   uint32_t mask = slots->size - 1;
+   uint32_t i = key_hash(entry_key(table, entry)) & mask;
+   while (slots->entries[i])
+      i = (i + 1) & mask;
+
+   /* Pairs with the p_atomic_read() in v3dv_sha1_table_search(), so that
+    * searches see the entry's contents once they see the entry.
+    */
+   p_atomic_set(&slots->entries[i], entry);
+}
+
+struct v3dv_sha1_table *
+v3dv_sha1_table_create(void *mem_ctx, size_t key_offset)
+{
+   struct v3dv_sha1_table *table = rzalloc(mem_ctx, struct v3dv_sha1_table);
+   if (!table)
+      return NULL;
+
+   table->key_offset = key_offset;
+   table->slots = slots_create(table, V3DV_SHA1_TABLE_MIN_SIZE);
+   if (!table->slots) {
+      ralloc_free(table);
+      return NULL;
+   }
+
+   return table;
+}
+
+void *
+v3dv_sha1_table_search(const struct v3dv_sha1_table *table,
+                       const unsigned char sha1_key[20])
+{
+   const struct v3dv_sha1_table_slots *slots = p_atomic_read(&table->slots);
+   uint32_t mask = slots->size - 1;
+
+   /* The table is never more than half full, so there is always an empty
+    * slot to end the probe.
+    */
+   for (uint32_t i = key_hash(sha1_key) & mask; ; i = (i + 1) & mask) {
+      void *entry = p_atomic_read(&slots->entries[i]);
+      if (!entry)
+         return NULL;
+      if (memcmp(entry_key(table, entry), sha1_key, 20) == 0)
+         return entry;
+   }
+}
+
+bool
+v3dv_sha1_table_insert(struct v3dv_sha1_table *table, void *entry)
+{
+   assert(!v3dv_sha1_table_search(table, entry_key(table, entry)));
+
+   struct v3dv_sha1_table_slots *slots = table->slots;
+   if ((table->count + 1) * 2 > slots->size) {
+      struct v3dv_sha1_table_slots *new_slots =
+         slots_create(table, slots->size * 2);
+      if (!new_slots)
+         return false;
+
+      for (uint32_t i = 0; i < slots->size; i++) {
+         if (slots->entries[i])
+            slots_add(table, new_slots, slots->entries[i]);
+      }
+
+      /* Searches may still be walking the old slots, so we leave them to be
+       * freed with the table.
+       */
+      p_atomic_set(&table->slots, new_slots);
+      slots = new_slots;
+   }
+
+   slots_add(table, slots, entry);
+   table->count++;
+
+   return true;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright © 2024 Raspberry Pi Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef V3DV_SHA1_TABLE_H
+#define V3DV_SHA1_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Insert-only hash table for the entries of the pipeline cache, keyed by the
+ * SHA-1 each entry embeds at key_offset.
+ *
+ * Searches don't take any lock, so that pipelines created from several
+ * threads don't serialize on cache hits. Inserts must be serialized by the
+ * caller. When the table grows, the new slot array is filled in before it is
+ * published, and the old one is kept alive until the table is destroyed, so
+ * a search racing with an insert sees either the old or the new contents.
+ *
+ * The table is a ralloc context, so it can also own the entries.
+ */
+struct v3dv_sha1_table_slots {
+   /* Always a power of two */
+   uint32_t size;
+   void *entries[];
+};
+
+struct v3dv_sha1_table {
+   size_t key_offset;
+   /* Number of entries, only accessed by writers */
+   uint32_t count;
+   struct v3dv_sha1_table_slots *slots;
+};
+
+struct v3dv_sha1_table *
+v3dv_sha1_table_create(void *mem_ctx, size_t key_offset);
+
+void *
+v3dv_sha1_table_search(const struct v3dv_sha1_table *table,
+                       const unsigned char sha1_key[20]);
+
+bool
+v3dv_sha1_table_insert(struct v3dv_sha1_table *table, void *entry);
+
+/* Iterates over the entries. Like inserts, it must not race with them. */
+#define v3dv_sha1_table_foreach(table, entry)                                 \
+   for (struct v3dv_sha1_table_slots *_slots = (table)->slots; _slots;       \
+        _slots = NULL)                                                        \
+      for (uint32_t _i = 0; _i < _slots->size; _i++)                         \
+         for (void *entry = _slots->entries[_i]; entry; entry = NULL)
+
+#endif /* V3DV_SHA1_TABLE_H */
@@ -46,6 +46,11 @@ struct gl_shader_program * standalone_compile_shader(
       unsigned num_files, char* const* files,
       struct gl_context *ctx);
 
+char *standalone_preprocess_shader(
+      const struct standalone_options *options,
+      const char *file, struct gl_context *ctx, void *mem_ctx,
+      char **info_log);
+
 void standalone_compiler_cleanup(struct gl_shader_program *prog);
 
 #ifdef __cplusplus
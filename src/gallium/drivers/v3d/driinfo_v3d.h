@@ -1,5 +1,6 @@
-// v3d-specific driconf options
+// v3d-specific driconf options, also used by vc4
 
 DRI_CONF_SECTION_MISCELLANEOUS
    DRI_CONF_V3D_NONMSAA_TEXTURE_SIZE_LIMIT(false)
+   DRI_CONF_VC4_THREADED_CONTEXT(false)
 DRI_CONF_SECTION_END
@@ -204,6 +204,14 @@ struct v3d_shader_uniform_info {
         uint32_t count;
 };
 
+#ifdef ENABLE_SHADER_CACHE
+struct v3d_disk_cache_prefetch {
+        cache_key cache_key;
+        /** Taken by the first v3d_disk_cache_retrieve() of this key. */
+        struct disk_cache_get_job *job;
+};
+#endif
+
 struct v3d_uncompiled_shader {
         /** A name for this program, so you can track it in shader-db output. */
         uint32_t program_id;
@@ -215,6 +223,14 @@ struct v3d_uncompiled_shader {
         uint16_t tf_specs[16];
         uint16_t tf_specs_psiz[16];
         uint32_t num_tf_specs;
+#ifdef ENABLE_SHADER_CACHE
+        /**
+         * On-disk cache lookups of the variants v3d_shader_precompile()
+         * would compile, started at shader creation.
+         */
+        struct v3d_disk_cache_prefetch prefetches[2];
+        uint32_t num_prefetches;
+#endif
 };
 
 struct v3d_compiled_shader {
@@ -815,6 +831,11 @@ void v3d_get_tile_buffer_size(bool is_msaa,
 bool v3d_render_condition_check(struct v3d_context *v3d);
 
 #ifdef ENABLE_SHADER_CACHE
+void v3d_disk_cache_prefetch(struct v3d_context *v3d,
+                             const struct v3d_key *key);
+
+void v3d_disk_cache_discard_prefetches(struct v3d_uncompiled_shader *uncompiled);
+
 struct v3d_compiled_shader *v3d_disk_cache_retrieve(struct v3d_context *v3d,
                                                     const struct v3d_key *key);
 
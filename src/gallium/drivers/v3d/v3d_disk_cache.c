@@ -29,6 +29,7 @@
 
 #include "compiler/nir/nir_serialize.h"
 #include "util/blob.h"
+#include "util/u_atomic.h"
 #include "util/u_upload_mgr.h"
 
 #ifdef ENABLE_SHADER_CACHE
@@ -70,7 +71,9 @@ void v3d_disk_cache_init(struct v3d_screen *screen)
         char timestamp[41];
         _mesa_sha1_format(timestamp, id_sha1);
 
-        screen->disk_cache = disk_cache_create(renderer, timestamp, v3d_mesa_debug);
+        screen->disk_cache =
+                disk_cache_create(renderer, timestamp,
+                                  v3d_mesa_debug & ~V3D_DEBUG_CACHE_NEUTRAL);
 
         free(renderer);
 }
@@ -104,6 +107,38 @@ v3d_disk_cache_compute_key(struct disk_cache *cache,
         free(ckey);
 }
 
+/**
+ * Starts looking a variant up in the background, so that
+ * v3d_disk_cache_retrieve() doesn't have to wait for the disk if the variant
+ * gets used.
+ */
+void
+v3d_disk_cache_prefetch(struct v3d_context *v3d,
+                        const struct v3d_key *key)
+{
+        struct v3d_screen *screen = v3d->screen;
+        struct disk_cache *cache = screen->disk_cache;
+        struct v3d_uncompiled_shader *uncompiled = key->shader_state;
+
+        if (!cache ||
+            uncompiled->num_prefetches == ARRAY_SIZE(uncompiled->prefetches)) {
+                return;
+        }
+
+        struct v3d_disk_cache_prefetch *prefetch =
+                &uncompiled->prefetches[uncompiled->num_prefetches++];
+        v3d_disk_cache_compute_key(cache, key, prefetch->cache_key);
+        prefetch->job = disk_cache_get_async(cache, prefetch->cache_key);
+}
+
+void
+v3d_disk_cache_discard_prefetches(struct v3d_uncompiled_shader *uncompiled)
+{
+        for (unsigned i = 0; i < uncompiled->num_prefetches; i++)
+                disk_cache_get_job_discard(uncompiled->prefetches[i].job);
+        uncompiled->num_prefetches = 0;
+}
+
 struct v3d_compiled_shader *
 v3d_disk_cache_retrieve(struct v3d_context *v3d,
                         const struct v3d_key *key)
@@ -122,13 +157,40 @@ v3d_disk_cache_retrieve(struct v3d_context *v3d,
         v3d_disk_cache_compute_key(cache, key, cache_key);
 
         size_t buffer_size;
-        void *buffer = disk_cache_get(cache, cache_key, &buffer_size);
+        void *buffer = NULL;
+        bool prefetched = false;
+
+        /* Pick up the lookup started at shader creation if this is one of
+         * its variants.  The shader may be shared between contexts, so the
+         * job goes to whichever of them asks first.
+         */
+        for (unsigned i = 0; i < uncompiled->num_prefetches; i++) {
+                struct v3d_disk_cache_prefetch *prefetch =
+                        &uncompiled->prefetches[i];
+
+                if (memcmp(prefetch->cache_key, cache_key,
+                           sizeof(cache_key)) != 0) {
+                        continue;
+                }
+
+                struct disk_cache_get_job *job =
+                        p_atomic_xchg(&prefetch->job, NULL);
+                if (job) {
+                        buffer = disk_cache_get_job_wait(job, &buffer_size);
+                        prefetched = true;
+                }
+                break;
+        }
+
+        if (!prefetched)
+                buffer = disk_cache_get(cache, cache_key, &buffer_size);
 
         if (V3D_DBG(CACHE)) {
                 char sha1[41];
                 _mesa_sha1_format(sha1, cache_key);
-                fprintf(stderr, "[v3d on-disk cache] %s %s\n",
+                fprintf(stderr, "[v3d on-disk cache] %s%s %s\n",
                         buffer ? "hit" : "miss",
+                        prefetched ? " (prefetched)" : "",
                         sha1);
         }
 
@@ -196,14 +196,31 @@ precompile_all_outputs(nir_shader *s,
         }
 }
 
+static void
+v3d_precompile_variant(struct v3d_context *v3d, struct v3d_key *key,
+                       size_t key_size, bool prefetch)
+{
+#ifdef ENABLE_SHADER_CACHE
+        if (prefetch) {
+                v3d_disk_cache_prefetch(v3d, key);
+                return;
+        }
+#endif
+        v3d_get_compiled_shader(v3d, key, key_size);
+}
+
 /**
  * Precompiles a shader variant at shader state creation time if
  * V3D_DEBUG=precompile is set.  Used for shader-db
  * (https://gitlab.freedesktop.org/mesa/shader-db)
+ *
+ * With \p prefetch, the variants are only looked up in the on-disk cache in
+ * the background, so that the lookup is done by the time they get used.
  */
 static void
 v3d_shader_precompile(struct v3d_context *v3d,
-                      struct v3d_uncompiled_shader *so)
+                      struct v3d_uncompiled_shader *so,
+                      bool prefetch)
 {
         nir_shader *s = so->base.ir.nir;
 
@@ -224,7 +241,8 @@ v3d_shader_precompile(struct v3d_context *v3d,
                 key.logicop_func = PIPE_LOGICOP_COPY;
 
                 v3d_setup_shared_precompile_key(so, &key.base);
-                v3d_get_compiled_shader(v3d, &key.base, sizeof(key));
+                v3d_precompile_variant(v3d, &key.base, sizeof(key),
+                                       prefetch);
         } else if (s->info.stage == MESA_SHADER_GEOMETRY) {
                 struct v3d_gs_key key = {
                         .base.shader_state = so,
@@ -237,7 +255,8 @@ v3d_shader_precompile(struct v3d_context *v3d,
                                        key.used_outputs,
                                        &key.num_used_outputs);
 
-                v3d_get_compiled_shader(v3d, &key.base, sizeof(key));
+                v3d_precompile_variant(v3d, &key.base, sizeof(key),
+                                       prefetch);
 
                 /* Compile GS bin shader: only position (XXX: include TF) */
                 key.is_coord = true;
@@ -247,7 +266,15 @@ v3d_shader_precompile(struct v3d_context *v3d,
                                 v3d_slot_from_slot_and_component(VARYING_SLOT_POS,
                                                                  i);
                 }
-                v3d_get_compiled_shader(v3d, &key.base, sizeof(key));
+                v3d_precompile_variant(v3d, &key.base, sizeof(key),
+                                       prefetch);
+        } else if (s->info.stage == MESA_SHADER_COMPUTE) {
+                struct v3d_key key = {
+                        .shader_state = so,
+                };
+
+                v3d_setup_shared_precompile_key(so, &key);
+                v3d_precompile_variant(v3d, &key, sizeof(key), prefetch);
         } else {
                 assert(s->info.stage == MESA_SHADER_VERTEX);
                 struct v3d_vs_key key = {
@@ -262,7 +289,8 @@ v3d_shader_precompile(struct v3d_context *v3d,
                                        key.used_outputs,
                                        &key.num_used_outputs);
 
-                v3d_get_compiled_shader(v3d, &key.base, sizeof(key));
+                v3d_precompile_variant(v3d, &key.base, sizeof(key),
+                                       prefetch);
 
                 /* Compile VS bin shader: only position (XXX: include TF) */
                 key.is_coord = true;
@@ -272,7 +300,8 @@ v3d_shader_precompile(struct v3d_context *v3d,
                                 v3d_slot_from_slot_and_component(VARYING_SLOT_POS,
                                                                  i);
                 }
-                v3d_get_compiled_shader(v3d, &key.base, sizeof(key));
+                v3d_precompile_variant(v3d, &key.base, sizeof(key),
+                                       prefetch);
         }
 }
 
@@ -344,7 +373,11 @@ v3d_uncompiled_shader_create(struct pipe_context *pctx,
         }
 
         if (V3D_DBG(PRECOMPILE))
-                v3d_shader_precompile(v3d, so);
+                v3d_shader_precompile(v3d, so, false);
+#ifdef ENABLE_SHADER_CACHE
+        else if (v3d->screen->disk_cache)
+                v3d_shader_precompile(v3d, so, true);
+#endif
 
         return so;
 }
@@ -937,6 +970,10 @@ v3d_shader_state_delete(struct pipe_context *pctx, void *hwcso)
                 v3d_free_compiled_shader(shader);
         }
 
+#ifdef ENABLE_SHADER_CACHE
+        v3d_disk_cache_discard_prefetches(so);
+#endif
+
         ralloc_free(so->base.ir.nir);
         free(so);
 }
@@ -0,0 +1,247 @@
+/*
+ * Copyright © 2017 Broadcom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/** @file mip_upload_bench.c
+ *
+ * Benchmark for uploading whole mip chains of texture atlases to tiled vc4
+ * textures.  It compares doing a transfer per level (a malloced staging map
+ * that the data is written into, tiled into the BO at unmap) against storing
+ * the chain straight into the BO with vc4_store_tiled_levels(), as
+ * texture_subdata and CPU mipmap generation do.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/os_time.h"
+#include "util/u_math.h"
+#include "util/u_box.h"
+#include "vc4_tiling.h"
+#include "kernel/vc4_packet.h"
+
+#define MAX_LEVELS 12
+
+struct chain {
+        int cpp;
+        unsigned num_levels;
+        struct vc4_tiled_level levels[MAX_LEVELS];
+        size_t bo_size;
+        size_t linear_size;
+};
+
+/**
+ * Lays out a full mip chain for a tiled \p width x \p height texture the way
+ * vc4_setup_slices() does, with the linear source data for each level packed
+ * into one allocation at \p src.
+ */
+static void
+setup_chain(struct chain *chain, uint32_t width, uint32_t height, int cpp,
+            const uint8_t *src)
+{
+        uint32_t utile_w = vc4_utile_width(cpp);
+        uint32_t utile_h = vc4_utile_height(cpp);
+        uint32_t offset = 0;
+
+        chain->cpp = cpp;
+        chain->num_levels = util_logbase2(MAX2(width, height)) + 1;
+        assert(chain->num_levels <= MAX_LEVELS);
+
+        for (int i = chain->num_levels - 1; i >= 0; i--) {
+                struct vc4_tiled_level *level = &chain->levels[i];
+                uint32_t level_width = u_minify(width, i);
+                uint32_t level_height = u_minify(height, i);
+
+                if (vc4_size_is_lt(level_width, level_height, cpp)) {
+                        level->tiling = VC4_TILING_FORMAT_LT;
+                        level_width = align(level_width, utile_w);
+                        level_height = align(level_height, utile_h);
+                } else {
+                        level->tiling = VC4_TILING_FORMAT_T;
+                        level_width = align(level_width, 4 * 2 * utile_w);
+                        level_height = align(level_height, 4 * 2 * utile_h);
+                }
+
+                level->offset = offset;
+                level->stride = level_width * cpp;
+                offset += level_height * level->stride;
+        }
+        chain->bo_size = offset;
+
+        size_t linear_offset = 0;
+        for (int i = 0; i < chain->num_levels; i++) {
+                struct vc4_tiled_level *level = &chain->levels[i];
+
+                u_box_2d(0, 0, u_minify(width, i), u_minify(height, i),
+                         &level->box);
+                level->src = src + linear_offset;
+                level->src_stride = level->box.width * cpp;
+                linear_offset += level->src_stride * level->box.height;
+        }
+        chain->linear_size = linear_offset;
+}
+
+/** Uploads the chain the way a map/unmap per level does. */
+static void
+upload_per_level(uint8_t *bo, const struct chain *chain)
+{
+        for (int i = 0; i < chain->num_levels; i++) {
+                const struct vc4_tiled_level *level = &chain->levels[i];
+                size_t size = level->src_stride * level->box.height;
+                void *map = malloc(size);
+
+                memcpy(map, level->src, size);
+                vc4_store_tiled_image(bo + level->offset, level->stride,
+                                      map, level->src_stride,
+                                      level->tiling, chain->cpp,
+                                      &level->box);
+                free(map);
+        }
+}
+
+/** Uploads the chain straight into the BO, smallest level first. */
+static void
+upload_bulk(uint8_t *bo, const struct chain *chain)
+{
+        struct vc4_tiled_level levels[MAX_LEVELS];
+
+        for (int i = 0; i < chain->num_levels; i++)
+                levels[i] = chain->levels[chain->num_levels - 1 - i];
+
+        vc4_store_tiled_levels(bo, chain->cpp, levels, chain->num_levels);
+}
+
+/**
+ * Returns the average time in ns of an upload of \p chain, repeating it until
+ * \p min_time_ns has passed.
+ */
+static double
+bench_upload(uint8_t *bo, const struct chain *chain, bool bulk,
+             int64_t min_time_ns)
+{
+        /* Warm up the caches and page tables. */
+        if (bulk)
+                upload_bulk(bo, chain);
+        else
+                upload_per_level(bo, chain);
+
+        int64_t iterations = 0;
+        int64_t start = os_time_get_nano();
+        int64_t elapsed;
+        do {
+                if (bulk)
+                        upload_bulk(bo, chain);
+                else
+                        upload_per_level(bo, chain);
+                iterations++;
+                elapsed = os_time_get_nano() - start;
+        } while (elapsed < min_time_ns || iterations < 3);
+
+        return (double)elapsed / iterations;
+}
+
+static void
+usage(const char *name)
+{
+        fprintf(stderr,
+                "Usage: %s [-t milliseconds]\n"
+                "  -t ms    minimum time per measurement (default 250)\n",
+                name);
+}
+
+int
+main(int argc, char **argv)
+{
+        static const struct {
+                const char *name;
+                int cpp;
+        } formats[] = {
+                { "RGBA8", 4 },
+                { "RGB565", 2 },
+        };
+        static const uint32_t sizes[] = { 1024, 2048 };
+        int64_t min_time_ms = 250;
+        int c;
+
+        while ((c = getopt(argc, argv, "t:h")) != -1) {
+                switch (c) {
+                case 't':
+                        min_time_ms = strtoll(optarg, NULL, 0);
+                        break;
+                default:
+                        usage(argv[0]);
+                        return c == 'h' ? 0 : 1;
+                }
+        }
+
+        printf("%-8s %9s %6s %14s %14s %8s\n", "format", "size", "levels",
+               "per-level ms", "bulk ms", "speedup");
+
+        for (int f = 0; f < ARRAY_SIZE(formats); f++) {
+                for (int s = 0; s < ARRAY_SIZE(sizes); s++) {
+                        uint32_t size = sizes[s];
+                        int cpp = formats[f].cpp;
+                        struct chain chain;
+
+                        /* Size the source for a full chain of the level
+                         * sizes, which is under 4/3 of the base level.
+                         */
+                        size_t src_size = (size_t)size * size * cpp * 4 / 3 +
+                                          64 * cpp;
+                        uint8_t *src = malloc(src_size);
+                        if (!src) {
+                                fprintf(stderr, "Failed to allocate %zd bytes\n",
+                                        src_size);
+                                return 1;
+                        }
+                        setup_chain(&chain, size, size, cpp, src);
+                        assert(chain.linear_size <= src_size);
+                        memset(src, 0xaa, chain.linear_size);
+
+                        uint8_t *bo = aligned_alloc(4096,
+                                                    align(chain.bo_size, 4096));
+                        if (!bo) {
+                                fprintf(stderr, "Failed to allocate %zd bytes\n",
+                                        chain.bo_size);
+                                return 1;
+                        }
+
+                        double per_level = bench_upload(bo, &chain, false,
+                                                        min_time_ms * 1000000);
+                        double bulk = bench_upload(bo, &chain, true,
+                                                   min_time_ms * 1000000);
+
+                        printf("%-8s %4ux%-4u %6u %14.3f %14.3f %7.2fx\n",
+                               formats[f].name, size, size, chain.num_levels,
+                               per_level / 1e6, bulk / 1e6,
+                               per_level / bulk);
+
+                        free(bo);
+                        free(src);
+                }
+        }
+
+        return 0;
+}
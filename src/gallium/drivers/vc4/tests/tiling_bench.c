@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2017 Broadcom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/** @file tiling_bench.c
+ *
+ * Microbenchmark for the CPU tiling paths built on v3d_cpu_tiling.h: the vc4
+ * LT and T formats and the v3d LT and UIF formats.  For each format and cpp,
+ * it reports the GB/s of linear pixel data moved by loads (tiled to linear)
+ * and stores (linear to tiled).
+ *
+ * The utile kernels are picked at build time (NEON, SSE2, or scalar), except
+ * that on x86-64 the AVX2 build is dispatched to at runtime.  Run with
+ * GALLIUM_NOSSE=1 to compare against the non-AVX2 build.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/os_time.h"
+#include "util/u_cpu_detect.h"
+#include "broadcom/common/v3d_tiling.h"
+#include "vc4_tiling.h"
+#include "kernel/vc4_packet.h"
+
+enum bench_format {
+        BENCH_VC4_LT,
+        BENCH_VC4_T,
+        BENCH_V3D_LT,
+        BENCH_V3D_UIF,
+        BENCH_V3D_UIF_XOR,
+};
+
+static const struct {
+        const char *name;
+        int max_cpp;
+} formats[] = {
+        [BENCH_VC4_LT] = { "vc4 LT", 8 },
+        [BENCH_VC4_T] = { "vc4 T", 8 },
+        [BENCH_V3D_LT] = { "v3d LT", 16 },
+        [BENCH_V3D_UIF] = { "v3d UIF", 16 },
+        [BENCH_V3D_UIF_XOR] = { "v3d UIF XOR", 16 },
+};
+
+static void
+move_image(enum bench_format format, bool load,
+           void *gpu, uint32_t gpu_stride,
+           void *cpu, uint32_t cpu_stride,
+           int cpp, uint32_t image_h, const struct pipe_box *box)
+{
+        void *dst = load ? cpu : gpu;
+        uint32_t dst_stride = load ? cpu_stride : gpu_stride;
+        void *src = load ? gpu : cpu;
+        uint32_t src_stride = load ? gpu_stride : cpu_stride;
+
+        switch (format) {
+        case BENCH_VC4_LT:
+        case BENCH_VC4_T: {
+                uint8_t tiling = (format == BENCH_VC4_LT ?
+                                  VC4_TILING_FORMAT_LT :
+                                  VC4_TILING_FORMAT_T);
+                if (load) {
+                        vc4_load_tiled_image(dst, dst_stride, src, src_stride,
+                                             tiling, cpp, box);
+                } else {
+                        vc4_store_tiled_image(dst, dst_stride, src, src_stride,
+                                              tiling, cpp, box);
+                }
+                break;
+        }
+        case BENCH_V3D_LT:
+        case BENCH_V3D_UIF:
+        case BENCH_V3D_UIF_XOR: {
+                enum v3d_tiling_mode tiling =
+                        (format == BENCH_V3D_LT ? V3D_TILING_LINEARTILE :
+                         format == BENCH_V3D_UIF ? V3D_TILING_UIF_NO_XOR :
+                         V3D_TILING_UIF_XOR);
+                if (load) {
+                        v3d_load_tiled_image(dst, dst_stride, src, src_stride,
+                                             tiling, cpp, image_h, box);
+                } else {
+                        v3d_store_tiled_image(dst, dst_stride, src, src_stride,
+                                              tiling, cpp, image_h, box);
+                }
+                break;
+        }
+        }
+}
+
+/**
+ * Returns the GB/s of moving a \p width x \p height box in \p format,
+ * repeating the move until \p min_time_ns has passed.
+ */
+static double
+bench_move(enum bench_format format, bool load, int cpp,
+           uint32_t width, uint32_t height, int64_t min_time_ns)
+{
+        /* v3d LT is a single line of utiles, so bench one row of them. */
+        if (format == BENCH_V3D_LT)
+                height = v3d_utile_height(cpp);
+
+        uint32_t stride = width * cpp;
+        size_t cpu_size = (size_t)stride * height;
+        /* The UIF XOR swizzle can address up to 16 rows of 4 UIF blocks
+         * past the end of the image.
+         */
+        size_t gpu_size = cpu_size + 16 * 4 * 256;
+        uint8_t *gpu = aligned_alloc(4096, align(gpu_size, 4096));
+        uint8_t *cpu = aligned_alloc(4096, align(cpu_size, 4096));
+        if (!gpu || !cpu) {
+                fprintf(stderr, "Failed to allocate %zd bytes\n",
+                        gpu_size + cpu_size);
+                exit(1);
+        }
+        memset(gpu, 0x55, gpu_size);
+        memset(cpu, 0xaa, cpu_size);
+
+        struct pipe_box box;
+        u_box_2d(0, 0, width, height, &box);
+
+        /* Warm up the caches and page tables. */
+        move_image(format, load, gpu, stride, cpu, stride, cpp, height, &box);
+
+        int64_t iterations = 0;
+        int64_t start = os_time_get_nano();
+        int64_t elapsed;
+        do {
+                move_image(format, load, gpu, stride, cpu, stride,
+                           cpp, height, &box);
+                iterations++;
+                elapsed = os_time_get_nano() - start;
+        } while (elapsed < min_time_ns || iterations < 3);
+
+        free(gpu);
+        free(cpu);
+
+        return (double)cpu_size * iterations / elapsed;
+}
+
+static void
+usage(const char *name)
+{
+        fprintf(stderr,
+                "Usage: %s [-s size] [-t milliseconds]\n"
+                "  -s size  width and height in pixels of the image "
+                "(default 1024)\n"
+                "  -t ms    minimum time per measurement (default 250)\n",
+                name);
+}
+
+int
+main(int argc, char **argv)
+{
+        uint32_t size = 1024;
+        int64_t min_time_ms = 250;
+        int c;
+
+        while ((c = getopt(argc, argv, "s:t:h")) != -1) {
+                switch (c) {
+                case 's':
+                        size = strtoul(optarg, NULL, 0);
+                        break;
+                case 't':
+                        min_time_ms = strtoll(optarg, NULL, 0);
+                        break;
+                default:
+                        usage(argv[0]);
+                        return c == 'h' ? 0 : 1;
+                }
+        }
+
+        /* Keep whole vc4 T-format 4k tiles and v3d UIF blocks. */
+        if (size < 64 || size % 64 != 0) {
+                fprintf(stderr, "size must be a nonzero multiple of 64\n");
+                return 1;
+        }
+
+        printf("%ux%u image, AVX2 tiling %s\n", size, size,
+#ifdef USE_X86_AVX2
+               util_get_cpu_caps()->has_avx2 ? "enabled" : "disabled"
+#else
+               "not built"
+#endif
+               );
+        printf("%-12s %4s %10s %10s\n", "format", "cpp", "load GB/s",
+               "store GB/s");
+
+        for (int f = 0; f < ARRAY_SIZE(formats); f++) {
+                for (int cpp = 1; cpp <= formats[f].max_cpp; cpp *= 2) {
+                        double load = bench_move(f, true, cpp, size, size,
+                                                 min_time_ms * 1000000);
+                        double store = bench_move(f, false, cpp, size, size,
+                                                  min_time_ms * 1000000);
+                        printf("%-12s %4d %10.2f %10.2f\n",
+                               formats[f].name, cpp, load, store);
+                }
+        }
+
+        return 0;
+}
@@ -317,12 +317,12 @@ vc4_yuv_blit(struct pipe_context *pctx, const struct pipe_blit_info *info)
 
         if (src->tiled)
                 return false;
-        if (src->base.format != PIPE_FORMAT_R8_UNORM &&
-            src->base.format != PIPE_FORMAT_R8G8_UNORM)
+        if (src->base.b.format != PIPE_FORMAT_R8_UNORM &&
+            src->base.b.format != PIPE_FORMAT_R8G8_UNORM)
                 return false;
 
         /* YUV blits always turn raster-order to tiled */
-        assert(dst->base.format == src->base.format);
+        assert(dst->base.b.format == src->base.b.format);
         assert(dst->tiled);
 
         /* Always 1:1 and at the origin */
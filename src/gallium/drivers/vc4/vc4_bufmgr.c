@@ -38,6 +38,23 @@
 
 static bool dump_stats = false;
 
+/* Buffers up to 2KB get suballocated out of 16KB slab BOs, since every
+ * kernel BO costs at least a page of CMA.
+ */
+#define VC4_BO_SLAB_MIN_ORDER 6
+#define VC4_BO_SLAB_MAX_ORDER 11
+#define VC4_BO_SLAB_SIZE (16 * 1024)
+
+struct vc4_bo_slab {
+        struct pb_slab base;
+
+        /** The BO that the entries are carved out of. */
+        struct vc4_bo *bo;
+
+        /** Array of the suballocated BOs. */
+        struct vc4_bo *entries;
+};
+
 static void
 vc4_bo_cache_free_all(struct vc4_bo_cache *cache);
 
@@ -283,6 +300,14 @@ vc4_bo_last_unreference(struct vc4_bo *bo)
 {
         struct vc4_screen *screen = bo->screen;
 
+        /* The slab allocator waits for the suballocation's last job before
+         * handing the range out again.
+         */
+        if (bo->parent) {
+                pb_slab_free(&screen->bo_slabs, &bo->slab_entry);
+                return;
+        }
+
         struct timespec time;
         clock_gettime(CLOCK_MONOTONIC, &time);
         mtx_lock(&screen->bo_cache.lock);
@@ -480,6 +505,106 @@ vc4_bo_get_dmabuf(struct vc4_bo *bo)
         return fd;
 }
 
+static bool
+vc4_bo_slab_can_reclaim(void *priv, struct pb_slab_entry *entry)
+{
+        struct vc4_screen *screen = priv;
+        struct vc4_bo *bo = container_of(entry, struct vc4_bo, slab_entry);
+
+        return vc4_wait_seqno(screen, bo->seqno, 0, NULL);
+}
+
+static struct pb_slab *
+vc4_bo_slab_alloc(void *priv, unsigned heap, unsigned entry_size,
+                  unsigned group_index)
+{
+        struct vc4_screen *screen = priv;
+        struct vc4_bo_slab *slab = CALLOC_STRUCT(vc4_bo_slab);
+        if (!slab)
+                return NULL;
+
+        slab->bo = vc4_bo_alloc(screen, VC4_BO_SLAB_SIZE, "slab");
+        if (!slab->bo)
+                goto fail;
+
+        slab->base.num_entries = slab->bo->size / entry_size;
+        slab->base.num_free = slab->base.num_entries;
+        slab->entries = calloc(slab->base.num_entries,
+                               sizeof(*slab->entries));
+        if (!slab->entries)
+                goto fail_bo;
+
+        list_inithead(&slab->base.free);
+
+        for (unsigned i = 0; i < slab->base.num_entries; i++) {
+                struct vc4_bo *bo = &slab->entries[i];
+
+                bo->screen = screen;
+                bo->handle = slab->bo->handle;
+                bo->size = entry_size;
+                bo->private = true;
+                bo->parent = slab->bo;
+                bo->offset = i * entry_size;
+
+                bo->slab_entry.slab = &slab->base;
+                bo->slab_entry.group_index = group_index;
+                bo->slab_entry.entry_size = entry_size;
+                list_addtail(&bo->slab_entry.head, &slab->base.free);
+        }
+
+        return &slab->base;
+
+fail_bo:
+        vc4_bo_unreference(&slab->bo);
+fail:
+        free(slab);
+        return NULL;
+}
+
+static void
+vc4_bo_slab_free(void *priv, struct pb_slab *pslab)
+{
+        struct vc4_bo_slab *slab = (struct vc4_bo_slab *)pslab;
+
+        /* Every entry has been reclaimed, so the parent is idle as far as
+         * they're concerned, and can go back to the BO cache.
+         */
+        vc4_bo_unreference(&slab->bo);
+        free(slab->entries);
+        free(slab);
+}
+
+/**
+ * Allocates a BO that may be a suballocation of a larger slab BO, for small
+ * buffers whose users can handle a nonzero bo->offset.
+ *
+ * Textures can't be suballocated, since their base addresses have to be
+ * page aligned, and neither can shaders, which the kernel validates as whole
+ * BOs.
+ */
+struct vc4_bo *
+vc4_bo_suballoc(struct vc4_screen *screen, uint32_t size, const char *name)
+{
+        if (size > (1 << VC4_BO_SLAB_MAX_ORDER))
+                return vc4_bo_alloc(screen, size, name);
+
+        struct pb_slab_entry *entry =
+                pb_slab_alloc(&screen->bo_slabs, MAX2(size, 1), 0);
+        if (!entry)
+                return vc4_bo_alloc(screen, size, name);
+
+        struct vc4_bo *bo = container_of(entry, struct vc4_bo, slab_entry);
+        pipe_reference_init(&bo->reference, 1);
+        bo->name = name;
+
+        if (dump_stats) {
+                fprintf(stderr, "Suballocated %s %db from slab %d\n",
+                        name, bo->size, bo->handle);
+        }
+
+        return bo;
+}
+
 struct vc4_bo *
 vc4_bo_alloc_shader(struct vc4_screen *screen, const void *data, uint32_t size)
 {
@@ -601,6 +726,12 @@ vc4_bo_wait(struct vc4_bo *bo, uint64_t timeout_ns, const char *reason)
 {
         struct vc4_screen *screen = bo->screen;
 
+        /* The parent of a suballocation is busy whenever any of its other
+         * entries are, so only wait for the last job using this one.
+         */
+        if (bo->parent)
+                return vc4_wait_seqno(screen, bo->seqno, timeout_ns, reason);
+
         if (VC4_DBG(PERF) && timeout_ns && reason) {
                 if (vc4_wait_bo_ioctl(screen->fd, bo->handle, 0) == -ETIME) {
                         fprintf(stderr, "Blocking on %s BO for %s\n",
@@ -630,6 +761,12 @@ vc4_bo_map_unsynchronized(struct vc4_bo *bo)
         if (bo->map)
                 return bo->map;
 
+        if (bo->parent) {
+                bo->map = ((uint8_t *)vc4_bo_map_unsynchronized(bo->parent) +
+                           bo->offset);
+                return bo->map;
+        }
+
         struct drm_vc4_mmap_bo map;
         memset(&map, 0, sizeof(map));
         map.handle = bo->handle;
@@ -666,12 +803,24 @@ vc4_bo_map(struct vc4_bo *bo)
         return map;
 }
 
+bool
+vc4_bufmgr_init(struct vc4_screen *screen)
+{
+        return pb_slabs_init(&screen->bo_slabs,
+                             VC4_BO_SLAB_MIN_ORDER, VC4_BO_SLAB_MAX_ORDER,
+                             1, false, screen,
+                             vc4_bo_slab_can_reclaim,
+                             vc4_bo_slab_alloc,
+                             vc4_bo_slab_free);
+}
+
 void
 vc4_bufmgr_destroy(struct pipe_screen *pscreen)
 {
         struct vc4_screen *screen = vc4_screen(pscreen);
         struct vc4_bo_cache *cache = &screen->bo_cache;
 
+        pb_slabs_deinit(&screen->bo_slabs);
         vc4_bo_cache_free_all(cache);
 
         if (dump_stats) {
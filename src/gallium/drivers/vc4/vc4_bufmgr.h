@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include "util/u_hash_table.h"
 #include "util/u_inlines.h"
+#include "pipebuffer/pb_slab.h"
 #include "vc4_qir.h"
 
 struct vc4_context;
@@ -58,10 +59,27 @@ struct vc4_bo {
          * it's safe to reuse it in the BO cache).
          */
         bool private;
+
+        /**
+         * For a suballocation from vc4_bo_suballoc(), the slab BO that it
+         * lives in, which is what gets passed to the kernel.  The handle is
+         * the parent's, and size is the size of the suballocation.
+         */
+        struct vc4_bo *parent;
+        /** Offset of the suballocation within the parent BO. */
+        uint32_t offset;
+        /**
+         * Seqno of the last job submitted that used the suballocation, which
+         * is what we wait on instead of the (shared) parent BO.
+         */
+        uint64_t seqno;
+        struct pb_slab_entry slab_entry;
 };
 
 struct vc4_bo *vc4_bo_alloc(struct vc4_screen *screen, uint32_t size,
                             const char *name);
+struct vc4_bo *vc4_bo_suballoc(struct vc4_screen *screen, uint32_t size,
+                               const char *name);
 struct vc4_bo *vc4_bo_alloc_shader(struct vc4_screen *screen, const void *data,
                                    uint32_t size);
 void vc4_bo_last_unreference(struct vc4_bo *bo);
@@ -143,6 +161,9 @@ vc4_wait_seqno(struct vc4_screen *screen, uint64_t seqno, uint64_t timeout_ns,
 void
 vc4_bo_label(struct vc4_screen *screen, struct vc4_bo *bo, const char *fmt, ...);
 
+bool
+vc4_bufmgr_init(struct vc4_screen *screen);
+
 void
 vc4_bufmgr_destroy(struct pipe_screen *pscreen);
 
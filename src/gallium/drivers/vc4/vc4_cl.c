@@ -23,6 +23,7 @@
 
 #include "util/u_math.h"
 #include "util/ralloc.h"
+#include "util/set.h"
 #include "vc4_context.h"
 
 void
@@ -59,6 +60,18 @@ vc4_reset_cl(struct vc4_cl *cl)
 uint32_t
 vc4_gem_hindex(struct vc4_job *job, struct vc4_bo *bo)
 {
+        /* The kernel only sees the parent of a suballocation, but the job
+         * also keeps the suballocation alive so that it gets stamped with
+         * the job's seqno at submit.
+         */
+        if (bo->parent) {
+                if (!job->bo_suballocs)
+                        job->bo_suballocs = _mesa_pointer_set_create(job);
+                if (!_mesa_set_search(job->bo_suballocs, bo))
+                        _mesa_set_add(job->bo_suballocs, vc4_bo_reference(bo));
+                return vc4_gem_hindex(job, bo->parent);
+        }
+
         uint32_t hindex;
         uint32_t *current_handles = job->bo_handles.base;
         uint32_t cl_hindex_count = cl_offset(&job->bo_handles) / 4;
@@ -28,6 +28,7 @@
 
 #include "util/u_math.h"
 #include "util/macros.h"
+#include "vc4_bufmgr.h"
 
 struct vc4_bo;
 struct vc4_job;
@@ -185,7 +186,7 @@ cl_reloc(struct vc4_job *job, struct vc4_cl *cl, struct vc4_cl_out **cl_out,
         cl->reloc_count--;
 #endif
 
-        cl_u32(cl_out, offset);
+        cl_u32(cl_out, bo->offset + offset);
 }
 
 static inline void
@@ -200,7 +201,7 @@ cl_aligned_reloc(struct vc4_job *job, struct vc4_cl *cl,
         cl->reloc_count--;
 #endif
 
-        cl_aligned_u32(cl_out, offset);
+        cl_aligned_u32(cl_out, bo->offset + offset);
 }
 
 /**
@@ -211,7 +212,7 @@ cl_address(struct vc4_bo *bo, uint32_t offset)
 {
         struct vc4_cl_reloc reloc = {
                 .bo = bo,
-                .offset = offset,
+                .offset = bo->offset + offset,
         };
         return reloc;
 }
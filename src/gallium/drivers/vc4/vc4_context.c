@@ -23,6 +23,7 @@
 
 #include <xf86drm.h>
 #include <err.h>
+#include <inttypes.h>
 
 #include "pipe/p_defines.h"
 #include "util/ralloc.h"
@@ -30,6 +31,7 @@
 #include "util/u_memory.h"
 #include "util/u_blitter.h"
 #include "util/u_upload_mgr.h"
+#include "util/u_threaded_context.h"
 #include "pipe/p_screen.h"
 
 #include "vc4_screen.h"
@@ -45,6 +47,9 @@ vc4_flush(struct pipe_context *pctx)
                 struct vc4_job *job = entry->data;
                 vc4_job_submit(vc4, job);
         }
+
+        /* Also covers TC batches that didn't leave any job behind. */
+        tc_driver_internal_flush_notify(vc4->tc);
 }
 
 static void
@@ -108,6 +113,14 @@ vc4_context_destroy(struct pipe_context *pctx)
 
         vc4_flush(pctx);
 
+        if (vc4->jobs_reordered) {
+                perf_debug("Reordered %"PRIu64" jobs past later writers, "
+                           "avoiding %"PRIu64" tile loads and "
+                           "%"PRIu64" tile stores\n",
+                           vc4->jobs_reordered, vc4->tile_loads_avoided,
+                           vc4->tile_stores_avoided);
+        }
+
         if (vc4->blitter)
                 util_blitter_destroy(vc4->blitter);
 
@@ -115,6 +128,7 @@ vc4_context_destroy(struct pipe_context *pctx)
                 u_upload_destroy(vc4->uploader);
 
         slab_destroy_child(&vc4->transfer_pool);
+        slab_destroy_child(&vc4->transfer_pool_unsync);
 
         pipe_surface_reference(&vc4->framebuffer.cbufs[0], NULL);
         pipe_surface_reference(&vc4->framebuffer.zsbuf, NULL);
@@ -181,6 +195,7 @@ vc4_context_create(struct pipe_screen *pscreen, void *priv, unsigned flags)
                 goto fail;
 
         slab_create_child(&vc4->transfer_pool, &screen->transfer_pool);
+        slab_create_child(&vc4->transfer_pool_unsync, &screen->transfer_pool);
 
 	vc4->uploader = u_upload_create_default(&vc4->base);
 	vc4->base.stream_uploader = vc4->uploader;
@@ -194,7 +209,29 @@ vc4_context_create(struct pipe_screen *pscreen, void *priv, unsigned flags)
 
         vc4->sample_mask = (1 << VC4_MAX_SAMPLES) - 1;
 
-        return &vc4->base;
+        if (!screen->threaded_context ||
+            !(flags & PIPE_CONTEXT_PREFER_THREADED)) {
+                return &vc4->base;
+        }
+
+        /* Move state emission and job flushing off of the application's
+         * thread.  Unsynchronized buffer maps still come from the
+         * application thread (see vc4_resource_transfer_map()).
+         */
+        struct pipe_context *tc =
+                threaded_context_create(pctx, &screen->transfer_pool,
+                                        vc4_replace_buffer_storage,
+                                        &(struct threaded_context_options) {
+                                                .driver_calls_flush_notify =
+                                                        true,
+                                                .is_resource_busy =
+                                                        vc4_resource_busy,
+                                        },
+                                        NULL);
+        if (tc && tc != pctx)
+                vc4->tc = (struct threaded_context *)tc;
+
+        return tc;
 
 fail:
         pctx->destroy(pctx);
@@ -31,6 +31,7 @@
 #include "pipe/p_state.h"
 #include "util/slab.h"
 #include "util/u_debug_cb.h"
+#include "util/u_queue.h"
 #include "xf86drm.h"
 
 #define __user
@@ -120,6 +121,12 @@ struct vc4_uncompiled_shader {
         /** How many variants of this program were compiled, for shader-db. */
         uint32_t compiled_variant_count;
         struct pipe_shader_state base;
+        /** SHA1 of the serialized NIR, for the on-disk shader cache. */
+        unsigned char sha1[20];
+
+        /** Recorded variants being warmed up on vc4->precompile_queue. */
+        struct vc4_precompile_job *precompiles;
+        unsigned num_precompiles;
 };
 
 struct vc4_fs_inputs {
@@ -168,6 +175,35 @@ struct vc4_compiled_shader {
         uint8_t vattrs_live;
 
         const struct vc4_fs_inputs *fs_inputs;
+
+        struct vc4_shader_stats stats;
+};
+
+/**
+ * A variant recorded by an earlier run of the application, compiled (or
+ * loaded from the disk cache) on vc4->precompile_queue and handed to
+ * vc4_get_compiled_shader() on its first use.
+ */
+struct vc4_precompile_job {
+        struct vc4_context *vc4;
+        struct util_queue_fence fence;
+
+        enum qstage stage;
+        union {
+                struct vc4_key base;
+                struct vc4_fs_key fs;
+                struct vc4_vs_key vs;
+        } key;
+        /** Storage for key.vs.fs_inputs, as it isn't interned yet. */
+        struct vc4_fs_inputs key_fs_inputs;
+        struct vc4_varying_slot key_input_slots[64];
+        cache_key cache_key;
+
+        /** Results for vc4_link_shader(), owned by the job until claimed. */
+        struct vc4_compiled_shader *shader;
+        struct vc4_fs_inputs fs_inputs;
+        void *qpu_insts;
+        uint32_t qpu_size;
 };
 
 struct vc4_program_stateobj {
@@ -221,6 +257,23 @@ struct vc4_job {
         struct vc4_cl uniforms;
         struct vc4_cl bo_handles;
         struct vc4_cl bo_pointers;
+        /**
+         * Set of the suballocated BOs referenced by the job, whose parents
+         * are what's in bo_handles/bo_pointers.  Created on first use.
+         */
+        struct set *bo_suballocs;
+        /**
+         * Set of the jobs that have to be submitted before this one, because
+         * they texture from a surface that this job renders to.  Created on
+         * first use.
+         */
+        struct set *deps;
+        /**
+         * Set when a later job got ordered after this one instead of
+         * flushing it, so that we can count the avoided tile loads and
+         * stores if drawing comes back to this job.
+         */
+        bool deferred;
         uint32_t shader_rec_count;
         /**
          * Amount of memory used by the BOs in bo_pointers.
@@ -308,6 +361,9 @@ struct vc4_context {
         int fd;
         struct vc4_screen *screen;
 
+        /** The u_threaded_context wrapping us, if any. */
+        struct threaded_context *tc;
+
         /** The 3D rendering job for the currently bound FBO. */
         struct vc4_job *job;
 
@@ -324,6 +380,8 @@ struct vc4_context {
         struct hash_table *write_jobs;
 
         struct slab_child_pool transfer_pool;
+        /** Pool for unsynchronized maps from u_threaded_context's thread. */
+        struct slab_child_pool transfer_pool_unsync;
         struct blitter_context *blitter;
 
         /** bitfield of VC4_DIRTY_* */
@@ -331,6 +389,8 @@ struct vc4_context {
 
         struct hash_table *fs_cache, *vs_cache;
         struct set *fs_inputs_set;
+        /** Warms up recorded variants, if this application has any. */
+        struct util_queue precompile_queue;
         uint32_t next_uncompiled_program_id;
         uint64_t next_compiled_program_id;
 
@@ -352,6 +412,16 @@ struct vc4_context {
         /** Seqno of the last CL flush's job. */
         uint64_t last_emit_seqno;
 
+        /** @{
+         * Counters of job flushes avoided by ordering a job writing a
+         * surface after the jobs texturing from it, reported at context
+         * destroy with VC4_DEBUG=perf.
+         */
+        uint64_t jobs_reordered;
+        uint64_t tile_loads_avoided;
+        uint64_t tile_stores_avoided;
+        /** @} */
+
         struct u_upload_mgr *uploader;
 
         struct pipe_shader_state *yuv_linear_blit_vs;
@@ -498,6 +568,7 @@ void vc4_flush_jobs_reading_resource(struct vc4_context *vc4,
                                      struct pipe_resource *prsc);
 void vc4_emit_state(struct pipe_context *pctx);
 void vc4_generate_code(struct vc4_context *vc4, struct vc4_compile *c);
+void vc4_alloc_reg_set(struct vc4_context *vc4);
 struct qpu_reg *vc4_register_allocate(struct vc4_context *vc4, struct vc4_compile *c);
 bool vc4_update_compiled_shaders(struct vc4_context *vc4, uint8_t prim_mode);
 
@@ -509,4 +580,43 @@ const uint8_t *vc4_get_format_swizzle(enum pipe_format f);
 void vc4_init_query_functions(struct vc4_context *vc4);
 void vc4_blit(struct pipe_context *pctx, const struct pipe_blit_info *blit_info);
 void vc4_blitter_save(struct vc4_context *vc4);
+
+void vc4_set_compiled_fs_inputs(struct vc4_context *vc4,
+                                struct vc4_compiled_shader *shader,
+                                struct vc4_fs_inputs *inputs);
+
+#ifdef ENABLE_SHADER_CACHE
+void vc4_disk_cache_hash_shader(struct vc4_screen *screen,
+                                struct vc4_uncompiled_shader *so);
+
+void vc4_disk_cache_compute_key(struct vc4_screen *screen,
+                                enum qstage stage,
+                                const struct vc4_key *key,
+                                cache_key cache_key);
+
+struct vc4_compiled_shader *vc4_disk_cache_retrieve(struct vc4_screen *screen,
+                                                    enum qstage stage,
+                                                    const struct vc4_key *key,
+                                                    struct vc4_fs_inputs *fs_inputs,
+                                                    void **qpu_insts,
+                                                    uint32_t *qpu_size);
+
+void vc4_disk_cache_record_variant(struct vc4_screen *screen,
+                                   enum qstage stage,
+                                   const struct vc4_key *key);
+
+bool vc4_disk_cache_has_variants(struct vc4_screen *screen);
+
+struct vc4_precompile_job *
+vc4_disk_cache_find_variants(struct vc4_screen *screen,
+                             struct vc4_uncompiled_shader *so,
+                             unsigned *num_jobs);
+
+void vc4_disk_cache_store(struct vc4_screen *screen,
+                          enum qstage stage,
+                          const struct vc4_key *key,
+                          const struct vc4_compiled_shader *shader,
+                          const uint64_t *qpu_insts,
+                          uint32_t qpu_size);
+#endif /* ENABLE_SHADER_CACHE */
 #endif /* VC4_CONTEXT_H */
@@ -0,0 +1,579 @@
+/*
+ * Copyright © 2017 Broadcom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * VC4 on-disk shader cache.
+ *
+ * Compiled variants are stored under the SHA1 of the uncompiled NIR together
+ * with the variant key, so that a new process can skip the NIR -> QIR -> QPU
+ * compile for any variant an earlier one has already seen.
+ *
+ * The serialized keys themselves are also recorded in a per-application
+ * entry, so that the next run of the application can warm those variants up
+ * as its shaders are created instead of on their first draw.
+ */
+
+#include "vc4_context.h"
+#include "vc4_qir.h"
+
+#include "compiler/nir/nir_serialize.h"
+#include "util/blob.h"
+#include "util/u_process.h"
+
+#ifdef ENABLE_SHADER_CACHE
+
+/* Bounds the size of an application's recorded variant list. */
+#define VC4_MAX_RECORDED_VARIANTS 512
+
+/** Location of one serialized key in screen->variant_records. */
+struct vc4_variant_record {
+        cache_key cache_key;
+        uint32_t offset;
+        uint32_t size;
+};
+
+static void
+vc4_disk_cache_load_variants(struct vc4_screen *screen)
+{
+        struct disk_cache *cache = screen->disk_cache;
+        const char *process_name = util_get_process_name();
+
+        blob_init(&screen->variant_records);
+        util_dynarray_init(&screen->variant_index, NULL);
+        simple_mtx_init(&screen->variant_lock, mtx_plain);
+
+        if (!process_name)
+                return;
+
+        char *name;
+        ASSERTED int len = asprintf(&name, "vc4 variant keys: %s",
+                                    process_name);
+        assert(len > 0);
+        disk_cache_compute_key(cache, name, strlen(name),
+                               screen->variant_records_key);
+        free(name);
+        screen->variant_records_enabled = true;
+
+        size_t size;
+        void *data = disk_cache_get(cache, screen->variant_records_key,
+                                    &size);
+        if (!data)
+                return;
+
+        struct blob_reader blob;
+        blob_reader_init(&blob, data, size);
+        while (blob.current < blob.end &&
+               util_dynarray_num_elements(&screen->variant_index,
+                                          struct vc4_variant_record) <
+               VC4_MAX_RECORDED_VARIANTS) {
+                uint32_t key_size = blob_read_uint32(&blob);
+                const void *key_data = blob_read_bytes(&blob, key_size);
+                if (blob.overrun || key_size < sizeof(cache_key))
+                        break;
+
+                struct vc4_variant_record record = {
+                        .offset = screen->variant_records.size +
+                                  sizeof(uint32_t),
+                        .size = key_size,
+                };
+                disk_cache_compute_key(cache, key_data, key_size,
+                                       record.cache_key);
+
+                blob_write_uint32(&screen->variant_records, key_size);
+                blob_write_bytes(&screen->variant_records, key_data,
+                                 key_size);
+                util_dynarray_append(&screen->variant_index,
+                                     struct vc4_variant_record, record);
+        }
+
+        if (VC4_DBG(CACHE)) {
+                fprintf(stderr, "[vc4 on-disk cache] %zu variant keys "
+                        "recorded for %s\n",
+                        util_dynarray_num_elements(&screen->variant_index,
+                                                   struct vc4_variant_record),
+                        process_name);
+        }
+
+        free(data);
+}
+
+void
+vc4_disk_cache_init(struct vc4_screen *screen)
+{
+        char *renderer;
+
+        ASSERTED int len =
+                asprintf(&renderer, "VC4 V3D %d.%d",
+                         screen->v3d_ver / 10,
+                         screen->v3d_ver % 10);
+        assert(len > 0);
+
+        const struct build_id_note *note =
+                build_id_find_nhdr_for_addr(vc4_disk_cache_init);
+        assert(note && build_id_length(note) == 20);
+
+        const uint8_t *id_sha1 = build_id_data(note);
+        assert(id_sha1);
+
+        char timestamp[41];
+        _mesa_sha1_format(timestamp, id_sha1);
+
+        screen->disk_cache = disk_cache_create(renderer, timestamp, vc4_mesa_debug);
+
+        free(renderer);
+
+        if (screen->disk_cache)
+                vc4_disk_cache_load_variants(screen);
+}
+
+void
+vc4_disk_cache_fini(struct vc4_screen *screen)
+{
+        if (!screen->disk_cache)
+                return;
+
+        blob_finish(&screen->variant_records);
+        util_dynarray_fini(&screen->variant_index);
+        simple_mtx_destroy(&screen->variant_lock);
+        disk_cache_destroy(screen->disk_cache);
+}
+
+void
+vc4_disk_cache_hash_shader(struct vc4_screen *screen,
+                           struct vc4_uncompiled_shader *so)
+{
+        if (!screen->disk_cache)
+                return;
+
+        assert(so->base.type == PIPE_SHADER_IR_NIR);
+
+        struct blob blob;
+        blob_init(&blob);
+        nir_serialize(&blob, so->base.ir.nir, true);
+        _mesa_sha1_compute(blob.data, blob.size, so->sha1);
+        blob_finish(&blob);
+}
+
+/**
+ * Serializes a variant key.  The shader SHA1 comes first, which is what the
+ * recorded keys are matched against when their shader gets created again.
+ */
+static void
+vc4_disk_cache_serialize_key(struct vc4_screen *screen,
+                             enum qstage stage,
+                             const struct vc4_key *key,
+                             struct blob *blob)
+{
+        blob_write_bytes(blob, key->shader_state->sha1,
+                         sizeof(key->shader_state->sha1));
+        blob_write_uint32(blob, stage);
+        /* Kernel features the compiler generates different code for.  The
+         * VC4_DEBUG flags that affect codegen are already part of the
+         * cache's driver flags.
+         */
+        blob_write_uint8(blob, screen->has_threaded_fs);
+        blob_write_uint8(blob, screen->has_control_flow);
+
+        if (stage == QSTAGE_FRAG) {
+                struct vc4_fs_key ckey;
+                memcpy(&ckey, key, sizeof(ckey));
+                ckey.base.shader_state = NULL;
+                blob_write_bytes(blob, &ckey, sizeof(ckey));
+        } else {
+                /* The FS inputs are interned per context, so hash their
+                 * contents rather than the pointer.
+                 */
+                struct vc4_vs_key ckey;
+                memcpy(&ckey, key, sizeof(ckey));
+                ckey.base.shader_state = NULL;
+                ckey.fs_inputs = NULL;
+                blob_write_bytes(blob, &ckey, sizeof(ckey));
+
+                const struct vc4_fs_inputs *fs_inputs =
+                        ((const struct vc4_vs_key *)key)->fs_inputs;
+                blob_write_uint32(blob, fs_inputs->num_inputs);
+                blob_write_bytes(blob, fs_inputs->input_slots,
+                                 fs_inputs->num_inputs *
+                                 sizeof(*fs_inputs->input_slots));
+        }
+}
+
+/**
+ * Fills in a warm-up job's key from a recorded one, returning false if it
+ * doesn't apply to this screen.
+ */
+static bool
+vc4_disk_cache_deserialize_key(struct vc4_screen *screen,
+                               const void *data, uint32_t size,
+                               struct vc4_uncompiled_shader *so,
+                               struct vc4_precompile_job *job)
+{
+        struct blob_reader blob;
+        blob_reader_init(&blob, data, size);
+
+        blob_skip_bytes(&blob, sizeof(so->sha1));
+        job->stage = blob_read_uint32(&blob);
+        if (blob_read_uint8(&blob) != screen->has_threaded_fs ||
+            blob_read_uint8(&blob) != screen->has_control_flow) {
+                return false;
+        }
+
+        if (job->stage == QSTAGE_FRAG) {
+                blob_copy_bytes(&blob, &job->key.fs, sizeof(job->key.fs));
+        } else {
+                blob_copy_bytes(&blob, &job->key.vs, sizeof(job->key.vs));
+
+                uint32_t num_inputs = blob_read_uint32(&blob);
+                if (num_inputs > ARRAY_SIZE(job->key_input_slots))
+                        return false;
+                blob_copy_bytes(&blob, job->key_input_slots,
+                                num_inputs * sizeof(job->key_input_slots[0]));
+
+                job->key_fs_inputs.input_slots = job->key_input_slots;
+                job->key_fs_inputs.num_inputs = num_inputs;
+                job->key.vs.fs_inputs = &job->key_fs_inputs;
+        }
+        job->key.base.shader_state = so;
+
+        return !blob.overrun && blob.current == blob.end;
+}
+
+void
+vc4_disk_cache_compute_key(struct vc4_screen *screen,
+                           enum qstage stage,
+                           const struct vc4_key *key,
+                           cache_key cache_key)
+{
+        struct disk_cache *cache = screen->disk_cache;
+        assert(cache);
+
+        struct blob blob;
+        blob_init(&blob);
+        vc4_disk_cache_serialize_key(screen, stage, key, &blob);
+        disk_cache_compute_key(cache, blob.data, blob.size, cache_key);
+        blob_finish(&blob);
+}
+
+/**
+ * Adds a variant to this application's recorded keys, if it isn't there
+ * already.
+ */
+void
+vc4_disk_cache_record_variant(struct vc4_screen *screen,
+                              enum qstage stage,
+                              const struct vc4_key *key)
+{
+        struct disk_cache *cache = screen->disk_cache;
+
+        if (!cache || !screen->variant_records_enabled)
+                return;
+
+        struct blob blob;
+        blob_init(&blob);
+        vc4_disk_cache_serialize_key(screen, stage, key, &blob);
+
+        struct vc4_variant_record record = {
+                .size = blob.size,
+        };
+        disk_cache_compute_key(cache, blob.data, blob.size, record.cache_key);
+
+        simple_mtx_lock(&screen->variant_lock);
+
+        util_dynarray_foreach(&screen->variant_index,
+                              struct vc4_variant_record, r) {
+                if (memcmp(r->cache_key, record.cache_key,
+                           sizeof(cache_key)) == 0) {
+                        goto out;
+                }
+        }
+
+        if (util_dynarray_num_elements(&screen->variant_index,
+                                       struct vc4_variant_record) >=
+            VC4_MAX_RECORDED_VARIANTS) {
+                goto out;
+        }
+
+        record.offset = screen->variant_records.size + sizeof(uint32_t);
+        blob_write_uint32(&screen->variant_records, blob.size);
+        blob_write_bytes(&screen->variant_records, blob.data, blob.size);
+        util_dynarray_append(&screen->variant_index,
+                             struct vc4_variant_record, record);
+
+        /* New variants mostly show up early in a run, so just rewrite the
+         * whole list each time.  disk_cache_put() copies it and does the
+         * write on its own thread.
+         */
+        disk_cache_put(cache, screen->variant_records_key,
+                       screen->variant_records.data,
+                       screen->variant_records.size, NULL);
+
+out:
+        simple_mtx_unlock(&screen->variant_lock);
+        blob_finish(&blob);
+}
+
+bool
+vc4_disk_cache_has_variants(struct vc4_screen *screen)
+{
+        if (!screen->disk_cache)
+                return false;
+
+        simple_mtx_lock(&screen->variant_lock);
+        bool ret = util_dynarray_num_elements(&screen->variant_index,
+                                              struct vc4_variant_record) != 0;
+        simple_mtx_unlock(&screen->variant_lock);
+
+        return ret;
+}
+
+/**
+ * Returns a calloced array of warm-up jobs for the recorded variants of \p so,
+ * with their keys filled in.
+ */
+struct vc4_precompile_job *
+vc4_disk_cache_find_variants(struct vc4_screen *screen,
+                             struct vc4_uncompiled_shader *so,
+                             unsigned *num_jobs)
+{
+        struct vc4_precompile_job *jobs = NULL;
+
+        *num_jobs = 0;
+
+        if (!screen->disk_cache)
+                return NULL;
+
+        simple_mtx_lock(&screen->variant_lock);
+
+        const uint8_t *records = screen->variant_records.data;
+        unsigned count = 0;
+        util_dynarray_foreach(&screen->variant_index,
+                              struct vc4_variant_record, r) {
+                if (memcmp(records + r->offset, so->sha1,
+                           sizeof(so->sha1)) == 0) {
+                        count++;
+                }
+        }
+
+        if (count)
+                jobs = calloc(count, sizeof(*jobs));
+
+        util_dynarray_foreach(&screen->variant_index,
+                              struct vc4_variant_record, r) {
+                if (!jobs)
+                        break;
+
+                if (memcmp(records + r->offset, so->sha1,
+                           sizeof(so->sha1)) != 0) {
+                        continue;
+                }
+
+                struct vc4_precompile_job *job = &jobs[*num_jobs];
+                if (!vc4_disk_cache_deserialize_key(screen,
+                                                    records + r->offset,
+                                                    r->size, so, job)) {
+                        memset(job, 0, sizeof(*job));
+                        continue;
+                }
+                memcpy(job->cache_key, r->cache_key, sizeof(cache_key));
+                (*num_jobs)++;
+        }
+
+        simple_mtx_unlock(&screen->variant_lock);
+
+        if (jobs && !*num_jobs) {
+                free(jobs);
+                jobs = NULL;
+        }
+
+        return jobs;
+}
+
+/**
+ * Loads a variant without touching the context's state.  The shader's FS
+ * inputs point at \p fs_inputs and its QPU code is returned in \p qpu_insts
+ * until vc4_link_shader() gets called on it.
+ */
+struct vc4_compiled_shader *
+vc4_disk_cache_retrieve(struct vc4_screen *screen,
+                        enum qstage stage,
+                        const struct vc4_key *key,
+                        struct vc4_fs_inputs *fs_inputs,
+                        void **qpu_insts,
+                        uint32_t *qpu_size)
+{
+        struct disk_cache *cache = screen->disk_cache;
+
+        if (!cache)
+                return NULL;
+
+        cache_key cache_key;
+        vc4_disk_cache_compute_key(screen, stage, key, cache_key);
+
+        size_t buffer_size;
+        void *buffer = disk_cache_get(cache, cache_key, &buffer_size);
+
+        if (VC4_DBG(CACHE)) {
+                char sha1[41];
+                _mesa_sha1_format(sha1, cache_key);
+                fprintf(stderr, "[vc4 on-disk cache] %s %s\n",
+                        buffer ? "hit" : "miss",
+                        sha1);
+        }
+
+        if (!buffer)
+                return NULL;
+
+        /* Load data */
+        struct blob_reader blob;
+        blob_reader_init(&blob, buffer, buffer_size);
+
+        bool fs_threaded = blob_read_uint8(&blob);
+        bool disable_early_z = blob_read_uint8(&blob);
+        uint8_t num_inputs = blob_read_uint8(&blob);
+        uint8_t vattrs_live = blob_read_uint8(&blob);
+        uint32_t color_inputs = blob_read_uint32(&blob);
+        uint8_t vattr_offsets[9];
+        blob_copy_bytes(&blob, vattr_offsets, sizeof(vattr_offsets));
+
+        uint32_t input_slots_size = 0;
+        const void *input_slots = NULL;
+        if (stage == QSTAGE_FRAG) {
+                input_slots_size = num_inputs * sizeof(struct vc4_varying_slot);
+                input_slots = blob_read_bytes(&blob, input_slots_size);
+        }
+
+        uint32_t ulist_count = blob_read_uint32(&blob);
+        uint32_t ulist_contents_size = ulist_count * sizeof(enum quniform_contents);
+        const void *ulist_contents = blob_read_bytes(&blob, ulist_contents_size);
+        uint32_t ulist_data_size = ulist_count * sizeof(uint32_t);
+        const void *ulist_data = blob_read_bytes(&blob, ulist_data_size);
+        uint32_t num_texture_samples = blob_read_uint32(&blob);
+
+        struct vc4_shader_stats stats;
+        blob_copy_bytes(&blob, &stats, sizeof(stats));
+
+        uint32_t code_size = blob_read_uint32(&blob);
+        const void *code = blob_read_bytes(&blob, code_size);
+
+        if (blob.overrun) {
+                free(buffer);
+                return NULL;
+        }
+
+        /* Assemble data */
+        struct vc4_compiled_shader *shader =
+                rzalloc(NULL, struct vc4_compiled_shader);
+
+        shader->fs_threaded = fs_threaded;
+        shader->disable_early_z = disable_early_z;
+        shader->num_inputs = num_inputs;
+        shader->vattrs_live = vattrs_live;
+        shader->color_inputs = color_inputs;
+        memcpy(shader->vattr_offsets, vattr_offsets, sizeof(vattr_offsets));
+        shader->stats = stats;
+
+        if (stage == QSTAGE_FRAG) {
+                fs_inputs->input_slots = ralloc_size(shader, input_slots_size);
+                fs_inputs->num_inputs = num_inputs;
+                memcpy(fs_inputs->input_slots, input_slots, input_slots_size);
+                shader->fs_inputs = fs_inputs;
+        }
+
+        struct vc4_shader_uniform_info *uinfo = &shader->uniforms;
+        uinfo->count = ulist_count;
+        uinfo->contents = ralloc_array(shader, enum quniform_contents,
+                                       ulist_count);
+        memcpy(uinfo->contents, ulist_contents, ulist_contents_size);
+        uinfo->data = ralloc_array(shader, uint32_t, ulist_count);
+        memcpy(uinfo->data, ulist_data, ulist_data_size);
+        uinfo->num_texture_samples = num_texture_samples;
+        vc4_set_shader_uniform_dirty_flags(shader);
+
+        *qpu_insts = ralloc_size(shader, code_size);
+        memcpy(*qpu_insts, code, code_size);
+        *qpu_size = code_size;
+
+        free(buffer);
+
+        return shader;
+}
+
+void
+vc4_disk_cache_store(struct vc4_screen *screen,
+                     enum qstage stage,
+                     const struct vc4_key *key,
+                     const struct vc4_compiled_shader *shader,
+                     const uint64_t *qpu_insts,
+                     uint32_t qpu_size)
+{
+        struct disk_cache *cache = screen->disk_cache;
+
+        if (!cache || shader->failed)
+                return;
+
+        cache_key cache_key;
+        vc4_disk_cache_compute_key(screen, stage, key, cache_key);
+
+        if (VC4_DBG(CACHE)) {
+                char sha1[41];
+                _mesa_sha1_format(sha1, cache_key);
+                fprintf(stderr, "[vc4 on-disk cache] storing %s\n", sha1);
+        }
+
+        struct blob blob;
+        blob_init(&blob);
+
+        blob_write_uint8(&blob, shader->fs_threaded);
+        blob_write_uint8(&blob, shader->disable_early_z);
+        blob_write_uint8(&blob, shader->num_inputs);
+        blob_write_uint8(&blob, shader->vattrs_live);
+        blob_write_uint32(&blob, shader->color_inputs);
+        blob_write_bytes(&blob, shader->vattr_offsets,
+                         sizeof(shader->vattr_offsets));
+
+        if (stage == QSTAGE_FRAG) {
+                assert(shader->fs_inputs->num_inputs == shader->num_inputs);
+                blob_write_bytes(&blob, shader->fs_inputs->input_slots,
+                                 shader->num_inputs *
+                                 sizeof(struct vc4_varying_slot));
+        }
+
+        const struct vc4_shader_uniform_info *uinfo = &shader->uniforms;
+        blob_write_uint32(&blob, uinfo->count);
+        blob_write_bytes(&blob, uinfo->contents,
+                         uinfo->count * sizeof(enum quniform_contents));
+        blob_write_bytes(&blob, uinfo->data,
+                         uinfo->count * sizeof(uint32_t));
+        blob_write_uint32(&blob, uinfo->num_texture_samples);
+
+        blob_write_bytes(&blob, &shader->stats, sizeof(shader->stats));
+
+        blob_write_uint32(&blob, qpu_size);
+        blob_write_bytes(&blob, qpu_insts, qpu_size);
+
+        disk_cache_put(cache, cache_key, blob.data, blob.size, NULL);
+
+        blob_finish(&blob);
+}
+
+#endif /* ENABLE_SHADER_CACHE */
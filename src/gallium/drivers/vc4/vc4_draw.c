@@ -216,7 +216,8 @@ vc4_emit_gl_shader_state(struct vc4_context *vc4,
 
         if (vtx->num_elements == 0) {
                 assert(num_elements_emit == 1);
-                struct vc4_bo *bo = vc4_bo_alloc(vc4->screen, 4096, "scratch VBO");
+                struct vc4_bo *bo = vc4_bo_suballoc(vc4->screen, 16,
+                                                    "scratch VBO");
 
                 cl_emit(&job->shader_rec, ATTRIBUTE_RECORD, attr) {
                         attr.address = cl_address(bo, 0);
@@ -440,7 +441,7 @@ vc4_draw_vbo(struct pipe_context *pctx, const struct pipe_draw_info *info,
                        VC4_INDEX_BUFFER_U16:
                        VC4_INDEX_BUFFER_U8));
                 cl_u32(&bcl, draws[0].count);
-                cl_u32(&bcl, offset);
+                cl_u32(&bcl, rsc->bo->offset + offset);
                 cl_u32(&bcl, vc4->max_index);
 
                 cl_end(&job->bcl, bcl);
@@ -30,6 +30,8 @@
 #include "vc4_cl_dump.h"
 #include "vc4_context.h"
 #include "util/hash_table.h"
+#include "util/set.h"
+#include "util/u_atomic.h"
 
 static void
 vc4_job_free(struct vc4_context *vc4, struct vc4_job *job)
@@ -38,9 +40,21 @@ vc4_job_free(struct vc4_context *vc4, struct vc4_job *job)
         for (int i = 0; i < cl_offset(&job->bo_handles) / 4; i++) {
                 vc4_bo_unreference(&referenced_bos[i]);
         }
+        if (job->bo_suballocs) {
+                set_foreach(job->bo_suballocs, entry) {
+                        struct vc4_bo *bo = (struct vc4_bo *)entry->key;
+                        vc4_bo_unreference(&bo);
+                }
+        }
 
         _mesa_hash_table_remove_key(vc4->jobs, &job->key);
 
+        hash_table_foreach(vc4->jobs, entry) {
+                struct vc4_job *other = entry->data;
+                if (other->deps)
+                        _mesa_set_remove_key(other->deps, job);
+        }
+
         if (job->color_write) {
                 _mesa_hash_table_remove_key(vc4->write_jobs,
                                             job->color_write->texture);
@@ -107,6 +121,45 @@ vc4_flush_jobs_writing_resource(struct vc4_context *vc4,
         }
 }
 
+/**
+ * Returns whether the job reads \p rsc, either by texturing from it or by
+ * loading it into the tile buffer.
+ */
+static bool
+vc4_job_reads_resource(struct vc4_job *job, struct vc4_resource *rsc)
+{
+        struct vc4_bo **referenced_bos = job->bo_pointers.base;
+        for (int i = 0; i < cl_offset(&job->bo_handles) / 4; i++) {
+                if (referenced_bos[i] == rsc->bo)
+                        return true;
+        }
+
+        if (rsc->bo->parent && job->bo_suballocs &&
+            _mesa_set_search(job->bo_suballocs, rsc->bo)) {
+                return true;
+        }
+
+        /* Also check for the Z/color buffers, since the references to
+         * those are only added immediately before submit.
+         */
+        if (job->color_read && !(job->cleared & PIPE_CLEAR_COLOR)) {
+                struct vc4_resource *ctex =
+                        vc4_resource(job->color_read->texture);
+                if (ctex->bo == rsc->bo)
+                        return true;
+        }
+
+        if (job->zs_read && !(job->cleared &
+                              (PIPE_CLEAR_DEPTH | PIPE_CLEAR_STENCIL))) {
+                struct vc4_resource *ztex =
+                        vc4_resource(job->zs_read->texture);
+                if (ztex->bo == rsc->bo)
+                        return true;
+        }
+
+        return false;
+}
+
 void
 vc4_flush_jobs_reading_resource(struct vc4_context *vc4,
                                 struct pipe_resource *prsc)
@@ -118,43 +171,73 @@ vc4_flush_jobs_reading_resource(struct vc4_context *vc4,
         hash_table_foreach(vc4->jobs, entry) {
                 struct vc4_job *job = entry->data;
 
-                struct vc4_bo **referenced_bos = job->bo_pointers.base;
-                bool found = false;
-                for (int i = 0; i < cl_offset(&job->bo_handles) / 4; i++) {
-                        if (referenced_bos[i] == rsc->bo) {
-                                found = true;
-                                break;
-                        }
-                }
-                if (found) {
+                if (vc4_job_reads_resource(job, rsc))
                         vc4_job_submit(vc4, job);
+        }
+}
+
+/**
+ * Orders \p job, which is about to render to \p prsc, after the other jobs
+ * reading from it.
+ *
+ * Once the writers have been flushed, the remaining readers are jobs
+ * texturing from the surface.  Rather than flushing them (and then reloading
+ * their whole tile buffer if drawing comes back to them, as in shadow map ->
+ * main -> overlay -> main), they stay open and get submitted just before
+ * \p job.  Dependencies only ever point from a new job to existing ones, so
+ * they can't form a cycle.  If a reader later textures from \p prsc again,
+ * flushing \p job as its writer submits the reader first, so it then gets a
+ * fresh job as before.
+ */
+static void
+vc4_job_order_after_readers(struct vc4_context *vc4, struct vc4_job *job,
+                            struct pipe_resource *prsc)
+{
+        struct vc4_resource *rsc = vc4_resource(prsc);
+
+        hash_table_foreach(vc4->jobs, entry) {
+                struct vc4_job *reader = entry->data;
+
+                if (reader == job || !vc4_job_reads_resource(reader, rsc))
                         continue;
-                }
 
-                /* Also check for the Z/color buffers, since the references to
-                 * those are only added immediately before submit.
-                 */
-                if (job->color_read && !(job->cleared & PIPE_CLEAR_COLOR)) {
-                        struct vc4_resource *ctex =
-                                vc4_resource(job->color_read->texture);
-                        if (ctex->bo == rsc->bo) {
-                                vc4_job_submit(vc4, job);
-                                continue;
-                        }
-                }
+                if (!job->deps)
+                        job->deps = _mesa_pointer_set_create(job);
+                if (_mesa_set_search(job->deps, reader))
+                        continue;
 
-                if (job->zs_read && !(job->cleared &
-                                      (PIPE_CLEAR_DEPTH | PIPE_CLEAR_STENCIL))) {
-                        struct vc4_resource *ztex =
-                                vc4_resource(job->zs_read->texture);
-                        if (ztex->bo == rsc->bo) {
-                                vc4_job_submit(vc4, job);
-                                continue;
-                        }
-                }
+                _mesa_set_add(job->deps, reader);
+                reader->deferred = true;
+                vc4->jobs_reordered++;
         }
 }
 
+/**
+ * Counts the tile stores (at the flush) and tile loads (when drawing came
+ * back) that we'd have done for \p job if it had been flushed when a later
+ * job was ordered after it.
+ */
+static void
+vc4_job_count_avoided_flush(struct vc4_context *vc4, struct vc4_job *job)
+{
+        uint32_t tiles = job->draw_tiles_x * job->draw_tiles_y;
+        uint32_t surfaces = 0;
+
+        if (job->resolve & PIPE_CLEAR_COLOR)
+                surfaces++;
+        if (job->resolve & (PIPE_CLEAR_DEPTH | PIPE_CLEAR_STENCIL))
+                surfaces++;
+
+        vc4->tile_stores_avoided += tiles * surfaces;
+        vc4->tile_loads_avoided += tiles * surfaces;
+
+        perf_debug("Reusing %dx%d-tile job ordered before a later job "
+                   "instead of flushing it\n",
+                   job->draw_tiles_x, job->draw_tiles_y);
+
+        job->deferred = false;
+}
+
 /**
  * Returns a vc4_job struture for tracking V3D rendering to a particular FBO.
  *
@@ -171,19 +254,29 @@ vc4_get_job(struct vc4_context *vc4,
         struct vc4_job_key local_key = {.cbuf = cbuf, .zsbuf = zsbuf};
         struct hash_entry *entry = _mesa_hash_table_search(vc4->jobs,
                                                            &local_key);
-        if (entry)
-                return entry->data;
+        if (entry) {
+                struct vc4_job *job = entry->data;
+                if (job->deferred)
+                        vc4_job_count_avoided_flush(vc4, job);
+                return job;
+        }
 
-        /* Creating a new job.  Make sure that any previous jobs reading or
-         * writing these buffers are flushed.
+        /* Creating a new job.  Make sure that any previous jobs writing
+         * these buffers are flushed, and that the ones reading them get
+         * submitted before us.
          */
         if (cbuf)
-                vc4_flush_jobs_reading_resource(vc4, cbuf->texture);
+                vc4_flush_jobs_writing_resource(vc4, cbuf->texture);
         if (zsbuf)
-                vc4_flush_jobs_reading_resource(vc4, zsbuf->texture);
+                vc4_flush_jobs_writing_resource(vc4, zsbuf->texture);
 
         struct vc4_job *job = vc4_job_create(vc4);
 
+        if (cbuf)
+                vc4_job_order_after_readers(vc4, job, cbuf->texture);
+        if (zsbuf)
+                vc4_job_order_after_readers(vc4, job, zsbuf->texture);
+
         if (cbuf) {
                 if (cbuf->texture->nr_samples > 1) {
                         job->msaa = true;
@@ -363,12 +456,45 @@ vc4_submit_setup_rcl_msaa_surface(struct vc4_job *job,
         rsc->writes++;
 }
 
+/**
+ * Records that the job's suballocations are in use until \p seqno, which is
+ * what decides when they can be waited on and reclaimed.
+ *
+ * Another context may be submitting a job using the same suballocation, so
+ * only ever move the seqno forward.
+ */
+static void
+vc4_job_stamp_suballocs(struct vc4_job *job, uint64_t seqno)
+{
+        set_foreach(job->bo_suballocs, entry) {
+                struct vc4_bo *bo = (struct vc4_bo *)entry->key;
+                uint64_t old = bo->seqno;
+
+                while (old < seqno) {
+                        uint64_t prev = p_atomic_cmpxchg(&bo->seqno,
+                                                         old, seqno);
+                        if (prev == old)
+                                break;
+                        old = prev;
+                }
+        }
+}
+
 /**
  * Submits the job to the kernel and then reinitializes it.
  */
 void
 vc4_job_submit(struct vc4_context *vc4, struct vc4_job *job)
 {
+        /* Jobs texturing from what we render to go first.  Submitting each
+         * one removes it from our deps.
+         */
+        while (job->deps && job->deps->entries) {
+                struct set_entry *entry = _mesa_set_next_entry(job->deps,
+                                                               NULL);
+                vc4_job_submit(vc4, (struct vc4_job *)entry->key);
+        }
+
         if (!job->needs_flush)
                 goto done;
 
@@ -499,6 +625,8 @@ vc4_job_submit(struct vc4_context *vc4, struct vc4_job *job)
                         vc4->last_emit_seqno = submit.seqno;
                         if (job->perfmon)
                                 job->perfmon->last_seqno = submit.seqno;
+                        if (job->bo_suballocs)
+                                vc4_job_stamp_suballocs(job, submit.seqno);
                 }
         }
 
@@ -521,6 +649,13 @@ vc4_job_submit(struct vc4_context *vc4, struct vc4_job *job)
 
 done:
         vc4_job_free(vc4, job);
+
+        /* u_threaded_context treats every buffer its batches referenced as
+         * busy until we tell it they have all reached the kernel, which is
+         * only the case once no job is left.
+         */
+        if (!_mesa_hash_table_num_entries(vc4->jobs))
+                tc_driver_internal_flush_notify(vc4->tc);
 }
 
 static bool
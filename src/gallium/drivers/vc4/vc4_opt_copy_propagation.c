@@ -24,12 +24,13 @@
 /**
  * @file vc4_opt_copy_propagation.c
  *
- * This implements simple copy propagation for QIR without control flow.
+ * This implements copy propagation for QIR.
  *
  * For each temp, it keeps a qreg of which source it was MOVed from, if it
- * was.  If we see that used later, we can just reuse the source value, since
- * we know we don't have control flow, and we have SSA for our values so
- * there's no killing to worry about.
+ * was.  If we see that used later, we can just reuse the source value as long
+ * as neither the temp nor the source have been written since.  MOVs from
+ * other blocks are picked up through qir_calculate_available_insts(), which
+ * finds the ones that happened on every path into the block.
  */
 
 #include "vc4_qir.h"
@@ -179,22 +180,51 @@ qir_opt_copy_propagation(struct vc4_compile *c)
         if (!movs)
                 return false;
 
+        struct qir_available_insts *avail =
+                qir_calculate_available_insts(c, is_copy_mov);
+
+        /* The availability was computed from the MOVs' original sources, so
+         * a MOV whose source we propagate into can't be carried into other
+         * blocks anymore.
+         */
+        BITSET_WORD *changed = rzalloc_array(avail, BITSET_WORD,
+                                             BITSET_WORDS(avail->num_insts));
+        uint32_t next_candidate = 0;
+
         qir_for_each_block(block, c) {
-                /* The MOVs array tracks only available movs within the
-                 * block.
+                /* The MOVs array starts with the movs available on every
+                 * path into the block.
                  */
                 memset(movs, 0, sizeof(struct qinst *) * c->num_temps);
+                unsigned i;
+                BITSET_FOREACH_SET(i, avail->block_in[block->index],
+                                   avail->num_insts) {
+                        if (!BITSET_TEST(changed, i))
+                                movs[avail->insts[i]->dst.index] = avail->insts[i];
+                }
 
                 qir_for_each_inst(inst, block) {
-                        progress = try_copy_prop(c, inst, movs) || progress;
+                        bool is_candidate =
+                                (next_candidate < avail->num_insts &&
+                                 avail->insts[next_candidate] == inst);
+
+                        if (try_copy_prop(c, inst, movs)) {
+                                if (is_candidate)
+                                        BITSET_SET(changed, next_candidate);
+                                progress = true;
+                        }
 
                         apply_kills(c, movs, inst);
 
                         if (is_copy_mov(inst))
                                 movs[inst->dst.index] = inst;
+
+                        if (is_candidate)
+                                next_candidate++;
                 }
         }
 
+        ralloc_free(avail);
         ralloc_free(movs);
 
         return progress;
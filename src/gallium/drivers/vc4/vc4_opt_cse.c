@@ -0,0 +1,226 @@
+/*
+ * Copyright © 2017 Broadcom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+/**
+ * @file vc4_opt_cse.c
+ *
+ * Eliminates ALU instructions and immediate loads that recompute a value
+ * which is still held in the destination of an identical earlier
+ * instruction, turning them into MOVs for copy propagation and dead code
+ * elimination to clean up.
+ *
+ * NIR's CSE runs before nir_to_qir(), so it never sees what texturing, I/O
+ * and some ALU ops expand to.  With branching, those expansions repeat in
+ * each block, so this looks across blocks, using the instructions available
+ * on every path into a block.
+ */
+
+#include "vc4_qir.h"
+
+static bool
+is_cse_src(struct qreg src)
+{
+        switch (src.file) {
+        case QFILE_NULL:
+        case QFILE_TEMP:
+        case QFILE_UNIF:
+        case QFILE_SMALL_IMM:
+        case QFILE_LOAD_IMM:
+                return true;
+        default:
+                return false;
+        }
+}
+
+static bool
+is_cse_candidate(struct qinst *inst)
+{
+        switch (inst->op) {
+        case QOP_FADD:
+        case QOP_FSUB:
+        case QOP_FMUL:
+        case QOP_MUL24:
+        case QOP_V8MULD:
+        case QOP_V8MIN:
+        case QOP_V8MAX:
+        case QOP_V8ADDS:
+        case QOP_V8SUBS:
+        case QOP_FMIN:
+        case QOP_FMAX:
+        case QOP_FMINABS:
+        case QOP_FMAXABS:
+        case QOP_FTOI:
+        case QOP_ITOF:
+        case QOP_ADD:
+        case QOP_SUB:
+        case QOP_SHL:
+        case QOP_SHR:
+        case QOP_ASR:
+        case QOP_MIN:
+        case QOP_MIN_NOIMM:
+        case QOP_MAX:
+        case QOP_AND:
+        case QOP_OR:
+        case QOP_XOR:
+        case QOP_NOT:
+        case QOP_LOAD_IMM:
+        case QOP_LOAD_IMM_U2:
+        case QOP_LOAD_IMM_I2:
+                break;
+        default:
+                return false;
+        }
+
+        if (inst->dst.file != QFILE_TEMP || inst->dst.pack ||
+            inst->cond != QPU_COND_ALWAYS || inst->sf) {
+                return false;
+        }
+
+        for (int i = 0; i < qir_get_nsrc(inst); i++) {
+                if (!is_cse_src(inst->src[i]))
+                        return false;
+
+                /* t = t + 1 doesn't leave the value in t. */
+                if (inst->src[i].file == QFILE_TEMP &&
+                    inst->src[i].index == inst->dst.index) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static bool
+is_commutative(enum qop op)
+{
+        switch (op) {
+        case QOP_FADD:
+        case QOP_FMUL:
+        case QOP_MUL24:
+        case QOP_V8MULD:
+        case QOP_V8MIN:
+        case QOP_V8MAX:
+        case QOP_V8ADDS:
+        case QOP_FMIN:
+        case QOP_FMAX:
+        case QOP_FMINABS:
+        case QOP_FMAXABS:
+        case QOP_ADD:
+        case QOP_MIN:
+        case QOP_MAX:
+        case QOP_AND:
+        case QOP_OR:
+        case QOP_XOR:
+                return true;
+        default:
+                return false;
+        }
+}
+
+static bool
+insts_compute_same_value(struct qinst *a, struct qinst *b)
+{
+        if (a->op != b->op)
+                return false;
+
+        int nsrc = qir_get_nsrc(a);
+        bool same = true;
+        for (int i = 0; i < nsrc; i++)
+                same = same && qir_reg_equals(a->src[i], b->src[i]);
+        if (same)
+                return true;
+
+        return (nsrc == 2 && is_commutative(a->op) &&
+                qir_reg_equals(a->src[0], b->src[1]) &&
+                qir_reg_equals(a->src[1], b->src[0]));
+}
+
+bool
+qir_opt_cse(struct vc4_compile *c)
+{
+        bool debug = false;
+        bool progress = false;
+
+        struct qir_available_insts *avail =
+                qir_calculate_available_insts(c, is_cse_candidate);
+        if (!avail->num_insts) {
+                ralloc_free(avail);
+                return false;
+        }
+
+        BITSET_WORD *available = ralloc_array(avail, BITSET_WORD,
+                                              BITSET_WORDS(avail->num_insts));
+        uint32_t next_candidate = 0;
+
+        qir_for_each_block(block, c) {
+                memcpy(available, avail->block_in[block->index],
+                       BITSET_WORDS(avail->num_insts) * sizeof(BITSET_WORD));
+
+                qir_for_each_inst(inst, block) {
+                        if (next_candidate >= avail->num_insts ||
+                            avail->insts[next_candidate] != inst) {
+                                qir_available_insts_kill(avail, available,
+                                                         inst);
+                                continue;
+                        }
+
+                        struct qinst *prev = NULL;
+                        unsigned i;
+                        BITSET_FOREACH_SET(i, available, avail->num_insts) {
+                                if (insts_compute_same_value(avail->insts[i],
+                                                             inst)) {
+                                        prev = avail->insts[i];
+                                        break;
+                                }
+                        }
+
+                        qir_available_insts_kill(avail, available, inst);
+
+                        if (prev) {
+                                if (debug) {
+                                        fprintf(stderr, "CSE: ");
+                                        qir_dump_inst(c, inst);
+                                        fprintf(stderr, "\n");
+                                }
+
+                                /* The rewritten instruction no longer
+                                 * computes its original value, so it isn't
+                                 * made available.
+                                 */
+                                inst->op = QOP_MOV;
+                                inst->src[0] = prev->dst;
+                                inst->src[1] = c->undef;
+                                progress = true;
+                        } else {
+                                BITSET_SET(available, next_candidate);
+                        }
+
+                        next_candidate++;
+                }
+        }
+
+        ralloc_free(avail);
+
+        return progress;
+}
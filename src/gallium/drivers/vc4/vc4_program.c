@@ -48,6 +48,10 @@ ntq_emit_cf_list(struct vc4_compile *c, struct exec_list *list);
 static struct vc4_compiled_shader *
 vc4_get_compiled_shader(struct vc4_context *vc4, enum qstage stage,
                         struct vc4_key *key);
+#ifdef ENABLE_SHADER_CACHE
+static void
+vc4_shader_warm_up(struct vc4_context *vc4, struct vc4_uncompiled_shader *so);
+#endif
 
 static int
 type_size(const struct glsl_type *type, bool bindless)
@@ -82,11 +86,9 @@ ntq_emit_thrsw(struct vc4_compile *c)
         if (!c->fs_threaded)
                 return;
 
-        /* Always thread switch after each texture operation for now.
-         *
-         * We could do better by batching a bunch of texture fetches up and
-         * then doing one thread switch and collecting all their results
-         * afterward.
+        /* Thread switch after each texture operation.  The QIR scheduler
+         * merges the switches of independent fetches, so that they share
+         * one switch and collect all their results afterward.
          */
         qir_emit_nondef(c, qir_inst(QOP_THRSW, c->undef,
                                     c->undef, c->undef));
@@ -2403,6 +2405,7 @@ vc4_shader_ntq(struct vc4_context *vc4, enum qstage stage,
 
         qir_optimize(c);
         qir_lower_uniforms(c);
+        qir_dedup_uniforms(c);
 
         qir_schedule_instructions(c);
         qir_emit_uniform_stream_resets(c);
@@ -2572,6 +2575,10 @@ vc4_shader_state_create(struct pipe_context *pctx,
         so->base.type = PIPE_SHADER_IR_NIR;
         so->base.ir.nir = s;
 
+#ifdef ENABLE_SHADER_CACHE
+        vc4_disk_cache_hash_shader(vc4->screen, so);
+#endif
+
         if (VC4_DBG(NIR)) {
                 fprintf(stderr, "%s prog %d NIR:\n",
                         gl_shader_stage_name(s->info.stage),
@@ -2584,6 +2591,10 @@ vc4_shader_state_create(struct pipe_context *pctx,
                 vc4_shader_precompile(vc4, so);
         }
 
+#ifdef ENABLE_SHADER_CACHE
+        vc4_shader_warm_up(vc4, so);
+#endif
+
         return so;
 }
 
@@ -2607,8 +2618,9 @@ copy_uniform_state_to_shader(struct vc4_compiled_shader *shader,
 }
 
 static void
-vc4_setup_compiled_fs_inputs(struct vc4_context *vc4, struct vc4_compile *c,
-                             struct vc4_compiled_shader *shader)
+vc4_setup_compiled_fs_inputs(struct vc4_compile *c,
+                             struct vc4_compiled_shader *shader,
+                             struct vc4_fs_inputs *fs_inputs)
 {
         struct vc4_fs_inputs inputs;
 
@@ -2649,63 +2661,76 @@ vc4_setup_compiled_fs_inputs(struct vc4_context *vc4, struct vc4_compile *c,
         }
         shader->num_inputs = inputs.num_inputs;
 
+        *fs_inputs = inputs;
+        shader->fs_inputs = fs_inputs;
+}
+
+/**
+ * Points the shader at the context's copy of \p inputs, taking ownership of
+ * inputs->input_slots (which must be ralloced).
+ */
+void
+vc4_set_compiled_fs_inputs(struct vc4_context *vc4,
+                           struct vc4_compiled_shader *shader,
+                           struct vc4_fs_inputs *inputs)
+{
         /* Add our set of inputs to the set of all inputs seen.  This way, we
          * can have a single pointer that identifies an FS inputs set,
          * allowing VS to avoid recompiling when the FS is recompiled (or a
          * new one is bound using separate shader objects) but the inputs
          * don't change.
          */
-        struct set_entry *entry = _mesa_set_search(vc4->fs_inputs_set, &inputs);
+        struct set_entry *entry = _mesa_set_search(vc4->fs_inputs_set, inputs);
         if (entry) {
                 shader->fs_inputs = entry->key;
-                ralloc_free(inputs.input_slots);
+                ralloc_free(inputs->input_slots);
         } else {
                 struct vc4_fs_inputs *alloc_inputs;
 
                 alloc_inputs = rzalloc(vc4->fs_inputs_set, struct vc4_fs_inputs);
-                memcpy(alloc_inputs, &inputs, sizeof(inputs));
-                ralloc_steal(alloc_inputs, inputs.input_slots);
+                memcpy(alloc_inputs, inputs, sizeof(*inputs));
+                ralloc_steal(alloc_inputs, inputs->input_slots);
                 _mesa_set_add(vc4->fs_inputs_set, alloc_inputs);
 
                 shader->fs_inputs = alloc_inputs;
         }
 }
 
+/* Threading hides the latency of each texture fetch behind the other
+ * thread, which is worth more than the extra instruction each spill fill
+ * costs as long as there aren't many more fills than fetches.
+ */
+#define VC4_MAX_FILLS_PER_TMU_FETCH 8
+
+/**
+ * Compiles a variant without touching the context's shader state, so that it
+ * can also run on vc4->precompile_queue.  The shader's FS inputs point at
+ * \p fs_inputs and its QPU code is returned in \p qpu_insts until
+ * vc4_link_shader() gets called on it.
+ */
 static struct vc4_compiled_shader *
-vc4_get_compiled_shader(struct vc4_context *vc4, enum qstage stage,
-                        struct vc4_key *key)
+vc4_compile_shader(struct vc4_context *vc4, enum qstage stage,
+                   struct vc4_key *key, bool try_threading,
+                   struct vc4_fs_inputs *fs_inputs,
+                   void **qpu_insts, uint32_t *qpu_size)
 {
-        struct hash_table *ht;
-        uint32_t key_size;
-        bool try_threading;
-
-        if (stage == QSTAGE_FRAG) {
-                ht = vc4->fs_cache;
-                key_size = sizeof(struct vc4_fs_key);
-                try_threading = vc4->screen->has_threaded_fs;
-        } else {
-                ht = vc4->vs_cache;
-                key_size = sizeof(struct vc4_vs_key);
-                try_threading = false;
-        }
-
         struct vc4_compiled_shader *shader;
-        struct hash_entry *entry = _mesa_hash_table_search(ht, key);
-        if (entry)
-                return entry->data;
-
         struct vc4_compile *c = vc4_shader_ntq(vc4, stage, key, try_threading);
-        /* If the FS failed to compile threaded, fall back to single threaded. */
-        if (try_threading && c->failed) {
+        /* If the FS failed to compile threaded, or only fit in the halved
+         * register file by spilling heavily, fall back to single threaded.
+         */
+        if (try_threading &&
+            (c->failed ||
+             c->stats.fills > (c->stats.tmu_fetches *
+                               VC4_MAX_FILLS_PER_TMU_FETCH))) {
                 qir_compile_destroy(c);
                 c = vc4_shader_ntq(vc4, stage, key, false);
         }
 
         shader = rzalloc(NULL, struct vc4_compiled_shader);
 
-        shader->program_id = vc4->next_compiled_program_id++;
         if (stage == QSTAGE_FRAG) {
-                vc4_setup_compiled_fs_inputs(vc4, c, shader);
+                vc4_setup_compiled_fs_inputs(c, shader, fs_inputs);
 
                 /* Note: the temporary clone in c->s has been freed. */
                 nir_shader *orig_shader = key->shader_state->base.ir.nir;
@@ -2729,15 +2754,204 @@ vc4_get_compiled_shader(struct vc4_context *vc4, enum qstage stage,
                 shader->failed = true;
         } else {
                 copy_uniform_state_to_shader(shader, c);
-                shader->bo = vc4_bo_alloc_shader(vc4->screen, c->qpu_insts,
-                                                 c->qpu_inst_count *
-                                                 sizeof(uint64_t));
         }
 
         shader->fs_threaded = c->fs_threaded;
+        shader->stats = c->stats;
+
+#ifdef ENABLE_SHADER_CACHE
+        vc4_disk_cache_store(vc4->screen, stage, key, shader, c->qpu_insts,
+                             c->qpu_inst_count * sizeof(uint64_t));
+#endif
+
+        ralloc_steal(shader, c->qpu_insts);
+        *qpu_insts = c->qpu_insts;
+        *qpu_size = c->qpu_inst_count * sizeof(uint64_t);
 
         qir_compile_destroy(c);
 
+        return shader;
+}
+
+/**
+ * Finishes a variant from vc4_compile_shader() or the disk cache: gives it a
+ * program ID, interns its FS inputs and uploads (then frees) its QPU code.
+ */
+static void
+vc4_link_shader(struct vc4_context *vc4, enum qstage stage,
+                struct vc4_compiled_shader *shader,
+                struct vc4_fs_inputs *fs_inputs,
+                void *qpu_insts, uint32_t qpu_size)
+{
+        shader->program_id = vc4->next_compiled_program_id++;
+
+        if (stage == QSTAGE_FRAG)
+                vc4_set_compiled_fs_inputs(vc4, shader, fs_inputs);
+
+        if (!shader->failed) {
+                shader->bo = vc4_bo_alloc_shader(vc4->screen, qpu_insts,
+                                                 qpu_size);
+        }
+        ralloc_free(qpu_insts);
+}
+
+#ifdef ENABLE_SHADER_CACHE
+static void
+vc4_precompile_execute(void *data, void *gdata, int thread_index)
+{
+        struct vc4_precompile_job *job = data;
+        struct vc4_context *vc4 = job->vc4;
+
+        job->shader = vc4_disk_cache_retrieve(vc4->screen, job->stage,
+                                              &job->key.base, &job->fs_inputs,
+                                              &job->qpu_insts,
+                                              &job->qpu_size);
+        if (!job->shader) {
+                bool try_threading = (job->stage == QSTAGE_FRAG &&
+                                      vc4->screen->has_threaded_fs);
+                job->shader = vc4_compile_shader(vc4, job->stage,
+                                                 &job->key.base,
+                                                 try_threading,
+                                                 &job->fs_inputs,
+                                                 &job->qpu_insts,
+                                                 &job->qpu_size);
+        }
+}
+
+/**
+ * Queues up the variants of a new shader that earlier runs of the
+ * application used, so that they are ready before its first draw instead of
+ * being compiled in the middle of it.
+ */
+static void
+vc4_shader_warm_up(struct vc4_context *vc4, struct vc4_uncompiled_shader *so)
+{
+        if (!util_queue_is_initialized(&vc4->precompile_queue))
+                return;
+
+        so->precompiles = vc4_disk_cache_find_variants(vc4->screen, so,
+                                                       &so->num_precompiles);
+
+        for (unsigned i = 0; i < so->num_precompiles; i++) {
+                struct vc4_precompile_job *job = &so->precompiles[i];
+
+                job->vc4 = vc4;
+                util_queue_fence_init(&job->fence);
+                util_queue_add_job(&vc4->precompile_queue, job, &job->fence,
+                                   vc4_precompile_execute, NULL, 0);
+        }
+}
+
+/**
+ * Takes the result of the warm-up job for \p key, if there is one, waiting
+ * for it if it hasn't finished yet.
+ */
+static struct vc4_compiled_shader *
+vc4_precompile_claim(struct vc4_context *vc4, enum qstage stage,
+                     struct vc4_key *key, struct vc4_fs_inputs *fs_inputs,
+                     void **qpu_insts, uint32_t *qpu_size)
+{
+        struct vc4_uncompiled_shader *so = key->shader_state;
+
+        if (!so->num_precompiles)
+                return NULL;
+
+        cache_key cache_key;
+        vc4_disk_cache_compute_key(vc4->screen, stage, key, cache_key);
+
+        for (unsigned i = 0; i < so->num_precompiles; i++) {
+                struct vc4_precompile_job *job = &so->precompiles[i];
+
+                if (job->stage != stage ||
+                    memcmp(job->cache_key, cache_key, sizeof(cache_key)) != 0) {
+                        continue;
+                }
+
+                util_queue_fence_wait(&job->fence);
+
+                struct vc4_compiled_shader *shader = job->shader;
+                if (!shader)
+                        return NULL;
+
+                *fs_inputs = job->fs_inputs;
+                if (stage == QSTAGE_FRAG)
+                        shader->fs_inputs = fs_inputs;
+                *qpu_insts = job->qpu_insts;
+                *qpu_size = job->qpu_size;
+                job->shader = NULL;
+
+                return shader;
+        }
+
+        return NULL;
+}
+
+static void
+vc4_precompile_release(struct vc4_uncompiled_shader *so)
+{
+        for (unsigned i = 0; i < so->num_precompiles; i++) {
+                struct vc4_precompile_job *job = &so->precompiles[i];
+
+                util_queue_fence_wait(&job->fence);
+                util_queue_fence_destroy(&job->fence);
+                ralloc_free(job->shader);
+        }
+
+        free(so->precompiles);
+        so->precompiles = NULL;
+        so->num_precompiles = 0;
+}
+#endif /* ENABLE_SHADER_CACHE */
+
+static struct vc4_compiled_shader *
+vc4_get_compiled_shader(struct vc4_context *vc4, enum qstage stage,
+                        struct vc4_key *key)
+{
+        struct hash_table *ht;
+        uint32_t key_size;
+        bool try_threading;
+
+        if (stage == QSTAGE_FRAG) {
+                ht = vc4->fs_cache;
+                key_size = sizeof(struct vc4_fs_key);
+                try_threading = vc4->screen->has_threaded_fs;
+        } else {
+                ht = vc4->vs_cache;
+                key_size = sizeof(struct vc4_vs_key);
+                try_threading = false;
+        }
+
+        struct vc4_compiled_shader *shader = NULL;
+        struct hash_entry *entry = _mesa_hash_table_search(ht, key);
+        if (entry)
+                return entry->data;
+
+        struct vc4_fs_inputs fs_inputs;
+        void *qpu_insts;
+        uint32_t qpu_size;
+
+#ifdef ENABLE_SHADER_CACHE
+        shader = vc4_precompile_claim(vc4, stage, key, &fs_inputs,
+                                      &qpu_insts, &qpu_size);
+        if (!shader) {
+                shader = vc4_disk_cache_retrieve(vc4->screen, stage, key,
+                                                 &fs_inputs, &qpu_insts,
+                                                 &qpu_size);
+        }
+#endif
+
+        if (!shader) {
+                shader = vc4_compile_shader(vc4, stage, key, try_threading,
+                                            &fs_inputs, &qpu_insts,
+                                            &qpu_size);
+        }
+        vc4_link_shader(vc4, stage, shader, &fs_inputs, qpu_insts, qpu_size);
+
+#ifdef ENABLE_SHADER_CACHE
+        if (!shader->failed)
+                vc4_disk_cache_record_variant(vc4->screen, stage, key);
+#endif
+
         struct vc4_key *dup_key;
         dup_key = rzalloc_size(shader, key_size); /* TODO: don't use rzalloc */
         memcpy(dup_key, key, key_size);
@@ -2992,6 +3206,10 @@ vc4_shader_state_delete(struct pipe_context *pctx, void *hwcso)
                                              entry, so);
         }
 
+#ifdef ENABLE_SHADER_CACHE
+        vc4_precompile_release(so);
+#endif
+
         ralloc_free(so->base.ir.nir);
         free(so);
 }
@@ -3032,6 +3250,20 @@ vc4_program_init(struct pipe_context *pctx)
                                                 vs_cache_compare);
         vc4->fs_inputs_set = _mesa_set_create(pctx, fs_inputs_hash,
                                               fs_inputs_compare);
+
+#ifdef ENABLE_SHADER_CACHE
+        /* The warm-up thread compiles with this context's register set, so
+         * allocate it up front rather than racing on it.
+         */
+        if (!VC4_DBG(SHADERDB) && vc4_disk_cache_has_variants(vc4->screen)) {
+                vc4_alloc_reg_set(vc4);
+                /* On failure, the queue is left zeroed and we just don't
+                 * warm anything up.
+                 */
+                util_queue_init(&vc4->precompile_queue, "vc4_precomp", 64, 1,
+                                UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL);
+        }
+#endif
 }
 
 void
@@ -3039,6 +3271,11 @@ vc4_program_fini(struct pipe_context *pctx)
 {
         struct vc4_context *vc4 = vc4_context(pctx);
 
+        if (util_queue_is_initialized(&vc4->precompile_queue)) {
+                util_queue_finish(&vc4->precompile_queue);
+                util_queue_destroy(&vc4->precompile_queue);
+        }
+
         hash_table_foreach(vc4->fs_cache, entry) {
                 struct vc4_compiled_shader *shader = entry->data;
                 vc4_bo_unreference(&shader->bo);
@@ -793,6 +793,32 @@ qir_uniform(struct vc4_compile *c,
         return qir_reg(QFILE_UNIF, uniform);
 }
 
+/**
+ * Returns whether a read of the uniform may be moved to a different
+ * instruction or shared between instructions.
+ *
+ * The kernel's shader validator tracks where the texture setup and UBO
+ * addresses are in the stream relative to the TMU writes using them, so those
+ * have to stay where the compiler put them.
+ */
+bool
+qir_uniform_is_relocatable(enum quniform_contents contents)
+{
+        switch (contents) {
+        case QUNIFORM_TEXTURE_CONFIG_P0:
+        case QUNIFORM_TEXTURE_CONFIG_P1:
+        case QUNIFORM_TEXTURE_CONFIG_P2:
+        case QUNIFORM_TEXTURE_FIRST_LEVEL:
+        case QUNIFORM_TEXTURE_MSAA_ADDR:
+        case QUNIFORM_UBO0_ADDR:
+        case QUNIFORM_UBO1_ADDR:
+        case QUNIFORM_UNIFORMS_ADDRESS:
+                return false;
+        default:
+                return true;
+        }
+}
+
 void
 qir_SF(struct vc4_compile *c, struct qreg src)
 {
@@ -838,6 +864,7 @@ qir_optimize(struct vc4_compile *c)
                 OPTPASS(qir_opt_algebraic);
                 OPTPASS(qir_opt_constant_folding);
                 OPTPASS(qir_opt_copy_propagation);
+                OPTPASS(qir_opt_cse);
                 OPTPASS(qir_opt_peephole_sf);
                 OPTPASS(qir_opt_dead_code);
                 OPTPASS(qir_opt_small_immediates);
@@ -33,7 +33,9 @@
 
 #include "util/macros.h"
 #include "compiler/nir/nir.h"
+#include "util/bitset.h"
 #include "util/list.h"
+#include "util/u_dynarray.h"
 #include "util/u_math.h"
 
 #include "vc4_screen.h"
@@ -382,6 +384,25 @@ struct qblock {
         /** @} */
 };
 
+/**
+ * Static statistics of a compiled shader, as reported by VC4_DEBUG=shaderdb
+ * and kept with the shader for offline tools.
+ */
+struct vc4_shader_stats {
+        uint32_t qpu_inst_count;
+        /** Scheduled cycles, from the QPU scheduler's latency estimates. */
+        uint32_t estimated_cycles;
+        uint32_t num_uniforms;
+        /** TMU lookups issued, counting direct (UBO/indirect) loads. */
+        uint32_t tmu_fetches;
+        /** Maximum number of temporaries live at once. */
+        uint32_t max_temps;
+        uint32_t spills;
+        uint32_t fills;
+        /** Bytes per draw that sharing repeated uniform reads saved. */
+        uint32_t uniform_bytes_saved;
+};
+
 struct vc4_compile {
         struct vc4_context *vc4;
         nir_shader *s;
@@ -465,6 +486,12 @@ struct vc4_compile {
         enum qstage stage;
         uint32_t num_temps;
         uint32_t max_reg_pressure;
+        struct vc4_shader_stats stats;
+        /**
+         * The MOVs qir_dedup_uniforms() added to share a uniform read, which
+         * rematerializing takes back out of stats.uniform_bytes_saved.
+         */
+        struct set *shared_uniform_movs;
 
         struct list_head blocks;
         int next_block_index;
@@ -529,15 +556,42 @@ void qir_remove_instruction(struct vc4_compile *c, struct qinst *qinst);
 struct qreg qir_uniform(struct vc4_compile *c,
                         enum quniform_contents contents,
                         uint32_t data);
+bool qir_uniform_is_relocatable(enum quniform_contents contents);
 void qir_schedule_instructions(struct vc4_compile *c);
 void qir_reorder_uniforms(struct vc4_compile *c);
 void qir_emit_uniform_stream_resets(struct vc4_compile *c);
+void qir_update_uniform_stream_resets(struct vc4_compile *c);
+void qir_dedup_uniforms(struct vc4_compile *c);
 
 struct qreg qir_emit_def(struct vc4_compile *c, struct qinst *inst);
 struct qinst *qir_emit_nondef(struct vc4_compile *c, struct qinst *inst);
 
 struct qreg qir_get_temp(struct vc4_compile *c);
 void qir_calculate_live_intervals(struct vc4_compile *c);
+void qir_free_live_intervals(struct vc4_compile *c);
+
+/**
+ * Result of qir_calculate_available_insts(): which instructions' results are
+ * still valid on entry to each block.
+ */
+struct qir_available_insts {
+        /** The candidate instructions, in program order. */
+        struct qinst **insts;
+        uint32_t num_insts;
+
+        /** Per temp, the candidate indices that a write to it invalidates. */
+        struct util_dynarray *kills;
+        uint32_t num_temps;
+
+        /** Per block index, the candidates available on entry. */
+        BITSET_WORD **block_in;
+};
+
+struct qir_available_insts *
+qir_calculate_available_insts(struct vc4_compile *c,
+                              bool (*is_candidate)(struct qinst *inst));
+void qir_available_insts_kill(const struct qir_available_insts *avail,
+                              BITSET_WORD *set, struct qinst *inst);
 int qir_get_nsrc(struct qinst *inst);
 int qir_get_non_sideband_nsrc(struct qinst *inst);
 int qir_get_tex_uniform_src(struct qinst *inst);
@@ -568,6 +622,7 @@ bool qir_opt_algebraic(struct vc4_compile *c);
 bool qir_opt_coalesce_ff_writes(struct vc4_compile *c);
 bool qir_opt_constant_folding(struct vc4_compile *c);
 bool qir_opt_copy_propagation(struct vc4_compile *c);
+bool qir_opt_cse(struct vc4_compile *c);
 bool qir_opt_dead_code(struct vc4_compile *c);
 bool qir_opt_peephole_sf(struct vc4_compile *c);
 bool qir_opt_small_immediates(struct vc4_compile *c);
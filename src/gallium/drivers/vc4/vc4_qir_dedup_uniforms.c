@@ -0,0 +1,205 @@
+/*
+ * Copyright © 2017 Broadcom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+/**
+ * @file vc4_qir_dedup_uniforms.c
+ *
+ * The QPU reads uniforms sequentially, so qir_reorder_uniforms() gives every
+ * instruction reading a uniform its own slot in the stream, even when several
+ * read the same value.  Every slot is written to the CL for every draw.
+ *
+ * This pass finds uniforms read by more than one instruction in a block and,
+ * when register pressure allows, reads them once into a temp that the other
+ * instructions share.  If the allocator runs short of registers later anyway,
+ * it can still rematerialize the temp back into separate uniform reads.
+ */
+
+#include "util/ralloc.h"
+#include "util/u_dynarray.h"
+#include "vc4_qir.h"
+
+struct uniform_reads {
+        struct qinst *first;
+        int first_ip, last_ip;
+        uint32_t count;
+};
+
+struct uniform_dedup {
+        struct qblock *block;
+        struct qinst *first;
+        uint32_t index;
+};
+
+/* Leave half the register file for the scheduler and for the allocator's
+ * register class restrictions.
+ */
+static int
+max_dedup_pressure(struct vc4_compile *c)
+{
+        return c->fs_threaded ? 16 : 32;
+}
+
+/**
+ * Returns the uniform read by the instruction that we could share with other
+ * instructions, or ~0.
+ */
+static uint32_t
+get_dedup_uniform(struct vc4_compile *c, struct qinst *inst)
+{
+        for (int i = 0; i < qir_get_nsrc(inst); i++) {
+                if (inst->src[i].file != QFILE_UNIF)
+                        continue;
+
+                /* The TMU write itself has to read the texture's implicit
+                 * uniform.
+                 */
+                if (qir_has_implicit_tex_uniform(inst) &&
+                    i == qir_get_tex_uniform_src(inst)) {
+                        continue;
+                }
+
+                if (!qir_uniform_is_relocatable(c->uniform_contents[inst->src[i].index]))
+                        continue;
+
+                return inst->src[i].index;
+        }
+
+        return ~0;
+}
+
+void
+qir_dedup_uniforms(struct vc4_compile *c)
+{
+        if (!c->num_uniforms)
+                return;
+
+        qir_calculate_live_intervals(c);
+
+        int num_ips = 0;
+        qir_for_each_inst_inorder(inst, c)
+                num_ips++;
+
+        /* Register pressure at each instruction, to be raised by each
+         * uniform we decide to keep in a register.
+         */
+        int *pressure = rzalloc_array(c, int, num_ips + 1);
+        for (int i = 0; i < c->num_temps; i++) {
+                if (c->temp_start[i] < c->temp_end[i]) {
+                        pressure[c->temp_start[i]]++;
+                        pressure[c->temp_end[i]]--;
+                }
+        }
+        for (int ip = 1; ip < num_ips; ip++)
+                pressure[ip] += pressure[ip - 1];
+
+        struct uniform_reads *reads =
+                ralloc_array(c, struct uniform_reads, c->num_uniforms);
+        struct util_dynarray dedups;
+        util_dynarray_init(&dedups, c);
+
+        /* Decide on everything first, since adding instructions would move
+         * the IPs that the pressure is tracked by.
+         */
+        int ip = 0;
+        qir_for_each_block(block, c) {
+                memset(reads, 0, sizeof(*reads) * c->num_uniforms);
+
+                qir_for_each_inst(inst, block) {
+                        uint32_t index = get_dedup_uniform(c, inst);
+                        if (index != ~0) {
+                                if (!reads[index].first) {
+                                        reads[index].first = inst;
+                                        reads[index].first_ip = ip;
+                                }
+                                reads[index].last_ip = ip;
+                                reads[index].count++;
+                        }
+                        ip++;
+                }
+
+                for (uint32_t index = 0; index < c->num_uniforms; index++) {
+                        if (reads[index].count < 2)
+                                continue;
+
+                        bool fits = true;
+                        for (int i = reads[index].first_ip;
+                             i < reads[index].last_ip; i++) {
+                                if (pressure[i] + 1 > max_dedup_pressure(c))
+                                        fits = false;
+                        }
+                        if (!fits)
+                                continue;
+
+                        for (int i = reads[index].first_ip;
+                             i < reads[index].last_ip; i++) {
+                                pressure[i]++;
+                        }
+
+                        struct uniform_dedup dedup = {
+                                .block = block,
+                                .first = reads[index].first,
+                                .index = index,
+                        };
+                        util_dynarray_append(&dedups, struct uniform_dedup,
+                                             dedup);
+                }
+        }
+
+        if (util_dynarray_num_elements(&dedups, struct uniform_dedup))
+                c->shared_uniform_movs = _mesa_pointer_set_create(c);
+
+        util_dynarray_foreach(&dedups, struct uniform_dedup, dedup) {
+                struct qreg unif = qir_reg(QFILE_UNIF, dedup->index);
+                struct qinst *mov = qir_inst(QOP_MOV, qir_get_temp(c),
+                                             unif, c->undef);
+                list_addtail(&mov->link, &dedup->first->link);
+                c->defs[mov->dst.index] = mov;
+                _mesa_set_add(c->shared_uniform_movs, mov);
+
+                /* Point the reads after the MOV at its result. */
+                list_for_each_entry_from(struct qinst, inst, dedup->first,
+                                         &dedup->block->instructions, link) {
+                        if (get_dedup_uniform(c, inst) != dedup->index)
+                                continue;
+
+                        for (int i = 0; i < qir_get_nsrc(inst); i++) {
+                                if (inst->src[i].file == QFILE_UNIF &&
+                                    inst->src[i].index == dedup->index) {
+                                        uint8_t pack = inst->src[i].pack;
+                                        inst->src[i] = mov->dst;
+                                        inst->src[i].pack = pack;
+                                }
+                        }
+
+                        /* The MOV reads the uniform once for all of them. */
+                        c->stats.uniform_bytes_saved += 4;
+                }
+                c->stats.uniform_bytes_saved -= 4;
+        }
+
+        util_dynarray_fini(&dedups);
+        ralloc_free(reads);
+        ralloc_free(pressure);
+        qir_free_live_intervals(c);
+}
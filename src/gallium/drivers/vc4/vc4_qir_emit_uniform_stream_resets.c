@@ -71,6 +71,7 @@ qir_emit_uniform_stream_resets(struct vc4_compile *c)
                         struct qinst *add =
                                 qir_inst(QOP_UNIFORMS_RESET, c->undef,
                                          t, uni_addr);
+                        c->defs[t.index] = load_imm;
 
                         /* Pushes to the top of the block, so in reverse
                          * order.
@@ -85,3 +86,26 @@ qir_emit_uniform_stream_resets(struct vc4_compile *c)
                 }
         }
 }
+
+/**
+ * Recomputes the offsets loaded by the uniform stream resets, for when
+ * uniform reads have been added after qir_emit_uniform_stream_resets() (such
+ * as by rematerialization during register allocation).
+ */
+void
+qir_update_uniform_stream_resets(struct vc4_compile *c)
+{
+        uint32_t uniform_count = 0;
+
+        qir_for_each_inst_inorder(inst, c) {
+                if (inst->op == QOP_UNIFORMS_RESET) {
+                        struct qinst *load_imm = c->defs[inst->src[0].index];
+
+                        assert(load_imm && load_imm->op == QOP_LOAD_IMM);
+                        load_imm->src[0].index = (uniform_count + 1) * 4;
+                }
+
+                if (qir_has_uniform_read(inst))
+                        uniform_count++;
+        }
+}
@@ -314,22 +314,196 @@ qir_calculate_live_intervals(struct vc4_compile *c)
 
         qir_compute_start_end(c, c->num_temps);
 
-        if (VC4_DBG(SHADERDB)) {
-                int last_ip = 0;
-                for (int i = 0; i < c->num_temps; i++)
-                        last_ip = MAX2(last_ip, c->temp_end[i]);
-
-                int reg_pressure = 0;
-                int max_reg_pressure = 0;
-                for (int i = 0; i < last_ip; i++) {
-                        for (int j = 0; j < c->num_temps; j++) {
-                                if (c->temp_start[j] == i)
-                                        reg_pressure++;
-                                if (c->temp_end[j] == i)
-                                        reg_pressure--;
+        /* Track the register pressure for the shader stats, by summing the
+         * starts and ends of the live ranges at each instruction.
+         */
+        int last_ip = 0;
+        for (int i = 0; i < c->num_temps; i++)
+                last_ip = MAX2(last_ip, c->temp_end[i]);
+
+        int *pressure_delta = rzalloc_array(c, int, last_ip + 1);
+        for (int i = 0; i < c->num_temps; i++) {
+                if (c->temp_start[i] < last_ip)
+                        pressure_delta[c->temp_start[i]]++;
+                if (c->temp_end[i] >= 0 && c->temp_end[i] < last_ip)
+                        pressure_delta[c->temp_end[i]]--;
+        }
+
+        int reg_pressure = 0;
+        int max_reg_pressure = 0;
+        for (int i = 0; i < last_ip; i++) {
+                reg_pressure += pressure_delta[i];
+                max_reg_pressure = MAX2(max_reg_pressure, reg_pressure);
+        }
+        c->max_reg_pressure = max_reg_pressure;
+
+        ralloc_free(pressure_delta);
+}
+
+/**
+ * Frees the results of qir_calculate_live_intervals(), for when the program
+ * has changed and they need to be calculated again.
+ */
+void
+qir_free_live_intervals(struct vc4_compile *c)
+{
+        ralloc_free(c->temp_start);
+        ralloc_free(c->temp_end);
+        c->temp_start = NULL;
+        c->temp_end = NULL;
+
+        qir_for_each_block(block, c) {
+                ralloc_free(block->def);
+                ralloc_free(block->use);
+                ralloc_free(block->live_in);
+                ralloc_free(block->live_out);
+                block->def = NULL;
+                block->use = NULL;
+                block->live_in = NULL;
+                block->live_out = NULL;
+        }
+}
+
+void
+qir_available_insts_kill(const struct qir_available_insts *avail,
+                         BITSET_WORD *set, struct qinst *inst)
+{
+        if (inst->dst.file != QFILE_TEMP || inst->dst.index >= avail->num_temps)
+                return;
+
+        util_dynarray_foreach(&avail->kills[inst->dst.index], uint32_t, index)
+                BITSET_CLEAR(set, *index);
+}
+
+/**
+ * Computes which of the instructions accepted by \p is_candidate are
+ * available at the start of each block: executed on every path from the
+ * start of the program, with no write since to their destination or to any
+ * temp they read.
+ *
+ * This is the forward counterpart to the liveness dataflow above, for the
+ * cross-block copy propagation and CSE.  The result is allocated out of \p c
+ * and should be freed by the caller.
+ */
+struct qir_available_insts *
+qir_calculate_available_insts(struct vc4_compile *c,
+                              bool (*is_candidate)(struct qinst *inst))
+{
+        struct qir_available_insts *avail =
+                rzalloc(c, struct qir_available_insts);
+        struct util_dynarray insts;
+
+        util_dynarray_init(&insts, avail);
+        avail->num_temps = c->num_temps;
+        avail->kills = ralloc_array(avail, struct util_dynarray,
+                                    c->num_temps);
+        for (uint32_t i = 0; i < c->num_temps; i++)
+                util_dynarray_init(&avail->kills[i], avail);
+
+        qir_for_each_inst_inorder(inst, c) {
+                if (!is_candidate(inst))
+                        continue;
+
+                assert(inst->dst.file == QFILE_TEMP);
+                uint32_t index = avail->num_insts++;
+                util_dynarray_append(&insts, struct qinst *, inst);
+                util_dynarray_append(&avail->kills[inst->dst.index],
+                                     uint32_t, index);
+                for (int i = 0; i < qir_get_nsrc(inst); i++) {
+                        if (inst->src[i].file == QFILE_TEMP) {
+                                util_dynarray_append(&avail->kills[inst->src[i].index],
+                                                     uint32_t, index);
+                        }
+                }
+        }
+        avail->insts = insts.data;
+
+        int bitset_words = BITSET_WORDS(avail->num_insts);
+        void *mem_ctx = ralloc_context(avail);
+        BITSET_WORD **gen = ralloc_array(mem_ctx, BITSET_WORD *,
+                                         c->next_block_index);
+        BITSET_WORD **kill = ralloc_array(mem_ctx, BITSET_WORD *,
+                                          c->next_block_index);
+        BITSET_WORD **out = ralloc_array(mem_ctx, BITSET_WORD *,
+                                         c->next_block_index);
+        avail->block_in = rzalloc_array(avail, BITSET_WORD *,
+                                        c->next_block_index);
+
+        /* Local sets: what each block leaves available, and what it
+         * invalidates from its predecessors.
+         */
+        uint32_t next_candidate = 0;
+        qir_for_each_block(block, c) {
+                int b = block->index;
+
+                gen[b] = rzalloc_array(mem_ctx, BITSET_WORD, bitset_words);
+                kill[b] = rzalloc_array(mem_ctx, BITSET_WORD, bitset_words);
+                out[b] = rzalloc_array(mem_ctx, BITSET_WORD, bitset_words);
+                avail->block_in[b] = rzalloc_array(avail, BITSET_WORD,
+                                                   bitset_words);
+
+                qir_for_each_inst(inst, block) {
+                        qir_available_insts_kill(avail, gen[b], inst);
+
+                        if (inst->dst.file == QFILE_TEMP) {
+                                util_dynarray_foreach(&avail->kills[inst->dst.index],
+                                                      uint32_t, index) {
+                                        BITSET_SET(kill[b], *index);
+                                }
+                        }
+
+                        if (next_candidate < avail->num_insts &&
+                            avail->insts[next_candidate] == inst) {
+                                BITSET_SET(gen[b], next_candidate);
+                                next_candidate++;
                         }
-                        max_reg_pressure = MAX2(max_reg_pressure, reg_pressure);
                 }
-                c->max_reg_pressure = max_reg_pressure;
+
+                /* Everything but the entry starts out optimistically
+                 * available, to be intersected down.
+                 */
+                if (block != qir_entry_block(c) &&
+                    block->predecessors->entries) {
+                        for (uint32_t i = 0; i < avail->num_insts; i++)
+                                BITSET_SET(avail->block_in[b], i);
+                }
+
+                for (int i = 0; i < bitset_words; i++) {
+                        out[b][i] = gen[b][i] | (avail->block_in[b][i] &
+                                                 ~kill[b][i]);
+                }
         }
+
+        bool cont = true;
+        while (cont) {
+                cont = false;
+
+                qir_for_each_block(block, c) {
+                        int b = block->index;
+
+                        if (block == qir_entry_block(c) ||
+                            !block->predecessors->entries) {
+                                continue;
+                        }
+
+                        for (int i = 0; i < bitset_words; i++) {
+                                BITSET_WORD new_in = ~0;
+                                set_foreach(block->predecessors, entry) {
+                                        const struct qblock *pred = entry->key;
+                                        new_in &= out[pred->index][i];
+                                }
+
+                                if (new_in != avail->block_in[b][i]) {
+                                        avail->block_in[b][i] = new_in;
+                                        out[b][i] = gen[b][i] |
+                                                    (new_in & ~kill[b][i]);
+                                        cont = true;
+                                }
+                        }
+                }
+        }
+
+        ralloc_free(mem_ctx);
+
+        return avail;
 }
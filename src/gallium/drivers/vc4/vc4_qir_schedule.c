@@ -34,6 +34,12 @@
  * The goal of scheduling here, before register allocation and conversion to
  * QPU instructions, is to reduce register pressure by reordering instructions
  * to consume values when possible.
+ *
+ * Unless VC4_DEBUG=notexpipe is set, we also software-pipeline texturing:
+ * the coordinates of independent fetches get submitted as early as the TMU
+ * FIFOs allow and their results collected as late as possible, and for
+ * threaded fragment shaders, fetches share a thread switch when they fit in
+ * the thread's half of the FIFOs.
  */
 
 #include "vc4_qir.h"
@@ -62,6 +68,8 @@ struct schedule_state {
 
         uint32_t time;
 
+        bool pipeline_tex;
+
         uint32_t *temp_writes;
 
         BITSET_WORD *temp_live;
@@ -120,11 +128,15 @@ struct schedule_setup_state {
         struct schedule_node *last_uniforms_reset;
         enum direction dir;
 
-	/**
+        /**
          * Texture FIFO tracking.  This is done top-to-bottom, and is used to
          * track the QOP_TEX_RESULTs and add dependencies on previous ones
          * when trying to submit texture coords with TFREQ full or new texture
          * fetches with TXRCV full.
+         *
+         * There's one entry per submitted fetch, plus the one whose
+         * coordinates are being written.  Several fetches may be submitted
+         * before the first of their results is collected.
          */
         struct {
                 struct schedule_node *node;
@@ -132,12 +144,14 @@ struct schedule_setup_state {
         } tex_fifo[8];
         int tfreq_count; /**< Number of texture coords outstanding. */
         int tfrcv_count; /**< Number of texture results outstanding. */
-        int tex_fifo_pos;
+        int tex_fifo_submitted; /**< Fetches submitted, not yet blocked on. */
+        int tex_fifo_results; /**< Of those, the ones with a result node. */
 };
 
 static void
 block_until_tex_result(struct schedule_setup_state *state, struct schedule_node *n)
 {
+        assert(state->tex_fifo_results > 0);
         add_dep(state->dir, state->tex_fifo[0].node, n);
 
         state->tfreq_count -= state->tex_fifo[0].coords;
@@ -145,8 +159,9 @@ block_until_tex_result(struct schedule_setup_state *state, struct schedule_node
 
         memmove(&state->tex_fifo[0],
                 &state->tex_fifo[1],
-                state->tex_fifo_pos * sizeof(state->tex_fifo[0]));
-        state->tex_fifo_pos--;
+                state->tex_fifo_submitted * sizeof(state->tex_fifo[0]));
+        state->tex_fifo_submitted--;
+        state->tex_fifo_results--;
 }
 
 /**
@@ -352,8 +367,15 @@ calculate_forward_deps(struct vc4_compile *c, void *mem_ctx,
                                 state.tfrcv_count++;
                         }
 
-                        state.tex_fifo[state.tex_fifo_pos].coords++;
+                        state.tex_fifo[state.tex_fifo_submitted].coords++;
                         state.tfreq_count++;
+
+                        if (inst->dst.file == QFILE_TEX_S ||
+                            inst->dst.file == QFILE_TEX_S_DIRECT) {
+                                state.tex_fifo_submitted++;
+                                memset(&state.tex_fifo[state.tex_fifo_submitted],
+                                       0, sizeof(state.tex_fifo[0]));
+                        }
                         break;
 
                 default:
@@ -371,11 +393,10 @@ calculate_forward_deps(struct vc4_compile *c, void *mem_ctx,
                          */
                         add_dep(state.dir, state.last_tex_coord, n);
 
-                        state.tex_fifo[state.tex_fifo_pos].node = n;
-
-                        state.tex_fifo_pos++;
-                        memset(&state.tex_fifo[state.tex_fifo_pos], 0,
-                               sizeof(state.tex_fifo[0]));
+                        assert(state.tex_fifo_results <
+                               state.tex_fifo_submitted);
+                        state.tex_fifo[state.tex_fifo_results].node = n;
+                        state.tex_fifo_results++;
                         break;
 
                 case QOP_UNIFORMS_RESET:
@@ -453,6 +474,22 @@ locks_scoreboard(struct qinst *inst)
         }
 }
 
+/**
+ * Returns how eager we are to schedule the instruction when pipelining
+ * texturing.  We schedule bottom-up, so we choose results first to collect
+ * them as late as possible, and coordinates last to submit them as early as
+ * possible.
+ */
+static int
+get_tex_pipeline_priority(struct qinst *inst)
+{
+        if (inst->op == QOP_TEX_RESULT)
+                return 1;
+        if (qir_is_tex(inst))
+                return -1;
+        return 0;
+}
+
 static struct schedule_node *
 choose_instruction(struct schedule_state *state)
 {
@@ -486,6 +523,20 @@ choose_instruction(struct schedule_state *state)
                         continue;
                 }
 
+                if (state->pipeline_tex) {
+                        int tex_priority =
+                                get_tex_pipeline_priority(n->inst);
+                        int chosen_tex_priority =
+                                get_tex_pipeline_priority(chosen->inst);
+
+                        if (tex_priority > chosen_tex_priority) {
+                                chosen = n;
+                                continue;
+                        } else if (tex_priority < chosen_tex_priority) {
+                                continue;
+                        }
+                }
+
                 /* If we would block on the previously chosen node, but would
                  * block less on this one, then prefer it.
                  */
@@ -707,12 +758,171 @@ static void assert_no_color_read(struct schedule_node *n) {
         ralloc_free(seen);
 }
 
+/**
+ * Returns whether the instruction has to stay on its side of a thread switch
+ * (or, for the inputs to texture setup, isn't worth moving across one).
+ */
+static bool
+is_pinned_to_thrsw(struct vc4_compile *c, struct qinst *inst)
+{
+        switch (inst->op) {
+        case QOP_THRSW:
+        case QOP_TEX_RESULT:
+        case QOP_BRANCH:
+        case QOP_VARY_ADD_C:
+        case QOP_TLB_COLOR_READ:
+        case QOP_MS_MASK:
+        case QOP_FRAG_Z:
+        case QOP_FRAG_W:
+        case QOP_ROT_MUL:
+        case QOP_UNIFORMS_RESET:
+                return true;
+        default:
+                break;
+        }
+
+        if (inst->sf || inst->cond != QPU_COND_ALWAYS ||
+            qir_depends_on_flags(inst)) {
+                return true;
+        }
+
+        for (int i = 0; i < qir_get_nsrc(inst); i++) {
+                if (inst->src[i].file == QFILE_VARY ||
+                    inst->src[i].file == QFILE_VPM) {
+                        return true;
+                }
+        }
+
+        if (qir_is_tex(inst))
+                return false;
+
+        /* Only move SSA values, so that we don't need to worry about other
+         * reads or writes of the temp in between.
+         */
+        return (inst->dst.file != QFILE_TEMP ||
+                qir_has_side_effects(c, inst) ||
+                c->defs[inst->dst.index] != inst);
+}
+
+/**
+ * Moves the texture coordinate writes between \p thrsw and \p end, along
+ * with the instructions computing them, to before \p thrsw.
+ *
+ * Returns false without changing anything if they depend on something that
+ * has to stay after \p thrsw, such as one of its texture results.
+ */
+static bool
+hoist_tex_setup(struct vc4_compile *c, struct qinst *thrsw, struct qinst *end)
+{
+        BITSET_WORD *needed = rzalloc_array(NULL, BITSET_WORD,
+                                            BITSET_WORDS(c->num_temps));
+        struct util_dynarray slice;
+        util_dynarray_init(&slice, needed);
+        bool ok = true;
+
+        for (struct qinst *inst = list_entry(end->link.prev, struct qinst,
+                                             link);
+             inst != thrsw;
+             inst = list_entry(inst->link.prev, struct qinst, link)) {
+                if (!qir_is_tex(inst) &&
+                    !(inst->dst.file == QFILE_TEMP &&
+                      BITSET_TEST(needed, inst->dst.index))) {
+                        continue;
+                }
+
+                if (is_pinned_to_thrsw(c, inst)) {
+                        ok = false;
+                        break;
+                }
+
+                for (int i = 0; i < qir_get_nsrc(inst); i++) {
+                        if (inst->src[i].file == QFILE_TEMP)
+                                BITSET_SET(needed, inst->src[i].index);
+                }
+
+                util_dynarray_append(&slice, struct qinst *, inst);
+        }
+
+        if (ok) {
+                /* The slice was collected bottom-up, so pop it to keep the
+                 * original order.
+                 */
+                while (slice.size) {
+                        struct qinst *inst =
+                                util_dynarray_pop(&slice, struct qinst *);
+                        list_del(&inst->link);
+                        list_addtail(&inst->link, &thrsw->link);
+                }
+        }
+
+        ralloc_free(needed);
+
+        return ok;
+}
+
+/**
+ * Makes independent texture fetches in a threaded fragment shader share one
+ * thread switch, so that their latencies overlap.
+ *
+ * nir_to_qir() emits a THRSW between each fetch's coordinate setup and its
+ * result collection.  When a later fetch's coordinates don't depend on the
+ * earlier fetches' results, its setup is moved up to before their THRSW and
+ * its own THRSW is dropped.
+ */
+static void
+merge_thread_switches(struct vc4_compile *c, struct qblock *block)
+{
+        /* A thread may only use half of the per-QPU FIFOs (see
+         * calculate_forward_deps()): four TFREQ slots and two TFRCV
+         * results.
+         */
+        const int max_requests = 2, max_coords = 4;
+
+        struct qinst *group_thrsw = NULL;
+        int group_requests = 0, group_coords = 0;
+        int requests = 0, coords = 0;
+
+        qir_for_each_inst_safe(inst, block) {
+                if (qir_is_tex(inst)) {
+                        coords++;
+                        if (inst->dst.file == QFILE_TEX_S ||
+                            inst->dst.file == QFILE_TEX_S_DIRECT) {
+                                requests++;
+                        }
+                        continue;
+                }
+
+                if (inst->op != QOP_THRSW)
+                        continue;
+
+                if (group_thrsw &&
+                    group_requests + requests <= max_requests &&
+                    group_coords + coords <= max_coords &&
+                    hoist_tex_setup(c, group_thrsw, inst)) {
+                        group_requests += requests;
+                        group_coords += coords;
+                        qir_remove_instruction(c, inst);
+                } else {
+                        group_thrsw = inst;
+                        group_requests = requests;
+                        group_coords = coords;
+                }
+
+                requests = 0;
+                coords = 0;
+        }
+}
+
 static void
 qir_schedule_instructions_block(struct vc4_compile *c,
                                 struct qblock *block)
 {
         struct schedule_state *state = rzalloc(NULL, struct schedule_state);
 
+        state->pipeline_tex = !VC4_DBG(NO_TEX_PIPELINE);
+        if (state->pipeline_tex && c->fs_threaded)
+                merge_thread_switches(c, block);
+
         state->temp_writes = rzalloc_array(state, uint32_t, c->num_temps);
         state->temp_live = rzalloc_array(state, BITSET_WORD,
                                          BITSET_WORDS(c->num_temps));
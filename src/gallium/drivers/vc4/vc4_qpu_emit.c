@@ -680,15 +680,36 @@ vc4_generate_code(struct vc4_context *vc4, struct vc4_compile *c)
 
         cycles += c->qpu_inst_count - inst_count_at_schedule_time;
 
+        c->stats.qpu_inst_count = c->qpu_inst_count;
+        c->stats.estimated_cycles = cycles;
+        c->stats.num_uniforms = c->num_uniforms;
+        c->stats.max_temps = c->max_reg_pressure;
+        for (uint32_t i = 0; i < c->qpu_inst_count; i++) {
+                uint64_t inst = c->qpu_insts[i];
+                if (QPU_GET_FIELD(inst, QPU_SIG) == QPU_SIG_BRANCH)
+                        continue;
+
+                uint32_t waddr_add = QPU_GET_FIELD(inst, QPU_WADDR_ADD);
+                uint32_t waddr_mul = QPU_GET_FIELD(inst, QPU_WADDR_MUL);
+                if (waddr_add == QPU_W_TMU0_S || waddr_add == QPU_W_TMU1_S ||
+                    waddr_mul == QPU_W_TMU0_S || waddr_mul == QPU_W_TMU1_S) {
+                        c->stats.tmu_fetches++;
+                }
+        }
+
         if (VC4_DBG(SHADERDB)) {
                 util_debug_message(&vc4->base.debug, SHADER_INFO,
-                                   "%s shader: %d inst, %d threads, %d uniforms, %d max-temps, %d estimated-cycles",
+                                   "%s shader: %d inst, %d threads, %d uniforms, %d max-temps, %d estimated-cycles, %d tmu-fetches, %d spills, %d fills, %d uniform-bytes-saved",
                                    qir_get_stage_name(c->stage),
                                    c->qpu_inst_count,
                                    1 + c->fs_threaded,
                                    c->num_uniforms,
                                    c->max_reg_pressure,
-                                   cycles);
+                                   cycles,
+                                   c->stats.tmu_fetches,
+                                   c->stats.spills,
+                                   c->stats.fills,
+                                   c->stats.uniform_bytes_saved);
         }
 
         if (VC4_DBG(QPU))
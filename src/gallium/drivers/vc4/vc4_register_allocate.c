@@ -105,7 +105,7 @@ static const struct qpu_reg vc4_regs[] = {
 #define AB_INDEX      (ACC_INDEX + ACC_COUNT)
 #define AB_COUNT      64
 
-static void
+void
 vc4_alloc_reg_set(struct vc4_context *vc4)
 {
         assert(vc4_regs[AB_INDEX].addr == 0);
@@ -242,16 +242,96 @@ vc4_ra_select_callback(unsigned int n, BITSET_WORD *regs, void *data)
 }
 
 /**
- * Returns a mapping from QFILE_TEMP indices to struct qpu_regs.
+ * Returns whether the temp's value can be recomputed at each of its uses
+ * instead of being kept in a register, which is the only kind of spilling we
+ * can do: the kernel's shader validator rejects general VPM DMA and the TMU
+ * can only read, so there's no scratch memory to spill to.
+ */
+static bool
+vc4_is_rematerializable(struct vc4_compile *c, uint32_t temp)
+{
+        struct qinst *def = c->defs[temp];
+
+        if (!def || def->cond != QPU_COND_ALWAYS || def->sf || def->dst.pack)
+                return false;
+
+        switch (def->op) {
+        case QOP_LOAD_IMM:
+        case QOP_LOAD_IMM_U2:
+        case QOP_LOAD_IMM_I2:
+                return true;
+
+        case QOP_MOV:
+        case QOP_FMOV:
+                if (def->src[0].pack)
+                        return false;
+                if (def->src[0].file == QFILE_SMALL_IMM)
+                        return true;
+                return (def->src[0].file == QFILE_UNIF &&
+                        qir_uniform_is_relocatable(c->uniform_contents[def->src[0].index]));
+
+        default:
+                return false;
+        }
+}
+
+/**
+ * "Spills" the temp by re-emitting its definition in front of each
+ * instruction using it, so that it only lives for one instruction at a time.
+ */
+static void
+vc4_rematerialize_temp(struct vc4_compile *c, uint32_t temp)
+{
+        struct qinst *def = c->defs[temp];
+        uint32_t num_fills = 0;
+
+        qir_for_each_inst_inorder(inst, c) {
+                struct qinst *fill = NULL;
+
+                for (int i = 0; i < qir_get_nsrc(inst); i++) {
+                        if (inst->src[i].file != QFILE_TEMP ||
+                            inst->src[i].index != temp) {
+                                continue;
+                        }
+
+                        if (!fill) {
+                                fill = qir_inst(def->op, qir_get_temp(c),
+                                                def->src[0], def->src[1]);
+                                list_addtail(&fill->link, &inst->link);
+                                c->defs[fill->dst.index] = fill;
+                                num_fills++;
+                        }
+
+                        inst->src[i].index = fill->dst.index;
+                }
+        }
+
+        /* Each fill reads the uniform again, undoing what sharing it saved. */
+        if (c->shared_uniform_movs &&
+            _mesa_set_search(c->shared_uniform_movs, def)) {
+                _mesa_set_remove_key(c->shared_uniform_movs, def);
+                c->stats.uniform_bytes_saved -= (num_fills - 1) * 4;
+        }
+
+        c->stats.fills += num_fills;
+        qir_remove_instruction(c, def);
+        c->stats.spills++;
+}
+
+/**
+ * Tries to allocate registers for the current temps.
  *
- * The return value should be freed by the caller.
+ * If the graph can't be colored but a temp could be spilled, this spills it
+ * and sets \p spilled so that the caller tries again.
  */
-struct qpu_reg *
-vc4_register_allocate(struct vc4_context *vc4, struct vc4_compile *c)
+static struct qpu_reg *
+vc4_try_register_allocate(struct vc4_context *vc4, struct vc4_compile *c,
+                          bool *spilled)
 {
         struct node_to_temp_map map[c->num_temps];
         uint32_t temp_to_node[c->num_temps];
         uint8_t class_bits[c->num_temps];
+        uint32_t use_count[c->num_temps];
         struct qpu_reg *temp_registers = calloc(c->num_temps,
                                                 sizeof(*temp_registers));
         struct vc4_ra_select_callback_data callback_data = {
@@ -291,6 +371,7 @@ vc4_register_allocate(struct vc4_context *vc4, struct vc4_compile *c)
         memset(class_bits,
                CLASS_BIT_A | CLASS_BIT_B | CLASS_BIT_R4 | CLASS_BIT_R0_R3,
                sizeof(class_bits));
+        memset(use_count, 0, sizeof(use_count));
 
         int ip = 0;
         qir_for_each_inst_inorder(inst, c) {
@@ -362,6 +443,9 @@ vc4_register_allocate(struct vc4_context *vc4, struct vc4_compile *c)
                  * either A or R4.
                  */
                 for (int i = 0; i < qir_get_nsrc(inst); i++) {
+                        if (inst->src[i].file == QFILE_TEMP)
+                                use_count[inst->src[i].index]++;
+
                         if (inst->src[i].file == QFILE_TEMP &&
                             inst->src[i].pack) {
                                 if (qir_is_float_input(inst)) {
@@ -422,6 +506,18 @@ vc4_register_allocate(struct vc4_context *vc4, struct vc4_compile *c)
                 }
         }
 
+        /* Offer the rematerializable temps for spilling, with each use
+         * costing an instruction.  Temps only living until the next
+         * instruction would gain nothing from it.
+         */
+        for (uint32_t i = 0; i < c->num_temps; i++) {
+                if (c->temp_end[i] - c->temp_start[i] > 1 &&
+                    vc4_is_rematerializable(c, i)) {
+                        ra_set_node_spill_cost(g, temp_to_node[i],
+                                               use_count[i]);
+                }
+        }
+
         for (uint32_t i = 0; i < c->num_temps; i++) {
                 for (uint32_t j = i + 1; j < c->num_temps; j++) {
                         if (!(c->temp_start[i] >= c->temp_end[j] ||
@@ -435,6 +531,15 @@ vc4_register_allocate(struct vc4_context *vc4, struct vc4_compile *c)
 
         bool ok = ra_allocate(g);
         if (!ok) {
+                int node = ra_get_best_spill_node(g);
+                if (node >= 0) {
+                        vc4_rematerialize_temp(c, map[node].temp);
+                        *spilled = true;
+                        ralloc_free(g);
+                        free(temp_registers);
+                        return NULL;
+                }
+
                 if (!c->fs_threaded) {
                         fprintf(stderr, "Failed to register allocate:\n");
                         qir_dump(c);
@@ -459,3 +564,27 @@ vc4_register_allocate(struct vc4_context *vc4, struct vc4_compile *c)
 
         return temp_registers;
 }
+
+/**
+ * Returns a mapping from QFILE_TEMP indices to struct qpu_regs.
+ *
+ * The return value should be freed by the caller.
+ */
+struct qpu_reg *
+vc4_register_allocate(struct vc4_context *vc4, struct vc4_compile *c)
+{
+        while (true) {
+                bool spilled = false;
+                struct qpu_reg *temp_registers =
+                        vc4_try_register_allocate(vc4, c, &spilled);
+                if (!spilled)
+                        return temp_registers;
+
+                /* The fills may have added uniform reads, so renumber the
+                 * stream and point the resets at their new offsets.
+                 */
+                qir_free_live_intervals(c);
+                qir_reorder_uniforms(c);
+                qir_update_uniform_stream_resets(c);
+        }
+}
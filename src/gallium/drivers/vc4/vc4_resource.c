@@ -41,7 +41,7 @@
 static bool
 vc4_resource_bo_alloc(struct vc4_resource *rsc)
 {
-        struct pipe_resource *prsc = &rsc->base;
+        struct pipe_resource *prsc = &rsc->base.b;
         struct pipe_screen *pscreen = prsc->screen;
         struct vc4_bo *bo;
 
@@ -55,11 +55,19 @@ vc4_resource_bo_alloc(struct vc4_resource *rsc)
                         rsc->cube_map_stride * (prsc->array_size - 1));
         }
 
-        bo = vc4_bo_alloc(vc4_screen(pscreen),
-                          rsc->slices[0].offset +
-                          rsc->slices[0].size +
-                          rsc->cube_map_stride * (prsc->array_size - 1),
-                          "resource");
+        uint32_t size = (rsc->slices[0].offset +
+                         rsc->slices[0].size +
+                         rsc->cube_map_stride * (prsc->array_size - 1));
+
+        /* Small buffers get packed into slab BOs, rather than each taking a
+         * page of CMA.  Anything that might be shared needs its own BO.
+         */
+        if (prsc->target == PIPE_BUFFER &&
+            !(prsc->bind & (PIPE_BIND_SHARED | PIPE_BIND_SCANOUT))) {
+                bo = vc4_bo_suballoc(vc4_screen(pscreen), size, "resource");
+        } else {
+                bo = vc4_bo_alloc(vc4_screen(pscreen), size, "resource");
+        }
         if (bo) {
                 vc4_bo_unreference(&rsc->bo);
                 rsc->bo = bo;
@@ -110,10 +118,12 @@ vc4_resource_transfer_map(struct pipe_context *pctx,
         char *buf;
 
         /* Upgrade DISCARD_RANGE to WHOLE_RESOURCE if the whole resource is
-         * being mapped.
+         * being mapped.  u_threaded_context does its own buffer
+         * invalidation, and tells us when we mustn't.
          */
         if ((usage & PIPE_MAP_DISCARD_RANGE) &&
             !(usage & PIPE_MAP_UNSYNCHRONIZED) &&
+            !(usage & TC_TRANSFER_MAP_NO_INVALIDATE) &&
             !(prsc->flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT) &&
             prsc->last_level == 0 &&
             prsc->width0 == box->width &&
@@ -153,13 +163,19 @@ vc4_resource_transfer_map(struct pipe_context *pctx,
                 rsc->initialized_buffers = ~0;
         }
 
-        trans = slab_zalloc(&vc4->transfer_pool);
+        /* Unsynchronized maps under u_threaded_context come from the
+         * application thread, which can't use the driver thread's pool.
+         */
+        if (usage & TC_TRANSFER_MAP_THREADED_UNSYNC)
+                trans = slab_zalloc(&vc4->transfer_pool_unsync);
+        else
+                trans = slab_zalloc(&vc4->transfer_pool);
         if (!trans)
                 return NULL;
 
         /* XXX: Handle DONTBLOCK, DISCARD_RANGE, PERSISTENT, COHERENT. */
 
-        ptrans = &trans->base;
+        ptrans = &trans->base.b;
 
         pipe_resource_reference(&ptrans->resource, prsc);
         ptrans->level = level;
@@ -218,6 +234,36 @@ fail:
         return NULL;
 }
 
+/**
+ * Synchronizes and maps \p rsc's BO for the CPU to store into, for the paths
+ * that write the tiled data straight into the BO instead of going through a
+ * staging transfer.
+ */
+static void *
+vc4_resource_map_for_store(struct vc4_context *vc4, struct vc4_resource *rsc,
+                           unsigned usage)
+{
+        struct pipe_resource *prsc = &rsc->base.b;
+
+        if (usage & PIPE_MAP_DISCARD_WHOLE_RESOURCE) {
+                /* If we failed to reallocate, flush users so that we don't
+                 * violate any syncing requirements.
+                 */
+                if (!vc4_resource_bo_alloc(rsc))
+                        vc4_flush_jobs_reading_resource(vc4, prsc);
+        } else if (!(usage & PIPE_MAP_UNSYNCHRONIZED)) {
+                vc4_flush_jobs_reading_resource(vc4, prsc);
+        }
+
+        rsc->writes++;
+        rsc->initialized_buffers = ~0;
+
+        if (usage & PIPE_MAP_UNSYNCHRONIZED)
+                return vc4_bo_map_unsynchronized(rsc->bo);
+        else
+                return vc4_bo_map(rsc->bo);
+}
+
 static void
 vc4_texture_subdata(struct pipe_context *pctx,
                     struct pipe_resource *prsc,
@@ -228,32 +274,209 @@ vc4_texture_subdata(struct pipe_context *pctx,
                     unsigned stride,
                     unsigned layer_stride)
 {
+        struct vc4_context *vc4 = vc4_context(pctx);
         struct vc4_resource *rsc = vc4_resource(prsc);
         struct vc4_resource_slice *slice = &rsc->slices[level];
+        struct vc4_tiled_level faces[6];
 
         /* For a direct mapping, we can just take the u_transfer path. */
-        if (!rsc->tiled ||
-            box->depth != 1 ||
-            (usage & PIPE_MAP_DISCARD_WHOLE_RESOURCE)) {
+        if (!rsc->tiled || box->depth > ARRAY_SIZE(faces)) {
                 return u_default_texture_subdata(pctx, prsc, level, usage, box,
                                                  data, stride, layer_stride);
         }
 
-        /* Otherwise, map and store the texture data directly into the tiled
-         * texture.
+        /* Otherwise, store the texture data directly into the tiled
+         * texture, without a staging copy.
          */
-        void *buf;
-        if (usage & PIPE_MAP_UNSYNCHRONIZED)
-                buf = vc4_bo_map_unsynchronized(rsc->bo);
-        else
-                buf = vc4_bo_map(rsc->bo);
+        struct pipe_box blocks;
+        u_box_pixels_to_blocks(&blocks, box, prsc->format);
+
+        for (int i = 0; i < box->depth; i++) {
+                faces[i] = (struct vc4_tiled_level) {
+                        .offset = (slice->offset +
+                                   (box->z + i) * rsc->cube_map_stride),
+                        .stride = slice->stride,
+                        .tiling = slice->tiling,
+                        .src = data + i * layer_stride,
+                        .src_stride = stride,
+                        .box = blocks,
+                };
+        }
+
+        void *buf = vc4_resource_map_for_store(vc4, rsc, usage);
+        if (!buf) {
+                fprintf(stderr, "Failed to map bo\n");
+                return;
+        }
+
+        vc4_store_tiled_levels(buf, rsc->cpp, faces, box->depth);
+}
+
+/**
+ * Averages 2x2 blocks of the linear \p src level into the next level down,
+ * clamping at the edges of NPOT levels.  \p rows is scratch space for three
+ * rows of \p src_w RGBA floats.
+ */
+static void
+vc4_downsample_level(enum pipe_format format, int cpp,
+                     const uint8_t *src, uint32_t src_w, uint32_t src_h,
+                     uint8_t *dst, uint32_t dst_w, uint32_t dst_h,
+                     float *rows)
+{
+        float *row0 = rows;
+        float *row1 = rows + src_w * 4;
+        float *out = rows + src_w * 8;
+
+        for (uint32_t y = 0; y < dst_h; y++) {
+                uint32_t y0 = MIN2(y * 2, src_h - 1);
+                uint32_t y1 = MIN2(y * 2 + 1, src_h - 1);
+
+                util_format_unpack_rgba(format, row0,
+                                        src + y0 * src_w * cpp, src_w);
+                util_format_unpack_rgba(format, row1,
+                                        src + y1 * src_w * cpp, src_w);
+
+                for (uint32_t x = 0; x < dst_w; x++) {
+                        uint32_t x0 = MIN2(x * 2, src_w - 1);
+                        uint32_t x1 = MIN2(x * 2 + 1, src_w - 1);
+
+                        for (int c = 0; c < 4; c++) {
+                                out[x * 4 + c] = 0.25f * (row0[x0 * 4 + c] +
+                                                          row0[x1 * 4 + c] +
+                                                          row1[x0 * 4 + c] +
+                                                          row1[x1 * 4 + c]);
+                        }
+                }
+
+                util_format_pack_rgba(format, dst + y * dst_w * cpp,
+                                      out, dst_w);
+        }
+}
+
+/**
+ * Generates mipmaps on the CPU for the formats that the blitter can't render
+ * to, such as RGBA4444 and the luminance/alpha formats.
+ *
+ * Those would otherwise fall back to Mesa's software mipmap generation, which
+ * maps each level separately through a staging transfer.  Here the base level
+ * is untiled once, the chain is filtered in a single linear allocation, and
+ * all the new levels are tiled straight into the BO in one pass.
+ */
+static bool
+vc4_generate_mipmap(struct pipe_context *pctx,
+                    struct pipe_resource *prsc,
+                    enum pipe_format format,
+                    unsigned int base_level,
+                    unsigned int last_level,
+                    unsigned int first_layer,
+                    unsigned int last_layer)
+{
+        struct vc4_context *vc4 = vc4_context(pctx);
+        struct vc4_resource *rsc = vc4_resource(prsc);
+        struct pipe_screen *pscreen = pctx->screen;
+        const struct util_format_unpack_description *unpack =
+                util_format_unpack_description(format);
+
+        /* Leave anything util_gen_mipmap() can render to the GPU. */
+        if (format != prsc->format ||
+            !rsc->tiled ||
+            prsc->nr_samples > 1 ||
+            base_level >= last_level ||
+            util_format_is_compressed(format) ||
+            util_format_is_depth_or_stencil(format) ||
+            util_format_is_pure_integer(format) ||
+            util_format_is_srgb(format) ||
+            !unpack || !unpack->unpack_rgba ||
+            !util_format_pack_description(format)->pack_rgba_float ||
+            pscreen->is_format_supported(pscreen, format, prsc->target, 0, 0,
+                                         PIPE_BIND_RENDER_TARGET)) {
+                return false;
+        }
+
+        int cpp = rsc->cpp;
+        uint32_t base_w = u_minify(prsc->width0, base_level);
+        uint32_t base_h = u_minify(prsc->height0, base_level);
+
+        /* Offsets of each level within the linear copy of the chain. */
+        uint32_t linear_offset[VC4_MAX_MIP_LEVELS];
+        size_t chain_size = 0;
+        for (unsigned l = base_level; l <= last_level; l++) {
+                linear_offset[l] = chain_size;
+                chain_size += (u_minify(prsc->width0, l) *
+                               u_minify(prsc->height0, l) * cpp);
+        }
+
+        uint8_t *chain = malloc(chain_size);
+        float *rows = malloc(base_w * 3 * 4 * sizeof(float));
+        if (!chain || !rows) {
+                free(chain);
+                free(rows);
+                return false;
+        }
+
+        perf_debug("Generating %dx%d %s mipmaps on the CPU\n",
+                   base_w, base_h, util_format_short_name(format));
+
+        /* We read the base level and replace the rest. */
+        uint8_t *buf = vc4_resource_map_for_store(vc4, rsc, 0);
+        if (!buf) {
+                fprintf(stderr, "Failed to map bo\n");
+                free(chain);
+                free(rows);
+                return false;
+        }
 
-        vc4_store_tiled_image(buf + slice->offset +
-                              box->z * rsc->cube_map_stride,
-                              slice->stride,
-                              (void *)data, stride,
-                              slice->tiling, rsc->cpp,
-                              box);
+        for (unsigned layer = first_layer; layer <= last_layer; layer++) {
+                uint8_t *layer_map = buf + layer * rsc->cube_map_stride;
+                struct vc4_resource_slice *base = &rsc->slices[base_level];
+                struct pipe_box box;
+
+                u_box_2d(0, 0, base_w, base_h, &box);
+                vc4_load_tiled_image(chain, base_w * cpp,
+                                     layer_map + base->offset, base->stride,
+                                     base->tiling, cpp, &box);
+
+                struct vc4_tiled_level levels[VC4_MAX_MIP_LEVELS];
+                unsigned num_levels = 0;
+                for (unsigned l = base_level + 1; l <= last_level; l++) {
+                        uint32_t src_w = u_minify(prsc->width0, l - 1);
+                        uint32_t src_h = u_minify(prsc->height0, l - 1);
+                        uint32_t w = u_minify(prsc->width0, l);
+                        uint32_t h = u_minify(prsc->height0, l);
+
+                        vc4_downsample_level(format, cpp,
+                                             chain + linear_offset[l - 1],
+                                             src_w, src_h,
+                                             chain + linear_offset[l], w, h,
+                                             rows);
+                }
+
+                /* The smaller levels come first in the BO. */
+                for (unsigned l = last_level; l > base_level; l--) {
+                        struct vc4_resource_slice *slice = &rsc->slices[l];
+                        struct vc4_tiled_level *level = &levels[num_levels++];
+
+                        *level = (struct vc4_tiled_level) {
+                                .offset = (slice->offset +
+                                           layer * rsc->cube_map_stride),
+                                .stride = slice->stride,
+                                .tiling = slice->tiling,
+                                .src = chain + linear_offset[l],
+                                .src_stride = u_minify(prsc->width0, l) * cpp,
+                        };
+                        u_box_2d(0, 0,
+                                 u_minify(prsc->width0, l),
+                                 u_minify(prsc->height0, l),
+                                 &level->box);
+                }
+
+                vc4_store_tiled_levels(buf, cpp, levels, num_levels);
+        }
+
+        free(chain);
+        free(rows);
+
+        return true;
 }
 
 static void
@@ -267,6 +490,12 @@ vc4_resource_destroy(struct pipe_screen *pscreen,
         if (rsc->scanout)
                 renderonly_scanout_destroy(rsc->scanout, screen->ro);
 
+        if (rsc->base.buffer_id_unique) {
+                util_idalloc_mt_free(&screen->buffer_ids,
+                                     rsc->base.buffer_id_unique);
+        }
+        threaded_resource_deinit(prsc);
+
         free(rsc);
 }
 
@@ -289,6 +518,10 @@ vc4_resource_get_handle(struct pipe_screen *pscreen,
         struct vc4_screen *screen = vc4_screen(pscreen);
         struct vc4_resource *rsc = vc4_resource(prsc);
 
+        /* Suballocated buffers can't be handed out. */
+        if (rsc->bo->parent)
+                return false;
+
         whandle->stride = rsc->slices[0].stride;
         whandle->offset = 0;
         whandle->modifier = vc4_resource_modifier(rsc);
@@ -298,6 +531,7 @@ vc4_resource_get_handle(struct pipe_screen *pscreen,
          * the ones seeing it (like BO caching or shadow update avoidance).
          */
         rsc->bo->private = false;
+        rsc->base.is_shared = true;
 
         switch (whandle->type) {
         case WINSYS_HANDLE_TYPE_SHARED:
@@ -353,7 +587,7 @@ vc4_resource_get_param(struct pipe_screen *pscreen,
 static void
 vc4_setup_slices(struct vc4_resource *rsc, const char *caller)
 {
-        struct pipe_resource *prsc = &rsc->base;
+        struct pipe_resource *prsc = &rsc->base.b;
         uint32_t width = prsc->width0;
         uint32_t height = prsc->height0;
         if (prsc->format == PIPE_FORMAT_ETC1_RGB8) {
@@ -456,13 +690,19 @@ vc4_resource_setup(struct pipe_screen *pscreen,
         struct vc4_resource *rsc = CALLOC_STRUCT(vc4_resource);
         if (!rsc)
                 return NULL;
-        struct pipe_resource *prsc = &rsc->base;
+        struct pipe_resource *prsc = &rsc->base.b;
 
         *prsc = *tmpl;
 
         pipe_reference_init(&prsc->reference, 1);
         prsc->screen = pscreen;
 
+        threaded_resource_init(prsc, false);
+        if (prsc->target == PIPE_BUFFER) {
+                rsc->base.buffer_id_unique =
+                        util_idalloc_mt_alloc(&vc4_screen(pscreen)->buffer_ids);
+        }
+
         if (prsc->nr_samples <= 1)
                 rsc->cpp = util_format_get_blocksize(tmpl->format);
         else
@@ -501,7 +741,7 @@ vc4_resource_create_with_modifiers(struct pipe_screen *pscreen,
 {
         struct vc4_screen *screen = vc4_screen(pscreen);
         struct vc4_resource *rsc = vc4_resource_setup(pscreen, tmpl);
-        struct pipe_resource *prsc = &rsc->base;
+        struct pipe_resource *prsc = &rsc->base.b;
         bool linear_ok = drm_find_modifier(DRM_FORMAT_MOD_LINEAR, modifiers, count);
         /* Use a tiled layout if we can, for better 3D performance. */
         bool should_tile = true;
@@ -618,7 +858,7 @@ vc4_resource_from_handle(struct pipe_screen *pscreen,
 {
         struct vc4_screen *screen = vc4_screen(pscreen);
         struct vc4_resource *rsc = vc4_resource_setup(pscreen, tmpl);
-        struct pipe_resource *prsc = &rsc->base;
+        struct pipe_resource *prsc = &rsc->base.b;
         struct vc4_resource_slice *slice = &rsc->slices[0];
 
         if (!rsc)
@@ -640,6 +880,8 @@ vc4_resource_from_handle(struct pipe_screen *pscreen,
         if (!rsc->bo)
                 goto fail;
 
+        rsc->base.is_shared = true;
+
         struct drm_vc4_get_tiling get_tiling = {
                 .handle = rsc->bo->handle,
         };
@@ -1024,16 +1266,16 @@ vc4_update_shadow_baselevel_texture(struct pipe_context *pctx,
                 return;
 
         perf_debug("Updating %dx%d@%d shadow texture due to %s\n",
-                   orig->base.width0, orig->base.height0,
+                   orig->base.b.width0, orig->base.b.height0,
                    pview->u.tex.first_level,
                    pview->u.tex.first_level ? "base level" : "raster layout");
 
-        for (int i = 0; i <= shadow->base.last_level; i++) {
-                unsigned width = u_minify(shadow->base.width0, i);
-                unsigned height = u_minify(shadow->base.height0, i);
+        for (int i = 0; i <= shadow->base.b.last_level; i++) {
+                unsigned width = u_minify(shadow->base.b.width0, i);
+                unsigned height = u_minify(shadow->base.b.height0, i);
                 struct pipe_blit_info info = {
                         .dst = {
-                                .resource = &shadow->base,
+                                .resource = &shadow->base.b,
                                 .level = i,
                                 .box = {
                                         .x = 0,
@@ -1043,10 +1285,10 @@ vc4_update_shadow_baselevel_texture(struct pipe_context *pctx,
                                         .height = height,
                                         .depth = 1,
                                 },
-                                .format = shadow->base.format,
+                                .format = shadow->base.b.format,
                         },
                         .src = {
-                                .resource = &orig->base,
+                                .resource = &orig->base.b,
                                 .level = pview->u.tex.first_level + i,
                                 .box = {
                                         .x = 0,
@@ -1056,7 +1298,7 @@ vc4_update_shadow_baselevel_texture(struct pipe_context *pctx,
                                         .height = height,
                                         .depth = 1,
                                 },
-                                .format = orig->base.format,
+                                .format = orig->base.b.format,
                         },
                         .mask = ~0,
                 };
@@ -1099,7 +1341,7 @@ vc4_get_shadow_index_buffer(struct pipe_context *pctx,
         if (info->has_user_indices) {
                 src = (uint32_t*)((char*)info->index.user + offset);
         } else {
-                src = pipe_buffer_map_range(pctx, &orig->base,
+                src = pipe_buffer_map_range(pctx, &orig->base.b,
                                             offset,
                                             count * 4,
                                             PIPE_MAP_READ, &src_transfer);
@@ -1117,6 +1359,73 @@ vc4_get_shadow_index_buffer(struct pipe_context *pctx,
         return shadow_rsc;
 }
 
+/**
+ * Replaces the storage of \p pdst with the freshly allocated \p psrc.
+ *
+ * This is how u_threaded_context invalidates a busy buffer: it allocates the
+ * new storage on the application thread and has us swap it in when the
+ * driver thread gets to that point in the command stream.
+ */
+void
+vc4_replace_buffer_storage(struct pipe_context *pctx,
+                           struct pipe_resource *pdst,
+                           struct pipe_resource *psrc,
+                           unsigned num_rebinds,
+                           uint32_t rebind_mask,
+                           uint32_t delete_buffer_id)
+{
+        struct vc4_context *vc4 = vc4_context(pctx);
+        struct vc4_resource *dst = vc4_resource(pdst);
+        struct vc4_resource *src = vc4_resource(psrc);
+
+        assert(pdst->target == PIPE_BUFFER);
+        assert(psrc->target == PIPE_BUFFER);
+        assert(memcmp(dst->slices, src->slices, sizeof(dst->slices)) == 0);
+
+        util_idalloc_mt_free(&vc4->screen->buffer_ids, delete_buffer_id);
+
+        /* Jobs already referencing the old BO keep their own reference to
+         * it, so we only need to point later state emission at the new one.
+         */
+        vc4_bo_unreference(&dst->bo);
+        dst->bo = vc4_bo_reference(src->bo);
+        dst->writes++;
+
+        if (num_rebinds) {
+                if (rebind_mask & BITFIELD_BIT(TC_BINDING_VERTEX_BUFFER))
+                        vc4->dirty |= VC4_DIRTY_VTXBUF;
+                if (rebind_mask & (BITFIELD_BIT(TC_BINDING_UBO_VS) |
+                                   BITFIELD_BIT(TC_BINDING_UBO_FS))) {
+                        vc4->dirty |= VC4_DIRTY_CONSTBUF;
+                }
+        }
+}
+
+/**
+ * Returns whether a map of \p prsc with \p usage would have to wait for the
+ * GPU.
+ *
+ * u_threaded_context only asks about buffers that no batch since our last
+ * tc_driver_internal_flush_notify() references, and we only notify it once
+ * all our jobs are submitted, so the kernel's view of the BO is all we need
+ * to check.
+ */
+bool
+vc4_resource_busy(struct pipe_screen *pscreen,
+                  struct pipe_resource *prsc,
+                  unsigned usage)
+{
+        struct vc4_resource *rsc = vc4_resource(prsc);
+
+        /* Nothing we submit writes to a buffer, so only a CPU write has to
+         * wait for the GPU's reads to finish.
+         */
+        if (!(usage & PIPE_MAP_WRITE))
+                return false;
+
+        return !vc4_bo_wait(rsc->bo, 0, NULL);
+}
+
 static const struct u_transfer_vtbl transfer_vtbl = {
         .resource_create          = vc4_resource_create,
         .resource_destroy         = vc4_resource_destroy,
@@ -1162,6 +1471,7 @@ vc4_resource_context_init(struct pipe_context *pctx)
         pctx->texture_unmap = u_transfer_helper_transfer_unmap;
         pctx->buffer_subdata = u_default_buffer_subdata;
         pctx->texture_subdata = vc4_texture_subdata;
+        pctx->generate_mipmap = vc4_generate_mipmap;
         pctx->create_surface = vc4_create_surface;
         pctx->surface_destroy = vc4_surface_destroy;
         pctx->resource_copy_region = util_resource_copy_region;
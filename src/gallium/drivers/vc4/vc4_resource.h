@@ -27,10 +27,11 @@
 
 #include "vc4_screen.h"
 #include "kernel/vc4_packet.h"
+#include "util/u_threaded_context.h"
 #include "util/u_transfer.h"
 
 struct vc4_transfer {
-        struct pipe_transfer base;
+        struct threaded_transfer base;
         void *map;
 };
 
@@ -49,7 +50,7 @@ struct vc4_surface {
 };
 
 struct vc4_resource {
-        struct pipe_resource base;
+        struct threaded_resource base;
         struct vc4_bo *bo;
         struct renderonly_scanout *scanout;
         struct vc4_resource_slice slices[VC4_MAX_MIP_LEVELS];
@@ -110,5 +111,14 @@ struct pipe_resource *vc4_get_shadow_index_buffer(struct pipe_context *pctx,
                                                   uint32_t count,
                                                   uint32_t *shadow_offset);
 void vc4_dump_surface(struct pipe_surface *psurf);
+void vc4_replace_buffer_storage(struct pipe_context *pctx,
+                                struct pipe_resource *pdst,
+                                struct pipe_resource *psrc,
+                                unsigned num_rebinds,
+                                uint32_t rebind_mask,
+                                uint32_t delete_buffer_id);
+bool vc4_resource_busy(struct pipe_screen *pscreen,
+                       struct pipe_resource *prsc,
+                       unsigned usage);
 
 #endif /* VC4_RESOURCE_H */
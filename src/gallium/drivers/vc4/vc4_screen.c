@@ -34,6 +34,7 @@
 #include "util/u_screen.h"
 #include "util/u_transfer_helper.h"
 #include "util/ralloc.h"
+#include "util/xmlconfig.h"
 
 #include <xf86drm.h>
 #include "drm-uapi/drm_fourcc.h"
@@ -65,6 +66,10 @@ static const struct debug_named_value vc4_debug_options[] = {
           "Flush after each draw call" },
         { "always_sync", VC4_DEBUG_ALWAYS_SYNC,
           "Wait for finish after each flush" },
+        { "cache", VC4_DEBUG_CACHE,
+          "Print on-disk shader cache events" },
+        { "notexpipe", VC4_DEBUG_NO_TEX_PIPELINE,
+          "Don't software-pipeline texture fetches when scheduling" },
 #ifdef USE_VC4_SIMULATOR
         { "dump", VC4_DEBUG_DUMP,
           "Write a GPU command stream trace file" },
@@ -104,6 +109,7 @@ vc4_screen_destroy(struct pipe_screen *pscreen)
         _mesa_hash_table_destroy(screen->bo_handles, NULL);
         vc4_bufmgr_destroy(pscreen);
         slab_destroy_parent(&screen->transfer_pool);
+        util_idalloc_mt_fini(&screen->buffer_ids);
         if (screen->ro)
                 screen->ro->destroy(screen->ro);
 
@@ -113,10 +119,22 @@ vc4_screen_destroy(struct pipe_screen *pscreen)
 
         u_transfer_helper_destroy(pscreen->transfer_helper);
 
+#ifdef ENABLE_SHADER_CACHE
+        vc4_disk_cache_fini(screen);
+#endif
+
         close(screen->fd);
         ralloc_free(pscreen);
 }
 
+static struct disk_cache *
+vc4_screen_get_disk_shader_cache(struct pipe_screen *pscreen)
+{
+        struct vc4_screen *screen = vc4_screen(pscreen);
+
+        return screen->disk_cache;
+}
+
 static bool
 vc4_has_feature(struct vc4_screen *screen, uint32_t feature)
 {
@@ -146,6 +164,7 @@ vc4_screen_get_param(struct pipe_screen *pscreen, enum pipe_cap param)
         case PIPE_CAP_TEXTURE_SWIZZLE:
         case PIPE_CAP_TEXTURE_BARRIER:
         case PIPE_CAP_TGSI_TEXCOORD:
+        case PIPE_CAP_GENERATE_MIPMAP:
                 return 1;
 
         case PIPE_CAP_NATIVE_FENCE_FD:
@@ -568,6 +587,8 @@ vc4_screen_create(int fd, const struct pipe_screen_config *config,
         list_inithead(&screen->bo_cache.time_list);
         (void) mtx_init(&screen->bo_handles_mutex, mtx_plain);
         screen->bo_handles = util_hash_table_create_ptr_keys();
+        if (!vc4_bufmgr_init(screen))
+                goto fail;
 
         screen->has_control_flow =
                 vc4_has_feature(screen, DRM_VC4_PARAM_SUPPORTS_BRANCHES);
@@ -588,6 +609,15 @@ vc4_screen_create(int fd, const struct pipe_screen_config *config,
                 goto fail;
 
         slab_create_parent(&screen->transfer_pool, sizeof(struct vc4_transfer), 16);
+        util_idalloc_mt_init_tc(&screen->buffer_ids);
+
+        /* We have to driCheckOption for the simulator mode to not assertion
+         * fail on not having our XML config.
+         */
+        const char *threaded_name = "vc4_threaded_context";
+        screen->threaded_context =
+                driCheckOption(config->options, threaded_name, DRI_BOOL) &&
+                driQueryOptionb(config->options, threaded_name);
 
         vc4_fence_screen_init(screen);
 
@@ -599,10 +629,15 @@ vc4_screen_create(int fd, const struct pipe_screen_config *config,
 
         vc4_resource_screen_init(pscreen);
 
+#ifdef ENABLE_SHADER_CACHE
+        vc4_disk_cache_init(screen);
+#endif
+
         pscreen->get_name = vc4_screen_get_name;
         pscreen->get_vendor = vc4_screen_get_vendor;
         pscreen->get_device_vendor = vc4_screen_get_vendor;
         pscreen->get_compiler_options = vc4_screen_get_compiler_options;
+        pscreen->get_disk_shader_cache = vc4_screen_get_disk_shader_cache;
         pscreen->query_dmabuf_modifiers = vc4_screen_query_dmabuf_modifiers;
         pscreen->is_dmabuf_modifier_supported = vc4_screen_is_dmabuf_modifier_supported;
 
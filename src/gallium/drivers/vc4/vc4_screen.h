@@ -28,8 +28,14 @@
 #include "renderonly/renderonly.h"
 #include "util/u_thread.h"
 #include "frontend/drm_driver.h"
+#include "pipebuffer/pb_slab.h"
+#include "util/blob.h"
+#include "util/disk_cache.h"
 #include "util/list.h"
+#include "util/simple_mtx.h"
 #include "util/slab.h"
+#include "util/u_dynarray.h"
+#include "util/u_idalloc.h"
 
 #ifndef DRM_VC4_PARAM_SUPPORTS_ETC1
 #define DRM_VC4_PARAM_SUPPORTS_ETC1		4
@@ -53,6 +59,8 @@ extern uint32_t vc4_mesa_debug;
 #define VC4_DEBUG_NIR       0x0200
 #define VC4_DEBUG_DUMP      0x0400
 #define VC4_DEBUG_SURFACE   0x0800
+#define VC4_DEBUG_CACHE     0x1000
+#define VC4_DEBUG_NO_TEX_PIPELINE 0x2000
 
 #define VC4_MAX_MIP_LEVELS 12
 #define VC4_MAX_TEXTURE_SAMPLERS 16
@@ -78,6 +86,9 @@ struct vc4_screen {
 
         struct slab_parent_pool transfer_pool;
 
+        /** IDs of PIPE_BUFFER resources, for u_threaded_context. */
+        struct util_idalloc_mt buffer_ids;
+
         struct vc4_bo_cache {
                 /** List of struct vc4_bo freed, by age. */
                 struct list_head time_list;
@@ -91,6 +102,9 @@ struct vc4_screen {
                 uint32_t bo_count;
         } bo_cache;
 
+        /** Slabs that small buffers are suballocated from. */
+        struct pb_slabs bo_slabs;
+
         struct hash_table *bo_handles;
         mtx_t bo_handles_mutex;
 
@@ -104,8 +118,23 @@ struct vc4_screen {
         bool has_tiling_ioctl;
         bool has_perfmon_ioctl;
         bool has_syncobj;
+        /** Whether contexts get wrapped in u_threaded_context (driconf). */
+        bool threaded_context;
 
         struct vc4_simulator_file *sim_file;
+
+        struct disk_cache *disk_cache;
+
+        /**
+         * Serialized variant keys this application has compiled, loaded
+         * from and written back to the disk cache under
+         * variant_records_key, plus an index of them.
+         */
+        struct blob variant_records;
+        struct util_dynarray variant_index;
+        cache_key variant_records_key;
+        bool variant_records_enabled;
+        simple_mtx_t variant_lock;
 };
 
 static inline struct vc4_screen *
@@ -126,6 +155,14 @@ vc4_screen_get_compiler_options(struct pipe_screen *pscreen,
 void
 vc4_fence_screen_init(struct vc4_screen *screen);
 
+#ifdef ENABLE_SHADER_CACHE
+void
+vc4_disk_cache_init(struct vc4_screen *screen);
+
+void
+vc4_disk_cache_fini(struct vc4_screen *screen);
+#endif
+
 struct vc4_fence *
 vc4_fence_create(struct vc4_screen *screen, uint64_t seqno, int fd);
 
@@ -241,3 +241,102 @@ vc4_store_tiled_image(void *dst, uint32_t dst_stride,
         }
 }
 
+/**
+ * Stores a box of a T level by walking its 4k tiles, and the 1k subtiles in
+ * each, in memory order, so that the level is written front to back.
+ */
+static void
+vc4_store_t_level(void *dst, uint32_t dst_stride,
+                  const void *src, uint32_t src_stride,
+                  int cpp, const struct pipe_box *box)
+{
+        /* Where each subtile of a 4k tile sits, in memory order, as x and y
+         * in subtiles: see the (BL, TL, TR, BR) and (TR, BR, BL, TL) orders
+         * at the top of the file.
+         */
+        static const uint8_t even_stiles[4][2] = {
+                {0, 0}, {0, 1}, {1, 1}, {1, 0},
+        };
+        static const uint8_t odd_stiles[4][2] = {
+                {1, 1}, {1, 0}, {0, 0}, {0, 1},
+        };
+        uint32_t stile_w = 4 * vc4_utile_width(cpp);
+        uint32_t stile_h = 4 * vc4_utile_height(cpp);
+        uint32_t tile_stride = dst_stride / cpp / (2 * stile_w);
+        uint32_t x1 = box->x;
+        uint32_t y1 = box->y;
+        uint32_t x2 = box->x + box->width;
+        uint32_t y2 = box->y + box->height;
+
+        for (uint32_t tile_y = y1 / (2 * stile_h);
+             tile_y * 2 * stile_h < y2; tile_y++) {
+                bool odd_tile_y = tile_y & 1;
+                const uint8_t (*stiles)[2] = odd_tile_y ? odd_stiles :
+                                                          even_stiles;
+
+                for (uint32_t i = 0; i < tile_stride; i++) {
+                        /* Odd lines of 4k tiles go right-to-left. */
+                        uint32_t tile_x = odd_tile_y ? tile_stride - i - 1 : i;
+                        void *tile = dst + 4096 * (tile_y * tile_stride + i);
+
+                        for (int s = 0; s < 4; s++) {
+                                uint32_t sx = (2 * tile_x + stiles[s][0]) *
+                                              stile_w;
+                                uint32_t sy = (2 * tile_y + stiles[s][1]) *
+                                              stile_h;
+                                uint32_t bx1 = MAX2(x1, sx);
+                                uint32_t by1 = MAX2(y1, sy);
+                                uint32_t bx2 = MIN2(x2, sx + stile_w);
+                                uint32_t by2 = MIN2(y2, sy + stile_h);
+                                if (bx1 >= bx2 || by1 >= by2)
+                                        continue;
+
+                                struct pipe_box partial_box = {
+                                        .x = bx1 - sx,
+                                        .y = by1 - sy,
+                                        .width = bx2 - bx1,
+                                        .height = by2 - by1,
+                                };
+                                vc4_store_lt_image(tile + 1024 * s,
+                                                   stile_w * cpp,
+                                                   (void *)src +
+                                                   (by1 - y1) * src_stride +
+                                                   (bx1 - x1) * cpp,
+                                                   src_stride, cpp,
+                                                   &partial_box);
+                        }
+                }
+        }
+}
+
+/**
+ * Stores a set of linear images into the levels of a tiled texture mapped at
+ * \p dst, in a single pass over the BO.
+ *
+ * LT levels are already stored in memory order, and T levels are walked in
+ * memory order rather than in the source's raster order.  vc4 lays out the
+ * mip levels from the smallest at offset 0 to the base level at the end, so
+ * passing the levels smallest first writes the BO front to back, which is
+ * what write-combined mappings do best with.
+ */
+void
+vc4_store_tiled_levels(void *dst, int cpp,
+                       const struct vc4_tiled_level *levels,
+                       unsigned num_levels)
+{
+        for (unsigned i = 0; i < num_levels; i++) {
+                const struct vc4_tiled_level *level = &levels[i];
+
+                if (level->tiling == VC4_TILING_FORMAT_LT) {
+                        vc4_store_lt_image(dst + level->offset, level->stride,
+                                           (void *)level->src,
+                                           level->src_stride, cpp,
+                                           &level->box);
+                } else {
+                        assert(level->tiling == VC4_TILING_FORMAT_T);
+                        vc4_store_t_level(dst + level->offset, level->stride,
+                                          level->src, level->src_stride,
+                                          cpp, &level->box);
+                }
+        }
+}
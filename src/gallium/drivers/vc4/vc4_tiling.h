@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include "util/macros.h"
 #include "util/u_cpu_detect.h"
+#include "pipe/p_state.h"
 
 /** Return the width in pixels of a 64-byte microtile. */
 static inline uint32_t
@@ -75,6 +76,12 @@ void vc4_load_lt_image_neon(void *dst, uint32_t dst_stride,
 void vc4_store_lt_image_neon(void *dst, uint32_t dst_stride,
                              void *src, uint32_t src_stride,
                              int cpp, const struct pipe_box *box);
+void vc4_load_lt_image_avx2(void *dst, uint32_t dst_stride,
+                            void *src, uint32_t src_stride,
+                            int cpp, const struct pipe_box *box);
+void vc4_store_lt_image_avx2(void *dst, uint32_t dst_stride,
+                             void *src, uint32_t src_stride,
+                             int cpp, const struct pipe_box *box);
 void vc4_load_tiled_image(void *dst, uint32_t dst_stride,
                           void *src, uint32_t src_stride,
                           uint8_t tiling_format, int cpp,
@@ -84,6 +91,27 @@ void vc4_store_tiled_image(void *dst, uint32_t dst_stride,
                            uint8_t tiling_format, int cpp,
                            const struct pipe_box *box);
 
+/** One level (or cube face) of linear data for vc4_store_tiled_levels(). */
+struct vc4_tiled_level {
+        /** Offset of the level within the destination, in bytes. */
+        uint32_t offset;
+        /** Stride of the tiled level, in bytes. */
+        uint32_t stride;
+        /** One of VC4_TILING_FORMAT_LT or VC4_TILING_FORMAT_T. */
+        uint8_t tiling;
+
+        /** Start of the linear source data for the box. */
+        const void *src;
+        uint32_t src_stride;
+
+        /** Region of the level to store to, in blocks. */
+        struct pipe_box box;
+};
+
+void vc4_store_tiled_levels(void *dst, int cpp,
+                            const struct vc4_tiled_level *levels,
+                            unsigned num_levels);
+
 static inline void
 vc4_load_lt_image(void *dst, uint32_t dst_stride,
                   void *src, uint32_t src_stride,
@@ -95,6 +123,13 @@ vc4_load_lt_image(void *dst, uint32_t dst_stride,
                                        cpp, box);
                 return;
         }
+#endif
+#ifdef USE_X86_AVX2
+        if (util_get_cpu_caps()->has_avx2) {
+                vc4_load_lt_image_avx2(dst, dst_stride, src, src_stride,
+                                       cpp, box);
+                return;
+        }
 #endif
         vc4_load_lt_image_base(dst, dst_stride, src, src_stride,
                                cpp, box);
@@ -112,6 +147,13 @@ vc4_store_lt_image(void *dst, uint32_t dst_stride,
                 return;
         }
 #endif
+#ifdef USE_X86_AVX2
+        if (util_get_cpu_caps()->has_avx2) {
+                vc4_store_lt_image_avx2(dst, dst_stride, src, src_stride,
+                                        cpp, box);
+                return;
+        }
+#endif
 
         vc4_store_lt_image_base(dst, dst_stride, src, src_stride,
                                 cpp, box);
@@ -28,7 +28,8 @@
  *
  * If V3D_BUILD_NEON is set, then the functions will be suffixed with _neon.
  * They will only use NEON assembly if __ARM_ARCH is also set, to keep the x86
- * sim build working.
+ * sim build working.  Likewise, V3D_BUILD_AVX2 suffixes them with _avx2 for
+ * the build with -mavx2.
  */
 
 #include <string.h>
@@ -36,10 +37,12 @@
 #include "vc4_tiling.h"
 #include "broadcom/common/v3d_cpu_tiling.h"
 
-#ifdef V3D_BUILD_NEON
-#define NEON_TAG(x) x ## _neon
+#if defined(V3D_BUILD_NEON)
+#define SIMD_TAG(x) x ## _neon
+#elif defined(V3D_BUILD_AVX2)
+#define SIMD_TAG(x) x ## _avx2
 #else
-#define NEON_TAG(x) x ## _base
+#define SIMD_TAG(x) x ## _base
 #endif
 
 /** Returns the stride in bytes of a 64-byte microtile. */
@@ -270,7 +273,7 @@ vc4_lt_image_cpp_helper(void *gpu, uint32_t gpu_stride,
 }
 
 void
-NEON_TAG(vc4_load_lt_image)(void *dst, uint32_t dst_stride,
+SIMD_TAG(vc4_load_lt_image)(void *dst, uint32_t dst_stride,
                             void *src, uint32_t src_stride,
                             int cpp, const struct pipe_box *box)
 {
@@ -279,7 +282,7 @@ NEON_TAG(vc4_load_lt_image)(void *dst, uint32_t dst_stride,
 }
 
 void
-NEON_TAG(vc4_store_lt_image)(void *dst, uint32_t dst_stride,
+SIMD_TAG(vc4_store_lt_image)(void *dst, uint32_t dst_stride,
                              void *src, uint32_t src_stride,
                              int cpp, const struct pipe_box *box)
 {
@@ -3,63 +3,350 @@ use std::env;
 use std::ffi::OsStr;
 use std::fmt::Debug;
 use std::fs;
-use std::io::{Read, Write};
-use std::path::PathBuf;
+use std::io::{BufRead, BufReader, Read, Write};
+use std::path::{Path, PathBuf};
+use std::process::{Child, ChildStdin, ChildStdout, Command, Stdio};
+use std::sync::Mutex;
 use syn::visit::Visit;
 
+fn compiler_bin() -> String {
+    env::var("VC4_COMPILER_BIN").unwrap_or_else(|_| env!("VC4_COMPILER_BIN").to_string())
+}
+
+/// One vertex/fragment pair and the Rust module it compiles to.
+#[derive(Clone, Debug)]
+pub struct ShaderJob {
+    pub vert_path: PathBuf,
+    pub frag_path: PathBuf,
+    pub rs_path: PathBuf,
+}
+
+/// A long-lived `vc4-glsl --server` process.
+///
+/// Starting vc4-glsl sets up a screen, a context and the GLSL builtins from
+/// scratch, which dominates the cost of compiling a single pair.  The server
+/// keeps all of that warm and compiles the pairs it is sent on a pool of
+/// worker threads.
+pub struct ShaderCompiler {
+    bin: String,
+    child: Child,
+    stdin: Option<ChildStdin>,
+    stdout: BufReader<ChildStdout>,
+    next_job: u64,
+}
+
+impl ShaderCompiler {
+    /// Spawns the server.  When run from a build script, the worker count
+    /// follows cargo's `NUM_JOBS`; otherwise vc4-glsl uses one per CPU.
+    ///
+    /// Objects are written as raw `.bin` blobs; set `VC4_SHADER_DISASM` to
+    /// also get a `.asm` disassembly next to each one, and
+    /// `VC4_SHADER_STATS` to get a `<module>.stats.json` report of the
+    /// instruction counts, cycle estimates and register use of each module.
+    pub fn spawn() -> Result<Self, String> {
+        let bin = compiler_bin();
+        let mut cmd = Command::new(&bin);
+        cmd.arg("--server").arg("--bin");
+        if env::var_os("VC4_SHADER_DISASM").is_some() {
+            cmd.arg("--disasm");
+        }
+        if env::var_os("VC4_SHADER_STATS").is_some() {
+            cmd.arg("--stats");
+        }
+        if let Some(num_jobs) = env::var("NUM_JOBS")
+            .ok()
+            .and_then(|n| n.parse::<u32>().ok())
+        {
+            cmd.arg("--jobs").arg(num_jobs.to_string());
+        }
+        let mut child = cmd
+            .stdin(Stdio::piped())
+            .stdout(Stdio::piped())
+            .stderr(Stdio::inherit())
+            .spawn()
+            .map_err(|e| format!("{} --server\n{}", bin, e.to_string()))?;
+        let stdin = child.stdin.take();
+        let stdout = BufReader::new(child.stdout.take().unwrap());
+
+        Ok(ShaderCompiler {
+            bin,
+            child,
+            stdin,
+            stdout,
+            next_job: 0,
+        })
+    }
+
+    /// Returns false once the server has exited, e.g. because the compiler
+    /// aborted on a job.
+    pub fn is_alive(&self) -> bool {
+        self.stdin.is_some()
+    }
+
+    pub fn compile<S: AsRef<OsStr> + Debug>(
+        &mut self,
+        vert_path: S,
+        frag_path: S,
+        rs_out_path: S,
+    ) -> Result<(), String> {
+        self.compile_batch(&[ShaderJob {
+            vert_path: PathBuf::from(vert_path.as_ref()),
+            frag_path: PathBuf::from(frag_path.as_ref()),
+            rs_path: PathBuf::from(rs_out_path.as_ref()),
+        }])
+    }
+
+    /// Sends all of `jobs` to the server at once so that they compile in
+    /// parallel, then waits for every reply.  The diagnostics of all failed
+    /// jobs are returned together.
+    pub fn compile_batch(&mut self, jobs: &[ShaderJob]) -> Result<(), String> {
+        let error = |job: &ShaderJob, msg: &str| {
+            format!(
+                "{} {:?} {:?} {:?}\n{}",
+                self.bin, job.vert_path, job.frag_path, job.rs_path, msg
+            )
+        };
+
+        let mut lines = Vec::with_capacity(jobs.len());
+        for job in jobs {
+            let mut line = String::new();
+            for (i, path) in [&job.vert_path, &job.frag_path, &job.rs_path]
+                .iter()
+                .enumerate()
+            {
+                let path = path
+                    .to_str()
+                    .ok_or_else(|| error(job, "path is not valid UTF-8"))?;
+                if path.contains(&['\t', '\n'][..]) {
+                    return Err(error(job, "path contains a tab or newline"));
+                }
+                if i > 0 {
+                    line.push('\t');
+                }
+                line.push_str(path);
+            }
+            line.push('\n');
+            lines.push(line);
+        }
+
+        let first = self.next_job;
+        self.next_job += jobs.len() as u64;
+        let mut logs: Vec<Option<String>> = vec![None; jobs.len()];
+
+        let ShaderCompiler { stdin, stdout, .. } = self;
+        let result = match stdin.as_mut() {
+            None => Err("server is not running".to_string()),
+            Some(stdin) => std::thread::scope(|scope| {
+                // Write from a separate thread so that neither side can
+                // block the other on a full pipe.
+                let writer = scope.spawn(move || -> std::io::Result<()> {
+                    for line in &lines {
+                        stdin.write_all(line.as_bytes())?;
+                    }
+                    stdin.flush()
+                });
+
+                let mut read_result = Ok(());
+                for _ in 0..jobs.len() {
+                    match read_reply(stdout) {
+                        Ok((id, log)) => match id.checked_sub(first) {
+                            Some(index) if index < jobs.len() as u64 => {
+                                logs[index as usize] = log;
+                            }
+                            _ => {
+                                read_result = Err(format!("unexpected reply for job {}", id));
+                                break;
+                            }
+                        },
+                        Err(e) => {
+                            read_result = Err(e);
+                            break;
+                        }
+                    }
+                }
+
+                let write_result = writer.join().unwrap().map_err(|e| e.to_string());
+                read_result.and(write_result)
+            }),
+        };
+
+        if let Err(e) = result {
+            self.stdin = None;
+            let _ = self.child.wait();
+            let msg = format!("vc4-glsl server failed: {}", e);
+            return Err(jobs
+                .iter()
+                .map(|job| error(job, &msg))
+                .collect::<Vec<_>>()
+                .join("\n"));
+        }
+
+        let errors = jobs
+            .iter()
+            .zip(logs.iter())
+            .filter_map(|(job, log)| log.as_ref().map(|log| error(job, log)))
+            .collect::<Vec<_>>();
+        if errors.is_empty() {
+            Ok(())
+        } else {
+            Err(errors.join("\n"))
+        }
+    }
+}
+
+/// Reads one `<job> ok` or `<job> error <len>` reply, returning the job id and
+/// the diagnostics if the job failed.
+fn read_reply(stdout: &mut BufReader<ChildStdout>) -> Result<(u64, Option<String>), String> {
+    let mut reply = String::new();
+    if stdout.read_line(&mut reply).map_err(|e| e.to_string())? == 0 {
+        return Err("server exited".to_string());
+    }
+    let unexpected = || format!("unexpected reply {:?}", reply);
+    let mut fields = reply.split_whitespace();
+    let id = fields
+        .next()
+        .and_then(|id| id.parse::<u64>().ok())
+        .ok_or_else(unexpected)?;
+
+    match (fields.next(), fields.next()) {
+        (Some("ok"), None) => Ok((id, None)),
+        (Some("error"), Some(len)) => {
+            let len = len.parse::<usize>().map_err(|_| unexpected())?;
+            let mut log = vec![0u8; len];
+            stdout.read_exact(&mut log).map_err(|e| e.to_string())?;
+            Ok((id, Some(String::from_utf8_lossy(&log).into_owned())))
+        }
+        _ => Err(unexpected()),
+    }
+}
+
+impl Drop for ShaderCompiler {
+    fn drop(&mut self) {
+        // Closing stdin makes the server exit.
+        self.stdin = None;
+        let _ = self.child.wait();
+    }
+}
+
+static COMPILER: Mutex<Option<ShaderCompiler>> = Mutex::new(None);
+
+fn with_compiler<F>(f: F) -> Result<(), String>
+where
+    F: FnOnce(&mut ShaderCompiler) -> Result<(), String>,
+{
+    let mut compiler = COMPILER.lock().unwrap_or_else(|e| e.into_inner());
+    if !compiler.as_ref().map_or(false, |c| c.is_alive()) {
+        *compiler = Some(ShaderCompiler::spawn()?);
+    }
+    f(compiler.as_mut().unwrap())
+}
+
+/// Compiles one pair on a process-wide `ShaderCompiler`, starting it on first
+/// use and restarting it if a previous job took it down.
 pub fn compile_shader<S: AsRef<OsStr> + Debug>(
     vert_path: S,
     frag_path: S,
     rs_out_path: S,
 ) -> Result<(), String> {
-    use std::process::Command;
-
-    let vc4_compiler_bin =
-        env::var("VC4_COMPILER_BIN").unwrap_or_else(|_| env!("VC4_COMPILER_BIN").to_string());
-
-    let output = Command::new(&vc4_compiler_bin)
-        .arg(&vert_path)
-        .arg(&frag_path)
-        .arg(&rs_out_path)
-        .output();
-
-    match output {
-        Ok(ref out) => {
-            if !out.status.success() {
-                if let Ok(stderr) = String::from_utf8(output.unwrap().stderr) {
-                    return Err(format!(
-                        "{} {:?} {:?} {:?}\n{}",
-                        vc4_compiler_bin, vert_path, frag_path, rs_out_path, stderr
-                    ));
+    with_compiler(|compiler| compiler.compile(vert_path, frag_path, rs_out_path))
+}
+
+/// Like `compile_shader`, but compiles all of `jobs` in parallel.
+pub fn compile_shader_batch(jobs: &[ShaderJob]) -> Result<(), String> {
+    if jobs.is_empty() {
+        return Ok(());
+    }
+    with_compiler(|compiler| compiler.compile_batch(jobs))
+}
+
+/// Reads the dependencies listed in a make-style depfile written by vc4-glsl.
+fn read_depfile(d_path: &Path) -> Option<Vec<PathBuf>> {
+    let contents = fs::read_to_string(d_path).ok()?;
+    let contents = contents.replace("\\\n", " ");
+    let mut deps = Vec::new();
+    let mut dep = String::new();
+    let mut seen_target = false;
+    let mut chars = contents.chars().peekable();
+    while let Some(c) = chars.next() {
+        match c {
+            '\\' if matches!(chars.peek(), Some(' ') | Some('#')) => {
+                dep.push(chars.next().unwrap());
+            }
+            '$' if chars.peek() == Some(&'$') => {
+                dep.push(chars.next().unwrap());
+            }
+            ':' if !seen_target && matches!(chars.peek(), Some(' ') | Some('\n') | None) => {
+                seen_target = true;
+                dep.clear();
+            }
+            ' ' | '\t' | '\n' => {
+                if seen_target && !dep.is_empty() {
+                    deps.push(PathBuf::from(&dep));
                 }
+                dep.clear();
             }
-        }
-        Err(e) => {
-            return Err(format!(
-                "{} {:?} {:?} {:?}\n{}",
-                vc4_compiler_bin,
-                vert_path,
-                frag_path,
-                rs_out_path,
-                e.to_string()
-            ));
+            _ => dep.push(c),
         }
     }
+    if seen_target && !dep.is_empty() {
+        deps.push(PathBuf::from(&dep));
+    }
+    seen_target.then_some(deps)
+}
 
-    Ok(())
+fn depfile_path(rs_path: &PathBuf) -> PathBuf {
+    rs_path.with_extension("d")
 }
 
+/// Decides whether a pair has to go through vc4-glsl again.
+///
+/// vc4-glsl leaves generated files alone when their contents didn't change,
+/// so their mtime says nothing about when the pair was last built.  The
+/// depfile is rewritten on every run and serves as the stamp instead.
 fn needs_build(
     vert_metadata: fs::Metadata,
     frag_metadata: fs::Metadata,
+    sidecar_paths: &[PathBuf],
     rs_path: &PathBuf,
 ) -> bool {
-    let path = rs_path.as_path();
-    if !path.exists() {
+    if !rs_path.exists() {
+        return true;
+    }
+    // Without a depfile we can't tell whether an #include'd file changed.
+    let d_path = depfile_path(rs_path);
+    let (deps, built) = match (
+        read_depfile(&d_path),
+        fs::metadata(&d_path).and_then(|m| m.modified()),
+    ) {
+        (Some(deps), Ok(built)) => (deps, built),
+        _ => return true,
+    };
+    // A new compiler may generate different code; vc4-glsl's own cache keeps
+    // this cheap when the output is unchanged.
+    let compiler_newer = fs::metadata(compiler_bin())
+        .and_then(|m| m.modified())
+        .map_or(false, |compiler_mod| compiler_mod > built);
+    if compiler_newer
+        || vert_metadata.modified().unwrap() > built
+        || frag_metadata.modified().unwrap() > built
+    {
+        return true;
+    }
+
+    // The depfile lists the sidecars that existed, but not newly added ones.
+    if sidecar_paths.iter().any(|sidecar_path| {
+        fs::metadata(sidecar_path)
+            .and_then(|m| m.modified())
+            .map_or(false, |sidecar_mod| sidecar_mod > built)
+    }) {
         return true;
     }
-    let rs_mod = path.metadata().unwrap().modified().unwrap();
-    vert_metadata.modified().unwrap() > rs_mod || frag_metadata.modified().unwrap() > rs_mod
+
+    deps.iter().any(|dep| {
+        fs::metadata(dep)
+            .and_then(|m| m.modified())
+            .map_or(true, |dep_mod| dep_mod > built)
+    })
 }
 
 fn for_each_file_ext_in_dir<F>(dir: &PathBuf, ext: &str, mut f: F) -> Result<(), String>
@@ -89,7 +376,7 @@ where
 }
 
 fn compile_shaders(shaders_dir: &PathBuf, generated_dir: &PathBuf) -> Result<bool, String> {
-    let mut compiled_shader = false;
+    let mut jobs = Vec::new();
 
     for_each_file_ext_in_dir(&shaders_dir, "vert", |vert_path, vert_metadata| {
         let frag_path = vert_path.with_extension("frag");
@@ -111,18 +398,24 @@ fn compile_shaders(shaders_dir: &PathBuf, generated_dir: &PathBuf) -> Result<boo
         let rs_path = generated_dir
             .join(vert_path.file_name().unwrap())
             .with_extension("rs");
-        if needs_build(vert_metadata, frag_metadata, &rs_path) {
-            compiled_shader = true;
-            match compile_shader(vert_path, frag_path, rs_path) {
-                Err(e) => return Err(e),
-                _ => {}
-            }
+        let sidecar_paths = [
+            vert_path.with_extension("uniforms.toml"),
+            vert_path.with_extension("variants.toml"),
+        ];
+        if needs_build(vert_metadata, frag_metadata, &sidecar_paths, &rs_path) {
+            jobs.push(ShaderJob {
+                vert_path,
+                frag_path,
+                rs_path,
+            });
         }
 
         Ok(())
     })?;
 
-    Ok(compiled_shader)
+    compile_shader_batch(&jobs)?;
+
+    Ok(!jobs.is_empty())
 }
 
 #[derive(Default)]
@@ -143,17 +436,23 @@ impl<'ast> Visit<'ast> for ObjVisitor {
     }
 }
 
+/// Writes `contents` to `path` unless the file already holds exactly that.
+///
+/// The generated files are compiled into the crate, so touching one that
+/// didn't change would make rustc rebuild it for nothing.
+fn write_if_changed(path: &Path, contents: &[u8]) {
+    if fs::read(path).ok().as_deref() != Some(contents) {
+        fs::write(path, contents).unwrap();
+    }
+}
+
 fn build_generated_mod(
     generated_dir: &PathBuf,
     mod_path: &PathBuf,
 ) -> Result<HashSet<String>, String> {
-    let mut gen_mod_f = fs::File::create(mod_path).unwrap();
-    gen_mod_f
-        .write(
-            "use super::ShaderNode;\nmod objects;\npub use objects::initialize_shaders;\n"
-                .as_bytes(),
-        )
-        .unwrap();
+    let mut gen_mod = String::from(
+        "use super::ShaderNode;\nmod objects;\npub use objects::initialize_shaders;\n",
+    );
     let mut obj_set = HashSet::<String>::new();
 
     for_each_file_ext_in_dir(&generated_dir, "rs", |rs_path, _| {
@@ -161,9 +460,7 @@ fn build_generated_mod(
         if stem == "mod" {
             return Ok(());
         }
-        gen_mod_f
-            .write(format!("pub mod {};\n", stem.to_str().unwrap()).as_bytes())
-            .unwrap();
+        gen_mod.push_str(&format!("pub mod {};\n", stem.to_str().unwrap()));
         let rs_s = {
             let mut rs_f = fs::File::open(rs_path).unwrap();
             let mut rs_s = String::new();
@@ -178,35 +475,86 @@ fn build_generated_mod(
         }
         Ok(())
     })?;
+    write_if_changed(mod_path, gen_mod.as_bytes());
 
     Ok(obj_set)
 }
 
-fn build_objects_mod(mod_path: &PathBuf, obj_set: &HashSet<String>) -> Result<(), String> {
-    let mut obj_mod_f = fs::File::create(mod_path).unwrap();
-    obj_mod_f
-        .write("#![allow(nonstandard_style)]\nuse super::ShaderNode;\n".as_bytes())
-        .unwrap();
+/// Packs every object into `objects/archive.bin` and writes `objects/mod.rs`
+/// with the offset of each one in it.
+///
+/// The archive is pulled in with a single `include_bytes!()`, so rustc sees
+/// one blob and a small offset table instead of one source file per object,
+/// and all the code ends up contiguous in `.rodata`.  The kernel only
+/// accepts a shader at offset 0 of its BO, so each object still becomes a
+/// `ShaderNode` of its own, sliced out of the archive.
+fn build_objects_mod(objects_dir: &PathBuf, obj_set: &HashSet<String>) -> Result<(), String> {
+    let mut objs = obj_set.iter().collect::<Vec<_>>();
+    objs.sort();
+
+    let mut archive = Vec::<u8>::new();
+    let mut table = Vec::with_capacity(objs.len());
+    for obj in &objs {
+        let bin_path = objects_dir.join(obj).with_extension("bin");
+        let bin = fs::read(&bin_path)
+            .map_err(|e| format!("{}\n{}", bin_path.to_str().unwrap(), e.to_string()))?;
+        if bin.len() % 8 != 0 {
+            return Err(format!(
+                "{} is not a whole number of instructions",
+                bin_path.to_str().unwrap()
+            ));
+        }
+        table.push((obj, archive.len() / 8, bin.len() / 8));
+        archive.extend_from_slice(&bin);
+    }
+
+    write_if_changed(&objects_dir.join("archive.bin"), &archive);
 
-    for obj in obj_set {
-        obj_mod_f
-            .write(format!("pub mod {};\n", obj).as_bytes())
-            .unwrap();
+    let mut obj_mod = String::from("#![allow(nonstandard_style)]\nuse super::ShaderNode;\n");
+    obj_mod.push_str(&format!(
+        "
+/// Reassembles the instructions of the include_bytes!()'d archive.
+const fn le_words<const N: usize>(bytes: &[u8]) -> [u64; N] {{
+    assert!(bytes.len() == N * 8);
+    let mut words = [0u64; N];
+    let mut i = 0;
+    while i < N {{
+        let b = i * 8;
+        words[i] = u64::from_le_bytes([
+            bytes[b], bytes[b + 1], bytes[b + 2], bytes[b + 3],
+            bytes[b + 4], bytes[b + 5], bytes[b + 6], bytes[b + 7],
+        ]);
+        i += 1;
+    }}
+    words
+}}
+
+static ARCHIVE: [u64; {}] = le_words(include_bytes!(\"archive.bin\"));
+
+",
+        archive.len() / 8
+    ));
+
+    for (obj, offset, len) in &table {
+        obj_mod.push_str(&format!(
+            "pub mod {} {{
+    pub static ASM: super::ShaderNode =
+        super::ShaderNode::new(super::ARCHIVE.split_at({}).1.split_at({}).0);
+}}
+",
+            obj, offset, len
+        ));
     }
 
-    obj_mod_f
-        .write(
-            "\npub async fn initialize_shaders() {
-    let _ = vc4_drm::tokio::join!(\n"
-                .as_bytes(),
-        )
-        .unwrap();
-    for obj in obj_set {
-        obj_mod_f
-            .write(format!("        {}::ASM.initialize(),\n", obj).as_bytes())
-            .unwrap();
+    obj_mod.push_str(
+        "\npub async fn initialize_shaders() {
+    let _ = vc4_drm::tokio::join!(\n",
+    );
+    for obj in &objs {
+        obj_mod.push_str(&format!("        {}::ASM.initialize(),\n", obj));
     }
-    obj_mod_f.write("    );\n}\n".as_bytes()).unwrap();
+    obj_mod.push_str("    );\n}\n");
+    write_if_changed(&objects_dir.join("mod.rs"), obj_mod.as_bytes());
 
     Ok(())
 }
@@ -224,20 +572,83 @@ fn prune_generated_dir(generated_dir: &PathBuf, shaders_dir: &PathBuf) -> Result
         }
         Ok(())
     })?;
+    for_each_file_ext_in_dir(&generated_dir, "d", |d_path, _| {
+        if !d_path.with_extension("rs").exists() {
+            fs::remove_file(d_path).ok();
+        }
+        Ok(())
+    })?;
+    for_each_file_ext_in_dir(&generated_dir, "json", |json_path, _| {
+        // foo.stats.json -> foo.rs
+        let stem = json_path.file_stem().unwrap();
+        if Path::new(stem)
+            .extension()
+            .map_or(false, |ext| ext == "stats")
+            && !json_path.with_file_name(stem).with_extension("rs").exists()
+        {
+            fs::remove_file(json_path).ok();
+        }
+        Ok(())
+    })?;
     Ok(pruned_dir)
 }
 
+/// Tells cargo to rerun the build script when anything under the shaders
+/// directory changes, or any file a generated module was compiled from,
+/// #include'd files included.
+///
+/// Once a build script prints any `rerun-if-changed` line, cargo stops
+/// rerunning it for other changes in the package.  Cargo scans a directory
+/// recursively, so watching the shaders directory picks up new pairs and
+/// sidecars that no depfile can list yet.  Since the generated directory is
+/// inside it, a build that regenerated modules is followed by one more run
+/// of the script, which then finds everything up to date.
+fn emit_rerun_if_changed(shaders_dir: &PathBuf, generated_dir: &PathBuf) -> Result<(), String> {
+    println!("cargo:rerun-if-changed={}", shaders_dir.display());
+
+    let mut deps = HashSet::<PathBuf>::new();
+    for_each_file_ext_in_dir(&generated_dir, "d", |d_path, _| {
+        if let Some(d_deps) = read_depfile(&d_path) {
+            deps.extend(
+                d_deps
+                    .into_iter()
+                    .filter(|dep| !dep.starts_with(shaders_dir)),
+            );
+        }
+        Ok(())
+    })?;
+
+    let mut deps = deps.into_iter().collect::<Vec<_>>();
+    deps.sort();
+    for dep in deps {
+        println!("cargo:rerun-if-changed={}", dep.display());
+    }
+
+    Ok(())
+}
+
+/// Removes objects no generated module refers to anymore, along with the
+/// per-object `.rs` files of the qpu! macro format.
 fn prune_objects_dir(objects_dir: &PathBuf, obj_set: &HashSet<String>) -> Result<(), String> {
     for_each_file_ext_in_dir(&objects_dir, "rs", |rs_path, _| {
-        let stem = rs_path.file_stem().unwrap();
-        if stem == "mod" {
-            return Ok(());
-        }
-        if !obj_set.contains(stem.to_str().unwrap()) {
+        if rs_path.file_stem().unwrap() != "mod" {
             fs::remove_file(rs_path).ok();
         }
         Ok(())
-    })
+    })?;
+    for ext in ["bin", "asm"] {
+        for_each_file_ext_in_dir(&objects_dir, ext, |path, _| {
+            let stem = path.file_stem().unwrap();
+            if stem == "archive" {
+                return Ok(());
+            }
+            if !obj_set.contains(stem.to_str().unwrap()) {
+                fs::remove_file(path).ok();
+            }
+            Ok(())
+        })?;
+    }
+    Ok(())
 }
 
 pub fn build_shaders_dir(shaders_dir: &PathBuf) -> Result<(), String> {
@@ -249,13 +660,20 @@ pub fn build_shaders_dir(shaders_dir: &PathBuf) -> Result<(), String> {
     let compiled_shader = compile_shaders(&shaders_dir, &generated_dir)?;
     let generated_mod_path = generated_dir.join("mod.rs");
     let objects_mod_path = objects_dir.join("mod.rs");
+    let archive_path = objects_dir.join("archive.bin");
 
-    if pruned_dir || compiled_shader || !generated_mod_path.is_file() || !objects_mod_path.is_file()
+    if pruned_dir
+        || compiled_shader
+        || !generated_mod_path.is_file()
+        || !objects_mod_path.is_file()
+        || !archive_path.is_file()
     {
         let obj_set = build_generated_mod(&generated_dir, &generated_mod_path)?;
-        build_objects_mod(&objects_mod_path, &obj_set)?;
+        build_objects_mod(&objects_dir, &obj_set)?;
         prune_objects_dir(&objects_dir, &obj_set)?;
     }
 
+    emit_rerun_if_changed(&shaders_dir, &generated_dir)?;
+
     Ok(())
 }
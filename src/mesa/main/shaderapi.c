@@ -60,6 +60,7 @@
 #include "program/prog_parameter.h"
 #include "util/ralloc.h"
 #include "util/hash_table.h"
+#include "util/set.h"
 #include "util/crc32.h"
 #include "util/os_file.h"
 #include "util/list.h"
@@ -3260,6 +3261,18 @@ struct shader_includes {
    size_t num_include_paths;
    size_t relative_path_cursor;
 
+   /* Directory and full path of each file currently being included, indexed
+    * by relative_path_cursor.  These live here rather than in statics so
+    * that contexts with their own shared state can compile concurrently.
+    */
+   char *relative_path_stack[16];
+   char *absolute_path_stack[16];
+
+   /* If set, the path of every file loaded from disk is added to this set,
+    * so that the caller can list a compile's dependencies.
+    */
+   struct set *loaded_files;
+
    /* Root hash table holding the shader include tree */
    struct hash_table *shader_include_tree;
 };
@@ -3285,6 +3298,13 @@ _mesa_set_shader_include_cursor(struct gl_shared_state *shared, size_t cursor)
    shared->ShaderIncludes->relative_path_cursor = cursor;
 }
 
+void
+_mesa_set_shader_include_loaded_files(struct gl_shared_state *shared,
+                                      struct set *files)
+{
+   shared->ShaderIncludes->loaded_files = files;
+}
+
 static void
 destroy_shader_include(struct hash_entry *entry)
 {
@@ -3560,9 +3580,6 @@ load_text_file(void *ctx, const char *file_name, const char *return_file_name,
    return final_text;
 }
 
-static char *relative_path_stack[16] = {0};
-static char *absolute_path_stack[16] = {0};
-
 typedef struct glcpp_parser glcpp_parser_t;
 #include "compiler/glsl/glcpp/glcpp-parse.h"
 
@@ -3575,7 +3592,7 @@ _mesa_lookup_shader_include(void *locp, struct gl_context *ctx, char *path,
 
    bool needs_free = false;
    if (path[0] != '/' && ShaderIncludes->relative_path_cursor > 0) {
-      path = ralloc_asprintf(NULL, "%s/%s", relative_path_stack[
+      path = ralloc_asprintf(NULL, "%s/%s", ShaderIncludes->relative_path_stack[
          ShaderIncludes->relative_path_cursor - 1], path);
       needs_free = true;
    }
@@ -3585,17 +3602,23 @@ _mesa_lookup_shader_include(void *locp, struct gl_context *ctx, char *path,
    if (last_dir_slash) {
       *last_dir_slash = '\0';
    }
-   relative_path_stack[ShaderIncludes->relative_path_cursor] = dir_path;
-   absolute_path_stack[ShaderIncludes->relative_path_cursor] = strdup(path);
+   free(ShaderIncludes->relative_path_stack[ShaderIncludes->relative_path_cursor]);
+   free(ShaderIncludes->absolute_path_stack[ShaderIncludes->relative_path_cursor]);
+   ShaderIncludes->relative_path_stack[ShaderIncludes->relative_path_cursor] = dir_path;
+   ShaderIncludes->absolute_path_stack[ShaderIncludes->relative_path_cursor] = strdup(path);
    const char *source = load_text_file(NULL, path,
                                        ShaderIncludes->relative_path_cursor >
                                        0 ?
-                                       absolute_path_stack[
+                                       ShaderIncludes->absolute_path_stack[
                                           ShaderIncludes->relative_path_cursor -
                                           1] : NULL,
                                        locp_c->last_line);
    ShaderIncludes->relative_path_cursor++;
 
+   struct set *loaded_files = ShaderIncludes->loaded_files;
+   if (source && loaded_files && !_mesa_set_search(loaded_files, path))
+      _mesa_set_add(loaded_files, ralloc_strdup(loaded_files, path));
+
    if (needs_free) {
       ralloc_free(path);
    }
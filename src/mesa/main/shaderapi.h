@@ -193,6 +193,12 @@ _mesa_get_shader_include_cursor(struct gl_shared_state *shared);
 void
 _mesa_set_shader_include_cursor(struct gl_shared_state *shared, size_t cusor);
 
+struct set;
+
+void
+_mesa_set_shader_include_loaded_files(struct gl_shared_state *shared,
+                                      struct set *files);
+
 void
 _mesa_destroy_shader_includes(struct gl_shared_state *shared);
 
@@ -119,6 +119,8 @@ disk_cache_type_create(const char *gpu_name,
    if (cache == NULL)
       goto fail;
 
+   simple_mtx_init(&cache->get_queue_mtx, mtx_plain);
+
    /* Assume failure. */
    cache->path_init_failed = true;
    cache->type = DISK_CACHE_NONE;
@@ -261,8 +263,10 @@ disk_cache_type_create(const char *gpu_name,
    return cache;
 
  fail:
-   if (cache)
+   if (cache) {
+      simple_mtx_destroy(&cache->get_queue_mtx);
       ralloc_free(cache);
+   }
    ralloc_free(local);
 
    return NULL;
@@ -317,6 +321,11 @@ disk_cache_destroy(struct disk_cache *cache)
              cache->stats.misses);
    }
 
+   if (cache && util_queue_is_initialized(&cache->get_queue)) {
+      util_queue_finish(&cache->get_queue);
+      util_queue_destroy(&cache->get_queue);
+   }
+
    if (cache && util_queue_is_initialized(&cache->cache_queue)) {
       util_queue_finish(&cache->cache_queue);
       util_queue_destroy(&cache->cache_queue);
@@ -333,6 +342,9 @@ disk_cache_destroy(struct disk_cache *cache)
       disk_cache_destroy_mmap(cache);
    }
 
+   if (cache)
+      simple_mtx_destroy(&cache->get_queue_mtx);
+
    ralloc_free(cache);
 }
 
@@ -340,6 +352,13 @@ void
 disk_cache_wait_for_idle(struct disk_cache *cache)
 {
    util_queue_finish(&cache->cache_queue);
+
+   if (util_queue_is_initialized(&cache->get_queue))
+      util_queue_finish(&cache->get_queue);
+
+   /* Writes may have queued compactions of the DB parts */
+   if (cache->type == DISK_CACHE_DATABASE)
+      mesa_cache_db_multipart_wait_for_idle(&cache->cache_db);
 }
 
 void
@@ -620,6 +639,111 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    return buf;
 }
 
+struct disk_cache_get_job {
+   struct util_queue_fence fence;
+
+   struct disk_cache *cache;
+   cache_key key;
+
+   void *data;
+   size_t size;
+};
+
+static bool
+disk_cache_init_get_queue(struct disk_cache *cache)
+{
+   simple_mtx_lock(&cache->get_queue_mtx);
+
+   /* Unlike the put queue, this one runs at normal priority: the thread that
+    * queued the lookup is likely to end up waiting for it.
+    */
+   if (!util_queue_is_initialized(&cache->get_queue)) {
+      util_queue_init(&cache->get_queue, "disk$get", 32, 4,
+                      UTIL_QUEUE_INIT_SCALE_THREADS |
+                      UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                      UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY, NULL);
+   }
+
+   simple_mtx_unlock(&cache->get_queue_mtx);
+
+   return util_queue_is_initialized(&cache->get_queue);
+}
+
+static void
+cache_get(void *job, void *gdata, int thread_index)
+{
+   struct disk_cache_get_job *dc_job = (struct disk_cache_get_job *) job;
+
+   dc_job->data = disk_cache_get(dc_job->cache, dc_job->key, &dc_job->size);
+}
+
+struct disk_cache_get_job *
+disk_cache_get_async(struct disk_cache *cache, const cache_key key)
+{
+   struct disk_cache_get_job *dc_job = (struct disk_cache_get_job *)
+      calloc(1, sizeof(struct disk_cache_get_job));
+   if (!dc_job)
+      return NULL;
+
+   dc_job->cache = cache;
+   memcpy(dc_job->key, key, sizeof(cache_key));
+   util_queue_fence_init(&dc_job->fence);
+
+   /* If no thread can be started, do the lookup right away so that the
+    * caller doesn't need a separate path for it.
+    */
+   if (disk_cache_init_get_queue(cache)) {
+      util_queue_add_job(&cache->get_queue, dc_job, &dc_job->fence,
+                         cache_get, NULL, 0);
+   } else {
+      cache_get(dc_job, NULL, 0);
+   }
+
+   return dc_job;
+}
+
+bool
+disk_cache_get_job_is_done(struct disk_cache_get_job *job)
+{
+   return !job || util_queue_fence_is_signalled(&job->fence);
+}
+
+void *
+disk_cache_get_job_wait(struct disk_cache_get_job *job, size_t *size)
+{
+   if (size)
+      *size = 0;
+
+   if (!job)
+      return NULL;
+
+   util_queue_fence_wait(&job->fence);
+
+   void *data = job->data;
+   if (size)
+      *size = job->size;
+
+   util_queue_fence_destroy(&job->fence);
+   free(job);
+
+   return data;
+}
+
+void
+disk_cache_get_job_discard(struct disk_cache_get_job *job)
+{
+   if (!job)
+      return;
+
+   /* Skips the lookup if it hasn't started, waits for it otherwise. */
+   if (util_queue_is_initialized(&job->cache->get_queue))
+      util_queue_drop_job(&job->cache->get_queue, &job->fence);
+
+   free(job->data);
+   util_queue_fence_destroy(&job->fence);
+   free(job);
+}
+
 void
 disk_cache_put_key(struct disk_cache *cache, const cache_key key)
 {
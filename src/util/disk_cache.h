@@ -78,6 +78,7 @@ struct cache_item_metadata {
 };
 
 struct disk_cache;
+struct disk_cache_get_job;
 
 #ifdef HAVE_DLADDR
 static inline bool
@@ -229,6 +230,40 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size);
 
+/**
+ * Start retrieving the item stored in the cache with the name \key on a
+ * background thread, so that the file I/O and decompression of
+ * disk_cache_get() can overlap with other work.
+ *
+ * The returned job must be passed to either disk_cache_get_job_wait() or
+ * disk_cache_get_job_discard() before the cache is destroyed. It may be NULL
+ * if allocating it failed, which both of them treat as a cache miss.
+ */
+struct disk_cache_get_job *
+disk_cache_get_async(struct disk_cache *cache, const cache_key key);
+
+/**
+ * Return whether the lookup started by disk_cache_get_async() has finished,
+ * so that disk_cache_get_job_wait() would not block.
+ */
+bool
+disk_cache_get_job_is_done(struct disk_cache_get_job *job);
+
+/**
+ * Wait for the lookup started by disk_cache_get_async() and free \job.
+ *
+ * \return The same as disk_cache_get() would have returned for the key.
+ */
+void *
+disk_cache_get_job_wait(struct disk_cache_get_job *job, size_t *size);
+
+/**
+ * Free \job and whatever it retrieved, skipping the lookup if it hasn't
+ * started yet.
+ */
+void
+disk_cache_get_job_discard(struct disk_cache_get_job *job);
+
 /**
  * Store the name \key within the cache, (without any associated data).
  *
@@ -304,6 +339,31 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    return NULL;
 }
 
+static inline struct disk_cache_get_job *
+disk_cache_get_async(struct disk_cache *cache, const cache_key key)
+{
+   return NULL;
+}
+
+static inline bool
+disk_cache_get_job_is_done(struct disk_cache_get_job *job)
+{
+   return true;
+}
+
+static inline void *
+disk_cache_get_job_wait(struct disk_cache_get_job *job, size_t *size)
+{
+   if (size)
+      *size = 0;
+   return NULL;
+}
+
+static inline void
+disk_cache_get_job_discard(struct disk_cache_get_job *job)
+{
+}
+
 static inline void
 disk_cache_put_key(struct disk_cache *cache, const cache_key key)
 {
@@ -35,6 +35,7 @@
 #include "util/fossilize_db.h"
 #include "util/mesa_cache_db.h"
 #include "util/mesa_cache_db_multipart.h"
+#include "util/simple_mtx.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -64,6 +65,10 @@ struct disk_cache {
    /* Thread queue for compressing and writing cache entries to disk */
    struct util_queue cache_queue;
 
+   /* Thread queue for disk_cache_get_async(), created on first use */
+   struct util_queue get_queue;
+   simple_mtx_t get_queue_mtx;
+
    struct foz_db foz_db;
 
    struct mesa_cache_db_multipart cache_db;
@@ -503,6 +503,10 @@
    DRI_CONF_OPT_B(v3d_nonmsaa_texture_size_limit, def, \
                   "Report the non-MSAA-only texture size limit")
 
+#define DRI_CONF_VC4_THREADED_CONTEXT(def) \
+   DRI_CONF_OPT_B(vc4_threaded_context, def, \
+                  "Run vc4 gallium context calls on a driver thread")
+
 /**
  * \brief virgl specific configuration options
  */
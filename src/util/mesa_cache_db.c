@@ -91,14 +91,14 @@ static inline bool mesa_db_truncate(FILE *file, long pos)
 }
 
 static bool
-mesa_db_lock(struct mesa_cache_db *db)
+mesa_db_lock_op(struct mesa_cache_db *db, int operation)
 {
    simple_mtx_lock(&db->flock_mtx);
 
-   if (flock(fileno(db->cache.file), LOCK_EX) == -1)
+   if (flock(fileno(db->cache.file), operation) == -1)
       goto unlock_mtx;
 
-   if (flock(fileno(db->index.file), LOCK_EX) == -1)
+   if (flock(fileno(db->index.file), operation) == -1)
       goto unlock_cache;
 
    return true;
@@ -111,6 +111,19 @@ unlock_mtx:
    return false;
 }
 
+static bool
+mesa_db_lock(struct mesa_cache_db *db)
+{
+   return mesa_db_lock_op(db, LOCK_EX);
+}
+
+/* Like mesa_db_lock(), but fails instead of waiting for other processes */
+static bool
+mesa_db_trylock(struct mesa_cache_db *db)
+{
+   return mesa_db_lock_op(db, LOCK_EX | LOCK_NB);
+}
+
 static void
 mesa_db_unlock(struct mesa_cache_db *db)
 {
@@ -135,8 +148,15 @@ mesa_db_generate_uuid(void)
    /* This simple UUID implementation is sufficient for our needs
     * because UUID is updated rarely. It's nice to make UUID meaningful
     * and incremental by adding the timestamp to it, which also prevents
-    * the potential collisions. */
-   return ((os_time_get() / 1000000) << 32) | rand();
+    * the potential collisions.
+    *
+    * rand() isn't seeded, so it gives the same sequence in every process,
+    * and processes compacting the same DB within a second would generate
+    * the same UUID and miss each other's compactions. Mix in the PID and
+    * the time in nanoseconds to tell them apart. */
+   uint32_t salt = rand() ^ getpid() ^ os_time_get_nano();
+
+   return ((os_time_get() / 1000000) << 32) | salt;
 }
 
 static bool
@@ -221,6 +241,7 @@ mesa_db_zap(struct mesa_cache_db *db)
 {
    /* Disable cache to prevent the recurring faults */
    db->alive = false;
+   db->cache_size = 0;
 
    /* Zap corrupted database files to start over from a clean slate */
    if (!mesa_db_truncate(db->cache.file, 0) ||
@@ -584,6 +605,8 @@ mesa_db_compact(struct mesa_cache_db *db, int64_t blob_size,
        !mesa_db_write_header(&db->index, db->uuid, false))
       goto cleanup;
 
+   db->cache_size = ftell(compacted_cache) - sizeof(struct mesa_db_file_header);
+
    success = true;
 
 cleanup:
@@ -767,6 +790,32 @@ mesa_cache_db_eviction_size(struct mesa_cache_db *db)
    return db->max_cache_size / 2 - sizeof(struct mesa_db_file_header);
 }
 
+/* Space mesa_cache_db_try_compact() keeps free for the writes that happen
+ * until it gets to run, and evicts each time it does.
+ */
+static uint64_t
+mesa_cache_db_compaction_slack(struct mesa_cache_db *db)
+{
+   return db->max_cache_size / 8;
+}
+
+/* Size above which mesa_cache_db_try_compact() evicts entries */
+static uint64_t
+mesa_cache_db_compaction_watermark(struct mesa_cache_db *db)
+{
+   return db->max_cache_size - mesa_cache_db_compaction_slack(db);
+}
+
+/* Size to evict from a DB of cache_size bytes to get it one slack below the
+ * watermark, so that it stays close to its size limit rather than half empty.
+ */
+static uint64_t
+mesa_cache_db_compaction_size(struct mesa_cache_db *db, uint64_t cache_size)
+{
+   return cache_size + mesa_cache_db_compaction_slack(db) -
+          mesa_cache_db_compaction_watermark(db);
+}
+
 bool
 mesa_cache_db_entry_write(struct mesa_cache_db *db,
                           const uint8_t *cache_key_160bit,
@@ -790,8 +839,16 @@ mesa_cache_db_entry_write(struct mesa_cache_db *db,
       goto fail_fatal;
 
    if (!mesa_cache_db_has_space_locked(db, blob_size)) {
-      if (!mesa_db_compact(db, MAX2(blob_size, mesa_cache_db_eviction_size(db)),
-                           NULL))
+      uint64_t eviction_size = mesa_cache_db_eviction_size(db);
+
+      if (db->background_compaction) {
+         eviction_size =
+            mesa_cache_db_compaction_size(db, ftell(db->cache.file) -
+                                              sizeof(struct mesa_db_file_header) +
+                                              blob_file_size(blob_size));
+      }
+
+      if (!mesa_db_compact(db, MAX2(blob_size, eviction_size), NULL))
          goto fail_fatal;
    } else {
       if (!mesa_db_update_index(db))
@@ -835,6 +892,7 @@ mesa_cache_db_entry_write(struct mesa_cache_db *db,
    fflush(db->index.file);
 
    db->index.offset = ftell(db->index.file);
+   db->cache_size = ftell(db->cache.file) - sizeof(struct mesa_db_file_header);
 
    _mesa_hash_table_u64_insert(db->index_db, hash, hash_entry);
 
@@ -924,6 +982,64 @@ fail_fatal:
    return false;
 }
 
+bool
+mesa_cache_db_needs_compaction(struct mesa_cache_db *db)
+{
+   bool needs_compaction;
+
+   /* Only take the in-process lock, this is checked after every write and
+    * the size we last saw is good enough.
+    */
+   simple_mtx_lock(&db->flock_mtx);
+   needs_compaction = db->alive &&
+                      db->cache_size > mesa_cache_db_compaction_watermark(db);
+   simple_mtx_unlock(&db->flock_mtx);
+
+   return needs_compaction;
+}
+
+bool
+mesa_cache_db_try_compact(struct mesa_cache_db *db)
+{
+   int64_t cache_size;
+
+   /* If another process holds the DB, it may be compacting it already, and
+    * otherwise a later write will ask for compaction again.
+    */
+   if (!mesa_db_trylock(db))
+      return false;
+
+   if (!db->alive)
+      goto fail;
+
+   if (mesa_db_uuid_changed(db) && !mesa_db_reload(db))
+      goto fail_fatal;
+
+   if (!mesa_db_seek_end(db->cache.file))
+      goto fail_fatal;
+
+   cache_size = ftell(db->cache.file) - sizeof(struct mesa_db_file_header);
+
+   if (cache_size > mesa_cache_db_compaction_watermark(db)) {
+      if (!mesa_db_compact(db, mesa_cache_db_compaction_size(db, cache_size),
+                           NULL))
+         goto fail_fatal;
+   } else {
+      db->cache_size = cache_size;
+   }
+
+   mesa_db_unlock(db);
+
+   return true;
+
+fail_fatal:
+   mesa_db_zap(db);
+fail:
+   mesa_db_unlock(db);
+
+   return false;
+}
+
 static uint64_t
 mesa_cache_db_eviction_2x_score_period(void)
 {
@@ -33,6 +33,13 @@ struct mesa_cache_db {
    struct mesa_cache_db_file cache;
    struct mesa_cache_db_file index;
    uint64_t max_cache_size;
+   /* Size of the cache file the last time this process wrote to it */
+   uint64_t cache_size;
+   /* Set when mesa_cache_db_try_compact() is run on the DB before it fills
+    * up. Writes that find it full anyway then evict only as much as that
+    * would, instead of half of the DB.
+    */
+   bool background_compaction;
    simple_mtx_t flock_mtx;
    void *mem_ctx;
    uint64_t uuid;
@@ -75,6 +82,12 @@ mesa_cache_db_has_space(struct mesa_cache_db *db, size_t blob_size);
 
 double
 mesa_cache_db_eviction_score(struct mesa_cache_db *db);
+
+bool
+mesa_cache_db_needs_compaction(struct mesa_cache_db *db);
+
+bool
+mesa_cache_db_try_compact(struct mesa_cache_db *db);
 #else
 static inline bool
 mesa_cache_db_open(struct mesa_cache_db *db, const char *cache_path)
@@ -139,6 +152,18 @@ mesa_cache_db_eviction_score(struct mesa_cache_db *db)
 {
    return 0;
 }
+
+static inline bool
+mesa_cache_db_needs_compaction(struct mesa_cache_db *db)
+{
+   return false;
+}
+
+static inline bool
+mesa_cache_db_try_compact(struct mesa_cache_db *db)
+{
+   return false;
+}
 #endif /* DETECT_OS_WINDOWS */
 
 #ifdef __cplusplus
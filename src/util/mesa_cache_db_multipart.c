@@ -9,8 +9,47 @@
 #include "detect_os.h"
 #include "string.h"
 #include "mesa_cache_db_multipart.h"
+#include "u_atomic.h"
 #include "u_debug.h"
 
+static void
+mesa_cache_db_multipart_compact_job(void *data, void *gdata, int thread_index)
+{
+   struct mesa_cache_db_multipart *db = gdata;
+   struct mesa_cache_db *part = data;
+
+   mesa_cache_db_try_compact(part);
+
+   p_atomic_set(&db->compact_pending[part - db->parts], 0);
+}
+
+static bool
+mesa_cache_db_multipart_init_compaction(struct mesa_cache_db_multipart *db)
+{
+   db->compact_pending = calloc(db->num_parts, sizeof(*db->compact_pending));
+   if (!db->compact_pending)
+      return false;
+
+   /* One thread is enough, compaction is bound by the disk and the point is
+    * only to take it off the writers.
+    */
+   if (!util_queue_init(&db->compact_queue, "mesa_db", db->num_parts, 1,
+                        UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, db)) {
+      free(db->compact_pending);
+      return false;
+   }
+
+   return true;
+}
+
+static void
+mesa_cache_db_multipart_finish_compaction(struct mesa_cache_db_multipart *db)
+{
+   util_queue_finish(&db->compact_queue);
+   util_queue_destroy(&db->compact_queue);
+   free(db->compact_pending);
+}
+
 bool
 mesa_cache_db_multipart_open(struct mesa_cache_db_multipart *db,
                              const char *cache_path)
@@ -22,15 +61,33 @@ mesa_cache_db_multipart_open(struct mesa_cache_db_multipart *db,
    unsigned int i;
 
    db->num_parts = debug_get_num_option("MESA_DISK_CACHE_DATABASE_NUM_PARTS", 50);
+   db->sharded = debug_get_bool_option("MESA_DISK_CACHE_DATABASE_SHARDED", false);
+
+   if (!db->num_parts)
+      return false;
 
    db->parts = calloc(db->num_parts, sizeof(*db->parts));
    if (!db->parts)
       return false;
 
+   if (db->sharded && !mesa_cache_db_multipart_init_compaction(db)) {
+      free(db->parts);
+      return false;
+   }
+
    for (i = 0; i < db->num_parts; i++) {
       bool db_opened = false;
+      int ret;
 
-      if (asprintf(&part_path, "%s/part%u", cache_path, i) == -1)
+      /* The entries of a shard can't be found with another layout or number
+       * of shards, so shards don't share directories with either.
+       */
+      if (db->sharded)
+         ret = asprintf(&part_path, "%s/shard%u_of_%u", cache_path, i,
+                        db->num_parts);
+      else
+         ret = asprintf(&part_path, "%s/part%u", cache_path, i);
+      if (ret == -1)
          goto close_db;
 
       if (mkdir(part_path, 0755) == -1 && errno != EEXIST)
@@ -43,6 +100,8 @@ mesa_cache_db_multipart_open(struct mesa_cache_db_multipart *db,
       if (!db_opened)
          goto free_path;
 
+      db->parts[i].background_compaction = db->sharded;
+
       free(part_path);
    }
 
@@ -57,6 +116,9 @@ close_db:
    while (i--)
       mesa_cache_db_close(&db->parts[i]);
 
+   if (db->sharded)
+      mesa_cache_db_multipart_finish_compaction(db);
+
    free(db->parts);
 
    return false;
@@ -66,6 +128,9 @@ close_db:
 void
 mesa_cache_db_multipart_close(struct mesa_cache_db_multipart *db)
 {
+   if (db->sharded)
+      mesa_cache_db_multipart_finish_compaction(db);
+
    while (db->num_parts--)
       mesa_cache_db_close(&db->parts[db->num_parts]);
 
@@ -81,6 +146,18 @@ mesa_cache_db_multipart_set_size_limit(struct mesa_cache_db_multipart *db,
                                    max_cache_size / db->num_parts);
 }
 
+static unsigned
+mesa_cache_db_multipart_shard(struct mesa_cache_db_multipart *db,
+                              const uint8_t *cache_key_160bit)
+{
+   uint32_t prefix = 0;
+
+   for (unsigned i = 0; i < 4; i++)
+      prefix |= ((uint32_t)cache_key_160bit[i]) << i * 8;
+
+   return prefix % db->num_parts;
+}
+
 void *
 mesa_cache_db_multipart_read_entry(struct mesa_cache_db_multipart *db,
                                    const uint8_t *cache_key_160bit,
@@ -88,6 +165,12 @@ mesa_cache_db_multipart_read_entry(struct mesa_cache_db_multipart *db,
 {
    unsigned last_read_part = db->last_read_part;
 
+   if (db->sharded) {
+      unsigned part = mesa_cache_db_multipart_shard(db, cache_key_160bit);
+      return mesa_cache_db_read_entry(&db->parts[part], cache_key_160bit,
+                                      size);
+   }
+
    for (unsigned int i = 0; i < db->num_parts; i++) {
       unsigned int part = (last_read_part + i) % db->num_parts;
 
@@ -128,6 +211,22 @@ mesa_cache_db_multipart_entry_write(struct mesa_cache_db_multipart *db,
    unsigned last_written_part = db->last_written_part;
    int wpart = -1;
 
+   if (db->sharded) {
+      unsigned part = mesa_cache_db_multipart_shard(db, cache_key_160bit);
+      bool written = mesa_cache_db_entry_write(&db->parts[part],
+                                               cache_key_160bit,
+                                               blob, blob_size);
+
+      /* Compact the part before it is full, so that writes don't have to */
+      if (written && mesa_cache_db_needs_compaction(&db->parts[part]) &&
+          p_atomic_cmpxchg(&db->compact_pending[part], 0, 1) == 0) {
+         util_queue_add_job(&db->compact_queue, &db->parts[part], NULL,
+                            mesa_cache_db_multipart_compact_job, NULL, 0);
+      }
+
+      return written;
+   }
+
    for (unsigned int i = 0; i < db->num_parts; i++) {
       unsigned int part = (last_written_part + i) % db->num_parts;
 
@@ -155,6 +254,19 @@ void
 mesa_cache_db_multipart_entry_remove(struct mesa_cache_db_multipart *db,
                                      const uint8_t *cache_key_160bit)
 {
+   if (db->sharded) {
+      unsigned part = mesa_cache_db_multipart_shard(db, cache_key_160bit);
+      mesa_cache_db_entry_remove(&db->parts[part], cache_key_160bit);
+      return;
+   }
+
    for (unsigned int i = 0; i < db->num_parts; i++)
       mesa_cache_db_entry_remove(&db->parts[i], cache_key_160bit);
 }
+
+void
+mesa_cache_db_multipart_wait_for_idle(struct mesa_cache_db_multipart *db)
+{
+   if (db->sharded)
+      util_queue_finish(&db->compact_queue);
+}
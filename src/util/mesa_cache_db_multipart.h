@@ -8,12 +8,22 @@
 #define MESA_CACHE_DB_MULTIPART_H
 
 #include "mesa_cache_db.h"
+#include "u_queue.h"
 
 struct mesa_cache_db_multipart {
    struct mesa_cache_db *parts;
    unsigned int num_parts;
    volatile unsigned int last_read_part;
    volatile unsigned int last_written_part;
+
+   /* In the sharded layout every entry lives in the part selected by its
+    * key, and parts that fill up are compacted on compact_queue instead of
+    * by the write that finds them full.
+    */
+   bool sharded;
+   struct util_queue compact_queue;
+   /* Set for the parts that have a compaction job queued */
+   uint32_t *compact_pending;
 };
 
 bool
@@ -41,4 +51,7 @@ void
 mesa_cache_db_multipart_entry_remove(struct mesa_cache_db_multipart *db,
                                      const uint8_t *cache_key_160bit);
 
+void
+mesa_cache_db_multipart_wait_for_idle(struct mesa_cache_db_multipart *db);
+
 #endif /* MESA_CACHE_DB_MULTIPART_H */
@@ -0,0 +1,299 @@
+/*
+ * Copyright © 2024 Raspberry Pi Ltd
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Contention benchmark for the Mesa-DB cache.
+ *
+ * A number of processes share one cache directory, as GL and Vulkan
+ * applications running side by side do, and read and write entries of a
+ * working set larger than the cache, so that eviction keeps happening. It
+ * is run once with the multi-part layout and once with the sharded one, and
+ * reports the operation throughput over all processes and the latency of
+ * reads and writes, where stalls behind the locks of other processes and
+ * behind compactions show up.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "util/macros.h"
+#include "util/mesa_cache_db_multipart.h"
+#include "util/os_time.h"
+
+#define MAX_PROCESSES 64
+
+struct bench_options {
+   unsigned num_processes;
+   unsigned num_ops;
+   unsigned num_parts;
+   unsigned entry_size;
+   uint64_t max_size;
+   unsigned num_keys;
+};
+
+struct latency_stats {
+   uint64_t count;
+   int64_t p50;
+   int64_t p99;
+   int64_t max;
+};
+
+struct process_result {
+   int64_t ns;
+   struct latency_stats reads;
+   struct latency_stats writes;
+   uint64_t hits;
+};
+
+static void
+make_key(uint8_t key[20], uint32_t n)
+{
+   uint32_t x = n * 2654435761u + 1;
+
+   for (unsigned i = 0; i < 20; i += 4) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      memcpy(&key[i], &x, 4);
+   }
+}
+
+static int
+compare_ns(const void *a, const void *b)
+{
+   int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+   return x < y ? -1 : x > y;
+}
+
+static struct latency_stats
+compute_latency_stats(int64_t *samples, uint64_t count)
+{
+   struct latency_stats stats = { .count = count };
+
+   if (!count)
+      return stats;
+
+   qsort(samples, count, sizeof(*samples), compare_ns);
+   stats.p50 = samples[count / 2];
+   stats.p99 = samples[count * 99 / 100];
+   stats.max = samples[count - 1];
+
+   return stats;
+}
+
+static struct process_result
+run_process(const struct bench_options *opts, const char *path,
+            unsigned index)
+{
+   struct process_result result = { 0 };
+   struct mesa_cache_db_multipart db;
+   int64_t *reads, *writes;
+   uint64_t num_reads = 0, num_writes = 0;
+   uint8_t key[20];
+   uint8_t *blob;
+
+   blob = malloc(opts->entry_size);
+   reads = malloc(opts->num_ops * sizeof(*reads));
+   writes = malloc(opts->num_ops * sizeof(*writes));
+   if (!blob || !reads || !writes || !mesa_cache_db_multipart_open(&db, path))
+      exit(1);
+
+   mesa_cache_db_multipart_set_size_limit(&db, opts->max_size);
+   memset(blob, index, opts->entry_size);
+
+   uint32_t seed = index * 7919 + 1;
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < opts->num_ops; i++) {
+      seed = seed * 1103515245 + 12345;
+      make_key(key, (seed >> 8) % opts->num_keys);
+
+      /* Look the entry up and write it on a miss, as a shader compile
+       * would.
+       */
+      size_t size;
+      int64_t t = os_time_get_nano();
+      void *data = mesa_cache_db_multipart_read_entry(&db, key, &size);
+      reads[num_reads++] = os_time_get_nano() - t;
+
+      if (data) {
+         result.hits++;
+         free(data);
+         continue;
+      }
+
+      t = os_time_get_nano();
+      mesa_cache_db_multipart_entry_write(&db, key, blob, opts->entry_size);
+      writes[num_writes++] = os_time_get_nano() - t;
+   }
+
+   result.ns = os_time_get_nano() - start;
+   result.reads = compute_latency_stats(reads, num_reads);
+   result.writes = compute_latency_stats(writes, num_writes);
+
+   mesa_cache_db_multipart_close(&db);
+   free(writes);
+   free(reads);
+   free(blob);
+
+   return result;
+}
+
+static bool
+run(const struct bench_options *opts, bool sharded)
+{
+   struct process_result results[MAX_PROCESSES];
+   char path[] = "/tmp/mesa_cache_db_bench.XXXXXX";
+   pid_t pids[MAX_PROCESSES];
+   int fds[MAX_PROCESSES];
+   bool success = true;
+
+   if (!mkdtemp(path))
+      return false;
+
+   char num_parts[16];
+   snprintf(num_parts, sizeof(num_parts), "%u", opts->num_parts);
+   setenv("MESA_DISK_CACHE_DATABASE_NUM_PARTS", num_parts, 1);
+   setenv("MESA_DISK_CACHE_DATABASE_SHARDED", sharded ? "true" : "false", 1);
+
+   /* Don't let the children inherit what is left to print */
+   fflush(stdout);
+
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < opts->num_processes; i++) {
+      int pipefd[2];
+
+      if (pipe(pipefd) == -1)
+         return false;
+
+      pids[i] = fork();
+      if (pids[i] == 0) {
+         close(pipefd[0]);
+         struct process_result result = run_process(opts, path, i);
+         exit(write(pipefd[1], &result, sizeof(result)) == sizeof(result) ?
+              0 : 1);
+      }
+
+      close(pipefd[1]);
+      fds[i] = pipefd[0];
+   }
+
+   for (unsigned i = 0; i < opts->num_processes; i++) {
+      int status;
+
+      if (read(fds[i], &results[i], sizeof(results[i])) != sizeof(results[i]))
+         success = false;
+      close(fds[i]);
+
+      if (waitpid(pids[i], &status, 0) == -1 || !WIFEXITED(status) ||
+          WEXITSTATUS(status))
+         success = false;
+   }
+
+   int64_t ns = os_time_get_nano() - start;
+
+   char cmd[64];
+   snprintf(cmd, sizeof(cmd), "rm -rf %s", path);
+   if (system(cmd) != 0)
+      fprintf(stderr, "Failed to remove %s\n", path);
+
+   if (!success) {
+      fprintf(stderr, "A benchmark process failed\n");
+      return false;
+   }
+
+   uint64_t ops = 0, hits = 0;
+   int64_t read_p99 = 0, read_max = 0, write_p99 = 0, write_max = 0;
+
+   /* The percentiles are the worst of the processes' ones */
+   for (unsigned i = 0; i < opts->num_processes; i++) {
+      ops += results[i].reads.count + results[i].writes.count;
+      hits += results[i].hits;
+      read_p99 = MAX2(read_p99, results[i].reads.p99);
+      read_max = MAX2(read_max, results[i].reads.max);
+      write_p99 = MAX2(write_p99, results[i].writes.p99);
+      write_max = MAX2(write_max, results[i].writes.max);
+   }
+
+   printf("%-10s %10.0f %7.1f%% %10.2f %10.2f %10.2f %10.2f\n",
+          sharded ? "sharded" : "multipart",
+          ops / (ns / 1e9), 100.0 * hits / (opts->num_processes * opts->num_ops),
+          read_p99 / 1e6, read_max / 1e6, write_p99 / 1e6, write_max / 1e6);
+
+   return true;
+}
+
+static void
+usage(const char *name)
+{
+   fprintf(stderr,
+           "Usage: %s [-p processes] [-n lookups per process] [-s parts] "
+           "[-e entry size] [-m max cache size in KB]\n",
+           name);
+   exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+   struct bench_options opts = {
+      .num_processes = 8,
+      .num_ops = 2000,
+      .num_parts = 16,
+      .entry_size = 4096,
+      .max_size = 4 * 1024 * 1024,
+   };
+   int opt;
+
+   while ((opt = getopt(argc, argv, "p:n:s:e:m:")) != -1) {
+      switch (opt) {
+      case 'p':
+         opts.num_processes = atoi(optarg);
+         break;
+      case 'n':
+         opts.num_ops = atoi(optarg);
+         break;
+      case 's':
+         opts.num_parts = atoi(optarg);
+         break;
+      case 'e':
+         opts.entry_size = atoi(optarg);
+         break;
+      case 'm':
+         opts.max_size = strtoull(optarg, NULL, 0) * 1024;
+         break;
+      default:
+         usage(argv[0]);
+      }
+   }
+   if (opts.num_processes < 1 || opts.num_processes > MAX_PROCESSES ||
+       opts.num_ops < 1 || opts.num_parts < 1 || opts.entry_size < 1 ||
+       opts.max_size < opts.entry_size * opts.num_parts * 2)
+      usage(argv[0]);
+
+   /* Twice as many entries as fit in the cache */
+   opts.num_keys = opts.max_size / opts.entry_size * 2;
+
+   printf("%u processes, %u lookups each, %u parts, %u byte entries, "
+          "%" PRIu64 " KB cache, %u keys\n\n",
+          opts.num_processes, opts.num_ops, opts.num_parts, opts.entry_size,
+          opts.max_size / 1024, opts.num_keys);
+   printf("%-10s %10s %8s %10s %10s %10s %10s\n", "layout", "ops/s", "hits",
+          "read p99", "read max", "write p99", "write max");
+   printf("%-10s %10s %8s %10s %10s %10s %10s\n", "", "", "",
+          "(ms)", "(ms)", "(ms)", "(ms)");
+
+   if (!run(&opts, false) || !run(&opts, true))
+      return 1;
+
+   return 0;
+}
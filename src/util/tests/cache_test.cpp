@@ -271,6 +271,11 @@ test_put_and_get(bool test_cache_size_limit, const char *driver_id)
    EXPECT_EQ(result, nullptr) << "disk_cache_get with non-existent item (pointer)";
    EXPECT_EQ(size, 0) << "disk_cache_get with non-existent item (size)";
 
+   result = (char *) disk_cache_get_job_wait(disk_cache_get_async(cache, blob_key),
+                                             &size);
+   EXPECT_EQ(result, nullptr) << "disk_cache_get_async with non-existent item (pointer)";
+   EXPECT_EQ(size, 0) << "disk_cache_get_async with non-existent item (size)";
+
    /* Simple test of put and get. */
    disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
 
@@ -296,6 +301,24 @@ test_put_and_get(bool test_cache_size_limit, const char *driver_id)
 
    free(result);
 
+   /* Test several lookups in flight at once, including a discarded one. */
+   struct disk_cache_get_job *blob_job = disk_cache_get_async(cache, blob_key);
+   struct disk_cache_get_job *string_job =
+      disk_cache_get_async(cache, string_key);
+   disk_cache_get_job_discard(disk_cache_get_async(cache, blob_key));
+
+   result = (char *) disk_cache_get_job_wait(string_job, &size);
+   EXPECT_STREQ(result, string) << "disk_cache_get_async of existing item (pointer)";
+   EXPECT_EQ(size, sizeof(string)) << "disk_cache_get_async of existing item (size)";
+
+   free(result);
+
+   result = (char *) disk_cache_get_job_wait(blob_job, &size);
+   EXPECT_STREQ(result, blob) << "2nd disk_cache_get_async of existing item (pointer)";
+   EXPECT_EQ(size, sizeof(blob)) << "2nd disk_cache_get_async of existing item (size)";
+
+   free(result);
+
    /* Set the cache size to 1KB and add a 1KB item to force an eviction. */
    disk_cache_destroy(cache);
 
@@ -795,6 +818,109 @@ TEST_F(Cache, Database)
 #endif
 }
 
+static void
+test_sharded_background_compaction(const char *driver_id)
+{
+   const unsigned int entry_size = 512;
+   uint8_t blob[entry_size];
+   cache_key keys[64];
+   unsigned int i, n;
+   char *result;
+   size_t size;
+
+   setenv("MESA_SHADER_CACHE_MAX_SIZE", "16K", 1);
+
+   struct disk_cache *cache = disk_cache_create("test", driver_id, 0);
+   struct mesa_cache_db_multipart *db = &cache->cache_db;
+
+   EXPECT_TRUE(db->sharded) << "MESA_DISK_CACHE_DATABASE_SHARDED";
+
+   unsigned int entry_file_size = entry_size;
+   entry_file_size -= sizeof(struct cache_entry_file_data);
+   entry_file_size -= mesa_cache_db_file_entry_size();
+   entry_file_size -= cache->driver_keys_blob_size;
+   entry_file_size -= 4 + 8; /* cache_item_metadata size + room for alignment */
+
+   /* Write four times what the cache can hold. Every write that takes a
+    * part above 7/8 of its size queues its compaction, so once the cache is
+    * idle no part should be above that, and no write should have had to
+    * compact a full part itself.
+    */
+   for (i = 0; i < ARRAY_SIZE(keys); i++) {
+      memset(blob, i, entry_file_size);
+
+      disk_cache_compute_key(cache, blob, entry_file_size, keys[i]);
+      disk_cache_put(cache, keys[i], blob, entry_file_size, NULL);
+      disk_cache_wait_for_idle(cache);
+
+      for (n = 0; n < db->num_parts; n++) {
+         EXPECT_LE(db->parts[n].cache_size, db->parts[n].max_cache_size -
+                                            db->parts[n].max_cache_size / 8)
+            << "DB part above the compaction watermark";
+      }
+
+      result = (char *) disk_cache_get(cache, keys[i], &size);
+      EXPECT_NE(result, nullptr) << "disk_cache_get with existent item (pointer)";
+      EXPECT_EQ(size, entry_file_size) << "disk_cache_get with existent item (size)";
+      free(result);
+   }
+
+   /* The first entries must have been evicted by now */
+   for (i = 0, n = 0; i < ARRAY_SIZE(keys); i++) {
+      result = (char *) disk_cache_get(cache, keys[i], &size);
+      if (!result)
+         n++;
+      free(result);
+   }
+
+   EXPECT_GE(n, ARRAY_SIZE(keys) / 2) << "evicted entries";
+
+   /* Compaction only evicts down to a little below the watermark, so every
+    * part that filled up is still mostly used.
+    */
+   for (n = 0; n < db->num_parts; n++) {
+      EXPECT_GT(db->parts[n].cache_size, db->parts[n].max_cache_size / 2)
+         << "DB part compacted too far";
+   }
+
+   disk_cache_destroy(cache);
+}
+
+TEST_F(Cache, DatabaseSharded)
+{
+   const char *driver_id = "make_check_uncompressed";
+
+#ifndef ENABLE_SHADER_CACHE
+   GTEST_SKIP() << "ENABLE_SHADER_CACHE not defined.";
+#else
+   setenv("MESA_DISK_CACHE_DATABASE_NUM_PARTS", "4", 1);
+   setenv("MESA_DISK_CACHE_DATABASE_SHARDED", "true", 1);
+   setenv("MESA_DISK_CACHE_DATABASE", "true", 1);
+
+   test_disk_cache_create(mem_ctx, CACHE_DIR_NAME_DB, driver_id);
+
+   test_put_and_get(false, driver_id);
+
+   test_put_key_and_get_key(driver_id);
+
+   test_put_and_get_between_instances(driver_id);
+
+   int err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+
+   test_disk_cache_create(mem_ctx, CACHE_DIR_NAME_DB, driver_id);
+
+   test_sharded_background_compaction(driver_id);
+
+   unsetenv("MESA_DISK_CACHE_DATABASE_NUM_PARTS");
+   unsetenv("MESA_DISK_CACHE_DATABASE_SHARDED");
+   unsetenv("MESA_DISK_CACHE_DATABASE");
+
+   err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+#endif
+}
+
 TEST_F(Cache, Combined)
 {
    const char *driver_id = "make_check";
@@ -1,6 +1,10 @@
+#include <ctype.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include "vc4/vc4_context.h"
+#include "compiler/nir/nir_builder.h"
 #include "main/consts_exts.h"
 #include "main/shader_types.h"
 #include "standalone.h"
@@ -14,7 +18,17 @@ struct st_config_options;
 #include "state_tracker/st_extensions.h"
 #include "main/shared.h"
 #include "main/shaderapi.h"
+#include "main/shaderobj.h"
+#include "util/blob.h"
+#include "util/disk_cache.h"
+#include "util/memstream.h"
+#include "util/os_file.h"
+#include "util/set.h"
 #include "util/sha1/sha1.h"
+#include "util/simple_mtx.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_dynarray.h"
+#include "util/u_queue.h"
 
 static int
 vc4_simulator_get_param_ioctl(int fd, struct drm_vc4_get_param *args) {
@@ -51,6 +65,8 @@ struct shader_bo {
     void *data;
 };
 
+/* Shared by all worker contexts, so every access takes the lock. */
+static simple_mtx_t shader_table_lock = SIMPLE_MTX_INITIALIZER;
 static __u32 shader_table_capacity = 0;
 static __u32 shader_table_num = 0;
 static struct shader_bo *shader_table = NULL;
@@ -58,6 +74,7 @@ static struct shader_bo *shader_table = NULL;
 static int
 vc4_simulator_create_shader_bo_ioctl(int fd,
                                      struct drm_vc4_create_shader_bo *args) {
+   simple_mtx_lock(&shader_table_lock);
    if (shader_table_capacity == 0) {
       shader_table_capacity = 32;
       shader_table = realloc(shader_table,
@@ -76,6 +93,21 @@ vc4_simulator_create_shader_bo_ioctl(int fd,
    memcpy(bo->data, (void *) (uintptr_t) args->data, args->size);
 
    args->handle = shader_table_num++;
+   simple_mtx_unlock(&shader_table_lock);
+
+   return 0;
+}
+
+static int
+vc4_simulator_gem_close_ioctl(int fd, struct drm_gem_close *args) {
+   /* Handles are never reused, so just release the code. */
+   simple_mtx_lock(&shader_table_lock);
+   assert(args->handle < shader_table_num);
+   struct shader_bo *bo = &shader_table[args->handle];
+   free(bo->data);
+   bo->data = NULL;
+   bo->size = 0;
+   simple_mtx_unlock(&shader_table_lock);
 
    return 0;
 }
@@ -93,6 +125,8 @@ int drmIoctl(int fd, unsigned long request, void *arg) {
          return -1;
       case DRM_IOCTL_VC4_CREATE_SHADER_BO:
          return vc4_simulator_create_shader_bo_ioctl(fd, arg);
+      case DRM_IOCTL_GEM_CLOSE:
+         return vc4_simulator_gem_close_ioctl(fd, arg);
       default:
          fprintf(stderr, "Unknown ioctl 0x%08x\n", (int) request);
          abort();
@@ -155,9 +189,388 @@ renderonly_scanout_destroy(struct renderonly_scanout *scanout,
    assert(0);
 }
 
+/**
+ * One "name = value" or "name = [value, ...]" entry of a sidecar file,
+ * under the [section] it appears in, if any.  Values are kept as text, with
+ * the quotes of strings removed.
+ */
+struct vc4_glsl_sidecar_entry {
+   const char *section;
+   const char *name;
+   const char **values;
+   unsigned num_values;
+   unsigned line;
+   /* Set once something has consumed the entry. */
+   bool used;
+};
+
+/** One pinned uniform dword, at its offset in the program's parameters. */
+struct vc4_glsl_pinned_dword {
+   uint32_t offset;
+   uint32_t value;
+};
+
+/* foo.vert -> foo.<suffix> */
+static char *
+sidecar_path(void *mem_ctx, const char *vert_path, const char *suffix) {
+   const char *dot = strrchr(vert_path, '.');
+   const char *slash = strrchr(vert_path, '/');
+   int len = dot && (!slash || dot > slash) ? dot - vert_path
+                                            : (int) strlen(vert_path);
+   return ralloc_asprintf(mem_ctx, "%.*s.%s", len, vert_path, suffix);
+}
+
+static void
+skip_sidecar_space(const char **c, unsigned *line, bool newlines) {
+   while (**c) {
+      if (**c == '#') {
+         while (**c && **c != '\n')
+            ++*c;
+      } else if (**c == '\n' && newlines) {
+         ++*line;
+         ++*c;
+      } else if (**c == ' ' || **c == '\t' || **c == '\r') {
+         ++*c;
+      } else {
+         break;
+      }
+   }
+}
+
+static const char *
+parse_sidecar_name(void *mem_ctx, const char **c) {
+   const char *name = *c;
+   while (isalnum(**c) || **c == '_')
+      ++*c;
+   if (*c == name || isdigit(*name))
+      return NULL;
+   return ralloc_strndup(mem_ctx, name, *c - name);
+}
+
+/**
+ * Parses a sidecar file next to a pair's .vert: the TOML subset of [section]
+ * headers and "name = value" or "name = [value, ...]" entries.
+ */
+static bool
+parse_sidecar(void *mem_ctx, const char *path, const char *text,
+              struct util_dynarray *entries, FILE *err) {
+   const char *c = text;
+   const char *section = NULL;
+   unsigned line = 1;
+   for (;;) {
+      skip_sidecar_space(&c, &line, true);
+      if (!*c)
+         return true;
+
+      if (*c == '[') {
+         ++c;
+         skip_sidecar_space(&c, &line, false);
+         section = parse_sidecar_name(mem_ctx, &c);
+         skip_sidecar_space(&c, &line, false);
+         if (!section || *c != ']') {
+            fprintf(err, "%s:%u: expected a [section] name\n", path, line);
+            return false;
+         }
+         ++c;
+         skip_sidecar_space(&c, &line, false);
+         if (*c && *c != '\n') {
+            fprintf(err, "%s:%u: trailing characters after [%s]\n", path,
+                    line, section);
+            return false;
+         }
+         continue;
+      }
+
+      struct vc4_glsl_sidecar_entry entry = {
+         .section = section,
+         .name = parse_sidecar_name(mem_ctx, &c),
+         .line = line,
+      };
+      if (!entry.name) {
+         fprintf(err, "%s:%u: expected a name\n", path, line);
+         return false;
+      }
+
+      skip_sidecar_space(&c, &line, false);
+      if (*c != '=') {
+         fprintf(err, "%s:%u: expected '=' after %s\n", path, line,
+                 entry.name);
+         return false;
+      }
+      ++c;
+      skip_sidecar_space(&c, &line, false);
+
+      bool list = *c == '[';
+      if (list)
+         ++c;
+      struct util_dynarray values;
+      util_dynarray_init(&values, mem_ctx);
+      for (;;) {
+         skip_sidecar_space(&c, &line, list);
+         if (list && *c == ']' &&
+             util_dynarray_num_elements(&values, const char *) == 0) {
+            ++c;
+            break;
+         }
+
+         const char *value = c, *value_end;
+         if (*c == '"') {
+            value = ++c;
+            while (*c && *c != '"' && *c != '\n')
+               ++c;
+            if (*c != '"') {
+               fprintf(err, "%s:%u: unterminated string in %s\n", path,
+                       line, entry.name);
+               return false;
+            }
+            value_end = c++;
+         } else {
+            while (*c && !isspace(*c) && *c != ',' && *c != ']' &&
+                   *c != '#')
+               ++c;
+            value_end = c;
+            if (c == value) {
+               fprintf(err, "%s:%u: expected a value for %s\n", path, line,
+                       entry.name);
+               return false;
+            }
+         }
+         util_dynarray_append(&values, const char *,
+                              ralloc_strndup(mem_ctx, value,
+                                             value_end - value));
+
+         if (!list)
+            break;
+         skip_sidecar_space(&c, &line, true);
+         if (*c == ']') {
+            ++c;
+            break;
+         }
+         if (*c != ',') {
+            fprintf(err, "%s:%u: expected ',' or ']' in %s\n", path, line,
+                    entry.name);
+            return false;
+         }
+         ++c;
+      }
+      entry.values = values.data;
+      entry.num_values = util_dynarray_num_elements(&values, const char *);
+
+      skip_sidecar_space(&c, &line, false);
+      if (*c && *c != '\n') {
+         fprintf(err, "%s:%u: trailing characters after %s\n", path, line,
+                 entry.name);
+         return false;
+      }
+
+      util_dynarray_foreach(entries, struct vc4_glsl_sidecar_entry, other) {
+         if (other->section == section &&
+             strcmp(other->name, entry.name) == 0) {
+            fprintf(err, "%s:%u: %s is set twice\n", path, line,
+                    entry.name);
+            return false;
+         }
+      }
+      util_dynarray_append(entries, struct vc4_glsl_sidecar_entry, entry);
+   }
+}
+
+/**
+ * Parses the uniform sidecar, which pins uniforms to constants with plain
+ * "name = value" entries, giving matrices in column-major order.
+ */
+static bool
+parse_pinned_uniforms(void *mem_ctx, const char *path, const char *text,
+                      struct util_dynarray *pins, FILE *err) {
+   if (!parse_sidecar(mem_ctx, path, text, pins, err))
+      return false;
+   util_dynarray_foreach(pins, struct vc4_glsl_sidecar_entry, pin) {
+      if (pin->section) {
+         fprintf(err, "%s:%u: uniforms can't be in a [section]\n", path,
+                 pin->line);
+         return false;
+      }
+   }
+   return true;
+}
+
+static bool
+parse_pinned_value(GLenum data_type, const char *text, uint32_t *value) {
+   char *end;
+   errno = 0;
+   switch (data_type) {
+      case GL_FLOAT_MAT4:
+      case GL_FLOAT_MAT3:
+      case GL_FLOAT_MAT2:
+      case GL_FLOAT_VEC4:
+      case GL_FLOAT_VEC3:
+      case GL_FLOAT_VEC2:
+      case GL_FLOAT:
+         *value = fui(strtof(text, &end));
+         break;
+      case GL_INT_VEC4:
+      case GL_INT_VEC3:
+      case GL_INT_VEC2:
+      case GL_INT:
+         *value = (uint32_t) strtol(text, &end, 0);
+         break;
+      case GL_UNSIGNED_INT_VEC4:
+      case GL_UNSIGNED_INT_VEC3:
+      case GL_UNSIGNED_INT_VEC2:
+      case GL_UNSIGNED_INT:
+         *value = (uint32_t) strtoul(text, &end, 0);
+         break;
+      default:
+         return false;
+   }
+   return errno == 0 && end != text && *end == '\0';
+}
+
+/**
+ * Resolves the pinned uniforms against one stage's parameters, appending a
+ * vc4_glsl_pinned_dword for each component to \p dwords.
+ */
+static bool
+resolve_pinned_uniforms(const struct gl_program_parameter_list *parameters,
+                        struct util_dynarray *pins,
+                        struct util_dynarray *dwords, FILE *err) {
+   util_dynarray_foreach(pins, struct vc4_glsl_sidecar_entry, pin) {
+      unsigned p = 0;
+      while (p < parameters->NumParameters &&
+             (parameters->Parameters[p].Type != PROGRAM_UNIFORM ||
+              strcmp(parameters->Parameters[p].Name, pin->name) != 0))
+         ++p;
+      if (p == parameters->NumParameters)
+         continue;
+      pin->used = true;
+
+      /* Matrix columns follow each other with the same storage index. */
+      const unsigned storage_index = parameters->Parameters[p].UniformStorageIndex;
+      unsigned end = p, num_values = 0;
+      for (; end < parameters->NumParameters &&
+             parameters->Parameters[end].Type == PROGRAM_UNIFORM &&
+             parameters->Parameters[end].UniformStorageIndex == storage_index;
+           ++end)
+         num_values += parameters->Parameters[end].Size;
+      if (pin->num_values != num_values) {
+         fprintf(err, "Unable to pin %s: expected %u values, got %u\n",
+                 pin->name, num_values, pin->num_values);
+         return false;
+      }
+
+      unsigned v = 0;
+      for (; p < end; ++p) {
+         const struct gl_program_parameter *parameter =
+            &parameters->Parameters[p];
+         for (unsigned i = 0; i < parameter->Size; ++i, ++v) {
+            struct vc4_glsl_pinned_dword dword = {
+               .offset = parameter->ValueOffset + i,
+            };
+            if (!parse_pinned_value(parameter->DataType, pin->values[v],
+                                    &dword.value)) {
+               fprintf(err, "Unable to pin %s: invalid value %s\n",
+                       pin->name, pin->values[v]);
+               return false;
+            }
+            util_dynarray_append(dwords, struct vc4_glsl_pinned_dword,
+                                 dword);
+         }
+      }
+   }
+   return true;
+}
+
+static const struct vc4_glsl_pinned_dword *
+find_pinned_dword(const struct util_dynarray *dwords, uint32_t offset) {
+   util_dynarray_foreach(dwords, struct vc4_glsl_pinned_dword, dword) {
+      if (dword->offset == offset)
+         return dword;
+   }
+   return NULL;
+}
+
+static bool
+is_pinned_uniform(const struct util_dynarray *pins, const char *name) {
+   util_dynarray_foreach(pins, struct vc4_glsl_sidecar_entry, pin) {
+      if (strcmp(pin->name, name) == 0)
+         return true;
+   }
+   return false;
+}
+
+/**
+ * Replaces the pinned components of directly-addressed uniform loads with
+ * immediates, like nir_inline_uniforms() does for UBO 0.  vc4 keeps its
+ * uniforms in load_uniform (in vec4 slots at this point), so that pass
+ * doesn't apply.  The driver's NIR optimization then folds the constants
+ * into the QPU code, and loads left without uses are dropped.
+ */
+static bool
+inline_pinned_uniforms_instr(nir_builder *b, nir_instr *instr, void *data) {
+   const struct util_dynarray *dwords = data;
+   if (instr->type != nir_instr_type_intrinsic)
+      return false;
+   nir_intrinsic_instr *intr = nir_instr_as_intrinsic(instr);
+   if (intr->intrinsic != nir_intrinsic_load_uniform ||
+       !nir_src_is_const(intr->src[0]) ||
+       intr->dest.ssa.bit_size != 32)
+      return false;
+
+   const uint32_t offset = (nir_intrinsic_base(intr) +
+                            nir_src_as_uint(intr->src[0])) * 4;
+   b->cursor = nir_after_instr(instr);
+   nir_ssa_def *comps[NIR_MAX_VEC_COMPONENTS];
+   bool progress = false;
+   for (unsigned i = 0; i < intr->num_components; ++i) {
+      const struct vc4_glsl_pinned_dword *dword =
+         find_pinned_dword(dwords, offset + i);
+      if (dword) {
+         comps[i] = nir_imm_int(b, dword->value);
+         progress = true;
+      } else {
+         comps[i] = nir_channel(b, &intr->dest.ssa, i);
+      }
+   }
+   if (!progress)
+      return false;
+
+   nir_ssa_def *vec = nir_vec(b, comps, intr->num_components);
+   nir_ssa_def_rewrite_uses_after(&intr->dest.ssa, vec, vec->parent_instr);
+   return true;
+}
+
+static void
+inline_pinned_uniforms(struct vc4_screen *screen,
+                       struct vc4_uncompiled_shader *so,
+                       const struct util_dynarray *dwords) {
+   if (!dwords->size)
+      return;
+
+   NIR_PASS_V(so->base.ir.nir, nir_shader_instructions_pass,
+              inline_pinned_uniforms_instr,
+              nir_metadata_block_index | nir_metadata_dominance,
+              (void *) dwords);
+#ifdef ENABLE_SHADER_CACHE
+   /* The driver's cache is keyed on the uncompiled NIR. */
+   vc4_disk_cache_hash_shader(screen, so);
+#endif
+}
+
 static void output_uniform_parameter(FILE *out,
                                      const struct gl_program_parameter_list *parameters,
+                                     const struct util_dynarray *pinned,
                                      uint32_t index) {
+   /* Pinned uniforms that are still loaded, e.g. through indirect
+    * addressing, come from the uniform stream.
+    */
+   const struct vc4_glsl_pinned_dword *dword =
+      find_pinned_dword(pinned, index);
+   if (dword) {
+      fprintf(out, "            ShaderUniform::Constant(0x%08X),\n",
+              dword->value);
+      return;
+   }
+
    unsigned last_uniform_storage_index = 0xffffffff;
    unsigned base_p = 0xffffffff;
    for (unsigned p = 0; p < parameters->NumParameters; ++p) {
@@ -227,6 +640,7 @@ static void output_uniform_parameter(FILE *out,
 static void output_uniforms(FILE *out, enum pipe_shader_type shader_type,
                             const struct vc4_shader_uniform_info *uniforms,
                             const struct gl_program_parameter_list *parameters,
+                            const struct util_dynarray *pinned,
                             const struct gl_shader_program_data *prog_data) {
    for (unsigned i = 0; i < uniforms->count; ++i) {
       const enum quniform_contents contents = uniforms->contents[i];
@@ -249,7 +663,7 @@ static void output_uniforms(FILE *out, enum pipe_shader_type shader_type,
                     data);
             break;
          case QUNIFORM_UNIFORM:
-            output_uniform_parameter(out, parameters, data);
+            output_uniform_parameter(out, parameters, pinned, data);
             break;
          case QUNIFORM_TEXTURE_CONFIG_P0:
             for (unsigned r = 0; r < prog_data->NumProgramResourceList; ++r) {
@@ -288,13 +702,15 @@ static void output_uniforms(FILE *out, enum pipe_shader_type shader_type,
 
 static void output_uniform_args(FILE *out,
                                 const struct gl_program_parameter_list *parameters_tup[2],
+                                const struct util_dynarray *pins,
                                 const struct gl_shader_program_data *prog_data) {
    uint32_t visited_uniforms = 0;
    for (unsigned i = 0; i < 2; ++i) {
       const struct gl_program_parameter_list *parameters = parameters_tup[i];
       for (unsigned p = 0; p < parameters->NumParameters; ++p) {
          const struct gl_program_parameter *parameter = &parameters->Parameters[p];
-         if (parameter->Type != PROGRAM_UNIFORM)
+         if (parameter->Type != PROGRAM_UNIFORM ||
+             is_pinned_uniform(pins, parameter->Name))
             continue;
          const uint32_t this_uniform_mask =
             1 << parameter->UniformStorageIndex;
@@ -364,236 +780,56 @@ static void output_uniform_args(FILE *out,
    }
 }
 
-static void output_compiled_shader(const char **shader_id,
-                                   const char *dir,
-                                   const struct vc4_compiled_shader *cshader) {
-   assert(cshader->bo->handle < shader_table_num);
-   const struct shader_bo *shader = &shader_table[cshader->bo->handle];
-
-   SHA1_CTX sha1;
-   SHA1Init(&sha1);
-   SHA1Update(&sha1, shader->data, shader->size);
-   uint8_t digest[SHA1_DIGEST_LENGTH];
-   SHA1Final(digest, &sha1);
-
-   *shader_id = ralloc_asprintf(NULL,
-                                "gen_%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X",
-                                digest[0], digest[1], digest[2], digest[3],
-                                digest[4], digest[5], digest[6], digest[7],
-                                digest[8], digest[9], digest[10], digest[11],
-                                digest[12], digest[13], digest[14],
-                                digest[15], digest[16], digest[17],
-                                digest[18], digest[19]);
-   char *shader_path = ralloc_asprintf(NULL, "%s%s.rs",
-                                       dir, *shader_id);
-
-   FILE *shader_f = fopen(shader_path, "w");
-   fprintf(shader_f,
-           "#![allow(unused_imports, nonstandard_style)]\n"
-           "use super::ShaderNode;\n"
-           "use vc4_drm::qpu;\n"
-           "const ASM_CODE: [u64; %u] = qpu! {\n",
-           (unsigned) shader->size / 8);
-   vc4_glsl_qpu_disasm(shader_f, shader->data, (int) shader->size / 8);
-   fprintf(shader_f,
-           "};\npub static ASM: ShaderNode = ShaderNode::new(&ASM_CODE);\n");
-   fclose(shader_f);
+/**
+ * Writes the static statistics of one compiled object as a member of the
+ * JSON object for its bind function.
+ */
+static void
+output_shader_stats(FILE *out, const char *stage, const char *id,
+                    const struct vc4_compiled_shader *cshader, bool last) {
+   const struct vc4_shader_stats *stats = &cshader->stats;
+   fprintf(out, "    \"%s\": {\n"
+                "      \"object\": \"%s\",\n"
+                "      \"instructions\": %u,\n"
+                "      \"estimated_cycles\": %u,\n"
+                "      \"uniforms\": %u,\n"
+                "      \"tmu_fetches\": %u,\n"
+                "      \"max_temps\": %u,\n"
+                "      \"spills\": %u,\n"
+                "      \"fills\": %u,\n"
+                "      \"uniform_bytes_saved\": %u,\n"
+                "      \"threads\": %u\n"
+                "    }%s\n",
+           stage, id, stats->qpu_inst_count, stats->estimated_cycles,
+           stats->num_uniforms, stats->tmu_fetches, stats->max_temps,
+           stats->spills, stats->fills, stats->uniform_bytes_saved,
+           cshader->fs_threaded ? 2 : 1,
+           last ? "" : ",");
 }
 
-int main(int argc, char **argv) {
-   if (argc < 4) {
-      fprintf(stderr, "Usage: %s <file>.vert <file>.frag <output>.rs\n",
-              argv[0]);
-      return 1;
-   }
-
-   char *vert_path = argv[1];
-   char *frag_path = argv[2];
-   char *rs_path = argv[3];
-   char *rs_dir = strdup(rs_path);
-   char *slash = strrchr(rs_dir, '/');
-   if (slash)
-      *(slash + 1) = '\0';
-   char *obj_dir = ralloc_asprintf(NULL, "%sobjects/", rs_dir);
-
-   struct vc4_context *vc4;
-
-   vc4 = rzalloc(NULL, struct vc4_context);
-   if (!vc4)
-      return 1;
-   struct vc4_screen *screen = (struct vc4_screen *) vc4_screen_create(-1,
-                                                                       NULL,
-                                                                       NULL);
-   vc4->screen = screen;
-
-   struct pipe_context *pctx = &vc4->base;
-
-   vc4_state_init(pctx);
-   vc4_program_init(pctx);
-   vc4_job_init(vc4);
-
-   static struct gl_shared_state shared = {0};
-   static struct gl_context local_ctx = {.Shared = &shared};
-   _mesa_init_shader_includes(&shared);
-   struct standalone_options standalone_opts = {
-      .glsl_version = 430,
-      .do_link = 1,
-      //.dump_ast = 1,
-      //.dump_builder = 1,
-   };
-   char *files[] = {vert_path, frag_path};
-   struct gl_shader_program *shader_program = standalone_compile_shader(
-      &standalone_opts, 2, files, &local_ctx);
-
-   for (unsigned i = 0; i < shader_program->NumShaders; ++i) {
-      struct gl_shader *shader = shader_program->Shaders[i];
-      if (!shader->CompileStatus) {
-         fwrite(shader->InfoLog, 1, strlen(shader->InfoLog), stderr);
-      }
-   }
-
-   if (!shader_program->data->LinkStatus) {
-      if (strlen(shader_program->data->InfoLog))
-         fprintf(stderr, "Unable to link shaders: %s\n",
-                 shader_program->data->InfoLog);
-      return 1;
-   }
-
+/**
+ * Writes the bind function for the shaders currently compiled into \p vc4.
+ */
+static void
+output_bind_fn(FILE *fout, const char *fn_name, struct vc4_context *vc4,
+               const char *ids[3], struct gl_shader_program *shader_program,
+               const struct pipe_vertex_element *vertex_elements,
+               const unsigned *vertex_element_sizes,
+               unsigned num_vertex_elements,
+               const struct util_dynarray *pins,
+               const struct util_dynarray *vs_pinned,
+               const struct util_dynarray *fs_pinned) {
    struct gl_linked_shader *linked_vertex = shader_program->_LinkedShaders[MESA_SHADER_VERTEX];
    struct gl_linked_shader *linked_fragment = shader_program->_LinkedShaders[MESA_SHADER_FRAGMENT];
 
-   struct pipe_vertex_element vertex_elements[16] = {0};
-   unsigned vertex_element_sizes[16] = {0};
-   unsigned num_vertex_elements = extract_vertex_attributes_from_ir(
-      vertex_elements, vertex_element_sizes, linked_vertex->ir);
-
-   struct gl_extensions extensions = {0};
-   st_init_limits(&screen->base, &local_ctx.Const, &extensions,
-                  API_OPENGL_CORE);
-
-   static struct st_context local_st_ctx = {0};
-   local_st_ctx.pipe = pctx;
-   local_st_ctx.screen = &screen->base;
-   local_st_ctx.ctx = &local_ctx;
-   local_ctx.st = &local_st_ctx;
-   struct gl_pipeline_object pipeline_object = {
-      .Flags = 0
-   };
-   local_ctx._Shader = &pipeline_object;
-
-   st_link_shader(&local_ctx, shader_program);
-
-   {
-      struct st_variant *variant = &linked_vertex->Program->variants[0];
-      struct vc4_uncompiled_shader *shader = variant->driver_shader;
-      pctx->bind_vs_state(pctx, shader);
-   }
-
-   {
-      struct st_variant *variant = &linked_fragment->Program->variants[0];
-      struct vc4_uncompiled_shader *shader = variant->driver_shader;
-      pctx->bind_fs_state(pctx, shader);
-   }
-
-   {
-      struct pipe_rasterizer_state ras_state = {
-         .clip_plane_enable = 0,
-      };
-      struct vc4_rasterizer_state *ras_state_obj = pctx->create_rasterizer_state(
-         pctx, &ras_state);
-      pctx->bind_rasterizer_state(pctx, ras_state_obj);
-   }
-
-   {
-      struct pipe_blend_state blend_state = {0};
-      blend_state.rt[0].blend_enable = 0;
-      blend_state.rt[0].rgb_func = PIPE_BLEND_ADD;
-      blend_state.rt[0].rgb_src_factor = PIPE_BLENDFACTOR_ONE;
-      blend_state.rt[0].rgb_dst_factor = PIPE_BLENDFACTOR_ONE;
-      blend_state.rt[0].alpha_func = PIPE_BLEND_ADD;
-      blend_state.rt[0].alpha_src_factor = PIPE_BLENDFACTOR_ONE;
-      blend_state.rt[0].alpha_dst_factor = PIPE_BLENDFACTOR_ONE;
-      blend_state.rt[0].colormask = PIPE_MASK_RGBA;
-      struct pipe_blend_state *blend_state_obj = pctx->create_blend_state(
-         pctx,
-         &blend_state);
-      pctx->bind_blend_state(pctx, blend_state_obj);
-   }
-
-   {
-      struct pipe_depth_stencil_alpha_state zsa_state = {
-         .depth_enabled = 1
-      };
-      struct vc4_depth_stencil_alpha_state *zsa_state_obj = pctx->create_depth_stencil_alpha_state(
-         pctx, &zsa_state);
-      pctx->bind_depth_stencil_alpha_state(pctx, zsa_state_obj);
-   }
-
-   {
-      struct vc4_vertex_stateobj *vtx_state = pctx->create_vertex_elements_state(
-         pctx, num_vertex_elements, vertex_elements);
-      pctx->bind_vertex_elements_state(pctx, vtx_state);
-   }
-
-   struct pipe_resource tex_res = {0};
-   tex_res.format = PIPE_FORMAT_B8G8R8A8_UNORM;
-   {
-      struct pipe_sampler_view *views[VC4_MAX_TEXTURE_SAMPLERS];
-      struct pipe_sampler_state *states[VC4_MAX_TEXTURE_SAMPLERS];
-      for (unsigned i = 0; i < VC4_MAX_TEXTURE_SAMPLERS; ++i) {
-         views[i] = rzalloc_size(NULL, sizeof(struct vc4_sampler_view));
-         views[i]->texture = &tex_res;
-         views[i]->format = PIPE_FORMAT_B8G8R8A8_UNORM;
-         views[i]->swizzle_r = PIPE_SWIZZLE_X;
-         views[i]->swizzle_g = PIPE_SWIZZLE_Y;
-         views[i]->swizzle_b = PIPE_SWIZZLE_Z;
-         views[i]->swizzle_a = PIPE_SWIZZLE_W;
-         states[i] = rzalloc_size(NULL, sizeof(struct pipe_sampler_state));
-      }
-      pctx->set_sampler_views(pctx, PIPE_SHADER_FRAGMENT, 0,
-                              VC4_MAX_TEXTURE_SAMPLERS, 0, true, views);
-      pctx->bind_sampler_states(pctx, PIPE_SHADER_FRAGMENT, 0,
-                                VC4_MAX_TEXTURE_SAMPLERS, (void **) states);
-   }
-
-   struct pipe_resource cbuf0_res = {0};
-   cbuf0_res.format = PIPE_FORMAT_B8G8R8A8_UNORM;
-   struct pipe_surface cbuf0 = {0};
-   cbuf0.reference.count = 1;
-   cbuf0.texture = &cbuf0_res;
-   cbuf0.format = cbuf0_res.format;
-   vc4->framebuffer.cbufs[0] = &cbuf0;
-
-   if ((linked_vertex->Program->info.outputs_written & VARYING_BIT_POS) ==
-       0) {
-      fprintf(stderr, "%s does not write to gl_Position\n", files[0]);
-      return 1;
-   }
-
-   vc4_get_job_for_fbo(vc4);
-   vc4_update_compiled_shaders(vc4, PIPE_PRIM_TRIANGLES);
-
-   FILE *fout = fopen(rs_path, "w");
-
-   fprintf(fout, "#![allow(unused_imports, nonstandard_style)]\n"
-                 "use super::objects;\n"
-                 "use rpi_drm::{Buffer, CommandEncoder, ShaderAttribute, ShaderUniform, TextureUniform};\n"
-                 "use vc4_drm::cl::AttributeRecord;\n"
-                 "use vc4_drm::{glam, qpu};\n\n");
-
-   const char *ids[3];
-   output_compiled_shader(&ids[0], obj_dir, vc4->prog.cs);
-   output_compiled_shader(&ids[1], obj_dir, vc4->prog.vs);
-   output_compiled_shader(&ids[2], obj_dir, vc4->prog.fs);
-
-   fprintf(fout, "pub fn bind(encoder: &mut CommandEncoder");
+   fprintf(fout, "pub fn %s(encoder: &mut CommandEncoder", fn_name);
    if (num_vertex_elements)
       fprintf(fout, ", cs_vbo: &Buffer, vs_vbo: &Buffer");
    const struct gl_program_parameter_list *parameters_tup[2] = {
       linked_vertex->Program->Parameters,
       linked_fragment->Program->Parameters
    };
-   output_uniform_args(fout, parameters_tup, shader_program->data);
+   output_uniform_args(fout, parameters_tup, pins, shader_program->data);
    fprintf(fout, ") {\n"
                  "    encoder.bind_shader(\n"
                  "        %s,\n"
@@ -673,22 +909,1485 @@ int main(int argc, char **argv) {
    fprintf(fout, "        ],\n"
                  "        &[\n");
    output_uniforms(fout, MESA_SHADER_FRAGMENT, &vc4->prog.fs->uniforms,
-                   linked_fragment->Program->Parameters,
+                   linked_fragment->Program->Parameters, fs_pinned,
                    shader_program->data);
    fprintf(fout, "        ],\n"
                  "        &[\n");
    output_uniforms(fout, MESA_SHADER_VERTEX, &vc4->prog.vs->uniforms,
-                   linked_vertex->Program->Parameters,
+                   linked_vertex->Program->Parameters, vs_pinned,
                    shader_program->data);
    fprintf(fout, "        ],\n"
                  "        &[\n");
    output_uniforms(fout, MESA_SHADER_VERTEX, &vc4->prog.cs->uniforms,
-                   linked_vertex->Program->Parameters,
+                   linked_vertex->Program->Parameters, vs_pinned,
                    shader_program->data);
    fprintf(fout, "        ],\n"
                  "    );\n"
                  "}\n");
+}
 
-   fclose(fout);
-   return 0;
+/**
+ * One generated output file, named relative to the directory of the output
+ * .rs file.  \p data is malloc'ed.
+ */
+struct vc4_glsl_file {
+   const char *name;
+   char *data;
+   size_t size;
+};
+
+/** How QPU objects are handed to rustc. */
+enum vc4_glsl_object_format {
+   /** objects/gen_*.rs with the disassembly inside a qpu! {} macro. */
+   VC4_GLSL_OBJECT_QPU_MACRO,
+   /**
+    * objects/gen_*.bin with the raw little-endian instructions, for the build
+    * script to pack into a single archive.
+    */
+   VC4_GLSL_OBJECT_BIN,
+};
+
+/* Output options; these are set once from the command line. */
+static enum vc4_glsl_object_format object_format = VC4_GLSL_OBJECT_QPU_MACRO;
+static bool write_disasm = false;
+static bool write_stats = false;
+
+static struct disk_cache *glsl_cache;
+
+static const struct standalone_options standalone_opts = {
+   .glsl_version = 430,
+   .do_link = 1,
+   //.dump_ast = 1,
+   //.dump_builder = 1,
+};
+
+static void
+add_output_file(struct util_dynarray *outputs, const char *name, char *data,
+                size_t size) {
+   struct vc4_glsl_file file = { .name = name, .data = data, .size = size };
+   util_dynarray_append(outputs, struct vc4_glsl_file, file);
+}
+
+/* Adds a file holding the disassembly of \p code between a prefix and suffix.
+ */
+static bool
+add_output_qpu_text(struct util_dynarray *outputs, const char *name,
+                    const char *prefix, const struct shader_bo *code,
+                    const char *suffix) {
+   char *data;
+   size_t size;
+   struct u_memstream mem;
+   if (!u_memstream_open(&mem, &data, &size))
+      return false;
+   FILE *f = u_memstream_get(&mem);
+   fputs(prefix, f);
+   vc4_glsl_qpu_disasm(f, code->data, (int) code->size / 8);
+   fputs(suffix, f);
+   u_memstream_close(&mem);
+
+   add_output_file(outputs, name, data, size);
+   return true;
+}
+
+static bool output_compiled_shader(void *mem_ctx,
+                                   const char **shader_id,
+                                   struct util_dynarray *outputs,
+                                   const struct vc4_compiled_shader *cshader) {
+   /* Take a copy of the entry: its code is only freed by this context, but
+    * the table itself may be reallocated by other workers.
+    */
+   simple_mtx_lock(&shader_table_lock);
+   assert(cshader->bo->handle < shader_table_num);
+   const struct shader_bo bo_entry = shader_table[cshader->bo->handle];
+   simple_mtx_unlock(&shader_table_lock);
+   const struct shader_bo *shader = &bo_entry;
+
+   SHA1_CTX sha1;
+   SHA1Init(&sha1);
+   SHA1Update(&sha1, shader->data, shader->size);
+   uint8_t digest[SHA1_DIGEST_LENGTH];
+   SHA1Final(digest, &sha1);
+
+   *shader_id = ralloc_asprintf(mem_ctx,
+                                "gen_%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X",
+                                digest[0], digest[1], digest[2], digest[3],
+                                digest[4], digest[5], digest[6], digest[7],
+                                digest[8], digest[9], digest[10], digest[11],
+                                digest[12], digest[13], digest[14],
+                                digest[15], digest[16], digest[17],
+                                digest[18], digest[19]);
+   const unsigned num_insts = shader->size / 8;
+
+   /* Variants of a pair often share code, e.g. the coordinate shader. */
+   const char *obj_name = ralloc_asprintf(mem_ctx, "objects/%s.%s",
+                                          *shader_id,
+                                          object_format == VC4_GLSL_OBJECT_BIN ?
+                                          "bin" : "rs");
+   util_dynarray_foreach(outputs, struct vc4_glsl_file, file) {
+      if (strcmp(file->name, obj_name) == 0)
+         return true;
+   }
+
+   if (object_format == VC4_GLSL_OBJECT_BIN) {
+      uint64_t *bin = malloc(num_insts * sizeof(uint64_t));
+      if (!bin)
+         return false;
+      for (unsigned i = 0; i < num_insts; ++i)
+         bin[i] = util_cpu_to_le64(((const uint64_t *) shader->data)[i]);
+      add_output_file(outputs, obj_name, (char *) bin,
+                      num_insts * sizeof(uint64_t));
+
+      if (write_disasm &&
+          !add_output_qpu_text(outputs,
+                               ralloc_asprintf(mem_ctx, "objects/%s.asm",
+                                               *shader_id),
+                               "", shader, ""))
+         return false;
+   } else {
+      char *prefix = ralloc_asprintf(mem_ctx,
+                                     "#![allow(unused_imports, nonstandard_style)]\n"
+                                     "use super::ShaderNode;\n"
+                                     "use vc4_drm::qpu;\n"
+                                     "const ASM_CODE: [u64; %u] = qpu! {\n",
+                                     num_insts);
+      if (!add_output_qpu_text(outputs, obj_name, prefix, shader,
+                               "};\npub static ASM: ShaderNode = ShaderNode::new(&ASM_CODE);\n"))
+         return false;
+   }
+
+   return true;
+}
+
+static bool
+file_matches(const char *path, const struct vc4_glsl_file *file) {
+   size_t size;
+   char *data = os_read_file(path, &size);
+   bool ret = data && size == file->size &&
+              memcmp(data, file->data, size) == 0;
+   free(data);
+   return ret;
+}
+
+/**
+ * Files whose contents didn't change are left alone, so that their mtime
+ * doesn't make cargo rebuild the crate that includes them.
+ */
+static bool
+write_output_files(const char *rs_dir, const struct util_dynarray *outputs,
+                   FILE *err) {
+   util_dynarray_foreach(outputs, struct vc4_glsl_file, file) {
+      char *path = ralloc_asprintf(NULL, "%s%s", rs_dir, file->name);
+      if (file_matches(path, file)) {
+         ralloc_free(path);
+         continue;
+      }
+      FILE *f = fopen(path, "wb");
+      if (!f || fwrite(file->data, 1, file->size, f) != file->size) {
+         fprintf(err, "Unable to write %s: %s\n", path, strerror(errno));
+         if (f)
+            fclose(f);
+         ralloc_free(path);
+         return false;
+      }
+      fclose(f);
+      ralloc_free(path);
+   }
+   return true;
+}
+
+static int
+compare_paths(const void *a, const void *b) {
+   return strcmp(*(const char **) a, *(const char **) b);
+}
+
+static void
+write_depfile_path(FILE *f, const char *path) {
+   for (const char *c = path; *c; ++c) {
+      if (*c == ' ' || *c == '#')
+         fputc('\\', f);
+      else if (*c == '$')
+         fputc('$', f);
+      fputc(*c, f);
+   }
+}
+
+/**
+ * Writes a make-style depfile next to \p rs_path (foo.rs -> foo.d), listing
+ * every file the preprocessor loaded, much like cc -MD.
+ */
+static bool
+write_depfile(const char *rs_path, struct set *loaded_files, FILE *err) {
+   void *mem_ctx = ralloc_context(NULL);
+   size_t len = strlen(rs_path);
+   if (len > 3 && strcmp(rs_path + len - 3, ".rs") == 0)
+      len -= 3;
+   char *path = ralloc_asprintf(mem_ctx, "%.*s.d", (int) len, rs_path);
+
+   const char **deps = ralloc_array(mem_ctx, const char *,
+                                    loaded_files->entries);
+   unsigned num_deps = 0;
+   set_foreach(loaded_files, entry)
+      deps[num_deps++] = entry->key;
+   qsort(deps, num_deps, sizeof(*deps), compare_paths);
+
+   FILE *f = fopen(path, "w");
+   if (!f) {
+      fprintf(err, "Unable to write %s: %s\n", path, strerror(errno));
+      ralloc_free(mem_ctx);
+      return false;
+   }
+   write_depfile_path(f, rs_path);
+   fputc(':', f);
+   for (unsigned i = 0; i < num_deps; ++i) {
+      fputs(" \\\n  ", f);
+      write_depfile_path(f, deps[i]);
+   }
+   fputc('\n', f);
+   fclose(f);
+
+   ralloc_free(mem_ctx);
+   return true;
+}
+
+#ifdef ENABLE_SHADER_CACHE
+
+/**
+ * Generated sources are cached under the preprocessed text of both stages,
+ * so that a fresh checkout or a touched file doesn't need a full compile.
+ * The cache itself is keyed on the build-id of this binary, which takes care
+ * of compiler upgrades.
+ */
+static void
+vc4_glsl_cache_init(void) {
+   const struct build_id_note *note =
+      build_id_find_nhdr_for_addr(vc4_glsl_cache_init);
+   if (!note || build_id_length(note) != 20)
+      return;
+
+   char timestamp[41];
+   _mesa_sha1_format(timestamp, build_id_data(note));
+
+   glsl_cache = disk_cache_create("vc4-glsl", timestamp, 0);
+}
+
+static bool
+vc4_glsl_cache_compute_key(struct gl_context *ctx, const char *vert_path,
+                           const char *frag_path, const char *rs_name,
+                           const char *pins_text, const char *variants_text,
+                           cache_key key) {
+   const char *paths[] = { vert_path, frag_path };
+   void *mem_ctx = ralloc_context(NULL);
+   struct mesa_sha1 sha1_ctx;
+   _mesa_sha1_init(&sha1_ctx);
+
+   const uint8_t output_opts[] = { object_format, write_disasm, write_stats };
+   _mesa_sha1_update(&sha1_ctx, output_opts, sizeof(output_opts));
+   /* The cached files are named after the pair's output, relative to its
+    * directory.
+    */
+   _mesa_sha1_update(&sha1_ctx, rs_name, strlen(rs_name) + 1);
+   const char *sidecars[] = { pins_text, variants_text };
+   for (unsigned i = 0; i < ARRAY_SIZE(sidecars); ++i) {
+      if (sidecars[i])
+         _mesa_sha1_update(&sha1_ctx, sidecars[i], strlen(sidecars[i]));
+      _mesa_sha1_update(&sha1_ctx, "", 1);
+   }
+
+   for (unsigned i = 0; i < ARRAY_SIZE(paths); ++i) {
+      char *info_log;
+      char *text = standalone_preprocess_shader(&standalone_opts, paths[i],
+                                                ctx, mem_ctx, &info_log);
+      if (!text) {
+         /* Let the full compile report the error. */
+         ralloc_free(mem_ctx);
+         return false;
+      }
+      _mesa_sha1_update(&sha1_ctx, text, strlen(text) + 1);
+   }
+   ralloc_free(mem_ctx);
+
+   uint8_t sha1[20];
+   _mesa_sha1_final(&sha1_ctx, sha1);
+   disk_cache_compute_key(glsl_cache, sha1, sizeof(sha1), key);
+   return true;
+}
+
+static bool
+vc4_glsl_cache_retrieve(const cache_key key, const char *rs_dir,
+                        FILE *err) {
+   size_t buffer_size;
+   void *buffer = disk_cache_get(glsl_cache, key, &buffer_size);
+   if (!buffer)
+      return false;
+
+   struct util_dynarray files;
+   util_dynarray_init(&files, NULL);
+   struct blob_reader blob;
+   blob_reader_init(&blob, buffer, buffer_size);
+   uint32_t num_files = blob_read_uint32(&blob);
+   for (unsigned i = 0; i < num_files && !blob.overrun; ++i) {
+      const char *name = blob_read_string(&blob);
+      uint32_t size = blob_read_uint32(&blob);
+      char *data = (char *) blob_read_bytes(&blob, size);
+      add_output_file(&files, name, data, size);
+   }
+
+   bool ret = false;
+   if (!blob.overrun && blob.current == blob.end)
+      ret = write_output_files(rs_dir, &files, err);
+
+   util_dynarray_fini(&files);
+   free(buffer);
+   return ret;
+}
+
+static void
+vc4_glsl_cache_store(const cache_key key,
+                     const struct util_dynarray *files) {
+   struct blob blob;
+   blob_init(&blob);
+   blob_write_uint32(&blob, util_dynarray_num_elements(files,
+                                                       struct vc4_glsl_file));
+   util_dynarray_foreach(files, struct vc4_glsl_file, file) {
+      blob_write_string(&blob, file->name);
+      blob_write_uint32(&blob, file->size);
+      blob_write_bytes(&blob, file->data, file->size);
+   }
+
+   if (!blob.out_of_memory)
+      disk_cache_put(glsl_cache, key, blob.data, blob.size, NULL);
+   blob_finish(&blob);
+}
+
+#else
+
+static void
+vc4_glsl_cache_init(void) {
+}
+
+static bool
+vc4_glsl_cache_compute_key(struct gl_context *ctx, const char *vert_path,
+                           const char *frag_path, const char *rs_name,
+                           const char *pins_text, const char *variants_text,
+                           cache_key key) {
+   return false;
+}
+
+static bool
+vc4_glsl_cache_retrieve(const cache_key key, const char *rs_dir,
+                        FILE *err) {
+   return false;
+}
+
+static void
+vc4_glsl_cache_store(const cache_key key,
+                     const struct util_dynarray *files) {
+}
+
+#endif /* ENABLE_SHADER_CACHE */
+
+/**
+ * Per-worker state that is set up once and reused for every vertex/fragment
+ * pair the worker compiles: the vc4 context, the GL context the GLSL compiler
+ * runs against and the fixed framebuffer/sampler bindings.  The screen is
+ * shared by all workers.
+ */
+struct vc4_glsl_compiler {
+   struct vc4_screen *screen;
+   struct vc4_context *vc4;
+
+   struct gl_shared_state shared;
+   struct gl_context ctx;
+   struct st_context st_ctx;
+   struct gl_pipeline_object pipeline_object;
+
+   struct pipe_resource tex_res;
+   struct pipe_resource cbuf0_res;
+   struct pipe_surface cbuf0;
+};
+
+static struct vc4_glsl_compiler *
+vc4_glsl_compiler_create(struct vc4_screen *screen) {
+   struct vc4_glsl_compiler *compiler = rzalloc(NULL,
+                                                struct vc4_glsl_compiler);
+   if (!compiler)
+      return NULL;
+
+   struct vc4_context *vc4 = rzalloc(compiler, struct vc4_context);
+   if (!vc4) {
+      ralloc_free(compiler);
+      return NULL;
+   }
+   vc4->screen = screen;
+   compiler->vc4 = vc4;
+   compiler->screen = screen;
+
+   struct pipe_context *pctx = &vc4->base;
+
+   vc4_state_init(pctx);
+   vc4_program_init(pctx);
+   vc4_job_init(vc4);
+
+   compiler->ctx.Shared = &compiler->shared;
+   _mesa_init_shader_includes(&compiler->shared);
+
+   compiler->st_ctx.pipe = pctx;
+   compiler->st_ctx.screen = &screen->base;
+   compiler->st_ctx.ctx = &compiler->ctx;
+
+   compiler->tex_res.format = PIPE_FORMAT_B8G8R8A8_UNORM;
+   {
+      struct pipe_sampler_view *views[VC4_MAX_TEXTURE_SAMPLERS];
+      struct pipe_sampler_state *states[VC4_MAX_TEXTURE_SAMPLERS];
+      for (unsigned i = 0; i < VC4_MAX_TEXTURE_SAMPLERS; ++i) {
+         views[i] = rzalloc_size(compiler, sizeof(struct vc4_sampler_view));
+         views[i]->texture = &compiler->tex_res;
+         views[i]->format = PIPE_FORMAT_B8G8R8A8_UNORM;
+         views[i]->swizzle_r = PIPE_SWIZZLE_X;
+         views[i]->swizzle_g = PIPE_SWIZZLE_Y;
+         views[i]->swizzle_b = PIPE_SWIZZLE_Z;
+         views[i]->swizzle_a = PIPE_SWIZZLE_W;
+         states[i] = rzalloc_size(compiler,
+                                  sizeof(struct pipe_sampler_state));
+      }
+      pctx->set_sampler_views(pctx, PIPE_SHADER_FRAGMENT, 0,
+                              VC4_MAX_TEXTURE_SAMPLERS, 0, true, views);
+      pctx->bind_sampler_states(pctx, PIPE_SHADER_FRAGMENT, 0,
+                                VC4_MAX_TEXTURE_SAMPLERS, (void **) states);
+   }
+
+   compiler->cbuf0_res.format = PIPE_FORMAT_B8G8R8A8_UNORM;
+   compiler->cbuf0.reference.count = 1;
+   compiler->cbuf0.texture = &compiler->cbuf0_res;
+   compiler->cbuf0.format = compiler->cbuf0_res.format;
+   vc4->framebuffer.cbufs[0] = &compiler->cbuf0;
+
+   return compiler;
+}
+
+/**
+ * A pipeline state to compile a pair for.  vc4 lowers blending and the
+ * colour and texture formats into the FS, so each of these needs its own
+ * code.  The generated module gets a bind() for the default state and a
+ * bind_<name>() for each [name] table in the pair's .variants.toml.
+ */
+struct vc4_glsl_variant {
+   const char *fn_name;
+   struct pipe_blend_state blend;
+   enum pipe_format cbuf_format;
+   enum pipe_format tex_formats[VC4_MAX_TEXTURE_SAMPLERS];
+   unsigned char tex_swizzles[VC4_MAX_TEXTURE_SAMPLERS][4];
+   uint8_t prim_mode;
+   bool point_size_per_vertex;
+};
+
+static void
+init_default_variant(struct vc4_glsl_variant *variant, const char *fn_name) {
+   memset(variant, 0, sizeof(*variant));
+   variant->fn_name = fn_name;
+
+   variant->blend.rt[0].blend_enable = 0;
+   variant->blend.rt[0].rgb_func = PIPE_BLEND_ADD;
+   variant->blend.rt[0].rgb_src_factor = PIPE_BLENDFACTOR_ONE;
+   variant->blend.rt[0].rgb_dst_factor = PIPE_BLENDFACTOR_ONE;
+   variant->blend.rt[0].alpha_func = PIPE_BLEND_ADD;
+   variant->blend.rt[0].alpha_src_factor = PIPE_BLENDFACTOR_ONE;
+   variant->blend.rt[0].alpha_dst_factor = PIPE_BLENDFACTOR_ONE;
+   variant->blend.rt[0].colormask = PIPE_MASK_RGBA;
+
+   variant->cbuf_format = PIPE_FORMAT_B8G8R8A8_UNORM;
+   for (unsigned i = 0; i < VC4_MAX_TEXTURE_SAMPLERS; ++i) {
+      variant->tex_formats[i] = PIPE_FORMAT_B8G8R8A8_UNORM;
+      variant->tex_swizzles[i][0] = PIPE_SWIZZLE_X;
+      variant->tex_swizzles[i][1] = PIPE_SWIZZLE_Y;
+      variant->tex_swizzles[i][2] = PIPE_SWIZZLE_Z;
+      variant->tex_swizzles[i][3] = PIPE_SWIZZLE_W;
+   }
+   variant->prim_mode = PIPE_PRIM_TRIANGLES;
+}
+
+struct vc4_glsl_enum_name {
+   const char *name;
+   unsigned value;
+};
+
+static const struct vc4_glsl_enum_name blend_funcs[] = {
+   { "add", PIPE_BLEND_ADD },
+   { "subtract", PIPE_BLEND_SUBTRACT },
+   { "reverse_subtract", PIPE_BLEND_REVERSE_SUBTRACT },
+   { "min", PIPE_BLEND_MIN },
+   { "max", PIPE_BLEND_MAX },
+};
+
+/* The constant colour factors would need the colour passed to bind(). */
+static const struct vc4_glsl_enum_name blend_factors[] = {
+   { "zero", PIPE_BLENDFACTOR_ZERO },
+   { "one", PIPE_BLENDFACTOR_ONE },
+   { "src_color", PIPE_BLENDFACTOR_SRC_COLOR },
+   { "src_alpha", PIPE_BLENDFACTOR_SRC_ALPHA },
+   { "dst_color", PIPE_BLENDFACTOR_DST_COLOR },
+   { "dst_alpha", PIPE_BLENDFACTOR_DST_ALPHA },
+   { "src_alpha_saturate", PIPE_BLENDFACTOR_SRC_ALPHA_SATURATE },
+   { "inv_src_color", PIPE_BLENDFACTOR_INV_SRC_COLOR },
+   { "inv_src_alpha", PIPE_BLENDFACTOR_INV_SRC_ALPHA },
+   { "inv_dst_color", PIPE_BLENDFACTOR_INV_DST_COLOR },
+   { "inv_dst_alpha", PIPE_BLENDFACTOR_INV_DST_ALPHA },
+};
+
+static const struct vc4_glsl_enum_name primitives[] = {
+   { "points", PIPE_PRIM_POINTS },
+   { "lines", PIPE_PRIM_LINES },
+   { "triangles", PIPE_PRIM_TRIANGLES },
+};
+
+static const struct {
+   const char *name;
+   unsigned rgb_src, rgb_dst, alpha_src, alpha_dst;
+} blend_presets[] = {
+   { "alpha", PIPE_BLENDFACTOR_SRC_ALPHA, PIPE_BLENDFACTOR_INV_SRC_ALPHA,
+     PIPE_BLENDFACTOR_ONE, PIPE_BLENDFACTOR_INV_SRC_ALPHA },
+   { "premultiplied", PIPE_BLENDFACTOR_ONE, PIPE_BLENDFACTOR_INV_SRC_ALPHA,
+     PIPE_BLENDFACTOR_ONE, PIPE_BLENDFACTOR_INV_SRC_ALPHA },
+   { "additive", PIPE_BLENDFACTOR_SRC_ALPHA, PIPE_BLENDFACTOR_ONE,
+     PIPE_BLENDFACTOR_ONE, PIPE_BLENDFACTOR_ONE },
+   { "multiply", PIPE_BLENDFACTOR_DST_COLOR, PIPE_BLENDFACTOR_ZERO,
+     PIPE_BLENDFACTOR_DST_ALPHA, PIPE_BLENDFACTOR_ZERO },
+};
+
+static bool
+lookup_enum_name(const struct vc4_glsl_enum_name *names, unsigned num_names,
+                 const char *name, unsigned *value) {
+   for (unsigned i = 0; i < num_names; ++i) {
+      if (strcmp(names[i].name, name) == 0) {
+         *value = names[i].value;
+         return true;
+      }
+   }
+   return false;
+}
+
+/* Formats are given by their short name, e.g. "B5G6R5_UNORM". */
+static bool
+lookup_format(struct pipe_screen *pscreen, const char *name, unsigned bind,
+              enum pipe_format *format) {
+   for (unsigned f = PIPE_FORMAT_NONE + 1; f < PIPE_FORMAT_COUNT; ++f) {
+      const struct util_format_description *desc = util_format_description(f);
+      if (desc && strcasecmp(desc->short_name, name) == 0) {
+         *format = f;
+         return pscreen->is_format_supported(pscreen, f, PIPE_TEXTURE_2D, 0,
+                                             0, bind);
+      }
+   }
+   return false;
+}
+
+/* "rgba", "bgr1", "xxx1", ... */
+static bool
+parse_swizzle(const char *text, unsigned char swizzle[4]) {
+   if (strlen(text) != 4)
+      return false;
+   for (unsigned i = 0; i < 4; ++i) {
+      switch (text[i]) {
+         case 'r': case 'x': swizzle[i] = PIPE_SWIZZLE_X; break;
+         case 'g': case 'y': swizzle[i] = PIPE_SWIZZLE_Y; break;
+         case 'b': case 'z': swizzle[i] = PIPE_SWIZZLE_Z; break;
+         case 'a': case 'w': swizzle[i] = PIPE_SWIZZLE_W; break;
+         case '0': swizzle[i] = PIPE_SWIZZLE_0; break;
+         case '1': swizzle[i] = PIPE_SWIZZLE_1; break;
+         default: return false;
+      }
+   }
+   return true;
+}
+
+static bool
+apply_variant_entry(struct pipe_screen *pscreen,
+                    struct vc4_glsl_variant *variant,
+                    const struct vc4_glsl_sidecar_entry *entry,
+                    const char *path, FILE *err) {
+   struct pipe_rt_blend_state *rt = &variant->blend.rt[0];
+   const char *const *values = entry->values;
+   const unsigned n = entry->num_values;
+
+   if (strcmp(entry->name, "blend") == 0) {
+      if (n != 1)
+         goto invalid;
+      if (strcmp(values[0], "none") == 0) {
+         rt->blend_enable = 0;
+         return true;
+      }
+      for (unsigned i = 0; i < ARRAY_SIZE(blend_presets); ++i) {
+         if (strcmp(blend_presets[i].name, values[0]) == 0) {
+            rt->blend_enable = 1;
+            rt->rgb_func = PIPE_BLEND_ADD;
+            rt->rgb_src_factor = blend_presets[i].rgb_src;
+            rt->rgb_dst_factor = blend_presets[i].rgb_dst;
+            rt->alpha_func = PIPE_BLEND_ADD;
+            rt->alpha_src_factor = blend_presets[i].alpha_src;
+            rt->alpha_dst_factor = blend_presets[i].alpha_dst;
+            return true;
+         }
+      }
+      goto invalid;
+   } else if (strcmp(entry->name, "blend_rgb") == 0 ||
+              strcmp(entry->name, "blend_alpha") == 0) {
+      /* [func, src_factor, dst_factor] */
+      unsigned func, src, dst;
+      if (n != 3 ||
+          !lookup_enum_name(blend_funcs, ARRAY_SIZE(blend_funcs), values[0],
+                            &func) ||
+          !lookup_enum_name(blend_factors, ARRAY_SIZE(blend_factors),
+                            values[1], &src) ||
+          !lookup_enum_name(blend_factors, ARRAY_SIZE(blend_factors),
+                            values[2], &dst))
+         goto invalid;
+      rt->blend_enable = 1;
+      if (strcmp(entry->name, "blend_rgb") == 0) {
+         rt->rgb_func = func;
+         rt->rgb_src_factor = src;
+         rt->rgb_dst_factor = dst;
+      } else {
+         rt->alpha_func = func;
+         rt->alpha_src_factor = src;
+         rt->alpha_dst_factor = dst;
+      }
+      return true;
+   } else if (strcmp(entry->name, "colormask") == 0) {
+      if (n != 1)
+         goto invalid;
+      unsigned mask = 0;
+      for (const char *c = values[0]; *c; ++c) {
+         switch (*c) {
+            case 'r': mask |= PIPE_MASK_R; break;
+            case 'g': mask |= PIPE_MASK_G; break;
+            case 'b': mask |= PIPE_MASK_B; break;
+            case 'a': mask |= PIPE_MASK_A; break;
+            default: goto invalid;
+         }
+      }
+      rt->colormask = mask;
+      return true;
+   } else if (strcmp(entry->name, "cbuf_format") == 0) {
+      if (n != 1 ||
+          !lookup_format(pscreen, values[0], PIPE_BIND_RENDER_TARGET,
+                         &variant->cbuf_format))
+         goto invalid;
+      return true;
+   } else if (strcmp(entry->name, "sampler_formats") == 0 ||
+              strcmp(entry->name, "sampler_swizzles") == 0) {
+      /* One value for all samplers, or one per sampler from 0. */
+      if (n == 0 || n > VC4_MAX_TEXTURE_SAMPLERS)
+         goto invalid;
+      const bool formats = strcmp(entry->name, "sampler_formats") == 0;
+      const unsigned num_samplers = n == 1 ? VC4_MAX_TEXTURE_SAMPLERS : n;
+      for (unsigned i = 0; i < num_samplers; ++i) {
+         const char *value = values[n == 1 ? 0 : i];
+         if (formats ? !lookup_format(pscreen, value, PIPE_BIND_SAMPLER_VIEW,
+                                      &variant->tex_formats[i])
+                     : !parse_swizzle(value, variant->tex_swizzles[i]))
+            goto invalid;
+      }
+      return true;
+   } else if (strcmp(entry->name, "primitive") == 0) {
+      unsigned prim_mode;
+      if (n != 1 ||
+          !lookup_enum_name(primitives, ARRAY_SIZE(primitives), values[0],
+                            &prim_mode))
+         goto invalid;
+      variant->prim_mode = prim_mode;
+      return true;
+   } else if (strcmp(entry->name, "point_size_per_vertex") == 0) {
+      if (n != 1 ||
+          (strcmp(values[0], "true") != 0 && strcmp(values[0], "false") != 0))
+         goto invalid;
+      variant->point_size_per_vertex = strcmp(values[0], "true") == 0;
+      return true;
+   }
+
+   fprintf(err, "%s:%u: unknown variant setting %s\n", path, entry->line,
+           entry->name);
+   return false;
+
+invalid:
+   fprintf(err, "%s:%u: invalid %s for [%s]\n", path, entry->line,
+           entry->name, entry->section);
+   return false;
+}
+
+/**
+ * Builds the list of variants to compile: the default state, followed by
+ * one for each [name] table of the variant sidecar, if there is one.
+ */
+static bool
+parse_variants(void *mem_ctx, struct pipe_screen *pscreen, const char *path,
+               const char *text, struct util_dynarray *variants,
+               FILE *err) {
+   struct vc4_glsl_variant *variant =
+      util_dynarray_grow(variants, struct vc4_glsl_variant, 1);
+   init_default_variant(variant, "bind");
+   if (!text)
+      return true;
+
+   struct util_dynarray entries;
+   util_dynarray_init(&entries, mem_ctx);
+   if (!parse_sidecar(mem_ctx, path, text, &entries, err))
+      return false;
+
+   const char *section = NULL;
+   util_dynarray_foreach(&entries, struct vc4_glsl_sidecar_entry, entry) {
+      if (!entry->section) {
+         fprintf(err, "%s:%u: %s must be in a [variant] table\n", path,
+                 entry->line, entry->name);
+         return false;
+      }
+      if (entry->section != section) {
+         section = entry->section;
+         const char *fn_name = ralloc_asprintf(mem_ctx, "bind_%s", section);
+         util_dynarray_foreach(variants, struct vc4_glsl_variant, other) {
+            if (strcmp(other->fn_name, fn_name) == 0) {
+               fprintf(err, "%s:%u: [%s] is defined twice\n", path,
+                       entry->line, section);
+               return false;
+            }
+         }
+         variant = util_dynarray_grow(variants, struct vc4_glsl_variant, 1);
+         init_default_variant(variant, fn_name);
+      }
+      if (!apply_variant_entry(pscreen, variant, entry, path, err))
+         return false;
+   }
+   return true;
+}
+
+/**
+ * Points the fixed colour buffer and sampler views at the formats of
+ * \p variant, or back at the defaults if it is NULL.
+ */
+static void
+set_variant_formats(struct vc4_glsl_compiler *compiler,
+                    const struct vc4_glsl_variant *variant) {
+   struct vc4_context *vc4 = compiler->vc4;
+   struct vc4_glsl_variant defaults;
+   if (!variant) {
+      init_default_variant(&defaults, NULL);
+      variant = &defaults;
+   }
+
+   compiler->cbuf0_res.format = variant->cbuf_format;
+   compiler->cbuf0.format = variant->cbuf_format;
+   for (unsigned i = 0; i < VC4_MAX_TEXTURE_SAMPLERS; ++i) {
+      struct pipe_sampler_view *view = vc4->fragtex.textures[i];
+      view->format = variant->tex_formats[i];
+      view->swizzle_r = variant->tex_swizzles[i][0];
+      view->swizzle_g = variant->tex_swizzles[i][1];
+      view->swizzle_b = variant->tex_swizzles[i][2];
+      view->swizzle_a = variant->tex_swizzles[i][3];
+   }
+   vc4->dirty |= VC4_DIRTY_FRAMEBUFFER | VC4_DIRTY_FRAGTEX;
+}
+
+/** Compiles the bound shaders for the state of \p variant. */
+static bool
+compile_variant(struct vc4_glsl_compiler *compiler,
+                const struct vc4_glsl_variant *variant) {
+   struct vc4_context *vc4 = compiler->vc4;
+   struct pipe_context *pctx = &vc4->base;
+
+   void *blend_state_obj = pctx->create_blend_state(pctx, &variant->blend);
+   pctx->bind_blend_state(pctx, blend_state_obj);
+
+   struct pipe_rasterizer_state ras_state = {
+      .clip_plane_enable = 0,
+      .point_size_per_vertex = variant->point_size_per_vertex,
+   };
+   void *ras_state_obj = pctx->create_rasterizer_state(pctx, &ras_state);
+   pctx->bind_rasterizer_state(pctx, ras_state_obj);
+
+   set_variant_formats(compiler, variant);
+
+   bool ret = vc4_update_compiled_shaders(vc4, variant->prim_mode);
+
+   pctx->bind_blend_state(pctx, NULL);
+   pctx->delete_blend_state(pctx, blend_state_obj);
+   pctx->bind_rasterizer_state(pctx, NULL);
+   pctx->delete_rasterizer_state(pctx, ras_state_obj);
+   return ret;
+}
+
+/**
+ * Frees a program returned by standalone_compile_shader().  The driver
+ * shaders of its variants must already have been deleted.
+ */
+static void
+free_shader_program(struct gl_context *ctx,
+                    struct gl_shader_program *shader_program) {
+   for (unsigned i = 0; i < MESA_SHADER_STAGES; ++i) {
+      struct gl_linked_shader *linked = shader_program->_LinkedShaders[i];
+      if (!linked)
+         continue;
+
+      if (linked->Program) {
+         struct st_variant *variant = linked->Program->variants;
+         while (variant) {
+            struct st_variant *next = variant->next;
+            free(variant);
+            variant = next;
+         }
+         linked->Program->variants = NULL;
+      }
+      _mesa_delete_linked_shader(ctx, linked);
+      shader_program->_LinkedShaders[i] = NULL;
+   }
+
+   _mesa_reference_shader_program_data(&shader_program->data, NULL);
+   standalone_compiler_cleanup(shader_program);
+}
+
+/**
+ * Compiles one vertex/fragment pair and writes the generated Rust sources.
+ *
+ * Diagnostics are written to \p err; returns false if the pair failed to
+ * compile.
+ */
+static bool
+vc4_glsl_compile(struct vc4_glsl_compiler *compiler, const char *vert_path,
+                 const char *frag_path, const char *rs_path, FILE *err) {
+   struct vc4_context *vc4 = compiler->vc4;
+   struct vc4_screen *screen = compiler->screen;
+   struct pipe_context *pctx = &vc4->base;
+   struct gl_context *local_ctx = &compiler->ctx;
+   bool ret = false;
+
+   void *mem_ctx = ralloc_context(NULL);
+   char *rs_dir = ralloc_strdup(mem_ctx, rs_path);
+   char *slash = strrchr(rs_dir, '/');
+   if (slash)
+      *(slash + 1) = '\0';
+   else
+      rs_dir[0] = '\0';
+   struct util_dynarray outputs;
+   util_dynarray_init(&outputs, mem_ctx);
+   char *rs_data = NULL;
+   size_t rs_size = 0;
+   char *stats_data = NULL;
+   size_t stats_size = 0;
+
+   struct gl_shader_program *shader_program = NULL;
+
+   struct set *loaded_files = _mesa_set_create(mem_ctx, _mesa_hash_string,
+                                               _mesa_key_string_equal);
+   _mesa_set_shader_include_loaded_files(&compiler->shared, loaded_files);
+
+   /* The optional sidecars pinning uniforms to constants and listing the
+    * variants to compile.
+    */
+   char *pins_path = sidecar_path(mem_ctx, vert_path, "uniforms.toml");
+   char *variants_path = sidecar_path(mem_ctx, vert_path, "variants.toml");
+   size_t sidecar_size;
+   char *pins_text = os_read_file(pins_path, &sidecar_size);
+   if (pins_text)
+      _mesa_set_add(loaded_files, pins_path);
+   char *variants_text = os_read_file(variants_path, &sidecar_size);
+   if (variants_text)
+      _mesa_set_add(loaded_files, variants_path);
+
+   cache_key cache_key;
+   bool cacheable = glsl_cache &&
+                    vc4_glsl_cache_compute_key(local_ctx, vert_path,
+                                               frag_path,
+                                               rs_path + strlen(rs_dir),
+                                               pins_text, variants_text,
+                                               cache_key);
+   if (cacheable && vc4_glsl_cache_retrieve(cache_key, rs_dir, err)) {
+      ret = write_depfile(rs_path, loaded_files, err);
+      goto out;
+   }
+
+   char *files[] = {
+      ralloc_strdup(mem_ctx, vert_path), ralloc_strdup(mem_ctx, frag_path)
+   };
+   shader_program = standalone_compile_shader(&standalone_opts, 2, files,
+                                              local_ctx);
+   if (!shader_program) {
+      fprintf(err, "Unable to compile %s and %s\n", vert_path, frag_path);
+      goto out;
+   }
+
+   for (unsigned i = 0; i < shader_program->NumShaders; ++i) {
+      struct gl_shader *shader = shader_program->Shaders[i];
+      if (!shader->CompileStatus) {
+         fwrite(shader->InfoLog, 1, strlen(shader->InfoLog), err);
+      }
+   }
+
+   if (!shader_program->data->LinkStatus) {
+      if (strlen(shader_program->data->InfoLog))
+         fprintf(err, "Unable to link shaders: %s\n",
+                 shader_program->data->InfoLog);
+      goto out;
+   }
+
+   struct gl_linked_shader *linked_vertex = shader_program->_LinkedShaders[MESA_SHADER_VERTEX];
+   struct gl_linked_shader *linked_fragment = shader_program->_LinkedShaders[MESA_SHADER_FRAGMENT];
+
+   struct util_dynarray pins;
+   util_dynarray_init(&pins, mem_ctx);
+   if (pins_text &&
+       !parse_pinned_uniforms(mem_ctx, pins_path, pins_text, &pins, err))
+      goto out;
+
+   struct util_dynarray variants;
+   util_dynarray_init(&variants, mem_ctx);
+   if (!parse_variants(mem_ctx, &screen->base, variants_path, variants_text,
+                       &variants, err))
+      goto out;
+
+   struct pipe_vertex_element vertex_elements[16] = {0};
+   unsigned vertex_element_sizes[16] = {0};
+   unsigned num_vertex_elements = extract_vertex_attributes_from_ir(
+      vertex_elements, vertex_element_sizes, linked_vertex->ir);
+
+   struct gl_extensions extensions = {0};
+   st_init_limits(&screen->base, &local_ctx->Const, &extensions,
+                  API_OPENGL_CORE);
+
+   local_ctx->st = &compiler->st_ctx;
+   compiler->pipeline_object.Flags = 0;
+   local_ctx->_Shader = &compiler->pipeline_object;
+
+   st_link_shader(local_ctx, shader_program);
+
+   struct vc4_uncompiled_shader *vs_shader;
+   {
+      struct st_variant *variant = &linked_vertex->Program->variants[0];
+      vs_shader = variant->driver_shader;
+      pctx->bind_vs_state(pctx, vs_shader);
+   }
+
+   struct vc4_uncompiled_shader *fs_shader;
+   {
+      struct st_variant *variant = &linked_fragment->Program->variants[0];
+      fs_shader = variant->driver_shader;
+      pctx->bind_fs_state(pctx, fs_shader);
+   }
+
+   struct vc4_depth_stencil_alpha_state *zsa_state_obj;
+   {
+      struct pipe_depth_stencil_alpha_state zsa_state = {
+         .depth_enabled = 1
+      };
+      zsa_state_obj = pctx->create_depth_stencil_alpha_state(pctx,
+                                                             &zsa_state);
+      pctx->bind_depth_stencil_alpha_state(pctx, zsa_state_obj);
+   }
+
+   struct vc4_vertex_stateobj *vtx_state;
+   {
+      vtx_state = pctx->create_vertex_elements_state(
+         pctx, num_vertex_elements, vertex_elements);
+      pctx->bind_vertex_elements_state(pctx, vtx_state);
+   }
+
+   struct util_dynarray vs_pinned, fs_pinned;
+   util_dynarray_init(&vs_pinned, mem_ctx);
+   util_dynarray_init(&fs_pinned, mem_ctx);
+   if (!resolve_pinned_uniforms(linked_vertex->Program->Parameters, &pins,
+                                &vs_pinned, err) ||
+       !resolve_pinned_uniforms(linked_fragment->Program->Parameters, &pins,
+                                &fs_pinned, err))
+      goto out_states;
+   util_dynarray_foreach(&pins, struct vc4_glsl_sidecar_entry, pin) {
+      if (!pin->used) {
+         fprintf(err, "%s: %s is not an active uniform\n", pins_path,
+                 pin->name);
+         goto out_states;
+      }
+   }
+
+   inline_pinned_uniforms(screen, vs_shader, &vs_pinned);
+   inline_pinned_uniforms(screen, fs_shader, &fs_pinned);
+
+   if ((linked_vertex->Program->info.outputs_written & VARYING_BIT_POS) ==
+       0) {
+      fprintf(err, "%s does not write to gl_Position\n", files[0]);
+      goto out_states;
+   }
+
+   vc4_get_job_for_fbo(vc4);
+
+   struct u_memstream rs_mem;
+   if (!u_memstream_open(&rs_mem, &rs_data, &rs_size)) {
+      fprintf(err, "Unable to open output stream\n");
+      goto out_states;
+   }
+   FILE *fout = u_memstream_get(&rs_mem);
+
+   struct u_memstream stats_mem;
+   FILE *stats_out = NULL;
+   if (write_stats) {
+      if (!u_memstream_open(&stats_mem, &stats_data, &stats_size)) {
+         fprintf(err, "Unable to open output stream\n");
+         u_memstream_close(&rs_mem);
+         goto out_states;
+      }
+      stats_out = u_memstream_get(&stats_mem);
+      fprintf(stats_out, "{\n");
+   }
+
+   fprintf(fout, "#![allow(unused_imports, nonstandard_style)]\n"
+                 "use super::objects;\n"
+                 "use rpi_drm::{Buffer, CommandEncoder, ShaderAttribute, ShaderUniform, TextureUniform};\n"
+                 "use vc4_drm::cl::AttributeRecord;\n"
+                 "use vc4_drm::{glam, qpu};\n\n");
+
+   util_dynarray_foreach(&variants, struct vc4_glsl_variant, variant) {
+      if (!compile_variant(compiler, variant)) {
+         fprintf(err, "Unable to compile %s and %s for %s()\n", vert_path,
+                 frag_path, variant->fn_name);
+         u_memstream_close(&rs_mem);
+         if (stats_out)
+            u_memstream_close(&stats_mem);
+         goto out_states;
+      }
+
+      const char *ids[3];
+      if (!output_compiled_shader(mem_ctx, &ids[0], &outputs, vc4->prog.cs) ||
+          !output_compiled_shader(mem_ctx, &ids[1], &outputs, vc4->prog.vs) ||
+          !output_compiled_shader(mem_ctx, &ids[2], &outputs, vc4->prog.fs)) {
+         fprintf(err, "Unable to open output stream\n");
+         u_memstream_close(&rs_mem);
+         if (stats_out)
+            u_memstream_close(&stats_mem);
+         goto out_states;
+      }
+
+      if (stats_out) {
+         fprintf(stats_out, "  \"%s\": {\n", variant->fn_name);
+         output_shader_stats(stats_out, "coordinate", ids[0], vc4->prog.cs,
+                             false);
+         output_shader_stats(stats_out, "vertex", ids[1], vc4->prog.vs, false);
+         output_shader_stats(stats_out, "fragment", ids[2], vc4->prog.fs,
+                             true);
+         fprintf(stats_out, "  }%s\n",
+                 variant + 1 == util_dynarray_end(&variants) ? "" : ",");
+      }
+
+      output_bind_fn(fout, variant->fn_name, vc4, ids, shader_program,
+                     vertex_elements, vertex_element_sizes,
+                     num_vertex_elements, &pins, &vs_pinned, &fs_pinned);
+   }
+
+   u_memstream_close(&rs_mem);
+   add_output_file(&outputs, rs_path + strlen(rs_dir), rs_data, rs_size);
+   rs_data = NULL;
+
+   if (stats_out) {
+      /* foo.rs -> foo.stats.json */
+      fprintf(stats_out, "}\n");
+      u_memstream_close(&stats_mem);
+      const char *rs_name = rs_path + strlen(rs_dir);
+      const char *dot = strrchr(rs_name, '.');
+      add_output_file(&outputs,
+                      ralloc_asprintf(mem_ctx, "%.*s.stats.json",
+                                      dot ? (int) (dot - rs_name)
+                                          : (int) strlen(rs_name),
+                                      rs_name),
+                      stats_data, stats_size);
+      stats_data = NULL;
+   }
+
+   ret = write_output_files(rs_dir, &outputs, err) &&
+         write_depfile(rs_path, loaded_files, err);
+   if (ret && cacheable)
+      vc4_glsl_cache_store(cache_key, &outputs);
+
+out_states:
+   /* Drop everything this pair bound so that the variant caches and shader
+    * BOs don't keep growing over the lifetime of a server process.
+    */
+   set_variant_formats(compiler, NULL);
+   pctx->bind_vertex_elements_state(pctx, NULL);
+   pctx->delete_vertex_elements_state(pctx, vtx_state);
+   pctx->bind_depth_stencil_alpha_state(pctx, NULL);
+   pctx->delete_depth_stencil_alpha_state(pctx, zsa_state_obj);
+   pctx->bind_fs_state(pctx, NULL);
+   pctx->delete_fs_state(pctx, fs_shader);
+   pctx->bind_vs_state(pctx, NULL);
+   pctx->delete_vs_state(pctx, vs_shader);
+   /* vc4_shader_state_delete() only clears the VS and FS pointers. */
+   vc4->prog.cs = NULL;
+out:
+   if (shader_program)
+      free_shader_program(local_ctx, shader_program);
+   _mesa_set_shader_include_loaded_files(&compiler->shared, NULL);
+   free(rs_data);
+   free(stats_data);
+   free(pins_text);
+   free(variants_text);
+   util_dynarray_foreach(&outputs, struct vc4_glsl_file, file)
+      free(file->data);
+   ralloc_free(mem_ctx);
+   return ret;
+}
+
+/**
+ * Splits a job line of the form
+ *
+ *    <file>.vert \t <file>.frag \t <output>.rs
+ *
+ * in place.  Returns false if the line is malformed.
+ */
+static bool
+parse_job_line(char *line, const char **vert_path, const char **frag_path,
+               const char **rs_path) {
+   char *save_ptr = NULL;
+   *vert_path = strtok_r(line, "\t", &save_ptr);
+   *frag_path = strtok_r(NULL, "\t", &save_ptr);
+   *rs_path = strtok_r(NULL, "\t", &save_ptr);
+   return *vert_path && *frag_path && *rs_path;
+}
+
+/**
+ * A set of worker threads, each with its own vc4_glsl_compiler, sharing one
+ * screen.
+ */
+struct vc4_glsl_pool {
+   struct vc4_screen *screen;
+   struct util_queue queue;
+   struct vc4_glsl_compiler **compilers;
+
+   /* In server mode, replies are written by the workers as jobs finish. */
+   FILE *replies;
+   simple_mtx_t replies_lock;
+};
+
+struct vc4_glsl_job {
+   unsigned id;
+   const char *vert_path;
+   const char *frag_path;
+   const char *rs_path;
+   struct util_queue_fence fence;
+
+   bool ok;
+   char *log;
+   size_t log_size;
+};
+
+static bool
+vc4_glsl_pool_init(struct vc4_glsl_pool *pool, struct vc4_screen *screen,
+                   unsigned num_threads, FILE *replies) {
+   memset(pool, 0, sizeof(*pool));
+   pool->screen = screen;
+   pool->compilers = rzalloc_array(NULL, struct vc4_glsl_compiler *,
+                                   num_threads);
+   pool->replies = replies;
+   simple_mtx_init(&pool->replies_lock, mtx_plain);
+
+   if (!pool->compilers ||
+       !util_queue_init(&pool->queue, "vc4glsl", 8, num_threads,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL, pool)) {
+      fprintf(stderr, "Unable to create %u compile threads\n", num_threads);
+      ralloc_free(pool->compilers);
+      simple_mtx_destroy(&pool->replies_lock);
+      return false;
+   }
+
+   return true;
+}
+
+static void
+vc4_glsl_pool_finish(struct vc4_glsl_pool *pool) {
+   util_queue_finish(&pool->queue);
+   util_queue_destroy(&pool->queue);
+   ralloc_free(pool->compilers);
+   simple_mtx_destroy(&pool->replies_lock);
+}
+
+static void
+vc4_glsl_job_execute(void *data, void *gdata, int thread_index) {
+   struct vc4_glsl_job *job = data;
+   struct vc4_glsl_pool *pool = gdata;
+   struct vc4_glsl_compiler **compiler = &pool->compilers[thread_index];
+
+   struct u_memstream mem;
+   if (!u_memstream_open(&mem, &job->log, &job->log_size)) {
+      fprintf(stderr, "Unable to open log stream\n");
+      abort();
+   }
+   FILE *err = u_memstream_get(&mem);
+
+   if (!*compiler)
+      *compiler = vc4_glsl_compiler_create(pool->screen);
+
+   if (!*compiler) {
+      fprintf(err, "Unable to create a compiler context\n");
+      job->ok = false;
+   } else if (!job->vert_path) {
+      fprintf(err, "Malformed job: expected <file>.vert, <file>.frag and "
+                   "<output>.rs separated by tabs\n");
+      job->ok = false;
+   } else {
+      job->ok = vc4_glsl_compile(*compiler, job->vert_path, job->frag_path,
+                                 job->rs_path, err);
+   }
+   u_memstream_close(&mem);
+
+   if (pool->replies) {
+      simple_mtx_lock(&pool->replies_lock);
+      if (job->ok) {
+         fprintf(pool->replies, "%u ok\n", job->id);
+      } else {
+         fprintf(pool->replies, "%u error %zu\n", job->id, job->log_size);
+         fwrite(job->log, 1, job->log_size, pool->replies);
+      }
+      fflush(pool->replies);
+      simple_mtx_unlock(&pool->replies_lock);
+   }
+}
+
+static void
+vc4_glsl_job_cleanup(void *data, void *gdata, int thread_index) {
+   struct vc4_glsl_job *job = data;
+
+   free(job->log);
+   ralloc_free(job);
+}
+
+/**
+ * Reads compile jobs from stdin until EOF, one per line in the format
+ * accepted by parse_job_line(), and answers each one on stdout with either
+ *
+ *    <job> ok \n
+ *    <job> error <length> \n <length bytes of diagnostics>
+ *
+ * where <job> counts the jobs received, starting at 0.  With more than one
+ * thread, replies come back in the order the jobs finish.  Anything the
+ * compiler itself prints to stdout is redirected to stderr so that it can't
+ * corrupt the replies.
+ */
+static int
+vc4_glsl_server(struct vc4_screen *screen, unsigned num_threads) {
+   FILE *replies = fdopen(dup(STDOUT_FILENO), "w");
+   if (!replies) {
+      fprintf(stderr, "Unable to open reply stream: %s\n", strerror(errno));
+      return 1;
+   }
+   fflush(stdout);
+   dup2(STDERR_FILENO, STDOUT_FILENO);
+
+   struct vc4_glsl_pool pool;
+   if (!vc4_glsl_pool_init(&pool, screen, num_threads, replies))
+      return 1;
+
+   char *line = NULL;
+   size_t line_size = 0;
+   ssize_t len;
+   unsigned id = 0;
+   while ((len = getline(&line, &line_size, stdin)) != -1) {
+      if (len > 0 && line[len - 1] == '\n')
+         line[--len] = '\0';
+      if (len == 0)
+         continue;
+
+      struct vc4_glsl_job *job = rzalloc(NULL, struct vc4_glsl_job);
+      job->id = id++;
+      char *job_line = ralloc_strdup(job, line);
+      if (!parse_job_line(job_line, &job->vert_path, &job->frag_path,
+                          &job->rs_path))
+         job->vert_path = NULL;
+
+      util_queue_fence_init(&job->fence);
+      util_queue_add_job(&pool.queue, job, &job->fence,
+                         vc4_glsl_job_execute, vc4_glsl_job_cleanup, 0);
+   }
+
+   vc4_glsl_pool_finish(&pool);
+   free(line);
+   fclose(replies);
+   return 0;
+}
+
+/**
+ * Compiles every job listed in \p manifest_path ("-" for stdin), one per
+ * line in the format accepted by parse_job_line(), and reports the failures
+ * on stderr in manifest order.
+ */
+static int
+vc4_glsl_manifest(struct vc4_screen *screen, unsigned num_threads,
+                  const char *manifest_path) {
+   FILE *manifest = strcmp(manifest_path, "-") == 0 ?
+                    stdin : fopen(manifest_path, "r");
+   if (!manifest) {
+      fprintf(stderr, "Unable to open %s: %s\n", manifest_path,
+              strerror(errno));
+      return 1;
+   }
+
+   struct vc4_glsl_pool pool;
+   if (!vc4_glsl_pool_init(&pool, screen, num_threads, NULL))
+      return 1;
+
+   void *mem_ctx = ralloc_context(NULL);
+   struct util_dynarray jobs;
+   util_dynarray_init(&jobs, mem_ctx);
+
+   char *line = NULL;
+   size_t line_size = 0;
+   ssize_t len;
+   while ((len = getline(&line, &line_size, manifest)) != -1) {
+      if (len > 0 && line[len - 1] == '\n')
+         line[--len] = '\0';
+      if (len == 0)
+         continue;
+
+      struct vc4_glsl_job *job = rzalloc(mem_ctx, struct vc4_glsl_job);
+      job->id = util_dynarray_num_elements(&jobs, struct vc4_glsl_job *);
+      char *job_line = ralloc_strdup(job, line);
+      if (!parse_job_line(job_line, &job->vert_path, &job->frag_path,
+                          &job->rs_path))
+         job->vert_path = NULL;
+
+      util_queue_fence_init(&job->fence);
+      util_queue_add_job(&pool.queue, job, &job->fence,
+                         vc4_glsl_job_execute, NULL, 0);
+      util_dynarray_append(&jobs, struct vc4_glsl_job *, job);
+   }
+   free(line);
+   if (manifest != stdin)
+      fclose(manifest);
+
+   vc4_glsl_pool_finish(&pool);
+
+   int ret = 0;
+   util_dynarray_foreach(&jobs, struct vc4_glsl_job *, jobp) {
+      struct vc4_glsl_job *job = *jobp;
+      if (!job->ok) {
+         if (job->vert_path)
+            fprintf(stderr, "%s %s:\n", job->vert_path, job->frag_path);
+         fwrite(job->log, 1, job->log_size, stderr);
+         ret = 1;
+      }
+      free(job->log);
+   }
+
+   ralloc_free(mem_ctx);
+   return ret;
+}
+
+static void
+usage(const char *argv0) {
+   fprintf(stderr,
+           "Usage: %s [options] <file>.vert <file>.frag <output>.rs\n"
+           "       %s [options] [-j <threads>] --manifest <file>\n"
+           "       %s [options] [-j <threads>] --server\n"
+           "\n"
+           "Options:\n"
+           "  --bin     write each QPU object as a little-endian .bin blob\n"
+           "            instead of a .rs source with a qpu! macro\n"
+           "  --disasm  with --bin, also write a .asm disassembly per object\n"
+           "  --stats   write <output>.stats.json with the static statistics\n"
+           "            of the objects of each bind function\n"
+           "\n"
+           "Uniforms listed in an optional <file>.uniforms.toml next to the\n"
+           ".vert are compiled in as constants, e.g.\n"
+           "\n"
+           "  alpha_ref = 0.5\n"
+           "  tint = [1.0, 0.5, 0.25, 1.0]\n"
+           "\n"
+           "Besides bind() for the default state, a bind_<name>() is generated\n"
+           "for each [name] table of an optional <file>.variants.toml, e.g.\n"
+           "\n"
+           "  [blended_565]\n"
+           "  blend = \"alpha\"   # none, alpha, premultiplied, additive, multiply\n"
+           "  blend_rgb = [\"add\", \"src_alpha\", \"inv_src_alpha\"]\n"
+           "  colormask = \"rgb\"\n"
+           "  cbuf_format = \"B5G6R5_UNORM\"\n"
+           "  sampler_formats = [\"B8G8R8A8_UNORM\", \"L8_UNORM\"]\n"
+           "  sampler_swizzles = [\"rgba\", \"rrr1\"]\n"
+           "  primitive = \"points\"   # triangles, lines, points\n"
+           "  point_size_per_vertex = true\n"
+           "\n"
+           "Compiled pairs are cached in the Mesa shader cache; set\n"
+           "MESA_SHADER_CACHE_DISABLE=true to always compile.\n",
+           argv0, argv0, argv0);
+}
+
+int main(int argc, char **argv) {
+   static const struct option long_options[] = {
+      {"server", no_argument, NULL, 's'},
+      {"manifest", required_argument, NULL, 'm'},
+      {"jobs", required_argument, NULL, 'j'},
+      {"bin", no_argument, NULL, 'b'},
+      {"disasm", no_argument, NULL, 'd'},
+      {"stats", no_argument, NULL, 't'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}
+   };
+   bool server = false;
+   const char *manifest_path = NULL;
+   unsigned num_threads = util_get_cpu_caps()->nr_cpus;
+
+   int c;
+   while ((c = getopt_long(argc, argv, "j:h", long_options, NULL)) != -1) {
+      switch (c) {
+         case 's':
+            server = true;
+            break;
+         case 'm':
+            manifest_path = optarg;
+            break;
+         case 'b':
+            object_format = VC4_GLSL_OBJECT_BIN;
+            break;
+         case 'd':
+            write_disasm = true;
+            break;
+         case 't':
+            write_stats = true;
+            break;
+         case 'j':
+            num_threads = strtoul(optarg, NULL, 10);
+            if (num_threads == 0) {
+               usage(argv[0]);
+               return 1;
+            }
+            break;
+         case 'h':
+            usage(argv[0]);
+            return 0;
+         default:
+            usage(argv[0]);
+            return 1;
+      }
+   }
+
+   bool batch = server || manifest_path;
+   if ((server && manifest_path) ||
+       (batch ? optind != argc : argc - optind < 3)) {
+      usage(argv[0]);
+      return 1;
+   }
+
+   struct vc4_screen *screen = (struct vc4_screen *) vc4_screen_create(-1,
+                                                                       NULL,
+                                                                       NULL);
+   vc4_glsl_cache_init();
+
+   int ret;
+   if (server) {
+      ret = vc4_glsl_server(screen, num_threads);
+   } else if (manifest_path) {
+      ret = vc4_glsl_manifest(screen, num_threads, manifest_path);
+   } else {
+      struct vc4_glsl_compiler *compiler = vc4_glsl_compiler_create(screen);
+      ret = compiler && vc4_glsl_compile(compiler, argv[optind],
+                                         argv[optind + 1], argv[optind + 2],
+                                         stderr) ? 0 : 1;
+   }
+
+   /* Waits for pending cache writes. */
+   if (glsl_cache)
+      disk_cache_destroy(glsl_cache);
+
+   return ret;
 }
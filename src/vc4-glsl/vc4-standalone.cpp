@@ -96,10 +96,9 @@ private:
    set *variables;
 };
 
-static const struct standalone_options *options;
-
 static void
-initialize_context(struct gl_context *ctx, gl_api api)
+initialize_context(struct gl_context *ctx, gl_api api,
+                   const struct standalone_options *options)
 {
    initialize_context_to_defaults(ctx, api);
    _mesa_glsl_builtin_functions_init_or_ref();
@@ -355,7 +354,8 @@ load_text_file(void *ctx, const char *file_name)
 }
 
 static void
-compile_shader(struct gl_context *ctx, struct gl_shader *shader)
+compile_shader(struct gl_context *ctx, struct gl_shader *shader,
+               const struct standalone_options *options)
 {
    _mesa_glsl_compile_shader(ctx, shader, options->dump_ast,
                              options->dump_hir, false);
@@ -401,15 +401,12 @@ clear_shader_program_data(struct gl_context *ctx,
     shProg->data->NumAtomicBuffers = 0;
 }
 
-extern "C" struct gl_shader_program *
-standalone_compile_shader(const struct standalone_options *_options,
-      unsigned num_files, char* const* files, struct gl_context *ctx)
+static bool
+initialize_context_for_options(struct gl_context *ctx,
+                               const struct standalone_options *options)
 {
-   int status = EXIT_SUCCESS;
    bool glsl_es = false;
 
-   options = _options;
-
    switch (options->glsl_version) {
    case 100:
    case 300:
@@ -432,15 +429,60 @@ standalone_compile_shader(const struct standalone_options *_options,
       break;
    default:
       fprintf(stderr, "Unrecognized GLSL version `%d'\n", options->glsl_version);
-      return NULL;
+      return false;
    }
 
    if (glsl_es) {
-      initialize_context(ctx, API_OPENGLES2);
+      initialize_context(ctx, API_OPENGLES2, options);
    } else {
-      initialize_context(ctx, options->glsl_version > 130 ? API_OPENGL_CORE : API_OPENGL_COMPAT);
+      initialize_context(ctx, options->glsl_version > 130 ? API_OPENGL_CORE : API_OPENGL_COMPAT,
+                         options);
    }
 
+   return true;
+}
+
+/* Shaders are compiled from a stub that #includes the file, so that nested
+ * includes resolve relative to it.
+ */
+static const char *
+shader_source(void *mem_ctx, const char *file)
+{
+   return ralloc_asprintf(mem_ctx,
+                          "#version 430\n"
+                          "#extension GL_ARB_shading_language_include : require\n"
+                          "#include \"%s\"\n", file);
+}
+
+/* Runs only the preprocessor over the source standalone_compile_shader()
+ * would compile for \p file.  Returns NULL on failure, with the errors in
+ * \p info_log.  Both strings are owned by \p mem_ctx.
+ */
+extern "C" char *
+standalone_preprocess_shader(const struct standalone_options *options,
+      const char *file, struct gl_context *ctx, void *mem_ctx,
+      char **info_log)
+{
+   if (!initialize_context_for_options(ctx, options))
+      return NULL;
+
+   const char *source = shader_source(mem_ctx, file);
+   *info_log = ralloc_strdup(mem_ctx, "");
+   if (glcpp_preprocess(mem_ctx, &source, info_log, NULL, NULL, ctx))
+      return NULL;
+
+   return (char *) source;
+}
+
+extern "C" struct gl_shader_program *
+standalone_compile_shader(const struct standalone_options *options,
+      unsigned num_files, char* const* files, struct gl_context *ctx)
+{
+   int status = EXIT_SUCCESS;
+
+   if (!initialize_context_for_options(ctx, options))
+      return NULL;
+
    if (options->lower_precision) {
       for (unsigned i = MESA_SHADER_VERTEX; i <= MESA_SHADER_COMPUTE; i++) {
          struct gl_shader_compiler_options *options =
@@ -478,10 +520,7 @@ standalone_compile_shader(const struct standalone_options *_options,
       else
          goto fail;
 
-      const char *source = ralloc_asprintf(whole_program,
-                                           "#version 430\n"
-                                           "#extension GL_ARB_shading_language_include : require\n"
-                                           "#include \"%s\"\n", files[i]);
+      const char *source = shader_source(whole_program, files[i]);
       //const char *source = load_text_file(whole_program, files[i]);
       if (source == NULL) {
          printf("File \"%s\" does not exist.\n", files[i]);
@@ -490,7 +529,7 @@ standalone_compile_shader(const struct standalone_options *_options,
 
       struct gl_shader *shader = standalone_add_shader_source(ctx, whole_program, type, source);
 
-      compile_shader(ctx, shader);
+      compile_shader(ctx, shader, options);
 
       if (strlen(shader->InfoLog) > 0) {
          if (!options->just_log)
@@ -592,9 +631,11 @@ fail:
    for (unsigned i = 0; i < MESA_SHADER_STAGES; i++) {
       if (whole_program->_LinkedShaders[i])
          _mesa_delete_linked_shader(ctx, whole_program->_LinkedShaders[i]);
+      whole_program->_LinkedShaders[i] = NULL;
    }
 
-   ralloc_free(whole_program);
+   _mesa_reference_shader_program_data(&whole_program->data, NULL);
+   standalone_compiler_cleanup(whole_program);
    return NULL;
 }
 
@@ -33,6 +33,7 @@
 #include <cstring>
 #include "util/ralloc.h"
 #include "util/strtod.h"
+#include "util/u_call_once.h"
 #include "main/mtypes.h"
 #include "string_to_uint_map.h"
 #include "main/shaderobj.h"
@@ -148,7 +149,11 @@ void initialize_context_to_defaults(struct gl_context *ctx, gl_api api)
    for (int sh = 0; sh < MESA_SHADER_STAGES; ++sh)
       memcpy(&ctx->Const.ShaderCompilerOptions[sh], &options, sizeof(options));
 
-   _mesa_locale_init();
+   /* Contexts may be initialized concurrently by vc4-glsl's workers, and
+    * the locale is global.
+    */
+   static util_once_flag locale_once = UTIL_ONCE_FLAG_INIT;
+   util_call_once(&locale_once, _mesa_locale_init);
 
    ctx->Driver.NewProgram = standalone_new_program;
 }